@@ -0,0 +1,45 @@
+require 'benchmark'
+require 'etc'
+require 'tmpdir'
+require 'winevt'
+require_relative '../test/evtx_writer'
+
+# Decode a generated .evtx file with the different number of workers
+# and without the template cache. This does not need Windows.
+#
+#   ruby -Ilib benchmark/evtx_file.rb [chunks] [records per chunk]
+
+chunks = (ARGV[0] || 256).to_i
+records = (ARGV[1] || 100).to_i
+
+Dir.mktmpdir do |dir|
+  path = File.join(dir, "System.evtx")
+  writer = EvtxWriter.new
+  chunks.times do |i|
+    events = records.times.map do |j|
+      EvtxWriter::Event.new(provider: "Service Control Manager",
+                            provider_guid: "{555908D1-A6D7-4695-8E1E-26931D2012F4}",
+                            qualifiers: 16384, event_id: 7036, level: 4,
+                            keywords: 0x8080000000000000,
+                            time: Time.at(1_700_000_000 + i * records + j),
+                            process_id: 720, thread_id: 1604, channel: "System",
+                            computer: "host.example", user_id: "S-1-5-18",
+                            data: ["Service #{j}", "running"])
+    end
+    writer.add_chunk(i * records + 1, events)
+  end
+  writer.write(path)
+
+  evtx = Winevt::EventLog::EvtxFile.new(path)
+  puts "#{chunks} chunks, #{chunks * records} records, #{Etc.nprocessors} processors"
+  Benchmark.bm(10) do |x|
+    [1, 2, 4, 8].each do |workers|
+      evtx.workers = workers
+      x.report("workers=#{workers}") { evtx.each { |_, _, _| } }
+    end
+    evtx.workers = 1
+    evtx.template_cache = nil
+    x.report("no cache") { evtx.each { |_, _, _| } }
+  end
+  evtx.close
+end
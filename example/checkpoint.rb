@@ -0,0 +1,23 @@
+require 'winevt'
+
+path = "application.checkpoint"
+@subscribe = Winevt::EventLog::Subscribe.new
+if File.exist?(path)
+  @checkpoint = Winevt::EventLog::Checkpoint.read(path)
+  @subscribe.subscribe("Application", "*", @checkpoint.to_bookmark)
+else
+  @subscribe.read_existing_events = true
+  @subscribe.subscribe("Application", "*")
+end
+@writer = Winevt::EventLog::CheckpointWriter.new(path, 5.0)
+begin
+  while true do
+    @subscribe.wait(1.0)
+    @subscribe.each do |eventlog, message, string_inserts|
+      puts ({eventlog: eventlog, data: message})
+    end
+    @writer.update(@subscribe)
+  end
+ensure
+  @writer.close
+end
@@ -0,0 +1,8 @@
+require 'winevt'
+
+evtx = Winevt::EventLog::EvtxFile.new(ARGV[0] || "Application.evtx")
+evtx.render_as_xml = false
+evtx.each do |eventlog, message, string_inserts|
+  puts ({eventlog: eventlog, data: string_inserts})
+end
+evtx.close
@@ -0,0 +1,21 @@
+require 'winevt'
+
+# Read the copies of Security.evtx which are overwritten in the spool
+# directory. The progress is kept in the checkpoint by the path.
+path = ARGV[0] || "spool/Security.evtx"
+checkpoint_path = "spool.checkpoint"
+@checkpoint = if File.exist?(checkpoint_path)
+                Winevt::EventLog::Checkpoint.read(checkpoint_path)
+              else
+                Winevt::EventLog::Checkpoint.new
+              end
+@tail = Winevt::EventLog::EvtxTail.new(path)
+@tail.last_record_id = @checkpoint[path] || 0
+@tail.render_as_xml = false
+while true do
+  @tail.each do |eventlog, message, string_inserts|
+    puts ({eventlog: eventlog, data: string_inserts})
+  end
+  @checkpoint.update(path, @tail.last_record_id).write(checkpoint_path)
+  sleep 60
+end
@@ -0,0 +1,7 @@
+require 'winevt'
+
+@query = Winevt::EventLog::ParallelQuery.new("Application", "*[System[Level <= 3]]",
+                                             Time.now - 86400 * 30, Time.now, 8)
+@query.each do |eventlog, message, string_inserts|
+  puts ({eventlog: eventlog, data: message})
+end
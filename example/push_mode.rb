@@ -0,0 +1,16 @@
+require 'winevt'
+
+@subscribe = Winevt::EventLog::Subscribe.new
+@subscribe.read_existing_events = true
+# Events are rendered on the EvtSubscribe callback thread and queued.
+@subscribe.push_mode = true
+@subscribe.push_queue_size = 4096
+@subscribe.subscribe(
+  "Application", "*[System[(Level <= 4) and TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+)
+while true do
+  @subscribe.wait(1.0)
+  @subscribe.each do |eventlog, message, string_inserts|
+    puts ({eventlog: eventlog, data: message})
+  end
+end
@@ -0,0 +1,5 @@
+require 'winevt'
+
+Winevt::EventLog::Query.tail("Application", 10).each do |eventlog, message, string_inserts|
+  puts ({eventlog: eventlog, data: message})
+end
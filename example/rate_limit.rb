@@ -3,12 +3,14 @@ require 'winevt'
 @subscribe = Winevt::EventLog::Subscribe.new
 @subscribe.read_existing_events = true
 @subscribe.rate_limit = 80
+@subscribe.rate_limit_burst = 160
+@subscribe.byte_rate_limit = 256 * 1024
 @subscribe.subscribe(
   "Application", "*[System[(Level <= 4) and TimeCreated[timediff(@SystemTime) <= 86400000]]]"
 )
 while true do
+  @subscribe.wait(1.0)
   @subscribe.each do |eventlog, message, string_inserts|
     puts ({eventlog: eventlog, data: message})
   end
-  sleep(0.1)
 end
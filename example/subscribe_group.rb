@@ -0,0 +1,15 @@
+require 'winevt'
+
+@group = Winevt::EventLog::SubscribeGroup.new
+["Application", "Security", "System"].each do |channel|
+  subscribe = Winevt::EventLog::Subscribe.new
+  subscribe.read_existing_events = true
+  subscribe.subscribe(channel, "*")
+  @group << subscribe
+end
+while true do
+  @group.wait(1.0)
+  @group.each do |eventlog, message, string_inserts, channel|
+    puts ({channel: channel, eventlog: eventlog, data: message})
+  end
+end
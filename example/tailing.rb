@@ -14,8 +14,8 @@ require 'winevt'
   @bookmark, @session
 )
 while true do
+  @subscribe.wait(1.0)
   @subscribe.each do |eventlog, message, string_inserts|
     puts ({eventlog: eventlog, data: message})
   end
-  sleep(1)
 end
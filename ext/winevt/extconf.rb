@@ -10,15 +10,28 @@ includedir = RbConfig::CONFIG["includedir"]
 
 dir_config("winevt", includedir, libdir)
 
-have_library("wevtapi")
-have_func("EvtQuery", "winevt.h")
-have_library("advapi32")
-have_library("ole32")
+windows = RbConfig::CONFIG['host_os'] =~ /mingw|mswin/
+
+if windows
+  have_library("wevtapi")
+  have_func("EvtQuery", "winevt.h")
+  have_library("advapi32")
+  have_library("ole32")
+else
+  # Only the portable parts are built for testing them on the other
+  # platforms.
+  $srcs = %w[winevt.c winevt_thread.c winevt_scheduler.c winevt_checkpoint.c
+             winevt_checkpoint_writer.c winevt_partition.c winevt_aggregate.c
+             winevt_evtx.c winevt_evtx_file.c winevt_evtx_tail.c
+             winevt_compiled_query.c winevt_filter.c winevt_dedup.c
+             winevt_sampler.c winevt_query_list.c]
+end
 if have_macro("RB_ALLOCV")
   $CFLAGS << " -DHAVE_RB_ALLOCV=1 "
 end
+have_header("ruby/fiber/scheduler.h")
 
-$LDFLAGS << " -lwevtapi -ladvapi32 -lole32"
+$LDFLAGS << " -lwevtapi -ladvapi32 -lole32" if windows
 $CFLAGS << " -Wall -std=c99 -fPIC -fms-extensions "
 $CXXFLAGS << " -Wall -std=c++11 -fPIC -fms-extensions "
 # $CFLAGS << " -g -O0 -ggdb"
@@ -1,8 +1,9 @@
 #include <winevt_c.h>
 
 VALUE rb_mWinevt;
-VALUE rb_cQuery;
 VALUE rb_cEventLog;
+#ifdef _WIN32
+VALUE rb_cQuery;
 VALUE rb_cSubscribe;
 VALUE rb_eWinevtQueryError;
 VALUE rb_eChannelNotFoundError;
@@ -10,12 +11,28 @@ VALUE rb_eRemoteHandlerError;
 VALUE rb_eSubscribeHandlerError;
 
 static ID id_call;
+#endif /* _WIN32 */
 
 void
 Init_winevt(void)
 {
   rb_mWinevt = rb_define_module("Winevt");
   rb_cEventLog = rb_define_class_under(rb_mWinevt, "EventLog", rb_cObject);
+
+  Init_winevt_scheduler(rb_cEventLog);
+  Init_winevt_checkpoint(rb_cEventLog);
+  Init_winevt_checkpoint_writer(rb_cEventLog);
+  Init_winevt_partition(rb_cEventLog);
+  Init_winevt_aggregate(rb_cEventLog);
+  Init_winevt_evtx_file(rb_cEventLog);
+  Init_winevt_evtx_tail(rb_cEventLog);
+  Init_winevt_compiled_query(rb_cEventLog);
+  Init_winevt_filter(rb_cEventLog);
+  Init_winevt_dedup(rb_cEventLog);
+  Init_winevt_sampler(rb_cEventLog);
+  Init_winevt_query_list(rb_cEventLog);
+
+#ifdef _WIN32
   rb_cQuery = rb_define_class_under(rb_cEventLog, "Query", rb_cObject);
   rb_cSubscribe = rb_define_class_under(rb_cEventLog, "Subscribe", rb_cObject);
   rb_eWinevtQueryError = rb_define_class_under(rb_cQuery, "Error", rb_eStandardError);
@@ -27,8 +44,11 @@ Init_winevt(void)
   Init_winevt_bookmark(rb_cEventLog);
   Init_winevt_query(rb_cEventLog);
   Init_winevt_subscribe(rb_cEventLog);
+  Init_winevt_subscribe_group(rb_cEventLog);
+  Init_winevt_parallel_query(rb_cEventLog);
   Init_winevt_locale(rb_cEventLog);
   Init_winevt_session(rb_cEventLog);
 
   id_call = rb_intern("call");
+#endif /* _WIN32 */
 }
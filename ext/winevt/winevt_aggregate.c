@@ -0,0 +1,439 @@
+#include <winevt_c.h>
+
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::Aggregator
+ *
+ * Count events per provider, EventID and level in time buckets with a
+ * native hash table. Query#aggregate uses the same table without
+ * creating Ruby objects for each event.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @aggregator = Winevt::EventLog::Aggregator.new(by: [:provider, :level], bucket: 60)
+ *  @aggregator.add(Time.now, "Service Control Manager", 7036, 4)
+ *  @aggregator.result
+ *  # => {[2024-01-01 00:00:00 +0000, "Service Control Manager", 4] => 1}
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cAggregator;
+
+static ID id_by;
+static ID id_bucket;
+static ID id_provider;
+static ID id_event_id;
+static ID id_level;
+
+#define AGGREGATE_INITIAL_CAPACITY 64
+
+int
+winevt_aggregate_init(struct WinevtAggregate* aggregate)
+{
+  aggregate->entries = calloc(AGGREGATE_INITIAL_CAPACITY, sizeof(struct WinevtAggregateEntry));
+  aggregate->capacity = aggregate->entries ? AGGREGATE_INITIAL_CAPACITY : 0;
+  aggregate->count = 0;
+
+  return aggregate->entries ? 0 : -1;
+}
+
+void
+winevt_aggregate_destroy(struct WinevtAggregate* aggregate)
+{
+  for (size_t i = 0; i < aggregate->capacity; i++) {
+    free(aggregate->entries[i].provider);
+  }
+  free(aggregate->entries);
+  aggregate->entries = NULL;
+  aggregate->capacity = 0;
+  aggregate->count = 0;
+}
+
+static int
+aggregate_has_field(const struct WinevtAggregate* aggregate, int field)
+{
+  for (int i = 0; i < aggregate->fieldCount; i++) {
+    if (aggregate->fields[i] == field)
+      return 1;
+  }
+  return 0;
+}
+
+/* FNV-1a */
+static uint64_t
+hash_bytes(uint64_t hash, const void* data, size_t length)
+{
+  const uint8_t* p = (const uint8_t*)data;
+
+  for (size_t i = 0; i < length; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+static struct WinevtAggregateEntry*
+aggregate_find_slot(struct WinevtAggregateEntry* entries, size_t capacity, uint64_t hash,
+                    int64_t bucket, const char* provider, size_t providerLength,
+                    uint32_t eventId, uint32_t level)
+{
+  size_t i = (size_t)hash & (capacity - 1);
+
+  for (;;) {
+    struct WinevtAggregateEntry* entry = &entries[i];
+    if (entry->count == 0 ||
+        (entry->hash == hash && entry->bucket == bucket && entry->eventId == eventId &&
+         entry->level == level && entry->providerLength == providerLength &&
+         memcmp(entry->provider, provider, providerLength) == 0)) {
+      return entry;
+    }
+    i = (i + 1) & (capacity - 1);
+  }
+}
+
+static int
+aggregate_grow(struct WinevtAggregate* aggregate)
+{
+  size_t capacity = aggregate->capacity * 2;
+  struct WinevtAggregateEntry* entries = calloc(capacity, sizeof(*entries));
+
+  if (!entries)
+    return -1;
+
+  for (size_t i = 0; i < aggregate->capacity; i++) {
+    struct WinevtAggregateEntry* entry = &aggregate->entries[i];
+    if (entry->count > 0) {
+      *aggregate_find_slot(entries, capacity, entry->hash, entry->bucket, entry->provider,
+                           entry->providerLength, entry->eventId, entry->level) = *entry;
+    }
+  }
+  free(aggregate->entries);
+  aggregate->entries = entries;
+  aggregate->capacity = capacity;
+
+  return 0;
+}
+
+/*
+ * Count events. The fields which are not aggregated by are ignored.
+ * Nothing is added when count is 0 because an entry whose count is 0
+ * is an empty slot. Returns -1 when memory is exhausted.
+ */
+int
+winevt_aggregate_add(struct WinevtAggregate* aggregate, int64_t time,
+                     const char* provider, size_t providerLength,
+                     uint32_t eventId, uint32_t level, uint64_t count)
+{
+  struct WinevtAggregateEntry* entry;
+  int64_t bucket = 0;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  if (count == 0)
+    return 0;
+  if (aggregate->bucketSize > 0) {
+    bucket = time / aggregate->bucketSize;
+    if (time % aggregate->bucketSize < 0)
+      bucket--;
+    bucket *= aggregate->bucketSize;
+  }
+  if (!aggregate_has_field(aggregate, AGGREGATE_BY_PROVIDER)) {
+    provider = "";
+    providerLength = 0;
+  }
+  if (!aggregate_has_field(aggregate, AGGREGATE_BY_EVENT_ID))
+    eventId = 0;
+  if (!aggregate_has_field(aggregate, AGGREGATE_BY_LEVEL))
+    level = 0;
+
+  hash = hash_bytes(hash, &bucket, sizeof(bucket));
+  hash = hash_bytes(hash, &eventId, sizeof(eventId));
+  hash = hash_bytes(hash, &level, sizeof(level));
+  hash = hash_bytes(hash, provider, providerLength);
+
+  if ((aggregate->count + 1) * 10 > aggregate->capacity * 7 && aggregate_grow(aggregate) < 0)
+    return -1;
+
+  entry = aggregate_find_slot(aggregate->entries, aggregate->capacity, hash, bucket,
+                              provider, providerLength, eventId, level);
+  if (entry->count == 0) {
+    entry->provider = malloc(providerLength + 1);
+    if (!entry->provider)
+      return -1;
+    memcpy(entry->provider, provider, providerLength);
+    entry->provider[providerLength] = '\0';
+    entry->providerLength = providerLength;
+    entry->hash = hash;
+    entry->bucket = bucket;
+    entry->eventId = eventId;
+    entry->level = level;
+    aggregate->count++;
+  }
+  entry->count += count;
+
+  return 0;
+}
+
+/*
+ * Parse by: and bucket: options into the aggregate. by: defaults to
+ * [:provider, :event_id, :level] and bucket: to nil, no time buckets.
+ */
+void
+winevt_aggregate_parse_options(struct WinevtAggregate* aggregate, VALUE rb_opts)
+{
+  ID keywords[2];
+  VALUE values[2];
+  VALUE rb_by;
+
+  keywords[0] = id_by;
+  keywords[1] = id_bucket;
+  values[0] = Qundef;
+  values[1] = Qundef;
+  if (!NIL_P(rb_opts)) {
+    rb_get_kwargs(rb_opts, keywords, 0, 2, values);
+  }
+
+  aggregate->fieldCount = 0;
+  aggregate->bucketSize = 0;
+
+  rb_by = values[0] == Qundef
+            ? rb_ary_new_from_args(3, ID2SYM(id_provider), ID2SYM(id_event_id), ID2SYM(id_level))
+            : rb_Array(values[0]);
+  if (RARRAY_LEN(rb_by) > AGGREGATE_MAX_FIELDS) {
+    rb_raise(rb_eArgError, "Too many fields to aggregate by");
+  }
+  for (long i = 0; i < RARRAY_LEN(rb_by); i++) {
+    VALUE rb_field = RARRAY_AREF(rb_by, i);
+    ID field = SYMBOL_P(rb_field) ? SYM2ID(rb_field) : 0;
+    int value;
+
+    if (field == id_provider) {
+      value = AGGREGATE_BY_PROVIDER;
+    } else if (field == id_event_id) {
+      value = AGGREGATE_BY_EVENT_ID;
+    } else if (field == id_level) {
+      value = AGGREGATE_BY_LEVEL;
+    } else {
+      rb_raise(rb_eArgError, "Unknown field to aggregate by: %" PRIsVALUE, rb_inspect(rb_field));
+    }
+    if (aggregate_has_field(aggregate, value)) {
+      rb_raise(rb_eArgError, "Duplicated field to aggregate by: %" PRIsVALUE, rb_inspect(rb_field));
+    }
+    aggregate->fields[aggregate->fieldCount++] = value;
+  }
+
+  if (values[1] != Qundef && !NIL_P(values[1])) {
+    long bucketSize = NUM2LONG(values[1]);
+    if (bucketSize < 1) {
+      rb_raise(rb_eArgError, "bucket must be positive seconds or nil");
+    }
+    aggregate->bucketSize = bucketSize;
+  }
+}
+
+/*
+ * Build {[bucket, fields...] => count}. bucket is only included when
+ * the time buckets are used.
+ */
+VALUE
+winevt_aggregate_to_rb_hash(const struct WinevtAggregate* aggregate)
+{
+  VALUE rb_result = rb_hash_new();
+
+  for (size_t i = 0; i < aggregate->capacity; i++) {
+    const struct WinevtAggregateEntry* entry = &aggregate->entries[i];
+    VALUE rb_key;
+
+    if (entry->count == 0)
+      continue;
+
+    rb_key = rb_ary_new_capa(aggregate->fieldCount + 1);
+    if (aggregate->bucketSize > 0) {
+      rb_ary_push(rb_key, rb_time_new((time_t)entry->bucket, 0));
+    }
+    for (int j = 0; j < aggregate->fieldCount; j++) {
+      switch (aggregate->fields[j]) {
+      case AGGREGATE_BY_PROVIDER:
+        rb_ary_push(rb_key, rb_utf8_str_new(entry->provider, entry->providerLength));
+        break;
+      case AGGREGATE_BY_EVENT_ID:
+        rb_ary_push(rb_key, UINT2NUM(entry->eventId));
+        break;
+      case AGGREGATE_BY_LEVEL:
+        rb_ary_push(rb_key, UINT2NUM(entry->level));
+        break;
+      }
+    }
+    rb_hash_aset(rb_result, rb_key, ULL2NUM(entry->count));
+  }
+
+  return rb_result;
+}
+
+static void aggregator_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_aggregator_type = { "winevt/aggregator",
+                                                          {
+                                                            0,
+                                                            aggregator_free,
+                                                            0,
+                                                          },
+                                                          NULL,
+                                                          NULL,
+                                                          RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+aggregator_free(void* ptr)
+{
+  winevt_aggregate_destroy((struct WinevtAggregate*)ptr);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_aggregator_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtAggregate* winevtAggregate;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtAggregate, &rb_winevt_aggregator_type, winevtAggregate);
+  return obj;
+}
+
+static struct WinevtAggregate*
+get_aggregate(VALUE self)
+{
+  struct WinevtAggregate* winevtAggregate;
+
+  TypedData_Get_Struct(
+    self, struct WinevtAggregate, &rb_winevt_aggregator_type, winevtAggregate);
+
+  return winevtAggregate;
+}
+
+/*
+ * Initalize Aggregator class.
+ *
+ * @overload initialize(by: [:provider, :event_id, :level], bucket: nil)
+ *   @param by [Array<Symbol>] Fields to aggregate by. :provider,
+ *     :event_id and :level are available.
+ *   @param bucket [Integer] Seconds of a time bucket. nil means no
+ *     time buckets.
+ * @return [Aggregator]
+ *
+ */
+static VALUE
+rb_winevt_aggregator_initialize(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_opts;
+  struct WinevtAggregate* winevtAggregate = get_aggregate(self);
+
+  rb_scan_args(argc, argv, "0:", &rb_opts);
+  if (winevtAggregate->entries) {
+    rb_raise(rb_eRuntimeError, "already initialized aggregator");
+  }
+  winevt_aggregate_parse_options(winevtAggregate, rb_opts);
+  if (winevt_aggregate_init(winevtAggregate) < 0) {
+    rb_memerror();
+  }
+
+  return Qnil;
+}
+
+/*
+ * This method counts an event.
+ *
+ * @param time [Time] TimeCreated of the event.
+ * @param provider [String] Provider name.
+ * @param event_id [Integer] EventID.
+ * @param level [Integer] Level.
+ * @param count [Integer] Number of the events. 0 is ignored.
+ * @return [Aggregator] self
+ */
+static VALUE
+rb_winevt_aggregator_add(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_time, rb_provider, rb_event_id, rb_level, rb_count;
+  struct WinevtAggregate* winevtAggregate = get_aggregate(self);
+  uint64_t count = 1;
+
+  rb_scan_args(argc, argv, "41", &rb_time, &rb_provider, &rb_event_id, &rb_level, &rb_count);
+  StringValue(rb_provider);
+  if (!NIL_P(rb_count)) {
+    count = NUM2ULL(rb_count);
+  }
+  if (!winevtAggregate->entries) {
+    rb_raise(rb_eRuntimeError, "uninitialized aggregator");
+  }
+
+  if (winevt_aggregate_add(winevtAggregate,
+                           (int64_t)rb_time_timespec(rb_time).tv_sec,
+                           RSTRING_PTR(rb_provider),
+                           RSTRING_LEN(rb_provider),
+                           NUM2UINT(rb_event_id),
+                           NUM2UINT(rb_level),
+                           count) < 0) {
+    rb_memerror();
+  }
+
+  return self;
+}
+
+/*
+ * This method returns the counts.
+ *
+ * @return [Hash] {[bucket, fields...] => count}. The bucket is the
+ *   beginning of the time bucket and only included when the time
+ *   buckets are used. The fields are in the order of by:.
+ */
+static VALUE
+rb_winevt_aggregator_result(VALUE self)
+{
+  return winevt_aggregate_to_rb_hash(get_aggregate(self));
+}
+
+/*
+ * This method returns the number of the distinct keys.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_aggregator_size(VALUE self)
+{
+  return SIZET2NUM(get_aggregate(self)->count);
+}
+
+void
+Init_winevt_aggregate(VALUE rb_cEventLog)
+{
+  rb_cAggregator = rb_define_class_under(rb_cEventLog, "Aggregator", rb_cObject);
+
+  rb_define_alloc_func(rb_cAggregator, rb_winevt_aggregator_alloc);
+
+  id_by = rb_intern("by");
+  id_bucket = rb_intern("bucket");
+  id_provider = rb_intern("provider");
+  id_event_id = rb_intern("event_id");
+  id_level = rb_intern("level");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cAggregator, "initialize", rb_winevt_aggregator_initialize, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cAggregator, "add", rb_winevt_aggregator_add, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cAggregator, "result", rb_winevt_aggregator_result, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cAggregator, "size", rb_winevt_aggregator_size, 0);
+}
@@ -98,16 +98,19 @@ rb_winevt_bookmark_initialize(int argc, VALUE* argv, VALUE self)
 }
 
 /*
- * This method updates bookmark and returns Bookmark instance.
+ * This method updates bookmark with the current batch of the query.
+ * Only the last event of each channel in the batch is used.
  *
  * @param event [Query]
- * @return [Bookmark]
+ * @return [Boolean]
  */
 static VALUE
 rb_winevt_bookmark_update(VALUE self, VALUE event)
 {
   struct WinevtQuery* winevtQuery;
   struct WinevtBookmark* winevtBookmark;
+  EVT_HANDLE lastEvents[QUERY_ARRAY_SIZE];
+  DWORD count;
 
   if (!rb_obj_is_kind_of(event, rb_cQuery)) {
     rb_raise(rb_eArgError, "Expected a Query instance");
@@ -118,8 +121,10 @@ rb_winevt_bookmark_update(VALUE self, VALUE event)
   TypedData_Get_Struct(
     self, struct WinevtBookmark, &rb_winevt_bookmark_type, winevtBookmark);
 
-  for (int i = 0; i < winevtQuery->count; i++) {
-    if (!EvtUpdateBookmark(winevtBookmark->bookmark, winevtQuery->hEvents[i]))
+  count = last_events_per_channel(
+    winevtQuery->hEvents, winevtQuery->count, winevtQuery->multiChannel, lastEvents);
+  for (DWORD i = 0; i < count; i++) {
+    if (!EvtUpdateBookmark(winevtBookmark->bookmark, lastEvents[i]))
       return Qfalse;
   }
   return Qtrue;
@@ -3,6 +3,532 @@
 
 #include <ruby.h>
 #include <ruby/encoding.h>
+#include <ruby/thread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if !defined(HAVE_RB_ALLOCV)
+#define ALLOCV     RB_ALLOCV
+#define ALLOCV_N   RB_ALLOCV_N
+#endif
+
+/* The parts above "#ifdef _WIN32" are portable. They are also built
+ * on the other platforms for testing. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Native threads for the background work which does not touch Ruby
+ * objects. */
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE winevt_thread_t;
+typedef CRITICAL_SECTION winevt_mutex_t;
+typedef CONDITION_VARIABLE winevt_cond_t;
+#else
+#include <pthread.h>
+typedef pthread_t winevt_thread_t;
+typedef pthread_mutex_t winevt_mutex_t;
+typedef pthread_cond_t winevt_cond_t;
+#endif /* _WIN32 */
+
+int winevt_thread_create(winevt_thread_t* thread, void* (*func)(void*), void* arg);
+void winevt_thread_join(winevt_thread_t thread);
+void winevt_mutex_init(winevt_mutex_t* mutex);
+void winevt_mutex_destroy(winevt_mutex_t* mutex);
+void winevt_mutex_lock(winevt_mutex_t* mutex);
+void winevt_mutex_unlock(winevt_mutex_t* mutex);
+void winevt_cond_init(winevt_cond_t* cond);
+void winevt_cond_destroy(winevt_cond_t* cond);
+void winevt_cond_wait(winevt_cond_t* cond, winevt_mutex_t* mutex);
+void winevt_cond_timedwait(winevt_cond_t* cond, winevt_mutex_t* mutex,
+                           unsigned long msec);
+void winevt_cond_broadcast(winevt_cond_t* cond);
+uint64_t winevt_monotonic_msec(void);
+
+/* Deficit round-robin scheduler over channels. */
+#define SCHEDULER_DEFAULT_QUANTUM 10
+
+struct WinevtSchedulerEntry
+{
+  unsigned long weight;
+  int priority;
+  unsigned long deficit;
+};
+
+struct WinevtScheduler
+{
+  struct WinevtSchedulerEntry* entries;
+  size_t* order;
+  size_t count;
+  size_t capacity;
+  size_t position;
+  unsigned long quantum;
+};
+
+void winevt_scheduler_init(struct WinevtScheduler* scheduler, unsigned long quantum);
+void winevt_scheduler_destroy(struct WinevtScheduler* scheduler);
+int winevt_scheduler_add(struct WinevtScheduler* scheduler,
+                         unsigned long weight, int priority);
+void winevt_scheduler_start_round(struct WinevtScheduler* scheduler);
+long winevt_scheduler_next(struct WinevtScheduler* scheduler, unsigned long* allowance);
+void winevt_scheduler_consumed(struct WinevtScheduler* scheduler, size_t index,
+                               unsigned long consumed, int backlogged);
+
+void Init_winevt_scheduler(VALUE rb_cEventLog);
+
+/* Last EventRecordID of each channel. */
+struct WinevtCheckpointEntry
+{
+  char* channel;
+  size_t channelLength;
+  uint64_t recordId;
+};
+
+struct WinevtCheckpoint
+{
+  struct WinevtCheckpointEntry* entries;
+  size_t count;
+  size_t capacity;
+  uint32_t current;
+};
+
+uint32_t winevt_crc32(uint32_t crc, const void* data, size_t length);
+void winevt_checkpoint_init(struct WinevtCheckpoint* checkpoint);
+void winevt_checkpoint_destroy(struct WinevtCheckpoint* checkpoint);
+const struct WinevtCheckpointEntry* winevt_checkpoint_find(
+  const struct WinevtCheckpoint* checkpoint, const char* channel, size_t channelLength);
+int winevt_checkpoint_update(struct WinevtCheckpoint* checkpoint,
+                             const char* channel, size_t channelLength,
+                             uint64_t recordId);
+size_t winevt_checkpoint_serialized_size(const struct WinevtCheckpoint* checkpoint);
+void winevt_checkpoint_serialize(const struct WinevtCheckpoint* checkpoint, uint8_t* buffer);
+int winevt_checkpoint_deserialize(struct WinevtCheckpoint* checkpoint,
+                                  const uint8_t* data, size_t length);
+int winevt_write_file_atomically(const char* path, const uint8_t* data, size_t length);
+struct WinevtCheckpoint* winevt_checkpoint_of(VALUE checkpoint);
+
+extern VALUE rb_cCheckpoint;
+void Init_winevt_checkpoint(VALUE rb_cEventLog);
+
+/* Writes the latest checkpoint snapshot from a background thread. */
+struct WinevtCheckpointWriter
+{
+  winevt_mutex_t lock;
+  winevt_cond_t wake;
+  winevt_cond_t done;
+  winevt_thread_t thread;
+  int initialized;
+  int started;
+  int running;
+  int stopping;
+  int requested;
+  int error;
+  char* path;
+  unsigned long interval;
+  uint8_t* pending;
+  size_t pendingLength;
+  unsigned long long generation;
+  unsigned long long writtenGeneration;
+  unsigned long long writtenCount;
+};
+
+extern VALUE rb_cCheckpointWriter;
+void Init_winevt_checkpoint_writer(VALUE rb_cEventLog);
+
+/* Planning of ParallelQuery. Times are msec since the epoch. */
+#define PARALLEL_QUERY_DEFAULT_PARTITIONS 4
+#define PARALLEL_QUERY_MAX_PARTITIONS 64
+
+struct WinevtTimeRange
+{
+  int64_t from; /* inclusive */
+  int64_t to;   /* exclusive */
+};
+
+struct WinevtMergeHeap
+{
+  uint64_t* keys;
+  size_t* indexes;
+  size_t count;
+  size_t capacity;
+};
+
+size_t winevt_split_time_range(int64_t from, int64_t to, size_t n,
+                               struct WinevtTimeRange* ranges);
+void winevt_format_system_time(int64_t msec, char* buffer, size_t size);
+char* winevt_time_range_xpath(const char* xpath, size_t length,
+                              const struct WinevtTimeRange* range);
+int winevt_merge_heap_init(struct WinevtMergeHeap* heap, size_t capacity);
+void winevt_merge_heap_destroy(struct WinevtMergeHeap* heap);
+void winevt_merge_heap_push(struct WinevtMergeHeap* heap, uint64_t key, size_t index);
+int winevt_merge_heap_pop(struct WinevtMergeHeap* heap, uint64_t* key, size_t* index);
+int64_t winevt_time_to_msec(VALUE rb_time);
+
+extern VALUE rb_cParallelQuery;
+void Init_winevt_partition(VALUE rb_cEventLog);
+
+/* Event counts per key in time buckets. */
+#define AGGREGATE_BY_PROVIDER 1
+#define AGGREGATE_BY_EVENT_ID 2
+#define AGGREGATE_BY_LEVEL    3
+#define AGGREGATE_MAX_FIELDS  3
+
+struct WinevtAggregateEntry
+{
+  uint64_t hash;
+  int64_t bucket;
+  char* provider;
+  size_t providerLength;
+  uint32_t eventId;
+  uint32_t level;
+  uint64_t count; /* 0 means an empty slot */
+};
+
+struct WinevtAggregate
+{
+  struct WinevtAggregateEntry* entries;
+  size_t count;
+  size_t capacity;
+  int fields[AGGREGATE_MAX_FIELDS];
+  int fieldCount;
+  int64_t bucketSize; /* seconds. 0 means no time buckets */
+};
+
+int winevt_aggregate_init(struct WinevtAggregate* aggregate);
+void winevt_aggregate_destroy(struct WinevtAggregate* aggregate);
+int winevt_aggregate_add(struct WinevtAggregate* aggregate, int64_t time,
+                         const char* provider, size_t providerLength,
+                         uint32_t eventId, uint32_t level, uint64_t count);
+void winevt_aggregate_parse_options(struct WinevtAggregate* aggregate, VALUE rb_opts);
+VALUE winevt_aggregate_to_rb_hash(const struct WinevtAggregate* aggregate);
+
+extern VALUE rb_cAggregator;
+void Init_winevt_aggregate(VALUE rb_cEventLog);
+
+/* EVTX file parser. The file is mapped and parsed in place. */
+#define EVTX_FILE_HEADER_SIZE  4096
+#define EVTX_CHUNK_SIZE        65536
+#define EVTX_MAX_WORKERS       64
+#define EVTX_CHUNK_TEMPLATES   64
+#define EVTX_MAX_TEMPLATES     4096
+#define EVTX_CHUNK_HEADER_SIZE 512
+
+#define EVTX_ERROR_CORRUPTED -1
+#define EVTX_ERROR_NOMEM     -2
+
+/* Indexes of WinevtEvtxRendered.system */
+#define EVTX_SYSTEM_PROVIDER_NAME       0
+#define EVTX_SYSTEM_PROVIDER_GUID       1
+#define EVTX_SYSTEM_EVENT_ID            2
+#define EVTX_SYSTEM_QUALIFIERS          3
+#define EVTX_SYSTEM_VERSION             4
+#define EVTX_SYSTEM_LEVEL               5
+#define EVTX_SYSTEM_TASK                6
+#define EVTX_SYSTEM_OPCODE              7
+#define EVTX_SYSTEM_KEYWORDS            8
+#define EVTX_SYSTEM_TIME_CREATED        9
+#define EVTX_SYSTEM_EVENT_RECORD_ID     10
+#define EVTX_SYSTEM_ACTIVITY_ID         11
+#define EVTX_SYSTEM_RELATED_ACTIVITY_ID 12
+#define EVTX_SYSTEM_PROCESS_ID          13
+#define EVTX_SYSTEM_THREAD_ID           14
+#define EVTX_SYSTEM_CHANNEL             15
+#define EVTX_SYSTEM_COMPUTER            16
+#define EVTX_SYSTEM_USER_ID             17
+#define EVTX_SYSTEM_COUNT               18
+
+struct WinevtMappedFile
+{
+  const uint8_t* data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE mapping;
+#endif /* _WIN32 */
+};
+
+/* The file which is read at the offsets without mapping. */
+struct WinevtOpenedFile
+{
+  uint64_t size;
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  int fd;
+#endif /* _WIN32 */
+};
+
+struct WinevtEvtxFileHeader
+{
+  uint64_t firstChunk;
+  uint64_t lastChunk;
+  uint64_t nextRecordId;
+  uint16_t minorVersion;
+  uint16_t majorVersion;
+  uint16_t chunkCount;
+  uint32_t flags;
+};
+
+struct WinevtEvtxChunkHeader
+{
+  uint64_t firstRecordNumber;
+  uint64_t lastRecordNumber;
+  uint64_t firstRecordId;
+  uint64_t lastRecordId;
+  uint32_t lastRecordOffset;
+  uint32_t freeSpaceOffset;
+  uint32_t recordsChecksum;
+  uint32_t checksum;
+};
+
+struct WinevtEvtxRecord
+{
+  uint64_t recordId;
+  uint64_t writtenTime; /* FILETIME */
+  const uint8_t* data;  /* BinXML */
+  size_t size;
+};
+
+struct WinevtEvtxBuffer
+{
+  char* data;
+  size_t length;
+  size_t capacity;
+};
+
+/* Range of WinevtEvtxRendered.text. */
+struct WinevtEvtxText
+{
+  size_t offset;
+  size_t length;
+  int present;
+};
+
+/* A substitution value of a template instance. */
+struct WinevtEvtxValue
+{
+  uint8_t type;
+  uint16_t size;
+  const uint8_t* data;
+};
+
+/* A template definition compiled into a substitution plan. */
+struct WinevtEvtxTemplatePlan;
+
+struct WinevtEvtxTemplateEntry
+{
+  uint8_t guid[16];
+  uint32_t dataSize;
+  uint64_t hash;
+  struct WinevtEvtxTemplatePlan* plan;
+};
+
+/*
+ * Plans keyed by the template GUID and the hash of its definition.
+ * The same templates are defined again in every chunk, so the cache is
+ * shared by the chunks and the files. This is locked for the workers.
+ */
+struct WinevtEvtxTemplateCache
+{
+  winevt_mutex_t lock;
+  struct WinevtEvtxTemplateEntry* entries;
+  size_t capacity;
+  size_t size;
+  unsigned long long hits;
+  unsigned long long misses;
+};
+
+/* Buffers are reused for the records of a chunk. */
+struct WinevtEvtxRendered
+{
+  uint64_t recordId;
+  struct WinevtEvtxBuffer xml;
+  struct WinevtEvtxBuffer text; /* unescaped system values and inserts */
+  struct WinevtEvtxBuffer scratch;
+  struct WinevtEvtxText system[EVTX_SYSTEM_COUNT];
+  struct WinevtEvtxText* inserts;
+  size_t insertCount;
+  size_t insertCapacity;
+  struct WinevtEvtxValue* values;
+  size_t valueCount;
+  size_t valueCapacity;
+  /* The plans of the current chunk by the definition offsets. A NULL
+   * plan means the template is walked every time. */
+  struct WinevtEvtxTemplateCache* templateCache;
+  const uint8_t* templateChunk;
+  uint32_t templateOffsets[EVTX_CHUNK_TEMPLATES];
+  const struct WinevtEvtxTemplatePlan* templatePlans[EVTX_CHUNK_TEMPLATES];
+  size_t templateCount;
+};
+
+/* A record in WinevtEvtxDecodedChunk. The offsets of system and
+ * inserts are relative to textOffset. */
+struct WinevtEvtxDecodedRecord
+{
+  uint64_t recordId;
+  size_t xmlOffset;
+  size_t xmlLength;
+  size_t textOffset;
+  size_t textLength;
+  size_t insertOffset;
+  size_t insertCount;
+  struct WinevtEvtxText system[EVTX_SYSTEM_COUNT];
+};
+
+/* Rendered records of a chunk which are decoded ahead of yielding. */
+struct WinevtEvtxDecodedChunk
+{
+  struct WinevtEvtxDecodedRecord* records;
+  size_t count;
+  size_t capacity;
+  struct WinevtEvtxBuffer xml;
+  struct WinevtEvtxBuffer text;
+  struct WinevtEvtxText* inserts;
+  size_t insertCount;
+  size_t insertCapacity;
+  int status; /* 0 or EVTX_ERROR_* which stopped decoding */
+};
+
+int winevt_map_file(const char* path, struct WinevtMappedFile* file);
+void winevt_unmap_file(struct WinevtMappedFile* file);
+int winevt_open_file(const char* path, struct WinevtOpenedFile* file);
+int winevt_read_file_at(const struct WinevtOpenedFile* file, uint64_t offset, uint8_t* buffer,
+                        size_t length, size_t* read);
+void winevt_close_file(struct WinevtOpenedFile* file);
+int winevt_evtx_read_file_header(const uint8_t* data, size_t size,
+                                 struct WinevtEvtxFileHeader* header);
+size_t winevt_evtx_chunk_count(size_t size);
+int winevt_evtx_read_chunk_header(const uint8_t* chunk, struct WinevtEvtxChunkHeader* header);
+int winevt_evtx_next_record(const uint8_t* chunk, const struct WinevtEvtxChunkHeader* header,
+                            uint32_t* offset, struct WinevtEvtxRecord* record);
+void winevt_evtx_rendered_init(struct WinevtEvtxRendered* rendered);
+void winevt_evtx_rendered_destroy(struct WinevtEvtxRendered* rendered);
+int winevt_evtx_render_record(const uint8_t* chunk, const struct WinevtEvtxRecord* record,
+                              struct WinevtEvtxRendered* rendered);
+void winevt_evtx_decoded_chunk_init(struct WinevtEvtxDecodedChunk* decoded);
+void winevt_evtx_decoded_chunk_destroy(struct WinevtEvtxDecodedChunk* decoded);
+int winevt_evtx_decode_chunk(const uint8_t* chunk, uint64_t firstRecordId,
+                             uint64_t lastRecordId, struct WinevtEvtxRendered* rendered,
+                             struct WinevtEvtxDecodedChunk* decoded);
+void winevt_evtx_decoded_record(const struct WinevtEvtxDecodedChunk* decoded, size_t index,
+                                struct WinevtEvtxRendered* view);
+void winevt_evtx_template_cache_init(struct WinevtEvtxTemplateCache* cache);
+void winevt_evtx_template_cache_destroy(struct WinevtEvtxTemplateCache* cache);
+VALUE winevt_evtx_rendered_to_rb_ary(const struct WinevtEvtxRendered* rendered,
+                                     int renderAsXML, int preserveQualifiers,
+                                     int preserveSID);
+
+extern VALUE rb_cEvtxFile;
+extern VALUE rb_eEvtxFileError;
+extern VALUE rb_cEvtxTemplateCache;
+struct WinevtEvtxTemplateCache* winevt_evtx_get_template_cache(VALUE rb_template_cache);
+void Init_winevt_evtx_file(VALUE rb_cEventLog);
+
+extern VALUE rb_cEvtxTail;
+void Init_winevt_evtx_tail(VALUE rb_cEventLog);
+
+/* XPath which is validated once and kept as a wide string. */
+extern VALUE rb_cCompiledQuery;
+extern VALUE rb_eCompiledQueryError;
+const uint16_t* winevt_compiled_query_wstr(VALUE rb_compiled_query);
+void Init_winevt_compiled_query(VALUE rb_cEventLog);
+
+/* Predicates which are evaluated on rendered values before creating
+ * Ruby objects. */
+#define FILTER_VALUE_NULL    0
+#define FILTER_VALUE_STRING  1
+#define FILTER_VALUE_INTEGER 2
+
+struct WinevtFilterValue
+{
+  int type;
+  const uint16_t* string; /* UTF-16, not terminated */
+  size_t length;
+  int negative; /* integer is the two's complement of a negative value */
+  uint64_t integer;
+};
+
+struct WinevtFilterPredicate;
+
+struct WinevtFilter
+{
+  struct WinevtFilterPredicate* predicates;
+  size_t count;
+  uint16_t** paths; /* terminated by NUL for EvtCreateRenderContext */
+  size_t pathCount;
+  int initialized;
+};
+
+int winevt_filter_match(const struct WinevtFilter* filter,
+                        const struct WinevtFilterValue* values);
+struct WinevtFilter* winevt_get_filter(VALUE rb_filter);
+
+extern VALUE rb_cFilter;
+void Init_winevt_filter(VALUE rb_cEventLog);
+
+/* Bounded and time-windowed set of delivered event identities. */
+#define DEDUP_DEFAULT_CAPACITY 65536
+
+struct WinevtDedupEntry
+{
+  uint64_t key;
+  uint64_t time; /* winevt_monotonic_msec() when it is added */
+};
+
+struct WinevtDedup
+{
+  winevt_mutex_t lock;
+  struct WinevtDedupEntry* entries; /* ring in the added order */
+  size_t capacity;
+  size_t head;
+  size_t count;
+  size_t* slots; /* open addressing. index of entries + 1 or 0 */
+  size_t slotMask;
+  uint64_t window; /* msec. 0 means only the capacity bounds it */
+  uint64_t duplicates;
+  int initialized;
+};
+
+uint64_t winevt_xxh64(const void* data, size_t length, uint64_t seed);
+uint64_t winevt_dedup_record_key(const uint16_t* channel, size_t length, uint64_t recordId);
+uint64_t winevt_dedup_xml_key(const uint16_t* xml, size_t length);
+int winevt_dedup_add(struct WinevtDedup* dedup, uint64_t key, uint64_t now);
+struct WinevtDedup* winevt_get_dedup(VALUE rb_dedup);
+
+extern VALUE rb_cDeduplicator;
+void Init_winevt_dedup(VALUE rb_cEventLog);
+
+/* Sampling rules keyed by provider and EventID. */
+struct WinevtSamplerRule;
+
+struct WinevtSampler
+{
+  winevt_mutex_t lock;
+  struct WinevtSamplerRule* rules;
+  size_t count;
+  uint64_t sampled;
+  int initialized;
+};
+
+int winevt_sampler_keep(struct WinevtSampler* sampler, const uint16_t* provider,
+                        size_t providerLength, uint32_t eventId, uint64_t recordId);
+struct WinevtSampler* winevt_get_sampler(VALUE rb_sampler);
+
+extern VALUE rb_cSampler;
+void Init_winevt_sampler(VALUE rb_cEventLog);
+
+VALUE winevt_query_list_to_xml(VALUE rb_query_list);
+VALUE winevt_query_list_channels(VALUE rb_query_list);
+
+extern VALUE rb_cQueryList;
+void Init_winevt_query_list(VALUE rb_cEventLog);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#ifdef _WIN32
 
 #ifdef __GNUC__
 #include <w32api.h>
@@ -16,11 +542,6 @@
 #endif /* WIN32_WINNT */
 #define _WIN32_WINNT MINIMUM_WINDOWS_VERSION
 
-#if !defined(HAVE_RB_ALLOCV)
-#define ALLOCV     RB_ALLOCV
-#define ALLOCV_N   RB_ALLOCV_N
-#endif
-
 #include <time.h>
 #include <winevt.h>
 #define EventQuery(object) ((struct WinevtQuery*)DATA_PTR(object))
@@ -34,6 +555,55 @@ typedef struct {
   CHAR* description;
 } LocaleInfo;
 
+struct WinevtRenderOptions
+{
+  BOOL renderAsXML;
+  BOOL renderPath;
+  LANGID langID;
+  EVT_HANDLE remoteHandle;
+  EVT_HANDLE systemContext;
+  EVT_HANDLE userContext;
+};
+
+/* Rendering context and buffers for evaluating a Filter. */
+struct WinevtFilterContext
+{
+  const struct WinevtFilter* filter;
+  EVT_HANDLE context;
+  PEVT_VARIANT buffer;
+  DWORD bufferSize;
+  struct WinevtFilterValue* values;
+};
+
+/* Rendering context and buffer for identifying an event. */
+struct WinevtDedupContext
+{
+  struct WinevtDedup* dedup;
+  EVT_HANDLE context;
+  PEVT_VARIANT buffer;
+  DWORD bufferSize;
+};
+
+/* Rendering context and buffer for sampling an event. */
+struct WinevtSamplerContext
+{
+  struct WinevtSampler* sampler;
+  EVT_HANDLE context;
+  PEVT_VARIANT buffer;
+  DWORD bufferSize;
+};
+
+struct WinevtRenderedEvent
+{
+  WCHAR* xml;
+  PEVT_VARIANT systemValues;
+  DWORD systemValuesCount;
+  WCHAR* message;
+  PEVT_VARIANT userValues;
+  DWORD userValuesCount;
+  WCHAR* path; /* the channel or the log file which has the event */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -48,14 +618,71 @@ VALUE wstr_to_rb_str(UINT cp, const WCHAR* wstr, int clen);
 void raise_system_error(VALUE error, DWORD errorCode);
 void raise_channel_not_found_error(VALUE channelPath);
 VALUE render_to_rb_str(EVT_HANDLE handle, DWORD flags);
+WCHAR* render_to_wstr(EVT_HANDLE handle, DWORD flags, DWORD* status);
+WCHAR* event_path_to_wstr(EVT_HANDLE hEvent, DWORD* status);
+VALUE get_event_path(EVT_HANDLE hEvent);
+PEVT_VARIANT render_to_values(EVT_HANDLE hContext, EVT_HANDLE handle,
+                              DWORD* propCount, DWORD* status);
+DWORD render_values_to_buffer(EVT_HANDLE hContext, EVT_HANDLE handle,
+                              PEVT_VARIANT* buffer, DWORD* bufferSize,
+                              DWORD* propCount);
+DWORD render_event(EVT_HANDLE hEvent, const struct WinevtRenderOptions* options,
+                   struct WinevtRenderedEvent* rendered);
+void free_rendered_event(struct WinevtRenderedEvent* rendered);
+VALUE rendered_event_to_rb_ary(const struct WinevtRenderedEvent* rendered,
+                               BOOL preserveQualifiers, BOOL preserveSID);
 EVT_HANDLE connect_to_remote(LPWSTR computerName, LPWSTR domain,
                              LPWSTR username, LPWSTR password,
                              EVT_RPC_LOGIN_FLAGS flags,
                              DWORD *error_code);
+DWORD format_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote,
+                         WCHAR** description);
 WCHAR* get_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote);
 VALUE get_values(EVT_HANDLE handle);
+VALUE extract_user_evt_variants(PEVT_VARIANT pRenderedValues, DWORD propCount);
 VALUE render_system_event(EVT_HANDLE handle, BOOL preserve_qualifiers, BOOL preserveSID);
+VALUE system_values_to_rb_hash(PEVT_VARIANT pRenderedValues, BOOL preserve_qualifiers,
+                               BOOL preserveSID);
 LocaleInfo* get_locale_info_from_rb_str(VALUE rb_locale_str);
+BOOL is_structured_query(const WCHAR* query);
+DWORD last_events_per_channel(EVT_HANDLE* events, DWORD count, BOOL multiChannel,
+                              EVT_HANDLE* lastEvents);
+void update_checkpoint_with_events(struct WinevtCheckpoint* checkpoint,
+                                    EVT_HANDLE* events, DWORD count);
+DWORD timeout_to_msec(VALUE rb_timeout);
+/* max_events: and max_time: of #each. */
+struct WinevtEachBudget
+{
+  ULONGLONG maxEvents; /* 0 means unlimited */
+  DWORD timeout;       /* msec or INFINITE */
+  ULONGLONG deadline;
+  ULONGLONG yielded;
+};
+
+void* call_without_gvl(void* (*func)(void*), void* data1,
+                       rb_unblock_function_t* ubf, void* data2);
+BOOL evt_next(EVT_HANDLE resultSet, DWORD eventsSize, EVT_HANDLE* events,
+              DWORD timeout, DWORD* count);
+DWORD remaining_msec(DWORD timeout, ULONGLONG deadline);
+void each_budget_init(struct WinevtEachBudget* budget, VALUE rb_opts);
+DWORD each_budget_allowance(const struct WinevtEachBudget* budget, DWORD size);
+BOOL each_budget_exhausted(const struct WinevtEachBudget* budget);
+DWORD wait_for_signal_events(HANDLE* handles, DWORD count, DWORD timeout);
+DWORD filter_context_init(struct WinevtFilterContext* filterContext,
+                          const struct WinevtFilter* filter);
+void filter_context_free(struct WinevtFilterContext* filterContext);
+DWORD filter_event(struct WinevtFilterContext* filterContext, EVT_HANDLE hEvent,
+                   BOOL* matched);
+DWORD dedup_context_init(struct WinevtDedupContext* dedupContext,
+                         struct WinevtDedup* dedup);
+void dedup_context_free(struct WinevtDedupContext* dedupContext);
+DWORD dedup_event(struct WinevtDedupContext* dedupContext, EVT_HANDLE hEvent,
+                  BOOL* duplicated);
+DWORD sampler_context_init(struct WinevtSamplerContext* samplerContext,
+                           struct WinevtSampler* sampler);
+void sampler_context_free(struct WinevtSamplerContext* samplerContext);
+DWORD sample_event(struct WinevtSamplerContext* samplerContext, EVT_HANDLE hEvent,
+                   BOOL* kept);
 
 #ifdef __cplusplus
 }
@@ -66,6 +693,7 @@ extern VALUE rb_cFlag;
 extern VALUE rb_cChannel;
 extern VALUE rb_cBookmark;
 extern VALUE rb_cSubscribe;
+extern VALUE rb_cSubscribeGroup;
 extern VALUE rb_eWinevtQueryError;
 extern VALUE rb_eChannelNotFoundError;
 extern VALUE rb_eRemoteHandlerError;
@@ -99,6 +727,7 @@ struct WinevtBookmark
 };
 
 #define QUERY_ARRAY_SIZE 10
+#define QUERY_COUNT_BATCH_SIZE 512
 
 struct WinevtQuery
 {
@@ -112,11 +741,47 @@ struct WinevtQuery
   BOOL preserveSID;
   LocaleInfo *localeInfo;
   EVT_HANDLE remoteHandle;
+  BOOL multiChannel;
+  BOOL yieldPath; /* opened with a QueryList */
+  struct WinevtFilterContext filter;
+  ULONGLONG filteredCount;
+  struct WinevtSamplerContext sampler;
+  ULONGLONG sampledCount;
 };
 
 #define SUBSCRIBE_ARRAY_SIZE 10
 #define SUBSCRIBE_RATE_INFINITE -1
 
+struct WinevtTokenBucket
+{
+  LONG rate;  /* tokens per second or SUBSCRIBE_RATE_INFINITE */
+  LONG burst; /* bucket size. 0 means the same as rate */
+  double tokens;
+  LONGLONG lastTick;
+};
+#define SUBSCRIBE_PUSH_QUEUE_SIZE 1024
+
+struct WinevtPushQueue
+{
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE notFull;
+  struct WinevtRenderedEvent* events;
+  DWORD capacity;
+  DWORD head;
+  DWORD count;
+  BOOL closing;
+  DWORD error;
+  HANDLE signalEvent;
+  EVT_HANDLE bookmark;
+  BOOL bookmarkUpdated;
+  struct WinevtRenderOptions options;
+  struct WinevtFilterContext filter;
+  ULONGLONG filteredCount;
+  struct WinevtDedupContext dedup;
+  struct WinevtSamplerContext sampler;
+  ULONGLONG sampledCount;
+};
+
 struct WinevtSubscribe
 {
   HANDLE signalEvent;
@@ -125,22 +790,102 @@ struct WinevtSubscribe
   EVT_HANDLE hEvents[SUBSCRIBE_ARRAY_SIZE];
   DWORD count;
   DWORD flags;
+  DWORD position;
+  BOOL multiChannel;
+  BOOL yieldPath; /* subscribed with a QueryList */
+  /* Delivered events which the bookmark is not updated with yet. */
+  EVT_HANDLE bookmarkEvents[SUBSCRIBE_ARRAY_SIZE];
+  DWORD bookmarkEventsCount;
+  BOOL bookmarkUpdated;
+  DWORD checkpointInterval;
+  DWORD checkpointCount;
+  ULONGLONG lastCheckpoint;
+  DWORD eventsSinceCheckpoint;
+  /* Owned by the Checkpoint object in @checkpoint. */
+  struct WinevtCheckpoint* checkpoint;
   BOOL readExistingEvents;
-  DWORD rateLimit;
-  time_t lastTime;
-  DWORD currentRate;
+  struct WinevtTokenBucket eventBucket;
+  struct WinevtTokenBucket byteBucket;
+  LONGLONG throttleStart;
+  LONGLONG throttledTicks;
+  ULONGLONG throttledCount;
   BOOL renderAsXML;
   BOOL preserveQualifiers;
   BOOL preserveSID;
   LocaleInfo* localeInfo;
   EVT_HANDLE remoteHandle;
+  BOOL pushMode;
+  DWORD pushQueueSize;
+  struct WinevtPushQueue* pushQueue;
+  struct WinevtRenderedEvent pushedEvents[SUBSCRIBE_ARRAY_SIZE];
+  struct WinevtFilterContext filter;
+  ULONGLONG filteredCount;
+  struct WinevtDedupContext dedup;
+  struct WinevtSamplerContext sampler;
+  ULONGLONG sampledCount;
+};
+
+VALUE subscribe_wait_ready(VALUE rb_subscriptions, VALUE rb_timeout);
+VALUE subscribe_next(VALUE self);
+DWORD subscribe_yield_batch(VALUE self, VALUE channel, DWORD maxEvents);
+
+struct WinevtSubscribeGroup
+{
+  struct WinevtScheduler scheduler;
+};
+
+#define PARALLEL_QUERY_QUEUE_SIZE 64
+
+struct WinevtParallelQuery;
+
+struct WinevtPartitionItem
+{
+  uint64_t recordId;
+  struct WinevtRenderedEvent rendered;
+};
+
+/* A time range which is read by its own thread. */
+struct WinevtPartition
+{
+  struct WinevtParallelQuery* parent;
+  WCHAR* xpath;
+  EVT_HANDLE query;
+  winevt_thread_t thread;
+  BOOL started;
+  BOOL finished;
+  DWORD error;
+  DWORD head;
+  DWORD count;
+  struct WinevtPartitionItem items[PARALLEL_QUERY_QUEUE_SIZE];
+};
+
+struct WinevtParallelQuery
+{
+  WCHAR* channel;
+  struct WinevtPartition* partitions;
+  DWORD partitionCount;
+  winevt_mutex_t lock;
+  winevt_cond_t notEmpty;
+  winevt_cond_t notFull;
+  BOOL initialized;
+  BOOL running;
+  BOOL cancelled;
+  struct WinevtMergeHeap heap;
+  BOOL renderAsXML;
+  BOOL preserveQualifiers;
+  BOOL preserveSID;
+  LocaleInfo* localeInfo;
 };
 
 void Init_winevt_query(VALUE rb_cEventLog);
 void Init_winevt_channel(VALUE rb_cEventLog);
 void Init_winevt_bookmark(VALUE rb_cEventLog);
 void Init_winevt_subscribe(VALUE rb_cEventLog);
+void Init_winevt_subscribe_group(VALUE rb_cEventLog);
+void Init_winevt_parallel_query(VALUE rb_cEventLog);
 void Init_winevt_locale(VALUE rb_cEventLog);
 void Init_winevt_session(VALUE rb_cEventLog);
 
+#endif /* _WIN32 */
+
 #endif // _WINEVT_C_H
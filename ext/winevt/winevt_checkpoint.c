@@ -0,0 +1,935 @@
+#include <winevt_c.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::Checkpoint
+ *
+ * Compact progress of reading channels: the last EventRecordID of
+ * each channel. It can be converted to and from Bookmark XML and
+ * written to a file atomically.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @subscribe = Winevt::EventLog::Subscribe.new
+ *  @subscribe.subscribe("Application", "*")
+ *  @subscribe.each do |eventlog, message, string_inserts|
+ *    puts ({eventlog: eventlog, data: message})
+ *  end
+ *  @subscribe.checkpoint.write("application.checkpoint")
+ *
+ *  # After restarting
+ *  @checkpoint = Winevt::EventLog::Checkpoint.read("application.checkpoint")
+ *  @subscribe.subscribe("Application", "*", @checkpoint.to_bookmark)
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cCheckpoint;
+
+/*
+ * Binary format, all integers are little endian:
+ *
+ *   "WEVC" version(u8) current(u32) count(u32)
+ *   count * { channel length(u16) channel(UTF-8) record id(u64) }
+ *   crc32(u32) of everything before it
+ *
+ * current is the index of the current channel or 0xFFFFFFFF.
+ */
+#define CHECKPOINT_MAGIC "WEVC"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_NO_CURRENT 0xFFFFFFFFU
+#define CHECKPOINT_HEADER_SIZE (4 + 1 + 4 + 4)
+
+/* CRC-32 (IEEE 802.3, reflected 0xEDB88320) of each byte. */
+static const uint32_t crc32Table[256] = {
+  0x00000000U, 0x77073096U, 0xee0e612cU, 0x990951baU, 0x076dc419U, 0x706af48fU,
+  0xe963a535U, 0x9e6495a3U, 0x0edb8832U, 0x79dcb8a4U, 0xe0d5e91eU, 0x97d2d988U,
+  0x09b64c2bU, 0x7eb17cbdU, 0xe7b82d07U, 0x90bf1d91U, 0x1db71064U, 0x6ab020f2U,
+  0xf3b97148U, 0x84be41deU, 0x1adad47dU, 0x6ddde4ebU, 0xf4d4b551U, 0x83d385c7U,
+  0x136c9856U, 0x646ba8c0U, 0xfd62f97aU, 0x8a65c9ecU, 0x14015c4fU, 0x63066cd9U,
+  0xfa0f3d63U, 0x8d080df5U, 0x3b6e20c8U, 0x4c69105eU, 0xd56041e4U, 0xa2677172U,
+  0x3c03e4d1U, 0x4b04d447U, 0xd20d85fdU, 0xa50ab56bU, 0x35b5a8faU, 0x42b2986cU,
+  0xdbbbc9d6U, 0xacbcf940U, 0x32d86ce3U, 0x45df5c75U, 0xdcd60dcfU, 0xabd13d59U,
+  0x26d930acU, 0x51de003aU, 0xc8d75180U, 0xbfd06116U, 0x21b4f4b5U, 0x56b3c423U,
+  0xcfba9599U, 0xb8bda50fU, 0x2802b89eU, 0x5f058808U, 0xc60cd9b2U, 0xb10be924U,
+  0x2f6f7c87U, 0x58684c11U, 0xc1611dabU, 0xb6662d3dU, 0x76dc4190U, 0x01db7106U,
+  0x98d220bcU, 0xefd5102aU, 0x71b18589U, 0x06b6b51fU, 0x9fbfe4a5U, 0xe8b8d433U,
+  0x7807c9a2U, 0x0f00f934U, 0x9609a88eU, 0xe10e9818U, 0x7f6a0dbbU, 0x086d3d2dU,
+  0x91646c97U, 0xe6635c01U, 0x6b6b51f4U, 0x1c6c6162U, 0x856530d8U, 0xf262004eU,
+  0x6c0695edU, 0x1b01a57bU, 0x8208f4c1U, 0xf50fc457U, 0x65b0d9c6U, 0x12b7e950U,
+  0x8bbeb8eaU, 0xfcb9887cU, 0x62dd1ddfU, 0x15da2d49U, 0x8cd37cf3U, 0xfbd44c65U,
+  0x4db26158U, 0x3ab551ceU, 0xa3bc0074U, 0xd4bb30e2U, 0x4adfa541U, 0x3dd895d7U,
+  0xa4d1c46dU, 0xd3d6f4fbU, 0x4369e96aU, 0x346ed9fcU, 0xad678846U, 0xda60b8d0U,
+  0x44042d73U, 0x33031de5U, 0xaa0a4c5fU, 0xdd0d7cc9U, 0x5005713cU, 0x270241aaU,
+  0xbe0b1010U, 0xc90c2086U, 0x5768b525U, 0x206f85b3U, 0xb966d409U, 0xce61e49fU,
+  0x5edef90eU, 0x29d9c998U, 0xb0d09822U, 0xc7d7a8b4U, 0x59b33d17U, 0x2eb40d81U,
+  0xb7bd5c3bU, 0xc0ba6cadU, 0xedb88320U, 0x9abfb3b6U, 0x03b6e20cU, 0x74b1d29aU,
+  0xead54739U, 0x9dd277afU, 0x04db2615U, 0x73dc1683U, 0xe3630b12U, 0x94643b84U,
+  0x0d6d6a3eU, 0x7a6a5aa8U, 0xe40ecf0bU, 0x9309ff9dU, 0x0a00ae27U, 0x7d079eb1U,
+  0xf00f9344U, 0x8708a3d2U, 0x1e01f268U, 0x6906c2feU, 0xf762575dU, 0x806567cbU,
+  0x196c3671U, 0x6e6b06e7U, 0xfed41b76U, 0x89d32be0U, 0x10da7a5aU, 0x67dd4accU,
+  0xf9b9df6fU, 0x8ebeeff9U, 0x17b7be43U, 0x60b08ed5U, 0xd6d6a3e8U, 0xa1d1937eU,
+  0x38d8c2c4U, 0x4fdff252U, 0xd1bb67f1U, 0xa6bc5767U, 0x3fb506ddU, 0x48b2364bU,
+  0xd80d2bdaU, 0xaf0a1b4cU, 0x36034af6U, 0x41047a60U, 0xdf60efc3U, 0xa867df55U,
+  0x316e8eefU, 0x4669be79U, 0xcb61b38cU, 0xbc66831aU, 0x256fd2a0U, 0x5268e236U,
+  0xcc0c7795U, 0xbb0b4703U, 0x220216b9U, 0x5505262fU, 0xc5ba3bbeU, 0xb2bd0b28U,
+  0x2bb45a92U, 0x5cb36a04U, 0xc2d7ffa7U, 0xb5d0cf31U, 0x2cd99e8bU, 0x5bdeae1dU,
+  0x9b64c2b0U, 0xec63f226U, 0x756aa39cU, 0x026d930aU, 0x9c0906a9U, 0xeb0e363fU,
+  0x72076785U, 0x05005713U, 0x95bf4a82U, 0xe2b87a14U, 0x7bb12baeU, 0x0cb61b38U,
+  0x92d28e9bU, 0xe5d5be0dU, 0x7cdcefb7U, 0x0bdbdf21U, 0x86d3d2d4U, 0xf1d4e242U,
+  0x68ddb3f8U, 0x1fda836eU, 0x81be16cdU, 0xf6b9265bU, 0x6fb077e1U, 0x18b74777U,
+  0x88085ae6U, 0xff0f6a70U, 0x66063bcaU, 0x11010b5cU, 0x8f659effU, 0xf862ae69U,
+  0x616bffd3U, 0x166ccf45U, 0xa00ae278U, 0xd70dd2eeU, 0x4e048354U, 0x3903b3c2U,
+  0xa7672661U, 0xd06016f7U, 0x4969474dU, 0x3e6e77dbU, 0xaed16a4aU, 0xd9d65adcU,
+  0x40df0b66U, 0x37d83bf0U, 0xa9bcae53U, 0xdebb9ec5U, 0x47b2cf7fU, 0x30b5ffe9U,
+  0xbdbdf21cU, 0xcabac28aU, 0x53b39330U, 0x24b4a3a6U, 0xbad03605U, 0xcdd70693U,
+  0x54de5729U, 0x23d967bfU, 0xb3667a2eU, 0xc4614ab8U, 0x5d681b02U, 0x2a6f2b94U,
+  0xb40bbe37U, 0xc30c8ea1U, 0x5a05df1bU, 0x2d02ef8dU
+};
+
+uint32_t
+winevt_crc32(uint32_t crc, const void* data, size_t length)
+{
+  const uint8_t* p = (const uint8_t*)data;
+
+  crc = ~crc;
+  while (length-- > 0) {
+    crc = crc32Table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+
+  return ~crc;
+}
+
+void
+winevt_checkpoint_init(struct WinevtCheckpoint* checkpoint)
+{
+  checkpoint->entries = NULL;
+  checkpoint->count = 0;
+  checkpoint->capacity = 0;
+  checkpoint->current = CHECKPOINT_NO_CURRENT;
+}
+
+void
+winevt_checkpoint_destroy(struct WinevtCheckpoint* checkpoint)
+{
+  for (size_t i = 0; i < checkpoint->count; i++) {
+    free(checkpoint->entries[i].channel);
+  }
+  free(checkpoint->entries);
+  winevt_checkpoint_init(checkpoint);
+}
+
+const struct WinevtCheckpointEntry*
+winevt_checkpoint_find(const struct WinevtCheckpoint* checkpoint,
+                       const char* channel, size_t channelLength)
+{
+  for (size_t i = 0; i < checkpoint->count; i++) {
+    const struct WinevtCheckpointEntry* entry = &checkpoint->entries[i];
+    if (entry->channelLength == channelLength &&
+        memcmp(entry->channel, channel, channelLength) == 0) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Record the last record id of the channel, which becomes the current
+ * one. Returns -1 when memory is exhausted or the channel name is too
+ * long.
+ */
+int
+winevt_checkpoint_update(struct WinevtCheckpoint* checkpoint,
+                         const char* channel, size_t channelLength,
+                         uint64_t recordId)
+{
+  const struct WinevtCheckpointEntry* found;
+  struct WinevtCheckpointEntry* entry;
+
+  if (channelLength > 0xFFFF)
+    return -1;
+
+  found = winevt_checkpoint_find(checkpoint, channel, channelLength);
+  if (found) {
+    entry = (struct WinevtCheckpointEntry*)found;
+  } else {
+    if (checkpoint->count == checkpoint->capacity) {
+      size_t capacity = checkpoint->capacity ? checkpoint->capacity * 2 : 4;
+      struct WinevtCheckpointEntry* entries =
+        realloc(checkpoint->entries, capacity * sizeof(*entries));
+      if (!entries)
+        return -1;
+      checkpoint->entries = entries;
+      checkpoint->capacity = capacity;
+    }
+    entry = &checkpoint->entries[checkpoint->count];
+    entry->channel = malloc(channelLength + 1);
+    if (!entry->channel)
+      return -1;
+    memcpy(entry->channel, channel, channelLength);
+    entry->channel[channelLength] = '\0';
+    entry->channelLength = channelLength;
+    checkpoint->count++;
+  }
+
+  entry->recordId = recordId;
+  checkpoint->current = (uint32_t)(entry - checkpoint->entries);
+
+  return 0;
+}
+
+static uint8_t*
+put_u16(uint8_t* p, uint16_t value)
+{
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+  return p + 2;
+}
+
+static uint8_t*
+put_u32(uint8_t* p, uint32_t value)
+{
+  for (int i = 0; i < 4; i++) {
+    p[i] = (uint8_t)(value >> (i * 8));
+  }
+  return p + 4;
+}
+
+static uint8_t*
+put_u64(uint8_t* p, uint64_t value)
+{
+  for (int i = 0; i < 8; i++) {
+    p[i] = (uint8_t)(value >> (i * 8));
+  }
+  return p + 8;
+}
+
+static uint16_t
+get_u16(const uint8_t* p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t
+get_u32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+get_u64(const uint8_t* p)
+{
+  return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+size_t
+winevt_checkpoint_serialized_size(const struct WinevtCheckpoint* checkpoint)
+{
+  size_t size = CHECKPOINT_HEADER_SIZE + 4;
+
+  for (size_t i = 0; i < checkpoint->count; i++) {
+    size += 2 + checkpoint->entries[i].channelLength + 8;
+  }
+
+  return size;
+}
+
+/* buffer must have winevt_checkpoint_serialized_size bytes. */
+void
+winevt_checkpoint_serialize(const struct WinevtCheckpoint* checkpoint, uint8_t* buffer)
+{
+  uint8_t* p = buffer;
+
+  memcpy(p, CHECKPOINT_MAGIC, 4);
+  p += 4;
+  *p++ = CHECKPOINT_VERSION;
+  p = put_u32(p, checkpoint->current);
+  p = put_u32(p, (uint32_t)checkpoint->count);
+  for (size_t i = 0; i < checkpoint->count; i++) {
+    const struct WinevtCheckpointEntry* entry = &checkpoint->entries[i];
+    p = put_u16(p, (uint16_t)entry->channelLength);
+    memcpy(p, entry->channel, entry->channelLength);
+    p += entry->channelLength;
+    p = put_u64(p, entry->recordId);
+  }
+  put_u32(p, winevt_crc32(0, buffer, p - buffer));
+}
+
+/*
+ * Replace the content with the serialized data. Returns -1 when the
+ * data is broken or memory is exhausted.
+ */
+int
+winevt_checkpoint_deserialize(struct WinevtCheckpoint* checkpoint,
+                              const uint8_t* data, size_t length)
+{
+  const uint8_t* p = data;
+  const uint8_t* end;
+  uint32_t current, count;
+
+  if (length < CHECKPOINT_HEADER_SIZE + 4 || memcmp(p, CHECKPOINT_MAGIC, 4) != 0 ||
+      p[4] != CHECKPOINT_VERSION)
+    return -1;
+  end = data + length - 4;
+  if (winevt_crc32(0, data, end - data) != get_u32(end))
+    return -1;
+
+  current = get_u32(p + 5);
+  count = get_u32(p + 9);
+  p += CHECKPOINT_HEADER_SIZE;
+
+  winevt_checkpoint_destroy(checkpoint);
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t channelLength;
+
+    if (end - p < 2)
+      goto broken;
+    channelLength = get_u16(p);
+    p += 2;
+    if ((size_t)(end - p) < (size_t)channelLength + 8)
+      goto broken;
+    if (winevt_checkpoint_update(checkpoint, (const char*)p, channelLength,
+                                 get_u64(p + channelLength)) < 0)
+      goto broken;
+    p += channelLength + 8;
+  }
+  if (p != end || (current != CHECKPOINT_NO_CURRENT && current >= count))
+    goto broken;
+  checkpoint->current = current;
+
+  return 0;
+
+broken:
+  winevt_checkpoint_destroy(checkpoint);
+  return -1;
+}
+
+static void checkpoint_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_checkpoint_type = { "winevt/checkpoint",
+                                                          {
+                                                            0,
+                                                            checkpoint_free,
+                                                            0,
+                                                          },
+                                                          NULL,
+                                                          NULL,
+                                                          RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+checkpoint_free(void* ptr)
+{
+  winevt_checkpoint_destroy((struct WinevtCheckpoint*)ptr);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_checkpoint_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtCheckpoint* winevtCheckpoint;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtCheckpoint, &rb_winevt_checkpoint_type, winevtCheckpoint);
+  winevt_checkpoint_init(winevtCheckpoint);
+  return obj;
+}
+
+struct WinevtCheckpoint*
+winevt_checkpoint_of(VALUE self)
+{
+  struct WinevtCheckpoint* winevtCheckpoint;
+
+  TypedData_Get_Struct(
+    self, struct WinevtCheckpoint, &rb_winevt_checkpoint_type, winevtCheckpoint);
+
+  return winevtCheckpoint;
+}
+
+static VALUE
+entry_channel(const struct WinevtCheckpointEntry* entry)
+{
+  return rb_utf8_str_new(entry->channel, entry->channelLength);
+}
+
+/*
+ * This method records the last EventRecordID of the channel. The
+ * channel becomes the current one.
+ *
+ * @param rb_channel [String] Channel path.
+ * @param rb_record_id [Integer] EventRecordID.
+ * @return [Checkpoint] self
+ */
+static VALUE
+rb_winevt_checkpoint_update(VALUE self, VALUE rb_channel, VALUE rb_record_id)
+{
+  uint64_t recordId;
+
+  Check_Type(rb_channel, T_STRING);
+  recordId = NUM2ULL(rb_record_id);
+
+  if (winevt_checkpoint_update(winevt_checkpoint_of(self),
+                               RSTRING_PTR(rb_channel),
+                               RSTRING_LEN(rb_channel),
+                               recordId) < 0) {
+    rb_raise(rb_eArgError, "Cannot record the channel");
+  }
+
+  return self;
+}
+
+/*
+ * This method returns the last EventRecordID of the channel.
+ *
+ * @param rb_channel [String] Channel path.
+ * @return [Integer] nil when the channel is not recorded.
+ */
+static VALUE
+rb_winevt_checkpoint_aref(VALUE self, VALUE rb_channel)
+{
+  const struct WinevtCheckpointEntry* entry;
+
+  Check_Type(rb_channel, T_STRING);
+  entry = winevt_checkpoint_find(
+    winevt_checkpoint_of(self), RSTRING_PTR(rb_channel), RSTRING_LEN(rb_channel));
+  if (!entry) {
+    return Qnil;
+  }
+
+  return ULL2NUM(entry->recordId);
+}
+
+/*
+ * This method returns the recorded channels.
+ *
+ * @return [Array<String>]
+ */
+static VALUE
+rb_winevt_checkpoint_channels(VALUE self)
+{
+  struct WinevtCheckpoint* winevtCheckpoint = winevt_checkpoint_of(self);
+  VALUE rb_channels = rb_ary_new_capa(winevtCheckpoint->count);
+
+  for (size_t i = 0; i < winevtCheckpoint->count; i++) {
+    rb_ary_push(rb_channels, entry_channel(&winevtCheckpoint->entries[i]));
+  }
+
+  return rb_channels;
+}
+
+/*
+ * This method returns the channel which is recorded last.
+ *
+ * @return [String] nil when nothing is recorded.
+ */
+static VALUE
+rb_winevt_checkpoint_current(VALUE self)
+{
+  struct WinevtCheckpoint* winevtCheckpoint = winevt_checkpoint_of(self);
+
+  if (winevtCheckpoint->current == CHECKPOINT_NO_CURRENT) {
+    return Qnil;
+  }
+
+  return entry_channel(&winevtCheckpoint->entries[winevtCheckpoint->current]);
+}
+
+/*
+ * This method returns the number of the recorded channels.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_checkpoint_size(VALUE self)
+{
+  return SIZET2NUM(winevt_checkpoint_of(self)->count);
+}
+
+/*
+ * This method returns pairs of the channel and the EventRecordID.
+ *
+ * @return [Hash]
+ */
+static VALUE
+rb_winevt_checkpoint_to_h(VALUE self)
+{
+  struct WinevtCheckpoint* winevtCheckpoint = winevt_checkpoint_of(self);
+  VALUE rb_hash = rb_hash_new();
+
+  for (size_t i = 0; i < winevtCheckpoint->count; i++) {
+    rb_hash_aset(rb_hash,
+                 entry_channel(&winevtCheckpoint->entries[i]),
+                 ULL2NUM(winevtCheckpoint->entries[i].recordId));
+  }
+
+  return rb_hash;
+}
+
+/*
+ * This method serializes the checkpoint into the compact binary
+ * format.
+ *
+ * @return [String]
+ */
+static VALUE
+rb_winevt_checkpoint_dump(VALUE self)
+{
+  struct WinevtCheckpoint* winevtCheckpoint = winevt_checkpoint_of(self);
+  VALUE rb_data;
+
+  rb_data = rb_str_new(NULL, winevt_checkpoint_serialized_size(winevtCheckpoint));
+  winevt_checkpoint_serialize(winevtCheckpoint, (uint8_t*)RSTRING_PTR(rb_data));
+
+  return rb_data;
+}
+
+/*
+ * This method deserializes the data which Checkpoint#dump returns.
+ *
+ * @param rb_data [String]
+ * @return [Checkpoint]
+ */
+static VALUE
+rb_winevt_checkpoint_s_load(VALUE klass, VALUE rb_data)
+{
+  VALUE rb_checkpoint;
+
+  StringValue(rb_data);
+  rb_checkpoint = rb_class_new_instance(0, NULL, klass);
+  if (winevt_checkpoint_deserialize(winevt_checkpoint_of(rb_checkpoint),
+                                    (const uint8_t*)RSTRING_PTR(rb_data),
+                                    RSTRING_LEN(rb_data)) < 0) {
+    rb_raise(rb_eArgError, "Invalid checkpoint data");
+  }
+  RB_GC_GUARD(rb_data);
+
+  return rb_checkpoint;
+}
+
+static void
+append_escaped(VALUE rb_xml, const char* str, size_t length)
+{
+  for (size_t i = 0; i < length; i++) {
+    switch (str[i]) {
+    case '&':
+      rb_str_cat_cstr(rb_xml, "&amp;");
+      break;
+    case '\'':
+      rb_str_cat_cstr(rb_xml, "&apos;");
+      break;
+    case '"':
+      rb_str_cat_cstr(rb_xml, "&quot;");
+      break;
+    case '<':
+      rb_str_cat_cstr(rb_xml, "&lt;");
+      break;
+    case '>':
+      rb_str_cat_cstr(rb_xml, "&gt;");
+      break;
+    default:
+      rb_str_cat(rb_xml, &str[i], 1);
+      break;
+    }
+  }
+}
+
+/*
+ * This method renders the checkpoint as Bookmark XML, which
+ * EvtCreateBookmark accepts.
+ *
+ * @return [String]
+ */
+static VALUE
+rb_winevt_checkpoint_to_bookmark_xml(VALUE self)
+{
+  struct WinevtCheckpoint* winevtCheckpoint = winevt_checkpoint_of(self);
+  VALUE rb_xml = rb_utf8_str_new_cstr("<BookmarkList>\r\n");
+  char recordId[32];
+
+  for (size_t i = 0; i < winevtCheckpoint->count; i++) {
+    const struct WinevtCheckpointEntry* entry = &winevtCheckpoint->entries[i];
+
+    rb_str_cat_cstr(rb_xml, "  <Bookmark Channel='");
+    append_escaped(rb_xml, entry->channel, entry->channelLength);
+    snprintf(recordId, sizeof(recordId), "%llu", (unsigned long long)entry->recordId);
+    rb_str_cat_cstr(rb_xml, "' RecordId='");
+    rb_str_cat_cstr(rb_xml, recordId);
+    rb_str_cat_cstr(rb_xml, "'");
+    if (i == winevtCheckpoint->current) {
+      rb_str_cat_cstr(rb_xml, " IsCurrent='true'");
+    }
+    rb_str_cat_cstr(rb_xml, "/>\r\n");
+  }
+  rb_str_cat_cstr(rb_xml, "</BookmarkList>");
+
+  return rb_xml;
+}
+
+/* Find the value of the attribute in [p, end) of a start tag. */
+static const char*
+find_attribute(const char* p, const char* end, const char* name, size_t* length)
+{
+  size_t nameLength = strlen(name);
+
+  for (; p + nameLength + 2 < end; p++) {
+    char quote;
+    const char* value;
+
+    if ((p[-1] != ' ' && p[-1] != '\t' && p[-1] != '\r' && p[-1] != '\n') ||
+        memcmp(p, name, nameLength) != 0 || p[nameLength] != '=')
+      continue;
+    quote = p[nameLength + 1];
+    if (quote != '\'' && quote != '"')
+      continue;
+    value = p + nameLength + 2;
+    for (const char* q = value; q < end; q++) {
+      if (*q == quote) {
+        *length = q - value;
+        return value;
+      }
+    }
+    return NULL;
+  }
+
+  return NULL;
+}
+
+static VALUE
+unescape_attribute(const char* value, size_t length)
+{
+  static const struct
+  {
+    const char* entity;
+    char c;
+  } entities[] = { { "&amp;", '&' }, { "&apos;", '\'' }, { "&quot;", '"' },
+                   { "&lt;", '<' },  { "&gt;", '>' } };
+  VALUE rb_value = rb_utf8_str_new(NULL, 0);
+
+  for (size_t i = 0; i < length; i++) {
+    size_t j;
+    if (value[i] == '&') {
+      for (j = 0; j < sizeof(entities) / sizeof(entities[0]); j++) {
+        size_t entityLength = strlen(entities[j].entity);
+        if (i + entityLength <= length &&
+            memcmp(&value[i], entities[j].entity, entityLength) == 0) {
+          rb_str_cat(rb_value, &entities[j].c, 1);
+          i += entityLength - 1;
+          break;
+        }
+      }
+      if (j < sizeof(entities) / sizeof(entities[0]))
+        continue;
+    }
+    rb_str_cat(rb_value, &value[i], 1);
+  }
+
+  return rb_value;
+}
+
+/*
+ * This method builds a checkpoint from Bookmark XML, which
+ * Bookmark#render and Subscribe#bookmark return.
+ *
+ * @param rb_xml [String]
+ * @return [Checkpoint]
+ */
+static VALUE
+rb_winevt_checkpoint_s_from_bookmark_xml(VALUE klass, VALUE rb_xml)
+{
+  VALUE rb_checkpoint, rb_channel, rb_current = Qnil;
+  const char *p, *end;
+
+  StringValue(rb_xml);
+  rb_checkpoint = rb_class_new_instance(0, NULL, klass);
+  p = RSTRING_PTR(rb_xml);
+  end = p + RSTRING_LEN(rb_xml);
+
+  while ((p = memchr(p, '<', end - p)) != NULL) {
+    const char *tagEnd, *value;
+    size_t length;
+    char recordId[32];
+
+    if ((size_t)(end - p) < 10 || memcmp(p, "<Bookmark", 9) != 0 ||
+        (p[9] != ' ' && p[9] != '\t' && p[9] != '\r' && p[9] != '\n')) {
+      p++;
+      continue;
+    }
+    tagEnd = memchr(p, '>', end - p);
+    if (!tagEnd) {
+      break;
+    }
+
+    value = find_attribute(p + 10, tagEnd, "Channel", &length);
+    if (!value) {
+      rb_raise(rb_eArgError, "Channel attribute is missing in Bookmark XML");
+    }
+    rb_channel = unescape_attribute(value, length);
+
+    value = find_attribute(p + 10, tagEnd, "RecordId", &length);
+    if (!value || length == 0 || length >= sizeof(recordId)) {
+      rb_raise(rb_eArgError, "RecordId attribute is invalid in Bookmark XML");
+    }
+    memcpy(recordId, value, length);
+    recordId[length] = '\0';
+    rb_winevt_checkpoint_update(
+      rb_checkpoint, rb_channel, rb_cstr2inum(recordId, 10));
+
+    value = find_attribute(p + 10, tagEnd, "IsCurrent", &length);
+    if (value && length == 4 && memcmp(value, "true", 4) == 0) {
+      rb_current = rb_channel;
+    }
+
+    p = tagEnd;
+  }
+
+  if (!NIL_P(rb_current)) {
+    struct WinevtCheckpoint* winevtCheckpoint = winevt_checkpoint_of(rb_checkpoint);
+    const struct WinevtCheckpointEntry* entry = winevt_checkpoint_find(
+      winevtCheckpoint, RSTRING_PTR(rb_current), RSTRING_LEN(rb_current));
+    winevtCheckpoint->current = (uint32_t)(entry - winevtCheckpoint->entries);
+  }
+  RB_GC_GUARD(rb_xml);
+
+  return rb_checkpoint;
+}
+
+struct WriteFileArgs
+{
+  const char* path;
+  const char* tempPath;
+  const uint8_t* data;
+  size_t length;
+  int error;
+};
+
+#ifdef _WIN32
+static WCHAR*
+utf8_to_wstr(const char* str)
+{
+  int len = MultiByteToWideChar(CP_UTF8, 0, str, -1, NULL, 0);
+  WCHAR* wstr = malloc(sizeof(WCHAR) * (len > 0 ? len : 1));
+
+  if (wstr && len > 0) {
+    MultiByteToWideChar(CP_UTF8, 0, str, -1, wstr, len);
+  }
+
+  return wstr;
+}
+
+static void
+write_file(struct WriteFileArgs* args)
+{
+  WCHAR* path = utf8_to_wstr(args->path);
+  WCHAR* tempPath = utf8_to_wstr(args->tempPath);
+  HANDLE hFile = INVALID_HANDLE_VALUE;
+  DWORD written;
+  DWORD err = ERROR_SUCCESS;
+
+  if (!path || !tempPath) {
+    err = ERROR_NOT_ENOUGH_MEMORY;
+    goto cleanup;
+  }
+
+  hFile = CreateFileW(
+    tempPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    err = GetLastError();
+    goto cleanup;
+  }
+  if (!WriteFile(hFile, args->data, (DWORD)args->length, &written, NULL) ||
+      !FlushFileBuffers(hFile)) {
+    err = GetLastError();
+  }
+  CloseHandle(hFile);
+  if (err == ERROR_SUCCESS &&
+      !MoveFileExW(tempPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    err = GetLastError();
+  }
+  if (err != ERROR_SUCCESS) {
+    DeleteFileW(tempPath);
+  }
+
+cleanup:
+  free(path);
+  free(tempPath);
+  args->error = err == ERROR_SUCCESS ? 0 : rb_w32_map_errno(err);
+}
+#else
+static void
+write_file(struct WriteFileArgs* args)
+{
+  size_t offset = 0;
+  int fd;
+
+  args->error = 0;
+  fd = open(args->tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    args->error = errno;
+    return;
+  }
+  while (offset < args->length) {
+    ssize_t written = write(fd, args->data + offset, args->length - offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      args->error = errno;
+      break;
+    }
+    offset += written;
+  }
+  if (args->error == 0 && fsync(fd) < 0) {
+    args->error = errno;
+  }
+  if (close(fd) < 0 && args->error == 0) {
+    args->error = errno;
+  }
+  if (args->error == 0 && rename(args->tempPath, args->path) < 0) {
+    args->error = errno;
+  }
+  if (args->error != 0) {
+    unlink(args->tempPath);
+  }
+}
+#endif /* _WIN32 */
+
+/*
+ * Write data into the file atomically: it is written into a temporary
+ * file next to the path, which then replaces the path. This does not
+ * touch any Ruby objects. So, it can be called without holding the
+ * GVL. Returns 0 or errno.
+ */
+int
+winevt_write_file_atomically(const char* path, const uint8_t* data, size_t length)
+{
+  struct WriteFileArgs args;
+  size_t pathLength = strlen(path);
+  char* tempPath = malloc(pathLength + 5);
+
+  if (!tempPath) {
+    return ENOMEM;
+  }
+  memcpy(tempPath, path, pathLength);
+  memcpy(tempPath + pathLength, ".tmp", 5);
+
+  args.path = path;
+  args.tempPath = tempPath;
+  args.data = data;
+  args.length = length;
+  args.error = 0;
+  write_file(&args);
+  free(tempPath);
+
+  return args.error;
+}
+
+struct WriteCheckpointArgs
+{
+  const char* path;
+  const uint8_t* data;
+  size_t length;
+  int error;
+};
+
+static void*
+write_checkpoint_without_gvl(void* ptr)
+{
+  struct WriteCheckpointArgs* args = (struct WriteCheckpointArgs*)ptr;
+
+  args->error = winevt_write_file_atomically(args->path, args->data, args->length);
+
+  return NULL;
+}
+
+/*
+ * This method writes the serialized checkpoint into the file
+ * atomically. The GVL is released while writing.
+ *
+ * @param rb_path [String]
+ */
+static VALUE
+rb_winevt_checkpoint_write(VALUE self, VALUE rb_path)
+{
+  VALUE rb_data;
+  struct WriteCheckpointArgs args;
+
+  FilePathValue(rb_path);
+  rb_path = rb_str_new_frozen(rb_path);
+  rb_data = rb_str_new_frozen(rb_winevt_checkpoint_dump(self));
+
+  args.path = StringValueCStr(rb_path);
+  args.data = (const uint8_t*)RSTRING_PTR(rb_data);
+  args.length = RSTRING_LEN(rb_data);
+  args.error = 0;
+  rb_thread_call_without_gvl(write_checkpoint_without_gvl, &args, RUBY_UBF_IO, NULL);
+  if (args.error != 0) {
+    rb_syserr_fail_str(args.error, rb_path);
+  }
+  RB_GC_GUARD(rb_data);
+
+  return Qnil;
+}
+
+void
+Init_winevt_checkpoint(VALUE rb_cEventLog)
+{
+  rb_cCheckpoint = rb_define_class_under(rb_cEventLog, "Checkpoint", rb_cObject);
+
+  rb_define_alloc_func(rb_cCheckpoint, rb_winevt_checkpoint_alloc);
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(rb_cCheckpoint, "load", rb_winevt_checkpoint_s_load, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(
+    rb_cCheckpoint, "from_bookmark_xml", rb_winevt_checkpoint_s_from_bookmark_xml, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "update", rb_winevt_checkpoint_update, 2);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "[]", rb_winevt_checkpoint_aref, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "channels", rb_winevt_checkpoint_channels, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "current", rb_winevt_checkpoint_current, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "size", rb_winevt_checkpoint_size, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "to_h", rb_winevt_checkpoint_to_h, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "dump", rb_winevt_checkpoint_dump, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "to_bookmark_xml", rb_winevt_checkpoint_to_bookmark_xml, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpoint, "write", rb_winevt_checkpoint_write, 1);
+}
@@ -0,0 +1,559 @@
+#include <winevt_c.h>
+
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::CheckpointWriter
+ *
+ * Persist checkpoints from a background thread. Updates only replace
+ * the pending snapshot in memory, so the file system is not touched
+ * on the path which reads events. The latest snapshot is written at
+ * the interval or on demand.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @subscribe = Winevt::EventLog::Subscribe.new
+ *  @subscribe.subscribe("Application", "*")
+ *  @writer = Winevt::EventLog::CheckpointWriter.new("application.checkpoint", 5.0)
+ *  begin
+ *    while true do
+ *      @subscribe.wait(1.0)
+ *      @subscribe.each do |eventlog, message, string_inserts|
+ *        puts ({eventlog: eventlog, data: message})
+ *      end
+ *      @writer.update(@subscribe)
+ *    end
+ *  ensure
+ *    @writer.close
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cCheckpointWriter;
+
+static ID id_checkpoint;
+static ID id_subscriptions;
+
+static void*
+checkpoint_writer_thread(void* ptr)
+{
+  struct WinevtCheckpointWriter* writer = (struct WinevtCheckpointWriter*)ptr;
+
+  winevt_mutex_lock(&writer->lock);
+  for (;;) {
+    if (!writer->stopping && !writer->requested) {
+      if (writer->interval > 0) {
+        winevt_cond_timedwait(&writer->wake, &writer->lock, writer->interval);
+      } else {
+        winevt_cond_wait(&writer->wake, &writer->lock);
+      }
+    }
+    /* A request which arrives while writing is kept for the next
+     * iteration. */
+    writer->requested = 0;
+
+    if (writer->pending) {
+      uint8_t* data = writer->pending;
+      size_t length = writer->pendingLength;
+      unsigned long long generation = writer->generation;
+      int error;
+
+      writer->pending = NULL;
+      winevt_mutex_unlock(&writer->lock);
+      error = winevt_write_file_atomically(writer->path, data, length);
+      winevt_mutex_lock(&writer->lock);
+
+      if (error != 0) {
+        writer->error = error;
+        /* Retry later unless a newer snapshot has arrived. */
+        if (!writer->pending) {
+          writer->pending = data;
+          writer->pendingLength = length;
+          data = NULL;
+        }
+      } else {
+        writer->writtenGeneration = generation;
+        writer->writtenCount++;
+      }
+      free(data);
+    }
+    winevt_cond_broadcast(&writer->done);
+
+    if (writer->stopping) {
+      break;
+    }
+  }
+  writer->running = 0;
+  winevt_cond_broadcast(&writer->done);
+  winevt_mutex_unlock(&writer->lock);
+
+  return NULL;
+}
+
+/* Stop the thread after it writes the pending snapshot. */
+static void*
+checkpoint_writer_stop(void* ptr)
+{
+  struct WinevtCheckpointWriter* writer = (struct WinevtCheckpointWriter*)ptr;
+
+  if (!writer->started) {
+    return NULL;
+  }
+
+  winevt_mutex_lock(&writer->lock);
+  writer->stopping = 1;
+  winevt_cond_broadcast(&writer->wake);
+  winevt_mutex_unlock(&writer->lock);
+  winevt_thread_join(writer->thread);
+  writer->started = 0;
+
+  return NULL;
+}
+
+static void checkpoint_writer_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_checkpoint_writer_type = {
+  "winevt/checkpoint_writer",
+  {
+    0,
+    checkpoint_writer_free,
+    0,
+  },
+  NULL,
+  NULL,
+  0
+};
+
+static void
+checkpoint_writer_free(void* ptr)
+{
+  struct WinevtCheckpointWriter* writer = (struct WinevtCheckpointWriter*)ptr;
+
+  checkpoint_writer_stop(writer);
+  if (writer->initialized) {
+    winevt_cond_destroy(&writer->wake);
+    winevt_cond_destroy(&writer->done);
+    winevt_mutex_destroy(&writer->lock);
+  }
+  free(writer->pending);
+  free(writer->path);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_checkpoint_writer_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtCheckpointWriter* writer;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtCheckpointWriter, &rb_winevt_checkpoint_writer_type, writer);
+  return obj;
+}
+
+static struct WinevtCheckpointWriter*
+get_writer(VALUE self)
+{
+  struct WinevtCheckpointWriter* writer;
+
+  TypedData_Get_Struct(
+    self, struct WinevtCheckpointWriter, &rb_winevt_checkpoint_writer_type, writer);
+
+  return writer;
+}
+
+static struct WinevtCheckpointWriter*
+get_open_writer(VALUE self)
+{
+  struct WinevtCheckpointWriter* writer = get_writer(self);
+
+  if (!writer->started) {
+    rb_raise(rb_eIOError, "closed checkpoint writer");
+  }
+
+  return writer;
+}
+
+/* Raise the error of the last write if any. Called with the lock. */
+static void
+raise_write_error(struct WinevtCheckpointWriter* writer)
+{
+  int error = writer->error;
+
+  writer->error = 0;
+  winevt_mutex_unlock(&writer->lock);
+  if (error != 0) {
+    rb_syserr_fail(error, writer->path);
+  }
+}
+
+/*
+ * Initalize CheckpointWriter class and start the writer thread.
+ *
+ * @overload initialize(path, interval=1.0)
+ *   @param path [String] File to write checkpoints into.
+ *   @param interval [Numeric] Seconds between writes. nil means
+ *     writing only on demand.
+ * @return [CheckpointWriter]
+ *
+ */
+static VALUE
+rb_winevt_checkpoint_writer_initialize(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_path, rb_interval;
+  struct WinevtCheckpointWriter* writer = get_writer(self);
+  double interval = 1.0;
+  int error;
+
+  rb_scan_args(argc, argv, "11", &rb_path, &rb_interval);
+  if (writer->initialized) {
+    rb_raise(rb_eRuntimeError, "already initialized checkpoint writer");
+  }
+  FilePathValue(rb_path);
+  if (argc > 1) {
+    interval = NIL_P(rb_interval) ? 0 : NUM2DBL(rb_interval);
+    if (!NIL_P(rb_interval) && interval * 1000 < 1) {
+      rb_raise(rb_eArgError, "interval must be positive or nil");
+    }
+  }
+
+  writer->path = strdup(StringValueCStr(rb_path));
+  if (!writer->path) {
+    rb_memerror();
+  }
+  writer->interval = (unsigned long)(interval * 1000);
+  winevt_mutex_init(&writer->lock);
+  winevt_cond_init(&writer->wake);
+  winevt_cond_init(&writer->done);
+  writer->initialized = 1;
+
+  writer->running = 1;
+  error = winevt_thread_create(&writer->thread, checkpoint_writer_thread, writer);
+  if (error != 0) {
+    writer->running = 0;
+    rb_raise(rb_eRuntimeError, "Cannot start the checkpoint writer thread: %d", error);
+  }
+  writer->started = 1;
+
+  return Qnil;
+}
+
+static void
+merge_checkpoint(struct WinevtCheckpoint* merged, VALUE rb_checkpoint)
+{
+  struct WinevtCheckpoint* checkpoint = winevt_checkpoint_of(rb_checkpoint);
+
+  for (size_t i = 0; i < checkpoint->count; i++) {
+    const struct WinevtCheckpointEntry* entry = &checkpoint->entries[i];
+    if (winevt_checkpoint_update(
+          merged, entry->channel, entry->channelLength, entry->recordId) < 0) {
+      rb_memerror();
+    }
+  }
+}
+
+struct SnapshotArgs
+{
+  struct WinevtCheckpoint merged;
+  VALUE source;
+  uint8_t* data;
+  size_t length;
+};
+
+static VALUE
+snapshot_source(VALUE ptr)
+{
+  struct SnapshotArgs* args = (struct SnapshotArgs*)ptr;
+  VALUE rb_source = args->source;
+
+  if (rb_obj_is_kind_of(rb_source, rb_cCheckpoint)) {
+    merge_checkpoint(&args->merged, rb_source);
+  } else if (rb_respond_to(rb_source, id_checkpoint)) {
+    merge_checkpoint(&args->merged, rb_funcall(rb_source, id_checkpoint, 0));
+  } else if (rb_respond_to(rb_source, id_subscriptions)) {
+    VALUE rb_subscriptions = rb_funcall(rb_source, id_subscriptions, 0);
+    Check_Type(rb_subscriptions, T_ARRAY);
+    for (long i = 0; i < RARRAY_LEN(rb_subscriptions); i++) {
+      merge_checkpoint(&args->merged,
+                       rb_funcall(RARRAY_AREF(rb_subscriptions, i), id_checkpoint, 0));
+    }
+  } else {
+    rb_raise(rb_eTypeError,
+             "Specify a Checkpoint, Subscribe or SubscribeGroup object");
+  }
+
+  args->length = winevt_checkpoint_serialized_size(&args->merged);
+  args->data = malloc(args->length);
+  if (!args->data) {
+    rb_memerror();
+  }
+  winevt_checkpoint_serialize(&args->merged, args->data);
+
+  return Qnil;
+}
+
+static VALUE
+destroy_snapshot_checkpoint(VALUE ptr)
+{
+  winevt_checkpoint_destroy(&((struct SnapshotArgs*)ptr)->merged);
+
+  return Qnil;
+}
+
+/*
+ * This method replaces the pending snapshot with the latest state of
+ * the source. Nothing is written here.
+ *
+ * @param rb_source [Checkpoint, Subscribe, SubscribeGroup] Subscribe
+ *   and SubscribeGroup provide their checkpoints. Checkpoints of the
+ *   subscriptions in SubscribeGroup are merged.
+ * @return [CheckpointWriter] self
+ */
+static VALUE
+rb_winevt_checkpoint_writer_update(VALUE self, VALUE rb_source)
+{
+  struct WinevtCheckpointWriter* writer = get_open_writer(self);
+  struct SnapshotArgs args;
+  uint8_t* stale;
+
+  winevt_checkpoint_init(&args.merged);
+  args.source = rb_source;
+  args.data = NULL;
+  rb_ensure(snapshot_source, (VALUE)&args, destroy_snapshot_checkpoint, (VALUE)&args);
+
+  winevt_mutex_lock(&writer->lock);
+  stale = writer->pending;
+  writer->pending = args.data;
+  writer->pendingLength = args.length;
+  writer->generation++;
+  winevt_mutex_unlock(&writer->lock);
+  free(stale);
+
+  return self;
+}
+
+/*
+ * This method asks the writer thread to write the pending snapshot
+ * now without waiting for it.
+ *
+ * @return [CheckpointWriter] self
+ */
+static VALUE
+rb_winevt_checkpoint_writer_persist(VALUE self)
+{
+  struct WinevtCheckpointWriter* writer = get_open_writer(self);
+
+  winevt_mutex_lock(&writer->lock);
+  writer->requested = 1;
+  winevt_cond_broadcast(&writer->wake);
+  winevt_mutex_unlock(&writer->lock);
+
+  return self;
+}
+
+struct FlushArgs
+{
+  struct WinevtCheckpointWriter* writer;
+  unsigned long long generation;
+  int interrupted;
+};
+
+static void*
+flush_without_gvl(void* ptr)
+{
+  struct FlushArgs* args = (struct FlushArgs*)ptr;
+  struct WinevtCheckpointWriter* writer = args->writer;
+
+  winevt_mutex_lock(&writer->lock);
+  writer->requested = 1;
+  winevt_cond_broadcast(&writer->wake);
+  while (writer->writtenGeneration < args->generation && writer->error == 0 &&
+         writer->running && !args->interrupted) {
+    winevt_cond_wait(&writer->done, &writer->lock);
+  }
+  winevt_mutex_unlock(&writer->lock);
+
+  return NULL;
+}
+
+static void
+interrupt_flush(void* ptr)
+{
+  struct FlushArgs* args = (struct FlushArgs*)ptr;
+
+  winevt_mutex_lock(&args->writer->lock);
+  args->interrupted = 1;
+  winevt_cond_broadcast(&args->writer->done);
+  winevt_mutex_unlock(&args->writer->lock);
+}
+
+/*
+ * This method waits until the snapshots which are passed to #update
+ * so far are written. The GVL is released while waiting.
+ *
+ * @return [CheckpointWriter] self
+ */
+static VALUE
+rb_winevt_checkpoint_writer_flush(VALUE self)
+{
+  struct FlushArgs args;
+  struct WinevtCheckpointWriter* writer = get_open_writer(self);
+
+  args.writer = writer;
+  winevt_mutex_lock(&writer->lock);
+  args.generation = writer->generation;
+  winevt_mutex_unlock(&writer->lock);
+
+  for (;;) {
+    args.interrupted = 0;
+    rb_thread_call_without_gvl(flush_without_gvl, &args, interrupt_flush, &args);
+    if (!args.interrupted) {
+      break;
+    }
+    rb_thread_check_ints();
+  }
+
+  winevt_mutex_lock(&writer->lock);
+  raise_write_error(writer);
+
+  return self;
+}
+
+/*
+ * This method writes the pending snapshot and stops the writer
+ * thread.
+ */
+static VALUE
+rb_winevt_checkpoint_writer_close(VALUE self)
+{
+  struct WinevtCheckpointWriter* writer = get_writer(self);
+
+  if (!writer->started) {
+    return Qnil;
+  }
+
+  rb_thread_call_without_gvl(checkpoint_writer_stop, writer, NULL, NULL);
+
+  winevt_mutex_lock(&writer->lock);
+  raise_write_error(writer);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether the writer is closed or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_checkpoint_writer_closed_p(VALUE self)
+{
+  return get_writer(self)->started ? Qfalse : Qtrue;
+}
+
+/*
+ * This method returns the file to write checkpoints into.
+ *
+ * @return [String]
+ */
+static VALUE
+rb_winevt_checkpoint_writer_path(VALUE self)
+{
+  struct WinevtCheckpointWriter* writer = get_writer(self);
+
+  if (!writer->path) {
+    return Qnil;
+  }
+
+  return rb_str_new_cstr(writer->path);
+}
+
+/*
+ * This method returns the seconds between writes.
+ *
+ * @return [Float] nil means writing only on demand.
+ */
+static VALUE
+rb_winevt_checkpoint_writer_interval(VALUE self)
+{
+  struct WinevtCheckpointWriter* writer = get_writer(self);
+
+  if (writer->interval == 0) {
+    return Qnil;
+  }
+
+  return DBL2NUM(writer->interval / 1000.0);
+}
+
+/*
+ * This method returns how many times the snapshots are written.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_checkpoint_writer_written_count(VALUE self)
+{
+  struct WinevtCheckpointWriter* writer = get_writer(self);
+  unsigned long long count;
+
+  if (!writer->initialized) {
+    return INT2FIX(0);
+  }
+  winevt_mutex_lock(&writer->lock);
+  count = writer->writtenCount;
+  winevt_mutex_unlock(&writer->lock);
+
+  return ULL2NUM(count);
+}
+
+void
+Init_winevt_checkpoint_writer(VALUE rb_cEventLog)
+{
+  rb_cCheckpointWriter = rb_define_class_under(rb_cEventLog, "CheckpointWriter", rb_cObject);
+
+  rb_define_alloc_func(rb_cCheckpointWriter, rb_winevt_checkpoint_writer_alloc);
+
+  id_checkpoint = rb_intern("checkpoint");
+  id_subscriptions = rb_intern("subscriptions");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "initialize", rb_winevt_checkpoint_writer_initialize, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "update", rb_winevt_checkpoint_writer_update, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "persist", rb_winevt_checkpoint_writer_persist, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "flush", rb_winevt_checkpoint_writer_flush, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "close", rb_winevt_checkpoint_writer_close, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "closed?", rb_winevt_checkpoint_writer_closed_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "path", rb_winevt_checkpoint_writer_path, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCheckpointWriter, "interval", rb_winevt_checkpoint_writer_interval, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cCheckpointWriter, "written_count", rb_winevt_checkpoint_writer_written_count, 0);
+}
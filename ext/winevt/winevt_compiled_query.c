@@ -0,0 +1,586 @@
+#include <winevt_c.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::CompiledQuery
+ *
+ * XPath which is validated once and kept as a wide string. Query.new
+ * and Subscribe#subscribe use it without converting it again, so it
+ * is useful to reopen them with the same XPath many times.
+ *
+ * The XPath 1.0 subset which Windows Event Log supports is validated
+ * locally: location paths with predicates, attributes, "and", "or",
+ * comparisons, parentheses, literals and band(), timediff() and
+ * position(). A structured query (QueryList XML) is accepted and the
+ * XPaths of its Select and Suppress elements are validated.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @xpath = Winevt::EventLog::CompiledQuery.new("*[System[(Level=1 or Level=2)]]")
+ *  @query = Winevt::EventLog::Query.new("Application", @xpath)
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cCompiledQuery;
+VALUE rb_eCompiledQueryError;
+
+static ID id_xpath;
+
+#define XPATH_MAX_DEPTH 64
+
+struct WinevtCompiledQuery
+{
+  uint16_t* wide; /* UTF-16LE terminated by NUL */
+  size_t length;
+  int structured;
+};
+
+struct XPathParser
+{
+  const char* start;
+  const char* p;
+  const char* end;
+  const char* error;
+  int depth;
+};
+
+static void compiled_query_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_compiled_query_type = { "winevt/compiled_query",
+                                                              {
+                                                                0,
+                                                                compiled_query_free,
+                                                                0,
+                                                              },
+                                                              NULL,
+                                                              NULL,
+                                                              RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+compiled_query_free(void* ptr)
+{
+  struct WinevtCompiledQuery* winevtCompiledQuery = (struct WinevtCompiledQuery*)ptr;
+
+  free(winevtCompiledQuery->wide);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_compiled_query_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtCompiledQuery* winevtCompiledQuery;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtCompiledQuery, &rb_winevt_compiled_query_type, winevtCompiledQuery);
+  return obj;
+}
+
+static struct WinevtCompiledQuery*
+get_compiled_query(VALUE self)
+{
+  struct WinevtCompiledQuery* winevtCompiledQuery;
+
+  TypedData_Get_Struct(
+    self, struct WinevtCompiledQuery, &rb_winevt_compiled_query_type, winevtCompiledQuery);
+  if (!winevtCompiledQuery->wide) {
+    rb_raise(rb_eRuntimeError, "uninitialized compiled query");
+  }
+
+  return winevtCompiledQuery;
+}
+
+static void
+skip_space(struct XPathParser* parser)
+{
+  while (parser->p < parser->end &&
+         (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\r' || *parser->p == '\n')) {
+    parser->p++;
+  }
+}
+
+static int
+fail(struct XPathParser* parser, const char* error)
+{
+  if (!parser->error) {
+    parser->error = error;
+  }
+
+  return -1;
+}
+
+/* Skip the string and the spaces after it when it is the next token. */
+static int
+accept(struct XPathParser* parser, const char* token)
+{
+  size_t length = strlen(token);
+
+  skip_space(parser);
+  if ((size_t)(parser->end - parser->p) < length || memcmp(parser->p, token, length) != 0)
+    return 0;
+  parser->p += length;
+  skip_space(parser);
+
+  return 1;
+}
+
+static int
+is_name_start(char c)
+{
+  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || (c & 0x80);
+}
+
+static int
+is_name_char(char c)
+{
+  return is_name_start(c) || (c >= '0' && c <= '9') || c == '-' || c == '.' || c == ':';
+}
+
+/* "and" and "or" are the operators only when they are words. */
+static int
+accept_keyword(struct XPathParser* parser, const char* keyword)
+{
+  size_t length = strlen(keyword);
+
+  skip_space(parser);
+  if ((size_t)(parser->end - parser->p) < length || memcmp(parser->p, keyword, length) != 0)
+    return 0;
+  if (parser->p + length < parser->end && is_name_char(parser->p[length]))
+    return 0;
+  parser->p += length;
+  skip_space(parser);
+
+  return 1;
+}
+
+static int
+parse_name(struct XPathParser* parser, const char** name, size_t* length)
+{
+  const char* start = parser->p;
+
+  if (parser->p >= parser->end || !is_name_start(*parser->p))
+    return fail(parser, "expected a name");
+  while (parser->p < parser->end && is_name_char(*parser->p)) {
+    parser->p++;
+  }
+  *name = start;
+  *length = (size_t)(parser->p - start);
+
+  return 0;
+}
+
+static int parse_or(struct XPathParser* parser);
+
+static int
+parse_predicates(struct XPathParser* parser)
+{
+  while (accept(parser, "[")) {
+    if (parse_or(parser) < 0)
+      return -1;
+    if (!accept(parser, "]"))
+      return fail(parser, "expected ']'");
+  }
+
+  return 0;
+}
+
+/* Steps are "*", names or "@name" separated by "/". An attribute is the last step. */
+static int
+parse_path(struct XPathParser* parser)
+{
+  for (;;) {
+    const char* name;
+    size_t length;
+
+    skip_space(parser);
+    if (accept(parser, "@")) {
+      return parse_name(parser, &name, &length);
+    }
+    if (parser->p < parser->end && *parser->p == '*') {
+      parser->p++;
+    } else if (parse_name(parser, &name, &length) < 0) {
+      return fail(parser, "expected a step");
+    }
+    if (parse_predicates(parser) < 0)
+      return -1;
+    if (!accept(parser, "/"))
+      return 0;
+  }
+}
+
+static int
+parse_function(struct XPathParser* parser, const char* name, size_t length)
+{
+  static const struct
+  {
+    const char* name;
+    int minArgs;
+    int maxArgs;
+  } functions[] = {
+    { "band", 2, 2 },
+    { "timediff", 1, 2 },
+    { "position", 0, 0 },
+  };
+  int args = 0, minArgs = -1, maxArgs = -1;
+
+  for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+    if (strlen(functions[i].name) == length && memcmp(functions[i].name, name, length) == 0) {
+      minArgs = functions[i].minArgs;
+      maxArgs = functions[i].maxArgs;
+    }
+  }
+  if (minArgs < 0)
+    return fail(parser, "unsupported function");
+
+  if (!accept(parser, ")")) {
+    do {
+      if (parse_or(parser) < 0)
+        return -1;
+      args++;
+    } while (accept(parser, ","));
+    if (!accept(parser, ")"))
+      return fail(parser, "expected ')'");
+  }
+  if (args < minArgs || args > maxArgs)
+    return fail(parser, "wrong number of arguments");
+
+  return 0;
+}
+
+static int
+parse_primary(struct XPathParser* parser)
+{
+  char c;
+
+  skip_space(parser);
+  if (parser->p >= parser->end)
+    return fail(parser, "unexpected end");
+  c = *parser->p;
+
+  if (c == '(') {
+    parser->p++;
+    if (parse_or(parser) < 0)
+      return -1;
+    if (!accept(parser, ")"))
+      return fail(parser, "expected ')'");
+    return 0;
+  }
+  if (c == '\'' || c == '"') {
+    const char* close = memchr(parser->p + 1, c, (size_t)(parser->end - parser->p - 1));
+    if (!close)
+      return fail(parser, "unterminated literal");
+    parser->p = close + 1;
+    return 0;
+  }
+  if ((c >= '0' && c <= '9') || c == '-' || c == '.') {
+    const char* start = parser->p;
+    if (c == '-')
+      parser->p++;
+    /* Keywords masks are written in hex. */
+    if (parser->end - parser->p > 2 && parser->p[0] == '0' &&
+        (parser->p[1] == 'x' || parser->p[1] == 'X') && isxdigit((unsigned char)parser->p[2])) {
+      parser->p += 2;
+      while (parser->p < parser->end && isxdigit((unsigned char)*parser->p))
+        parser->p++;
+      return 0;
+    }
+    while (parser->p < parser->end &&
+           ((*parser->p >= '0' && *parser->p <= '9') || *parser->p == '.')) {
+      parser->p++;
+    }
+    if (parser->p == start + (c == '-' ? 1 : 0))
+      return fail(parser, "expected a number");
+    return 0;
+  }
+  if (is_name_start(c)) {
+    const char* start = parser->p;
+    const char* name;
+    size_t length;
+
+    parse_name(parser, &name, &length);
+    if (accept(parser, "("))
+      return parse_function(parser, name, length);
+    parser->p = start;
+  }
+
+  return parse_path(parser);
+}
+
+static int
+parse_comparison(struct XPathParser* parser)
+{
+  static const char* operators[] = { "!=", "<=", ">=", "=", "<", ">" };
+
+  if (parser->depth >= XPATH_MAX_DEPTH)
+    return fail(parser, "too deeply nested");
+  parser->depth++;
+  if (parse_primary(parser) < 0)
+    return -1;
+  for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+    if (accept(parser, operators[i])) {
+      if (parse_primary(parser) < 0)
+        return -1;
+      break;
+    }
+  }
+  parser->depth--;
+
+  return 0;
+}
+
+static int
+parse_or(struct XPathParser* parser)
+{
+  do {
+    do {
+      if (parse_comparison(parser) < 0)
+        return -1;
+    } while (accept_keyword(parser, "and"));
+  } while (accept_keyword(parser, "or"));
+
+  return 0;
+}
+
+/* Returns the offset of the error or -1 when the XPath is valid. */
+static long
+validate_xpath(const char* xpath, size_t length, const char** error)
+{
+  struct XPathParser parser;
+
+  memset(&parser, 0, sizeof(parser));
+  parser.start = xpath;
+  parser.p = xpath;
+  parser.end = xpath + length;
+
+  if (parse_path(&parser) == 0) {
+    skip_space(&parser);
+    if (parser.p == parser.end)
+      return -1;
+    fail(&parser, "unexpected character");
+  }
+  *error = parser.error;
+
+  return (long)(parser.p - parser.start);
+}
+
+/* Decode the entities which are used in the XPath of QueryList. */
+static size_t
+decode_entities(const char* text, size_t length, char* out)
+{
+  static const struct
+  {
+    const char* entity;
+    char c;
+  } entities[] = {
+    { "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' },
+  };
+  size_t n = 0;
+
+  for (size_t i = 0; i < length;) {
+    size_t j;
+    for (j = 0; j < sizeof(entities) / sizeof(entities[0]); j++) {
+      size_t entityLength = strlen(entities[j].entity);
+      if (length - i >= entityLength && memcmp(text + i, entities[j].entity, entityLength) == 0) {
+        out[n++] = entities[j].c;
+        i += entityLength;
+        break;
+      }
+    }
+    if (j == sizeof(entities) / sizeof(entities[0])) {
+      out[n++] = text[i++];
+    }
+  }
+
+  return n;
+}
+
+/* Validate the XPaths in <Select> and <Suppress> of QueryList. */
+static void
+validate_structured_query(VALUE rb_xpath)
+{
+  const char* text = RSTRING_PTR(rb_xpath);
+  const char* end = text + RSTRING_LEN(rb_xpath);
+  const char* p = text;
+  size_t queries = 0;
+  VALUE rb_buf;
+  char* decoded = ALLOCV(rb_buf, RSTRING_LEN(rb_xpath) + 1);
+
+  while ((p = memchr(p, '<', (size_t)(end - p))) != NULL) {
+    const char* tag;
+    const char* close;
+    const char* body;
+    size_t tagLength, length;
+    const char* error = NULL;
+    long offset;
+
+    p++;
+    if ((size_t)(end - p) >= 6 && memcmp(p, "Select", 6) == 0) {
+      tag = "</Select>";
+    } else if ((size_t)(end - p) >= 8 && memcmp(p, "Suppress", 8) == 0) {
+      tag = "</Suppress>";
+    } else {
+      continue;
+    }
+    body = memchr(p, '>', (size_t)(end - p));
+    if (!body) {
+      break;
+    }
+    body++;
+    tagLength = strlen(tag);
+    for (close = body; close + tagLength <= end && memcmp(close, tag, tagLength) != 0; close++)
+      ;
+    if (close + tagLength > end) {
+      ALLOCV_END(rb_buf);
+      rb_raise(rb_eCompiledQueryError, "Invalid structured query: %s is missing", tag);
+    }
+
+    length = decode_entities(body, (size_t)(close - body), decoded);
+    offset = validate_xpath(decoded, length, &error);
+    if (offset >= 0) {
+      VALUE rb_select = rb_utf8_str_new(decoded, (long)length);
+      ALLOCV_END(rb_buf);
+      rb_raise(rb_eCompiledQueryError, "Invalid XPath: %s at %ld in %" PRIsVALUE, error, offset,
+               rb_select);
+    }
+    queries++;
+    p = close + tagLength;
+  }
+  ALLOCV_END(rb_buf);
+  if (queries == 0) {
+    rb_raise(rb_eCompiledQueryError, "Invalid structured query: no Select");
+  }
+}
+
+/*
+ * Initalize CompiledQuery class.
+ *
+ * @param xpath [String] XPath or structured query XML.
+ * @return [CompiledQuery]
+ * @raise [CompiledQuery::Error] when the XPath is not supported.
+ *
+ */
+static VALUE
+rb_winevt_compiled_query_initialize(VALUE self, VALUE rb_xpath)
+{
+  struct WinevtCompiledQuery* winevtCompiledQuery;
+  VALUE rb_wide;
+  const char* p;
+  const char* end;
+
+  TypedData_Get_Struct(
+    self, struct WinevtCompiledQuery, &rb_winevt_compiled_query_type, winevtCompiledQuery);
+  Check_Type(rb_xpath, T_STRING);
+  if (winevtCompiledQuery->wide) {
+    rb_raise(rb_eRuntimeError, "already initialized compiled query");
+  }
+  rb_xpath = rb_str_export_to_enc(rb_xpath, rb_utf8_encoding());
+
+  p = RSTRING_PTR(rb_xpath);
+  end = p + RSTRING_LEN(rb_xpath);
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+    p++;
+  }
+  if (p < end && *p == '<') {
+    validate_structured_query(rb_xpath);
+    winevtCompiledQuery->structured = 1;
+  } else {
+    const char* error = NULL;
+    long offset = validate_xpath(RSTRING_PTR(rb_xpath), RSTRING_LEN(rb_xpath), &error);
+    if (offset >= 0) {
+      rb_raise(rb_eCompiledQueryError, "Invalid XPath: %s at %ld in %" PRIsVALUE, error, offset,
+               rb_xpath);
+    }
+  }
+
+  rb_wide = rb_str_encode(rb_xpath, rb_enc_from_encoding(rb_enc_find("UTF-16LE")), 0, Qnil);
+  winevtCompiledQuery->length = (size_t)RSTRING_LEN(rb_wide) / 2;
+  winevtCompiledQuery->wide = malloc(sizeof(uint16_t) * (winevtCompiledQuery->length + 1));
+  if (!winevtCompiledQuery->wide) {
+    rb_memerror();
+  }
+  memcpy(winevtCompiledQuery->wide, RSTRING_PTR(rb_wide), winevtCompiledQuery->length * 2);
+  winevtCompiledQuery->wide[winevtCompiledQuery->length] = 0;
+  rb_ivar_set(self, id_xpath, rb_obj_freeze(rb_str_dup(rb_xpath)));
+
+  return Qnil;
+}
+
+/* The wide string which is valid while the object is alive. */
+const uint16_t*
+winevt_compiled_query_wstr(VALUE rb_compiled_query)
+{
+  return get_compiled_query(rb_compiled_query)->wide;
+}
+
+/*
+ * This method returns the XPath.
+ *
+ * @return [String]
+ */
+static VALUE
+rb_winevt_compiled_query_to_s(VALUE self)
+{
+  get_compiled_query(self);
+
+  return rb_ivar_get(self, id_xpath);
+}
+
+/*
+ * This method returns whether the query is a structured query or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_compiled_query_structured_p(VALUE self)
+{
+  return get_compiled_query(self)->structured ? Qtrue : Qfalse;
+}
+
+/*
+ * This method returns the length of the wide string.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_compiled_query_wide_length(VALUE self)
+{
+  return SIZET2NUM(get_compiled_query(self)->length);
+}
+
+void
+Init_winevt_compiled_query(VALUE rb_cEventLog)
+{
+  rb_cCompiledQuery = rb_define_class_under(rb_cEventLog, "CompiledQuery", rb_cObject);
+  rb_define_alloc_func(rb_cCompiledQuery, rb_winevt_compiled_query_alloc);
+
+  /*
+   * Raised when the XPath is not supported.
+   * @since 0.12.0
+   */
+  rb_eCompiledQueryError = rb_define_class_under(rb_cCompiledQuery, "Error", rb_eArgError);
+
+  id_xpath = rb_intern("@xpath");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCompiledQuery, "initialize", rb_winevt_compiled_query_initialize, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCompiledQuery, "to_s", rb_winevt_compiled_query_to_s, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCompiledQuery, "structured?", rb_winevt_compiled_query_structured_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cCompiledQuery, "wide_length", rb_winevt_compiled_query_wide_length, 0);
+}
@@ -0,0 +1,616 @@
+#include <winevt_c.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::Deduplicator
+ *
+ * Bounded and time-windowed set of delivered events. An event is
+ * identified by its channel and EventRecordID, or by the xxHash64
+ * fingerprint of its XML when it has no EventRecordID. Subscribe
+ * drops the events which are already in the set before rendering
+ * them. So, replays after reconnecting or restoring a bookmark are
+ * not delivered again.
+ *
+ * The oldest identities are forgotten when the set is full or when
+ * they are older than the window.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @deduplicator = Winevt::EventLog::Deduplicator.new(capacity: 100_000, window: 3600)
+ *  @subscribe = Winevt::EventLog::Subscribe.new
+ *  @subscribe.deduplicator = @deduplicator
+ *  @subscribe.subscribe("Application", "*")
+ *  @subscribe.each do |eventlog, message, string_inserts|
+ *    puts ({eventlog: eventlog, data: message})
+ *  end
+ *  @deduplicator.duplicates
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cDeduplicator;
+
+static ID id_capacity;
+static ID id_window;
+
+#define DEDUP_MAX_CAPACITY (1UL << 26)
+
+static void dedup_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_dedup_type = { "winevt/deduplicator",
+                                                     {
+                                                       0,
+                                                       dedup_free,
+                                                       0,
+                                                     },
+                                                     NULL,
+                                                     NULL,
+                                                     RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+dedup_free(void* ptr)
+{
+  struct WinevtDedup* winevtDedup = (struct WinevtDedup*)ptr;
+
+  if (winevtDedup->initialized) {
+    winevt_mutex_destroy(&winevtDedup->lock);
+  }
+  free(winevtDedup->entries);
+  free(winevtDedup->slots);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_dedup_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtDedup* winevtDedup;
+  obj = TypedData_Make_Struct(klass, struct WinevtDedup, &rb_winevt_dedup_type, winevtDedup);
+  return obj;
+}
+
+struct WinevtDedup*
+winevt_get_dedup(VALUE rb_dedup)
+{
+  struct WinevtDedup* winevtDedup;
+
+  TypedData_Get_Struct(rb_dedup, struct WinevtDedup, &rb_winevt_dedup_type, winevtDedup);
+  if (!winevtDedup->initialized) {
+    rb_raise(rb_eRuntimeError, "uninitialized deduplicator");
+  }
+
+  return winevtDedup;
+}
+
+#define XXH_PRIME64_1 11400714785074694791ULL
+#define XXH_PRIME64_2 14029467366897019727ULL
+#define XXH_PRIME64_3 1609587929392839161ULL
+#define XXH_PRIME64_4 9650029242287828579ULL
+#define XXH_PRIME64_5 2870177450012600261ULL
+
+static uint64_t
+rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t
+read64(const uint8_t* p)
+{
+  uint64_t v = 0;
+
+  for (int i = 7; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+
+  return v;
+}
+
+static uint32_t
+read32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+  acc += input * XXH_PRIME64_2;
+  acc = rotl64(acc, 31);
+
+  return acc * XXH_PRIME64_1;
+}
+
+static uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+  acc ^= xxh64_round(0, val);
+
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/* XXH64 of the bytes. The result is the same on all platforms. */
+uint64_t
+winevt_xxh64(const void* data, size_t length, uint64_t seed)
+{
+  const uint8_t* p = (const uint8_t*)data;
+  const uint8_t* end = p + length;
+  uint64_t h;
+
+  if (length >= 32) {
+    uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = seed + XXH_PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - XXH_PRIME64_1;
+    const uint8_t* limit = end - 32;
+
+    do {
+      v1 = xxh64_round(v1, read64(p));
+      v2 = xxh64_round(v2, read64(p + 8));
+      v3 = xxh64_round(v3, read64(p + 16));
+      v4 = xxh64_round(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxh64_merge_round(h, v1);
+    h = xxh64_merge_round(h, v2);
+    h = xxh64_merge_round(h, v3);
+    h = xxh64_merge_round(h, v4);
+  } else {
+    h = seed + XXH_PRIME64_5;
+  }
+  h += (uint64_t)length;
+
+  while (p + 8 <= end) {
+    h ^= xxh64_round(0, read64(p));
+    h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)read32(p) * XXH_PRIME64_1;
+    h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+  }
+  while (p < end) {
+    h ^= (*p) * XXH_PRIME64_5;
+    h = rotl64(h, 11) * XXH_PRIME64_1;
+    p++;
+  }
+
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+/* Identity of an event by the channel name in UTF-16 and the record ID. */
+uint64_t
+winevt_dedup_record_key(const uint16_t* channel, size_t length, uint64_t recordId)
+{
+  return winevt_xxh64(channel, length * sizeof(uint16_t), recordId);
+}
+
+/* Identity of an event by its XML in UTF-16. */
+uint64_t
+winevt_dedup_xml_key(const uint16_t* xml, size_t length)
+{
+  return winevt_xxh64(xml, length * sizeof(uint16_t), 0);
+}
+
+static size_t
+home_slot(const struct WinevtDedup* dedup, uint64_t key)
+{
+  return (size_t)(key ^ (key >> 32)) & dedup->slotMask;
+}
+
+/* Forget the oldest entry. It is removed from the slots by shifting
+ * the following entries back instead of leaving a tombstone. */
+static void
+remove_oldest(struct WinevtDedup* dedup)
+{
+  size_t index = dedup->head;
+  size_t i = home_slot(dedup, dedup->entries[index].key);
+  size_t j;
+
+  while (dedup->slots[i] != index + 1) {
+    i = (i + 1) & dedup->slotMask;
+  }
+  j = i;
+  for (;;) {
+    size_t k;
+    j = (j + 1) & dedup->slotMask;
+    if (dedup->slots[j] == 0) {
+      break;
+    }
+    k = home_slot(dedup, dedup->entries[dedup->slots[j] - 1].key);
+    /* The entry at j can move to i unless its home is in (i, j]. */
+    if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+      dedup->slots[i] = dedup->slots[j];
+      i = j;
+    }
+  }
+  dedup->slots[i] = 0;
+
+  dedup->head = (dedup->head + 1) % dedup->capacity;
+  dedup->count--;
+}
+
+/*
+ * Add the identity. Returns 1 when it is new and 0 when it is a
+ * duplicate. now is winevt_monotonic_msec(). This does not touch Ruby
+ * objects and can be called from any thread.
+ */
+int
+winevt_dedup_add(struct WinevtDedup* dedup, uint64_t key, uint64_t now)
+{
+  size_t i;
+  int added = 0;
+
+  winevt_mutex_lock(&dedup->lock);
+  while (dedup->count > 0 && dedup->window > 0 &&
+         now - dedup->entries[dedup->head].time >= dedup->window) {
+    remove_oldest(dedup);
+  }
+
+  for (i = home_slot(dedup, key); dedup->slots[i] != 0; i = (i + 1) & dedup->slotMask) {
+    if (dedup->entries[dedup->slots[i] - 1].key == key) {
+      dedup->duplicates++;
+      goto done;
+    }
+  }
+
+  if (dedup->count == dedup->capacity) {
+    remove_oldest(dedup);
+    /* The slot which was found may be shifted. */
+    for (i = home_slot(dedup, key); dedup->slots[i] != 0; i = (i + 1) & dedup->slotMask)
+      ;
+  }
+  {
+    size_t index = (dedup->head + dedup->count) % dedup->capacity;
+    dedup->entries[index].key = key;
+    dedup->entries[index].time = now;
+    dedup->slots[i] = index + 1;
+    dedup->count++;
+    added = 1;
+  }
+
+done:
+  winevt_mutex_unlock(&dedup->lock);
+
+  return added;
+}
+
+/*
+ * Initalize Deduplicator class.
+ *
+ * @overload initialize(capacity: 65536, window: nil)
+ *   @param capacity [Integer] Maximum number of remembered events.
+ *   @param window [Numeric, nil] Seconds to remember an event. nil
+ *     means that only the capacity limits it.
+ * @return [Deduplicator]
+ *
+ */
+static VALUE
+rb_winevt_dedup_initialize(int argc, VALUE* argv, VALUE self)
+{
+  struct WinevtDedup* winevtDedup;
+  VALUE rb_opts;
+  ID keywords[2];
+  VALUE values[2];
+  long capacity = DEDUP_DEFAULT_CAPACITY;
+  double window = 0;
+  size_t slotCount = 1;
+
+  TypedData_Get_Struct(self, struct WinevtDedup, &rb_winevt_dedup_type, winevtDedup);
+  rb_scan_args(argc, argv, "0:", &rb_opts);
+  if (winevtDedup->initialized) {
+    rb_raise(rb_eRuntimeError, "already initialized deduplicator");
+  }
+
+  keywords[0] = id_capacity;
+  keywords[1] = id_window;
+  values[0] = Qundef;
+  values[1] = Qundef;
+  if (!NIL_P(rb_opts)) {
+    rb_get_kwargs(rb_opts, keywords, 0, 2, values);
+  }
+  if (values[0] != Qundef) {
+    capacity = NUM2LONG(values[0]);
+    if (capacity < 1 || (unsigned long)capacity > DEDUP_MAX_CAPACITY) {
+      rb_raise(rb_eArgError, "capacity must be 1..%lu", DEDUP_MAX_CAPACITY);
+    }
+  }
+  if (values[1] != Qundef && !NIL_P(values[1])) {
+    window = NUM2DBL(values[1]);
+    if (!(window > 0)) {
+      rb_raise(rb_eArgError, "window must be positive");
+    }
+  }
+
+  /* At most half of the slots are used. */
+  while (slotCount < (size_t)capacity * 2) {
+    slotCount <<= 1;
+  }
+  winevtDedup->entries = calloc((size_t)capacity, sizeof(struct WinevtDedupEntry));
+  winevtDedup->slots = calloc(slotCount, sizeof(size_t));
+  if (!winevtDedup->entries || !winevtDedup->slots) {
+    rb_memerror();
+  }
+  winevtDedup->capacity = (size_t)capacity;
+  winevtDedup->slotMask = slotCount - 1;
+  winevtDedup->window = window > 0 && window * 1000 < 1 ? 1 : (uint64_t)(window * 1000);
+  winevt_mutex_init(&winevtDedup->lock);
+  winevtDedup->initialized = 1;
+
+  return Qnil;
+}
+
+/*
+ * This method adds the event identified by the channel and the
+ * EventRecordID.
+ *
+ * @param channel [String] Channel name.
+ * @param record_id [Integer] EventRecordID.
+ * @return [Boolean] false when it is a duplicate.
+ */
+static VALUE
+rb_winevt_dedup_add_p(VALUE self, VALUE rb_channel, VALUE rb_record_id)
+{
+  struct WinevtDedup* winevtDedup = winevt_get_dedup(self);
+  uint64_t recordId = NUM2ULL(rb_record_id);
+  VALUE rb_wide;
+  uint64_t key;
+
+  Check_Type(rb_channel, T_STRING);
+  rb_wide = rb_str_encode(rb_channel, rb_enc_from_encoding(rb_enc_find("UTF-16LE")), 0, Qnil);
+  key = winevt_dedup_record_key((const uint16_t*)RSTRING_PTR(rb_wide),
+                                (size_t)RSTRING_LEN(rb_wide) / 2, recordId);
+
+  return winevt_dedup_add(winevtDedup, key, winevt_monotonic_msec()) ? Qtrue : Qfalse;
+}
+
+/*
+ * This method adds the event identified by the fingerprint of its
+ * XML. It is for the events which have no EventRecordID.
+ *
+ * @param xml [String] XML of the event.
+ * @return [Boolean] false when it is a duplicate.
+ */
+static VALUE
+rb_winevt_dedup_add_xml_p(VALUE self, VALUE rb_xml)
+{
+  struct WinevtDedup* winevtDedup = winevt_get_dedup(self);
+  VALUE rb_wide;
+  uint64_t key;
+
+  Check_Type(rb_xml, T_STRING);
+  rb_wide = rb_str_encode(rb_xml, rb_enc_from_encoding(rb_enc_find("UTF-16LE")), 0, Qnil);
+  key = winevt_dedup_xml_key((const uint16_t*)RSTRING_PTR(rb_wide),
+                             (size_t)RSTRING_LEN(rb_wide) / 2);
+
+  return winevt_dedup_add(winevtDedup, key, winevt_monotonic_msec()) ? Qtrue : Qfalse;
+}
+
+/*
+ * This method returns the number of remembered events. The expired
+ * ones are counted until the next event is added.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_dedup_size(VALUE self)
+{
+  struct WinevtDedup* winevtDedup = winevt_get_dedup(self);
+  size_t count;
+
+  winevt_mutex_lock(&winevtDedup->lock);
+  count = winevtDedup->count;
+  winevt_mutex_unlock(&winevtDedup->lock);
+
+  return SIZET2NUM(count);
+}
+
+/*
+ * This method returns the maximum number of remembered events.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_dedup_capacity(VALUE self)
+{
+  return SIZET2NUM(winevt_get_dedup(self)->capacity);
+}
+
+/*
+ * This method returns the seconds to remember an event.
+ *
+ * @return [Float, nil]
+ */
+static VALUE
+rb_winevt_dedup_window(VALUE self)
+{
+  struct WinevtDedup* winevtDedup = winevt_get_dedup(self);
+
+  return winevtDedup->window > 0 ? DBL2NUM(winevtDedup->window / 1000.0) : Qnil;
+}
+
+/*
+ * This method returns the number of dropped duplicates.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_dedup_duplicates(VALUE self)
+{
+  struct WinevtDedup* winevtDedup = winevt_get_dedup(self);
+  uint64_t duplicates;
+
+  winevt_mutex_lock(&winevtDedup->lock);
+  duplicates = winevtDedup->duplicates;
+  winevt_mutex_unlock(&winevtDedup->lock);
+
+  return ULL2NUM(duplicates);
+}
+
+/*
+ * This method forgets all events.
+ *
+ * @return [Deduplicator] self
+ */
+static VALUE
+rb_winevt_dedup_clear(VALUE self)
+{
+  struct WinevtDedup* winevtDedup = winevt_get_dedup(self);
+
+  winevt_mutex_lock(&winevtDedup->lock);
+  memset(winevtDedup->slots, 0, sizeof(size_t) * (winevtDedup->slotMask + 1));
+  winevtDedup->head = 0;
+  winevtDedup->count = 0;
+  winevt_mutex_unlock(&winevtDedup->lock);
+
+  return self;
+}
+
+/*
+ * This method returns XXH64 of the bytes of the string.
+ *
+ * @param data [String]
+ * @param seed [Integer]
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_dedup_s_xxh64(int argc, VALUE* argv, VALUE klass)
+{
+  VALUE rb_data, rb_seed;
+
+  rb_scan_args(argc, argv, "11", &rb_data, &rb_seed);
+  Check_Type(rb_data, T_STRING);
+
+  return ULL2NUM(winevt_xxh64(RSTRING_PTR(rb_data), (size_t)RSTRING_LEN(rb_data),
+                              NIL_P(rb_seed) ? 0 : NUM2ULL(rb_seed)));
+}
+
+#ifdef _WIN32
+static LPCWSTR dedupProperties[] = {
+  L"Event/System/Channel",
+  L"Event/System/EventRecordID",
+};
+
+DWORD
+dedup_context_init(struct WinevtDedupContext* dedupContext, struct WinevtDedup* dedup)
+{
+  ZeroMemory(dedupContext, sizeof(struct WinevtDedupContext));
+  dedupContext->context = EvtCreateRenderContext(
+    sizeof(dedupProperties) / sizeof(dedupProperties[0]), dedupProperties,
+    EvtRenderContextValues);
+  if (!dedupContext->context) {
+    return GetLastError();
+  }
+  dedupContext->dedup = dedup;
+
+  return ERROR_SUCCESS;
+}
+
+void
+dedup_context_free(struct WinevtDedupContext* dedupContext)
+{
+  if (dedupContext->context) {
+    EvtClose(dedupContext->context);
+  }
+  free(dedupContext->buffer);
+  ZeroMemory(dedupContext, sizeof(struct WinevtDedupContext));
+}
+
+/*
+ * Add the identity of the event to the deduplicator. Only the channel
+ * and the EventRecordID are rendered. The XML is rendered only when
+ * the event has no EventRecordID. This does not raise any Ruby
+ * exceptions.
+ */
+DWORD
+dedup_event(struct WinevtDedupContext* dedupContext, EVT_HANDLE hEvent, BOOL* duplicated)
+{
+  DWORD propCount = 0;
+  DWORD status = render_values_to_buffer(dedupContext->context, hEvent, &dedupContext->buffer,
+                                         &dedupContext->bufferSize, &propCount);
+  PEVT_VARIANT values = dedupContext->buffer;
+  uint64_t key;
+
+  if (status != ERROR_SUCCESS) {
+    return status;
+  }
+
+  if (propCount >= 2 && values[0].Type == EvtVarTypeString &&
+      values[1].Type == EvtVarTypeUInt64) {
+    key = winevt_dedup_record_key(
+      (const uint16_t*)values[0].StringVal, wcslen(values[0].StringVal), values[1].UInt64Val);
+  } else {
+    WCHAR* xml = render_to_wstr(hEvent, EvtRenderEventXml, &status);
+    if (!xml) {
+      return status;
+    }
+    key = winevt_dedup_xml_key((const uint16_t*)xml, wcslen(xml));
+    free(xml);
+  }
+  *duplicated = !winevt_dedup_add(dedupContext->dedup, key, winevt_monotonic_msec());
+
+  return ERROR_SUCCESS;
+}
+#endif /* _WIN32 */
+
+void
+Init_winevt_dedup(VALUE rb_cEventLog)
+{
+  rb_cDeduplicator = rb_define_class_under(rb_cEventLog, "Deduplicator", rb_cObject);
+  rb_define_alloc_func(rb_cDeduplicator, rb_winevt_dedup_alloc);
+
+  id_capacity = rb_intern("capacity");
+  id_window = rb_intern("window");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(rb_cDeduplicator, "xxh64", rb_winevt_dedup_s_xxh64, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "initialize", rb_winevt_dedup_initialize, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "add?", rb_winevt_dedup_add_p, 2);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "add_xml?", rb_winevt_dedup_add_xml_p, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "size", rb_winevt_dedup_size, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "capacity", rb_winevt_dedup_capacity, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "window", rb_winevt_dedup_window, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "duplicates", rb_winevt_dedup_duplicates, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cDeduplicator, "clear", rb_winevt_dedup_clear, 0);
+}
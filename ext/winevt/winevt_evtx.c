@@ -0,0 +1,2115 @@
+#include <winevt_c.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+/*
+ * EVTX parser which does not depend on wevtapi. The records are
+ * rendered into the same XML as EvtRender does and the system values
+ * are captured while rendering.
+ *
+ * BinXML in a chunk refers the names and the templates by the offsets
+ * from the beginning of the chunk. The chunk is read in place from the
+ * mapped file or from the buffer which the whole chunk is read into.
+ */
+
+#define EVTX_FILE_SIGNATURE  "ElfFile"
+#define EVTX_CHUNK_SIGNATURE "ElfChnk"
+#define EVTX_RECORD_SIGNATURE 0x00002a2aU
+#define EVTX_RECORD_HEADER_SIZE 24
+
+#define EVTX_MAX_DEPTH   64
+#define EVTX_MAX_NESTING 16
+
+/* BinXML tokens. 0x40 is set to the tokens which have more data. */
+#define BINXML_TOKEN_EOF                 0x00
+#define BINXML_TOKEN_OPEN_START_ELEMENT  0x01
+#define BINXML_TOKEN_CLOSE_START_ELEMENT 0x02
+#define BINXML_TOKEN_CLOSE_EMPTY_ELEMENT 0x03
+#define BINXML_TOKEN_END_ELEMENT         0x04
+#define BINXML_TOKEN_VALUE               0x05
+#define BINXML_TOKEN_ATTRIBUTE           0x06
+#define BINXML_TOKEN_CDATA_SECTION       0x07
+#define BINXML_TOKEN_CHAR_REF            0x08
+#define BINXML_TOKEN_ENTITY_REF          0x09
+#define BINXML_TOKEN_PI_TARGET           0x0a
+#define BINXML_TOKEN_PI_DATA             0x0b
+#define BINXML_TOKEN_TEMPLATE_INSTANCE   0x0c
+#define BINXML_TOKEN_NORMAL_SUBSTITUTION 0x0d
+#define BINXML_TOKEN_OPTIONAL_SUBSTITUTION 0x0e
+#define BINXML_TOKEN_FRAGMENT_HEADER     0x0f
+#define BINXML_TOKEN_MORE_DATA           0x40
+
+/* Value types. They are the same as EVT_VARIANT_TYPE. */
+#define BINXML_TYPE_NULL        0x00
+#define BINXML_TYPE_STRING      0x01
+#define BINXML_TYPE_ANSI_STRING 0x02
+#define BINXML_TYPE_INT8        0x03
+#define BINXML_TYPE_UINT8       0x04
+#define BINXML_TYPE_INT16       0x05
+#define BINXML_TYPE_UINT16      0x06
+#define BINXML_TYPE_INT32       0x07
+#define BINXML_TYPE_UINT32      0x08
+#define BINXML_TYPE_INT64       0x09
+#define BINXML_TYPE_UINT64      0x0a
+#define BINXML_TYPE_REAL32      0x0b
+#define BINXML_TYPE_REAL64      0x0c
+#define BINXML_TYPE_BOOL        0x0d
+#define BINXML_TYPE_BINARY      0x0e
+#define BINXML_TYPE_GUID        0x0f
+#define BINXML_TYPE_SIZE_T      0x10
+#define BINXML_TYPE_FILE_TIME   0x11
+#define BINXML_TYPE_SYS_TIME    0x12
+#define BINXML_TYPE_SID         0x13
+#define BINXML_TYPE_HEX_INT32   0x14
+#define BINXML_TYPE_HEX_INT64   0x15
+#define BINXML_TYPE_BINXML      0x21
+#define BINXML_TYPE_ARRAY       0x80
+
+#define CAPTURE_NONE   -1
+#define CAPTURE_INSERT -2
+
+struct EvtxName
+{
+  const uint8_t* chars; /* UTF-16LE */
+  uint16_t length;
+};
+
+struct EvtxRenderer
+{
+  const uint8_t* chunk;
+  struct WinevtEvtxRendered* rendered;
+  struct EvtxName stack[EVTX_MAX_DEPTH];
+  int depth;
+  int nesting;
+  int inAttribute;
+  size_t attributeStart;
+  int attributeHasValue;
+  int attributeSkipped;
+  int capture;
+};
+
+static const struct
+{
+  const char* element;
+  const char* attribute;
+  int index;
+} systemFields[] = {
+  { "Provider", "Name", EVTX_SYSTEM_PROVIDER_NAME },
+  { "Provider", "Guid", EVTX_SYSTEM_PROVIDER_GUID },
+  { "EventID", NULL, EVTX_SYSTEM_EVENT_ID },
+  { "EventID", "Qualifiers", EVTX_SYSTEM_QUALIFIERS },
+  { "Version", NULL, EVTX_SYSTEM_VERSION },
+  { "Level", NULL, EVTX_SYSTEM_LEVEL },
+  { "Task", NULL, EVTX_SYSTEM_TASK },
+  { "Opcode", NULL, EVTX_SYSTEM_OPCODE },
+  { "Keywords", NULL, EVTX_SYSTEM_KEYWORDS },
+  { "TimeCreated", "SystemTime", EVTX_SYSTEM_TIME_CREATED },
+  { "EventRecordID", NULL, EVTX_SYSTEM_EVENT_RECORD_ID },
+  { "Correlation", "ActivityID", EVTX_SYSTEM_ACTIVITY_ID },
+  { "Correlation", "RelatedActivityID", EVTX_SYSTEM_RELATED_ACTIVITY_ID },
+  { "Execution", "ProcessID", EVTX_SYSTEM_PROCESS_ID },
+  { "Execution", "ThreadID", EVTX_SYSTEM_THREAD_ID },
+  { "Channel", NULL, EVTX_SYSTEM_CHANNEL },
+  { "Computer", NULL, EVTX_SYSTEM_COMPUTER },
+  { "Security", "UserID", EVTX_SYSTEM_USER_ID },
+};
+
+static uint16_t
+get_u16(const uint8_t* p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t
+get_u32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+get_u64(const uint8_t* p)
+{
+  return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+#ifdef _WIN32
+/* The copy job can truncate, overwrite or replace the file while it is
+ * opened. */
+static int
+open_shared_handle(const char* path, HANDLE* handle)
+{
+  WCHAR* wpath;
+  int len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+
+  wpath = malloc(sizeof(WCHAR) * len);
+  if (!wpath)
+    return ENOMEM;
+  MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, len);
+  *handle = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  free(wpath);
+  if (*handle == INVALID_HANDLE_VALUE)
+    return rb_w32_map_errno(GetLastError());
+
+  return 0;
+}
+#endif /* _WIN32 */
+
+/*
+ * Map the whole file read only. Returns 0 or errno.
+ */
+int
+winevt_map_file(const char* path, struct WinevtMappedFile* file)
+{
+#ifdef _WIN32
+  HANDLE handle;
+  LARGE_INTEGER size;
+  int error = 0;
+
+  file->data = NULL;
+  file->size = 0;
+  file->mapping = NULL;
+
+  error = open_shared_handle(path, &handle);
+  if (error != 0)
+    return error;
+
+  if (!GetFileSizeEx(handle, &size)) {
+    error = rb_w32_map_errno(GetLastError());
+  } else if (size.QuadPart == 0) {
+    error = EINVAL;
+  } else {
+    file->mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!file->mapping) {
+      error = rb_w32_map_errno(GetLastError());
+    } else {
+      file->data = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+      if (!file->data) {
+        error = rb_w32_map_errno(GetLastError());
+        CloseHandle(file->mapping);
+        file->mapping = NULL;
+      } else {
+        file->size = (size_t)size.QuadPart;
+      }
+    }
+  }
+  CloseHandle(handle);
+
+  return error;
+#else
+  struct stat st;
+  void* data;
+  int fd = open(path, O_RDONLY);
+  int error = 0;
+
+  file->data = NULL;
+  file->size = 0;
+  if (fd < 0)
+    return errno;
+
+  if (fstat(fd, &st) < 0) {
+    error = errno;
+  } else if (st.st_size == 0) {
+    error = EINVAL;
+  } else {
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      error = errno;
+    } else {
+      file->data = data;
+      file->size = (size_t)st.st_size;
+    }
+  }
+  close(fd);
+
+  return error;
+#endif /* _WIN32 */
+}
+
+void
+winevt_unmap_file(struct WinevtMappedFile* file)
+{
+  if (!file->data)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(file->data);
+  CloseHandle(file->mapping);
+  file->mapping = NULL;
+#else
+  munmap((void*)file->data, file->size);
+#endif /* _WIN32 */
+  file->data = NULL;
+  file->size = 0;
+}
+
+/*
+ * Open the file to read it with winevt_read_file_at. Unlike the mapped
+ * file, reading the file after it is truncated is not a fault but a
+ * short read. Returns 0 or errno.
+ */
+int
+winevt_open_file(const char* path, struct WinevtOpenedFile* file)
+{
+#ifdef _WIN32
+  LARGE_INTEGER size;
+  int error;
+
+  file->size = 0;
+  error = open_shared_handle(path, &file->handle);
+  if (error != 0) {
+    file->handle = INVALID_HANDLE_VALUE;
+    return error;
+  }
+  if (!GetFileSizeEx(file->handle, &size)) {
+    error = rb_w32_map_errno(GetLastError());
+    winevt_close_file(file);
+    return error;
+  }
+  file->size = (uint64_t)size.QuadPart;
+
+  return 0;
+#else
+  struct stat st;
+  int error;
+
+  file->size = 0;
+  file->fd = open(path, O_RDONLY);
+  if (file->fd < 0)
+    return errno;
+  if (fstat(file->fd, &st) < 0) {
+    error = errno;
+    winevt_close_file(file);
+    return error;
+  }
+  file->size = (uint64_t)st.st_size;
+
+  return 0;
+#endif /* _WIN32 */
+}
+
+/*
+ * Read length bytes at offset. *read is less than length at the end of
+ * the file. Returns 0 or errno.
+ */
+int
+winevt_read_file_at(const struct WinevtOpenedFile* file, uint64_t offset, uint8_t* buffer,
+                    size_t length, size_t* read)
+{
+  *read = 0;
+  while (*read < length) {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    DWORD bytes;
+    DWORD request = length - *read > 0x40000000 ? 0x40000000 : (DWORD)(length - *read);
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)(offset + *read);
+    overlapped.OffsetHigh = (DWORD)((offset + *read) >> 32);
+    if (!ReadFile(file->handle, buffer + *read, request, &bytes, &overlapped)) {
+      DWORD status = GetLastError();
+      if (status == ERROR_HANDLE_EOF)
+        break;
+      return rb_w32_map_errno(status);
+    }
+#else
+    ssize_t bytes = pread(file->fd, buffer + *read, length - *read, (off_t)(offset + *read));
+
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+#endif /* _WIN32 */
+    if (bytes == 0)
+      break;
+    *read += (size_t)bytes;
+  }
+
+  return 0;
+}
+
+void
+winevt_close_file(struct WinevtOpenedFile* file)
+{
+#ifdef _WIN32
+  if (file->handle != INVALID_HANDLE_VALUE) {
+    CloseHandle(file->handle);
+    file->handle = INVALID_HANDLE_VALUE;
+  }
+#else
+  if (file->fd >= 0) {
+    close(file->fd);
+    file->fd = -1;
+  }
+#endif /* _WIN32 */
+  file->size = 0;
+}
+
+/*
+ * Returns EVTX_ERROR_CORRUPTED when the signature or the checksum is
+ * wrong.
+ */
+int
+winevt_evtx_read_file_header(const uint8_t* data, size_t size,
+                             struct WinevtEvtxFileHeader* header)
+{
+  if (size < EVTX_FILE_HEADER_SIZE || memcmp(data, EVTX_FILE_SIGNATURE, 8) != 0)
+    return EVTX_ERROR_CORRUPTED;
+  if (winevt_crc32(0, data, 120) != get_u32(data + 124))
+    return EVTX_ERROR_CORRUPTED;
+
+  header->firstChunk = get_u64(data + 8);
+  header->lastChunk = get_u64(data + 16);
+  header->nextRecordId = get_u64(data + 24);
+  header->minorVersion = get_u16(data + 36);
+  header->majorVersion = get_u16(data + 38);
+  header->chunkCount = get_u16(data + 42);
+  header->flags = get_u32(data + 120);
+  if (header->majorVersion != 3)
+    return EVTX_ERROR_CORRUPTED;
+
+  return 0;
+}
+
+/* The chunks which are fully contained in the file. */
+size_t
+winevt_evtx_chunk_count(size_t size)
+{
+  if (size < EVTX_FILE_HEADER_SIZE)
+    return 0;
+  return (size - EVTX_FILE_HEADER_SIZE) / EVTX_CHUNK_SIZE;
+}
+
+/*
+ * Returns EVTX_ERROR_CORRUPTED when the chunk is not used yet or
+ * broken. Both of the header and records checksums are verified.
+ */
+int
+winevt_evtx_read_chunk_header(const uint8_t* chunk, struct WinevtEvtxChunkHeader* header)
+{
+  uint32_t crc;
+
+  if (memcmp(chunk, EVTX_CHUNK_SIGNATURE, 8) != 0)
+    return EVTX_ERROR_CORRUPTED;
+
+  header->firstRecordNumber = get_u64(chunk + 8);
+  header->lastRecordNumber = get_u64(chunk + 16);
+  header->firstRecordId = get_u64(chunk + 24);
+  header->lastRecordId = get_u64(chunk + 32);
+  header->lastRecordOffset = get_u32(chunk + 44);
+  header->freeSpaceOffset = get_u32(chunk + 48);
+  header->recordsChecksum = get_u32(chunk + 52);
+  header->checksum = get_u32(chunk + 124);
+
+  crc = winevt_crc32(0, chunk, 120);
+  crc = winevt_crc32(crc, chunk + 128, EVTX_CHUNK_HEADER_SIZE - 128);
+  if (crc != header->checksum)
+    return EVTX_ERROR_CORRUPTED;
+  if (header->freeSpaceOffset < EVTX_CHUNK_HEADER_SIZE ||
+      header->freeSpaceOffset > EVTX_CHUNK_SIZE)
+    return EVTX_ERROR_CORRUPTED;
+  if (winevt_crc32(0, chunk + EVTX_CHUNK_HEADER_SIZE,
+                   header->freeSpaceOffset - EVTX_CHUNK_HEADER_SIZE) != header->recordsChecksum)
+    return EVTX_ERROR_CORRUPTED;
+
+  return 0;
+}
+
+/*
+ * Read the record at *offset and move *offset to the next one. Start
+ * with *offset = 0. Returns 1 when a record is read, 0 at the end of
+ * the chunk or EVTX_ERROR_CORRUPTED.
+ */
+int
+winevt_evtx_next_record(const uint8_t* chunk, const struct WinevtEvtxChunkHeader* header,
+                        uint32_t* offset, struct WinevtEvtxRecord* record)
+{
+  uint32_t size;
+  const uint8_t* p;
+
+  if (*offset < EVTX_CHUNK_HEADER_SIZE)
+    *offset = EVTX_CHUNK_HEADER_SIZE;
+  if (*offset + EVTX_RECORD_HEADER_SIZE + 4 > header->freeSpaceOffset)
+    return 0;
+
+  p = chunk + *offset;
+  size = get_u32(p + 4);
+  if (get_u32(p) != EVTX_RECORD_SIGNATURE || size < EVTX_RECORD_HEADER_SIZE + 4 ||
+      size > header->freeSpaceOffset - *offset || get_u32(p + size - 4) != size)
+    return EVTX_ERROR_CORRUPTED;
+
+  record->recordId = get_u64(p + 8);
+  record->writtenTime = get_u64(p + 16);
+  record->data = p + EVTX_RECORD_HEADER_SIZE;
+  record->size = size - EVTX_RECORD_HEADER_SIZE - 4;
+  *offset += size;
+
+  return 1;
+}
+
+static int
+buffer_reserve(struct WinevtEvtxBuffer* buffer, size_t length)
+{
+  size_t capacity;
+  char* data;
+
+  if (buffer->length + length <= buffer->capacity)
+    return 0;
+
+  capacity = buffer->capacity ? buffer->capacity : 256;
+  while (capacity < buffer->length + length) {
+    capacity *= 2;
+  }
+  data = realloc(buffer->data, capacity);
+  if (!data)
+    return EVTX_ERROR_NOMEM;
+  buffer->data = data;
+  buffer->capacity = capacity;
+
+  return 0;
+}
+
+static int
+buffer_append(struct WinevtEvtxBuffer* buffer, const char* data, size_t length)
+{
+  /* data may be NULL when length is 0. */
+  if (length == 0)
+    return 0;
+  if (buffer_reserve(buffer, length) < 0)
+    return EVTX_ERROR_NOMEM;
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+
+  return 0;
+}
+
+static int
+buffer_append_cstr(struct WinevtEvtxBuffer* buffer, const char* str)
+{
+  return buffer_append(buffer, str, strlen(str));
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+static int buffer_printf(struct WinevtEvtxBuffer* buffer, const char* format, ...)
+  __attribute__((format(printf, 2, 3)));
+#endif /* __GNUC__ || __clang__ */
+
+static int
+buffer_printf(struct WinevtEvtxBuffer* buffer, const char* format, ...)
+{
+  char text[128];
+  va_list args;
+  int length;
+
+  va_start(args, format);
+  length = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (length < 0)
+    return EVTX_ERROR_CORRUPTED;
+
+  return buffer_append(buffer, text, (size_t)length < sizeof(text) ? (size_t)length : sizeof(text) - 1);
+}
+
+/* Append UTF-16LE as UTF-8. Unpaired surrogates become U+FFFD. */
+static int
+buffer_append_utf16(struct WinevtEvtxBuffer* buffer, const uint8_t* chars, size_t length)
+{
+  if (buffer_reserve(buffer, length * 3) < 0)
+    return EVTX_ERROR_NOMEM;
+
+  for (size_t i = 0; i < length; i++) {
+    uint32_t c = get_u16(chars + i * 2);
+    char* out = buffer->data + buffer->length;
+
+    if (c >= 0xd800 && c < 0xdc00 && i + 1 < length) {
+      uint32_t low = get_u16(chars + (i + 1) * 2);
+      if (low >= 0xdc00 && low < 0xe000) {
+        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+        i++;
+      }
+    }
+    if (c >= 0xd800 && c < 0xe000) {
+      c = 0xfffd;
+    }
+
+    if (c < 0x80) {
+      out[0] = (char)c;
+      buffer->length += 1;
+    } else if (c < 0x800) {
+      out[0] = (char)(0xc0 | (c >> 6));
+      out[1] = (char)(0x80 | (c & 0x3f));
+      buffer->length += 2;
+    } else if (c < 0x10000) {
+      out[0] = (char)(0xe0 | (c >> 12));
+      out[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+      out[2] = (char)(0x80 | (c & 0x3f));
+      buffer->length += 3;
+    } else {
+      /* A surrogate pair is 4 bytes in UTF-16 too. */
+      out[0] = (char)(0xf0 | (c >> 18));
+      out[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+      out[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+      out[3] = (char)(0x80 | (c & 0x3f));
+      buffer->length += 4;
+    }
+  }
+
+  return 0;
+}
+
+static int
+buffer_append_escaped(struct WinevtEvtxBuffer* buffer, const char* data, size_t length)
+{
+  size_t start = 0;
+
+  for (size_t i = 0; i < length; i++) {
+    const char* entity;
+
+    switch (data[i]) {
+    case '&':
+      entity = "&amp;";
+      break;
+    case '<':
+      entity = "&lt;";
+      break;
+    case '>':
+      entity = "&gt;";
+      break;
+    case '\'':
+      entity = "&apos;";
+      break;
+    case '"':
+      entity = "&quot;";
+      break;
+    default:
+      continue;
+    }
+    if (buffer_append(buffer, data + start, i - start) < 0 ||
+        buffer_append_cstr(buffer, entity) < 0)
+      return EVTX_ERROR_NOMEM;
+    start = i + 1;
+  }
+
+  return buffer_append(buffer, data + start, length - start);
+}
+
+void
+winevt_evtx_rendered_init(struct WinevtEvtxRendered* rendered)
+{
+  memset(rendered, 0, sizeof(*rendered));
+}
+
+void
+winevt_evtx_rendered_destroy(struct WinevtEvtxRendered* rendered)
+{
+  free(rendered->xml.data);
+  free(rendered->text.data);
+  free(rendered->scratch.data);
+  free(rendered->inserts);
+  free(rendered->values);
+  memset(rendered, 0, sizeof(*rendered));
+}
+
+static int
+name_equals(const struct EvtxName* name, const char* ascii)
+{
+  size_t length = strlen(ascii);
+
+  if (name->length != length)
+    return 0;
+  for (size_t i = 0; i < length; i++) {
+    if (get_u16(name->chars + i * 2) != (uint8_t)ascii[i])
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Read a name reference at *pos. The name is stored in place when its
+ * offset points just after the reference, and it is skipped then.
+ */
+static int
+read_name(struct EvtxRenderer* r, const uint8_t** pos, const uint8_t* end,
+          struct EvtxName* name)
+{
+  uint32_t offset;
+  uint16_t length;
+
+  if (end - *pos < 4)
+    return EVTX_ERROR_CORRUPTED;
+  offset = get_u32(*pos);
+  *pos += 4;
+  if (offset < EVTX_CHUNK_HEADER_SIZE || offset > EVTX_CHUNK_SIZE - 8)
+    return EVTX_ERROR_CORRUPTED;
+
+  length = get_u16(r->chunk + offset + 6);
+  if (offset + 8 + (uint32_t)length * 2 + 2 > EVTX_CHUNK_SIZE)
+    return EVTX_ERROR_CORRUPTED;
+  name->chars = r->chunk + offset + 8;
+  name->length = length;
+
+  if (r->chunk + offset == *pos) {
+    if ((size_t)(end - *pos) < 8 + (size_t)length * 2 + 2)
+      return EVTX_ERROR_CORRUPTED;
+    *pos += 8 + (size_t)length * 2 + 2;
+  }
+
+  return 0;
+}
+
+static int
+write_name(struct WinevtEvtxBuffer* buffer, const struct EvtxName* name)
+{
+  return buffer_append_utf16(buffer, name->chars, name->length);
+}
+
+/* Civil date from days since 1970-01-01. */
+static void
+civil_from_days(int64_t days, int* year, unsigned* month, unsigned* day)
+{
+  int64_t era, y;
+  unsigned doe, yoe, doy, mp;
+
+  days += 719468;
+  era = (days >= 0 ? days : days - 146096) / 146097;
+  doe = (unsigned)(days - era * 146097);
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  y = (int64_t)yoe + era * 400;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  *day = doy - (153 * mp + 2) / 5 + 1;
+  *month = mp < 10 ? mp + 3 : mp - 9;
+  *year = (int)(y + (*month <= 2));
+}
+
+static int
+format_file_time(struct WinevtEvtxBuffer* buffer, uint64_t fileTime)
+{
+  /* FILETIME counts 100 nanoseconds since 1601-01-01. */
+  int64_t seconds = (int64_t)(fileTime / 10000000ULL) - 11644473600LL;
+  int64_t days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+  int64_t rest = seconds - days * 86400;
+  int year;
+  unsigned month, day;
+
+  civil_from_days(days, &year, &month, &day);
+
+  return buffer_printf(buffer, "%04d-%02u-%02uT%02u:%02u:%02u.%07uZ", year, month, day,
+                       (unsigned)(rest / 3600), (unsigned)(rest / 60 % 60),
+                       (unsigned)(rest % 60), (unsigned)(fileTime % 10000000ULL));
+}
+
+static int
+format_guid(struct WinevtEvtxBuffer* buffer, const uint8_t* p)
+{
+  return buffer_printf(buffer, "{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}",
+                       get_u32(p), get_u16(p + 4), get_u16(p + 6), p[8], p[9], p[10],
+                       p[11], p[12], p[13], p[14], p[15]);
+}
+
+static int
+format_sid(struct WinevtEvtxBuffer* buffer, const uint8_t* p, size_t size)
+{
+  uint64_t authority = 0;
+  uint8_t count;
+
+  if (size < 8)
+    return EVTX_ERROR_CORRUPTED;
+  count = p[1];
+  if (size < 8 + (size_t)count * 4)
+    return EVTX_ERROR_CORRUPTED;
+  for (int i = 2; i < 8; i++) {
+    authority = (authority << 8) | p[i];
+  }
+
+  if (authority >= 0x100000000ULL) {
+    if (buffer_printf(buffer, "S-%u-0x%012llX", p[0], (unsigned long long)authority) < 0)
+      return EVTX_ERROR_NOMEM;
+  } else {
+    if (buffer_printf(buffer, "S-%u-%llu", p[0], (unsigned long long)authority) < 0)
+      return EVTX_ERROR_NOMEM;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (buffer_printf(buffer, "-%u", get_u32(p + 8 + i * 4)) < 0)
+      return EVTX_ERROR_NOMEM;
+  }
+
+  return 0;
+}
+
+static size_t
+fixed_value_size(uint8_t type)
+{
+  switch (type) {
+  case BINXML_TYPE_INT8:
+  case BINXML_TYPE_UINT8:
+    return 1;
+  case BINXML_TYPE_INT16:
+  case BINXML_TYPE_UINT16:
+    return 2;
+  case BINXML_TYPE_INT32:
+  case BINXML_TYPE_UINT32:
+  case BINXML_TYPE_REAL32:
+  case BINXML_TYPE_BOOL:
+  case BINXML_TYPE_HEX_INT32:
+    return 4;
+  case BINXML_TYPE_INT64:
+  case BINXML_TYPE_UINT64:
+  case BINXML_TYPE_REAL64:
+  case BINXML_TYPE_FILE_TIME:
+  case BINXML_TYPE_HEX_INT64:
+    return 8;
+  case BINXML_TYPE_GUID:
+  case BINXML_TYPE_SYS_TIME:
+    return 16;
+  default:
+    return 0;
+  }
+}
+
+/* Format a value which is not an array into the buffer without escaping. */
+static int
+format_value(struct WinevtEvtxBuffer* buffer, uint8_t type, const uint8_t* p, size_t size)
+{
+  size_t fixedSize = fixed_value_size(type);
+
+  if (size < fixedSize)
+    return EVTX_ERROR_CORRUPTED;
+
+  switch (type) {
+  case BINXML_TYPE_NULL:
+    return 0;
+  case BINXML_TYPE_STRING:
+    size /= 2;
+    while (size > 0 && get_u16(p + (size - 1) * 2) == 0) {
+      size--;
+    }
+    return buffer_append_utf16(buffer, p, size);
+  case BINXML_TYPE_ANSI_STRING:
+    while (size > 0 && p[size - 1] == 0) {
+      size--;
+    }
+    return buffer_append(buffer, (const char*)p, size);
+  case BINXML_TYPE_INT8:
+    return buffer_printf(buffer, "%d", (int8_t)p[0]);
+  case BINXML_TYPE_UINT8:
+    return buffer_printf(buffer, "%u", p[0]);
+  case BINXML_TYPE_INT16:
+    return buffer_printf(buffer, "%d", (int16_t)get_u16(p));
+  case BINXML_TYPE_UINT16:
+    return buffer_printf(buffer, "%u", get_u16(p));
+  case BINXML_TYPE_INT32:
+    return buffer_printf(buffer, "%d", (int32_t)get_u32(p));
+  case BINXML_TYPE_UINT32:
+    return buffer_printf(buffer, "%u", get_u32(p));
+  case BINXML_TYPE_INT64:
+    return buffer_printf(buffer, "%lld", (long long)get_u64(p));
+  case BINXML_TYPE_UINT64:
+    return buffer_printf(buffer, "%llu", (unsigned long long)get_u64(p));
+  case BINXML_TYPE_REAL32: {
+    float value;
+    uint32_t bits = get_u32(p);
+    memcpy(&value, &bits, sizeof(value));
+    return buffer_printf(buffer, "%g", value);
+  }
+  case BINXML_TYPE_REAL64: {
+    double value;
+    uint64_t bits = get_u64(p);
+    memcpy(&value, &bits, sizeof(value));
+    return buffer_printf(buffer, "%.15g", value);
+  }
+  case BINXML_TYPE_BOOL:
+    return buffer_append_cstr(buffer, get_u32(p) ? "true" : "false");
+  case BINXML_TYPE_BINARY:
+    for (size_t i = 0; i < size; i++) {
+      if (buffer_printf(buffer, "%02X", p[i]) < 0)
+        return EVTX_ERROR_NOMEM;
+    }
+    return 0;
+  case BINXML_TYPE_GUID:
+    return format_guid(buffer, p);
+  case BINXML_TYPE_SIZE_T:
+    if (size >= 8)
+      return buffer_printf(buffer, "0x%016llx", (unsigned long long)get_u64(p));
+    if (size >= 4)
+      return buffer_printf(buffer, "0x%08x", get_u32(p));
+    return EVTX_ERROR_CORRUPTED;
+  case BINXML_TYPE_FILE_TIME:
+    return format_file_time(buffer, get_u64(p));
+  case BINXML_TYPE_SYS_TIME:
+    /* SYSTEMTIME has wDayOfWeek at p + 4. */
+    return buffer_printf(buffer, "%04u-%02u-%02uT%02u:%02u:%02u.%03u0000Z", get_u16(p),
+                         get_u16(p + 2), get_u16(p + 6), get_u16(p + 8), get_u16(p + 10),
+                         get_u16(p + 12), get_u16(p + 14));
+  case BINXML_TYPE_SID:
+    return format_sid(buffer, p, size);
+  case BINXML_TYPE_HEX_INT32:
+    return buffer_printf(buffer, "0x%x", get_u32(p));
+  case BINXML_TYPE_HEX_INT64:
+    return buffer_printf(buffer, "0x%llx", (unsigned long long)get_u64(p));
+  default:
+    /* EvtHandle and the other types do not appear in files. */
+    return 0;
+  }
+}
+
+/*
+ * Arrays are rendered as comma separated items. The strings are
+ * separated by NUL and the other items have fixed sizes.
+ */
+static int
+format_array(struct WinevtEvtxBuffer* buffer, uint8_t type, const uint8_t* p, size_t size)
+{
+  size_t itemSize = fixed_value_size(type);
+  size_t start = 0;
+  int first = 1;
+
+  if (type == BINXML_TYPE_STRING) {
+    size /= 2;
+    for (size_t i = 0; i <= size; i++) {
+      if (i < size && get_u16(p + i * 2) != 0)
+        continue;
+      if (i > start || i < size) {
+        if ((!first && buffer_append_cstr(buffer, ",") < 0) ||
+            buffer_append_utf16(buffer, p + start * 2, i - start) < 0)
+          return EVTX_ERROR_NOMEM;
+        first = 0;
+      }
+      start = i + 1;
+    }
+    return 0;
+  }
+  if (itemSize == 0 && type == BINXML_TYPE_SID) {
+    while (start < size) {
+      size_t sidSize = size - start >= 2 ? 8 + (size_t)p[start + 1] * 4 : size;
+      if (sidSize > size - start)
+        return EVTX_ERROR_CORRUPTED;
+      if ((!first && buffer_append_cstr(buffer, ",") < 0) ||
+          format_sid(buffer, p + start, sidSize) < 0)
+        return EVTX_ERROR_CORRUPTED;
+      first = 0;
+      start += sidSize;
+    }
+    return 0;
+  }
+  if (itemSize == 0)
+    return format_value(buffer, type, p, size);
+
+  for (; start + itemSize <= size; start += itemSize) {
+    if ((!first && buffer_append_cstr(buffer, ",") < 0) ||
+        format_value(buffer, type, p + start, itemSize) < 0)
+      return EVTX_ERROR_NOMEM;
+    first = 0;
+  }
+
+  return 0;
+}
+
+/* Where the values of the current element or attribute are captured. */
+static int
+find_capture(const struct EvtxName* stack, int depth, const struct EvtxName* attribute)
+{
+  const struct EvtxName* element;
+
+  if (depth != 3 || !name_equals(&stack[0], "Event"))
+    return CAPTURE_NONE;
+  element = &stack[2];
+
+  if (name_equals(&stack[1], "System")) {
+    for (size_t i = 0; i < sizeof(systemFields) / sizeof(systemFields[0]); i++) {
+      if (!name_equals(element, systemFields[i].element))
+        continue;
+      if (attribute ? (!systemFields[i].attribute ||
+                       !name_equals(attribute, systemFields[i].attribute))
+                    : systemFields[i].attribute != NULL)
+        continue;
+      return systemFields[i].index;
+    }
+  } else if (name_equals(&stack[1], "EventData") && !attribute &&
+             name_equals(element, "Data")) {
+    return CAPTURE_INSERT;
+  }
+
+  return CAPTURE_NONE;
+}
+
+static int
+set_capture(struct EvtxRenderer* r, int capture)
+{
+  struct WinevtEvtxRendered* rendered = r->rendered;
+
+  r->capture = capture;
+  if (capture >= 0) {
+    rendered->system[capture].offset = rendered->text.length;
+    rendered->system[capture].length = 0;
+    rendered->system[capture].present = 0;
+  } else if (capture == CAPTURE_INSERT) {
+    if (rendered->insertCount == rendered->insertCapacity) {
+      size_t capacity = rendered->insertCapacity ? rendered->insertCapacity * 2 : 16;
+      struct WinevtEvtxText* inserts =
+        realloc(rendered->inserts, sizeof(struct WinevtEvtxText) * capacity);
+      if (!inserts)
+        return EVTX_ERROR_NOMEM;
+      rendered->inserts = inserts;
+      rendered->insertCapacity = capacity;
+    }
+    rendered->inserts[rendered->insertCount].offset = rendered->text.length;
+    rendered->inserts[rendered->insertCount].length = 0;
+    rendered->inserts[rendered->insertCount].present = 0;
+    rendered->insertCount++;
+  }
+
+  return 0;
+}
+
+static int
+start_capture(struct EvtxRenderer* r, const struct EvtxName* attribute)
+{
+  return set_capture(r, find_capture(r->stack, r->depth, attribute));
+}
+
+/* Write the value in the scratch buffer. NULL values are not captured. */
+static int
+emit_value(struct EvtxRenderer* r, int isNull)
+{
+  struct WinevtEvtxRendered* rendered = r->rendered;
+  struct WinevtEvtxText* text = NULL;
+
+  if (r->capture == CAPTURE_INSERT) {
+    text = &rendered->inserts[rendered->insertCount - 1];
+  } else if (r->capture != CAPTURE_NONE) {
+    text = &rendered->system[r->capture];
+  }
+  if (text && !isNull) {
+    if (buffer_append(&rendered->text, rendered->scratch.data, rendered->scratch.length) < 0)
+      return EVTX_ERROR_NOMEM;
+    text->length += rendered->scratch.length;
+    text->present = 1;
+  }
+
+  if (rendered->scratch.length == 0)
+    return 0;
+  if (r->inAttribute)
+    r->attributeHasValue = 1;
+
+  return buffer_append_escaped(&rendered->xml, rendered->scratch.data, rendered->scratch.length);
+}
+
+/*
+ * An attribute is dropped when its value is only empty optional
+ * substitutions.
+ */
+static int
+finish_attribute(struct EvtxRenderer* r)
+{
+  if (!r->inAttribute)
+    return 0;
+  r->inAttribute = 0;
+  r->capture = CAPTURE_NONE;
+  if (!r->attributeHasValue && r->attributeSkipped) {
+    r->rendered->xml.length = r->attributeStart;
+    return 0;
+  }
+
+  return buffer_append_cstr(&r->rendered->xml, "'");
+}
+
+static int render_tokens(struct EvtxRenderer* r, const uint8_t** pos, const uint8_t* end,
+                         size_t valueBase, size_t valueCount, int embedded);
+
+static int
+render_substitution(struct EvtxRenderer* r, const struct WinevtEvtxValue* value, int optional)
+{
+  struct WinevtEvtxRendered* rendered = r->rendered;
+  int status;
+
+  if (optional && (value->type == BINXML_TYPE_NULL || value->size == 0)) {
+    r->attributeSkipped = 1;
+    return 0;
+  }
+
+  if (value->type == BINXML_TYPE_BINXML) {
+    const uint8_t* p = value->data;
+    if (r->nesting >= EVTX_MAX_NESTING)
+      return EVTX_ERROR_CORRUPTED;
+    r->nesting++;
+    status = render_tokens(r, &p, value->data + value->size, 0, 0, 1);
+    r->nesting--;
+    return status;
+  }
+
+  rendered->scratch.length = 0;
+  if (value->type & BINXML_TYPE_ARRAY) {
+    status = format_array(&rendered->scratch, value->type & ~BINXML_TYPE_ARRAY, value->data,
+                          value->size);
+  } else {
+    status = format_value(&rendered->scratch, value->type, value->data, value->size);
+  }
+  if (status < 0)
+    return status;
+
+  return emit_value(r, value->type == BINXML_TYPE_NULL);
+}
+
+/*
+ * A template definition is compiled into the operations below. The
+ * names and the static text are converted into UTF-8 and the captures
+ * are resolved when compiled, so only the substitutions are formatted
+ * for each record. The plans are used only for the templates at the
+ * root of the records because the captures depend on the depth.
+ */
+#define PLAN_TEXT            0
+#define PLAN_PUSH            1
+#define PLAN_POP             2
+#define PLAN_CAPTURE         3
+#define PLAN_ATTRIBUTE_START 4
+#define PLAN_ATTRIBUTE_END   5
+#define PLAN_VALUE           6
+#define PLAN_REF             7
+#define PLAN_SUBSTITUTION    8
+
+/* The capture is not known after the substitutions of BinXML. */
+#define CAPTURE_UNKNOWN -3
+
+struct EvtxPlanOp
+{
+  uint8_t code;
+  uint8_t optional;
+  uint16_t id;
+  int capture;
+  uint32_t offset; /* in bytes */
+  uint32_t length;
+};
+
+struct WinevtEvtxTemplatePlan
+{
+  struct EvtxPlanOp* ops;
+  size_t count;
+  size_t capacity;
+  struct WinevtEvtxBuffer bytes; /* UTF-8 text and UTF-16LE names */
+};
+
+struct EvtxPlanCompiler
+{
+  struct EvtxRenderer* r;
+  struct WinevtEvtxTemplatePlan* plan; /* NULL only hashes */
+  struct WinevtEvtxBuffer scratch;
+  uint64_t hash;
+  struct EvtxName stack[EVTX_MAX_DEPTH];
+  int depth;
+  int inAttribute;
+  int capture;
+};
+
+static void
+plan_free(struct WinevtEvtxTemplatePlan* plan)
+{
+  if (!plan)
+    return;
+  free(plan->ops);
+  free(plan->bytes.data);
+  free(plan);
+}
+
+/* FNV-1a over the contents which do not depend on the chunk. */
+static void
+plan_hash(struct EvtxPlanCompiler* c, const uint8_t* p, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    c->hash ^= p[i];
+    c->hash *= 1099511628211ULL;
+  }
+}
+
+static void
+plan_hash_name(struct EvtxPlanCompiler* c, const struct EvtxName* name)
+{
+  plan_hash(c, (const uint8_t*)&name->length, sizeof(name->length));
+  plan_hash(c, name->chars, (size_t)name->length * 2);
+}
+
+static struct EvtxPlanOp*
+plan_op(struct EvtxPlanCompiler* c, uint8_t code)
+{
+  struct WinevtEvtxTemplatePlan* plan = c->plan;
+  struct EvtxPlanOp* op;
+
+  if (plan->count == plan->capacity) {
+    size_t capacity = plan->capacity ? plan->capacity * 2 : 32;
+    struct EvtxPlanOp* ops = realloc(plan->ops, sizeof(struct EvtxPlanOp) * capacity);
+    if (!ops)
+      return NULL;
+    plan->ops = ops;
+    plan->capacity = capacity;
+  }
+  op = &plan->ops[plan->count++];
+  memset(op, 0, sizeof(*op));
+  op->code = code;
+  op->offset = (uint32_t)plan->bytes.length;
+
+  return op;
+}
+
+/* Start an operation whose data is appended to bytes until plan_end. */
+static int
+plan_begin(struct EvtxPlanCompiler* c, uint8_t code)
+{
+  struct WinevtEvtxTemplatePlan* plan = c->plan;
+
+  if (!plan)
+    return 0;
+  /* The adjacent static text is merged. */
+  if (code == PLAN_TEXT && plan->count > 0 && plan->ops[plan->count - 1].code == PLAN_TEXT)
+    return 0;
+
+  return plan_op(c, code) ? 0 : EVTX_ERROR_NOMEM;
+}
+
+static void
+plan_end(struct EvtxPlanCompiler* c)
+{
+  struct WinevtEvtxTemplatePlan* plan = c->plan;
+  struct EvtxPlanOp* op;
+
+  if (!plan)
+    return;
+  op = &plan->ops[plan->count - 1];
+  op->length = (uint32_t)(plan->bytes.length - op->offset);
+}
+
+static int
+plan_text(struct EvtxPlanCompiler* c, const char* text)
+{
+  if (!c->plan)
+    return 0;
+  if (plan_begin(c, PLAN_TEXT) < 0 || buffer_append_cstr(&c->plan->bytes, text) < 0)
+    return EVTX_ERROR_NOMEM;
+  plan_end(c);
+
+  return 0;
+}
+
+static int
+plan_text_utf16(struct EvtxPlanCompiler* c, const uint8_t* chars, size_t length)
+{
+  if (!c->plan)
+    return 0;
+  if (plan_begin(c, PLAN_TEXT) < 0 || buffer_append_utf16(&c->plan->bytes, chars, length) < 0)
+    return EVTX_ERROR_NOMEM;
+  plan_end(c);
+
+  return 0;
+}
+
+static int
+plan_simple(struct EvtxPlanCompiler* c, uint8_t code, int capture)
+{
+  struct EvtxPlanOp* op;
+
+  if (!c->plan)
+    return 0;
+  op = plan_op(c, code);
+  if (!op)
+    return EVTX_ERROR_NOMEM;
+  op->capture = capture;
+
+  return 0;
+}
+
+/* The system values are reset whenever they are captured again. */
+static int
+plan_capture(struct EvtxPlanCompiler* c, int capture)
+{
+  if (capture == CAPTURE_NONE && c->capture == CAPTURE_NONE)
+    return 0;
+  c->capture = capture;
+
+  return plan_simple(c, PLAN_CAPTURE, capture);
+}
+
+static int
+plan_attribute_end(struct EvtxPlanCompiler* c)
+{
+  if (c->inAttribute) {
+    c->inAttribute = 0;
+    c->capture = CAPTURE_NONE;
+  }
+
+  return plan_simple(c, PLAN_ATTRIBUTE_END, CAPTURE_NONE);
+}
+
+/*
+ * Walk the template definition as render_tokens does. Returns 1 when
+ * the template cannot be compiled, for example it has a nested
+ * template instance.
+ */
+static int
+compile_template(struct EvtxPlanCompiler* c, const uint8_t* p, const uint8_t* end)
+{
+  int status = 0;
+
+  while (status == 0) {
+    uint8_t token;
+    struct EvtxName name;
+
+    if (p >= end)
+      return EVTX_ERROR_CORRUPTED;
+    token = *p;
+    plan_hash(c, &token, 1);
+
+    switch (token & ~BINXML_TOKEN_MORE_DATA) {
+    case BINXML_TOKEN_EOF:
+      return 0;
+    case BINXML_TOKEN_OPEN_START_ELEMENT:
+      p += 7;
+      if (p > end || read_name(c->r, &p, end, &name) < 0)
+        return EVTX_ERROR_CORRUPTED;
+      if (token & BINXML_TOKEN_MORE_DATA)
+        p += 4;
+      if (c->depth >= EVTX_MAX_DEPTH)
+        return EVTX_ERROR_CORRUPTED;
+      plan_hash_name(c, &name);
+      c->stack[c->depth++] = name;
+      if (c->plan) {
+        if (plan_begin(c, PLAN_PUSH) < 0 ||
+            buffer_append(&c->plan->bytes, (const char*)name.chars, (size_t)name.length * 2) < 0)
+          return EVTX_ERROR_NOMEM;
+        plan_end(c);
+      }
+      status = plan_capture(c, CAPTURE_NONE);
+      if (status == 0)
+        status = plan_text(c, "<");
+      if (status == 0)
+        status = plan_text_utf16(c, name.chars, name.length);
+      break;
+    case BINXML_TOKEN_CLOSE_START_ELEMENT:
+      p++;
+      status = plan_attribute_end(c);
+      if (status == 0)
+        status = plan_text(c, ">");
+      if (status == 0)
+        status = plan_capture(c, find_capture(c->stack, c->depth, NULL));
+      break;
+    case BINXML_TOKEN_CLOSE_EMPTY_ELEMENT:
+      p++;
+      status = plan_attribute_end(c);
+      if (status == 0)
+        status = plan_text(c, "/>");
+      if (status == 0)
+        status = plan_capture(c, find_capture(c->stack, c->depth, NULL));
+      if (status == 0)
+        status = plan_capture(c, CAPTURE_NONE);
+      if (status == 0 && c->depth > 0) {
+        c->depth--;
+        status = plan_simple(c, PLAN_POP, CAPTURE_NONE);
+      }
+      break;
+    case BINXML_TOKEN_END_ELEMENT:
+      p++;
+      if (c->depth == 0)
+        return EVTX_ERROR_CORRUPTED;
+      c->depth--;
+      status = plan_simple(c, PLAN_POP, CAPTURE_NONE);
+      if (status == 0)
+        status = plan_capture(c, CAPTURE_NONE);
+      if (status == 0)
+        status = plan_text(c, "</");
+      if (status == 0)
+        status = plan_text_utf16(c, c->stack[c->depth].chars, c->stack[c->depth].length);
+      if (status == 0)
+        status = plan_text(c, ">");
+      break;
+    case BINXML_TOKEN_VALUE: {
+      uint16_t length;
+      if (end - p < 4)
+        return EVTX_ERROR_CORRUPTED;
+      length = get_u16(p + 2);
+      if ((size_t)(end - p - 4) < (size_t)length * 2 || p[1] != BINXML_TYPE_STRING)
+        return EVTX_ERROR_CORRUPTED;
+      plan_hash(c, p + 2, 2 + (size_t)length * 2);
+      if (c->plan) {
+        c->scratch.length = 0;
+        if (buffer_append_utf16(&c->scratch, p + 4, length) < 0)
+          return EVTX_ERROR_NOMEM;
+        /* The values which are not captured are static text. */
+        if (c->capture == CAPTURE_NONE && !c->inAttribute) {
+          status = plan_begin(c, PLAN_TEXT);
+          if (status == 0)
+            status = buffer_append_escaped(&c->plan->bytes, c->scratch.data, c->scratch.length);
+        } else {
+          status = plan_begin(c, PLAN_VALUE);
+          if (status == 0)
+            status = buffer_append(&c->plan->bytes, c->scratch.data, c->scratch.length);
+        }
+        plan_end(c);
+      }
+      p += 4 + (size_t)length * 2;
+      break;
+    }
+    case BINXML_TOKEN_ATTRIBUTE:
+      p++;
+      status = plan_attribute_end(c);
+      if (status == 0)
+        status = read_name(c->r, &p, end, &name);
+      if (status < 0)
+        return status;
+      plan_hash_name(c, &name);
+      c->inAttribute = 1;
+      status = plan_simple(c, PLAN_ATTRIBUTE_START, CAPTURE_NONE);
+      if (status == 0)
+        status = plan_text(c, " ");
+      if (status == 0)
+        status = plan_text_utf16(c, name.chars, name.length);
+      if (status == 0)
+        status = plan_text(c, "='");
+      if (status == 0)
+        status = plan_capture(c, find_capture(c->stack, c->depth, &name));
+      break;
+    case BINXML_TOKEN_CDATA_SECTION: {
+      uint16_t length;
+      if (end - p < 3)
+        return EVTX_ERROR_CORRUPTED;
+      length = get_u16(p + 1);
+      if ((size_t)(end - p - 3) < (size_t)length * 2)
+        return EVTX_ERROR_CORRUPTED;
+      plan_hash(c, p + 1, 2 + (size_t)length * 2);
+      status = plan_text(c, "<![CDATA[");
+      if (status == 0)
+        status = plan_text_utf16(c, p + 3, length);
+      if (status == 0)
+        status = plan_text(c, "]]>");
+      p += 3 + (size_t)length * 2;
+      break;
+    }
+    case BINXML_TOKEN_CHAR_REF:
+      if (end - p < 3)
+        return EVTX_ERROR_CORRUPTED;
+      plan_hash(c, p + 1, 2);
+      if (c->plan) {
+        status = plan_begin(c, PLAN_REF);
+        if (status == 0)
+          status = buffer_printf(&c->plan->bytes, "&#%u;", get_u16(p + 1));
+        plan_end(c);
+      }
+      p += 3;
+      break;
+    case BINXML_TOKEN_ENTITY_REF:
+      p++;
+      status = read_name(c->r, &p, end, &name);
+      if (status < 0)
+        return status;
+      plan_hash_name(c, &name);
+      if (c->plan) {
+        status = plan_begin(c, PLAN_REF);
+        if (status == 0)
+          status = buffer_append_cstr(&c->plan->bytes, "&");
+        if (status == 0)
+          status = write_name(&c->plan->bytes, &name);
+        if (status == 0)
+          status = buffer_append_cstr(&c->plan->bytes, ";");
+        plan_end(c);
+      }
+      break;
+    case BINXML_TOKEN_PI_TARGET:
+      p++;
+      status = read_name(c->r, &p, end, &name);
+      if (status < 0)
+        return status;
+      plan_hash_name(c, &name);
+      status = plan_text(c, "<?");
+      if (status == 0)
+        status = plan_text_utf16(c, name.chars, name.length);
+      break;
+    case BINXML_TOKEN_PI_DATA: {
+      uint16_t length;
+      if (end - p < 3)
+        return EVTX_ERROR_CORRUPTED;
+      length = get_u16(p + 1);
+      if ((size_t)(end - p - 3) < (size_t)length * 2)
+        return EVTX_ERROR_CORRUPTED;
+      plan_hash(c, p + 1, 2 + (size_t)length * 2);
+      status = plan_text(c, " ");
+      if (status == 0)
+        status = plan_text_utf16(c, p + 3, length);
+      if (status == 0)
+        status = plan_text(c, "?>");
+      p += 3 + (size_t)length * 2;
+      break;
+    }
+    case BINXML_TOKEN_NORMAL_SUBSTITUTION:
+    case BINXML_TOKEN_OPTIONAL_SUBSTITUTION:
+      if (end - p < 4)
+        return EVTX_ERROR_CORRUPTED;
+      plan_hash(c, p + 1, 3);
+      if (c->plan) {
+        struct EvtxPlanOp* op = plan_op(c, PLAN_SUBSTITUTION);
+        if (!op)
+          return EVTX_ERROR_NOMEM;
+        op->id = get_u16(p + 1);
+        op->optional = token == BINXML_TOKEN_OPTIONAL_SUBSTITUTION;
+      }
+      c->capture = CAPTURE_UNKNOWN;
+      p += 4;
+      break;
+    case BINXML_TOKEN_FRAGMENT_HEADER:
+      p += 4;
+      break;
+    default:
+      /* The nested template instances are walked every time. */
+      return 1;
+    }
+  }
+
+  return status;
+}
+
+static int
+render_plan(struct EvtxRenderer* r, const struct WinevtEvtxTemplatePlan* plan,
+            size_t valueBase, size_t valueCount)
+{
+  struct WinevtEvtxRendered* rendered = r->rendered;
+  struct WinevtEvtxBuffer* xml = &rendered->xml;
+  int status = 0;
+
+  for (size_t i = 0; i < plan->count && status == 0; i++) {
+    const struct EvtxPlanOp* op = &plan->ops[i];
+    const char* data = plan->bytes.data + op->offset;
+
+    switch (op->code) {
+    case PLAN_TEXT:
+      status = buffer_append(xml, data, op->length);
+      break;
+    case PLAN_PUSH:
+      if (r->depth >= EVTX_MAX_DEPTH)
+        return EVTX_ERROR_CORRUPTED;
+      r->stack[r->depth].chars = (const uint8_t*)data;
+      r->stack[r->depth].length = (uint16_t)(op->length / 2);
+      r->depth++;
+      break;
+    case PLAN_POP:
+      if (r->depth > 0)
+        r->depth--;
+      break;
+    case PLAN_CAPTURE:
+      status = set_capture(r, op->capture);
+      break;
+    case PLAN_ATTRIBUTE_START:
+      r->inAttribute = 1;
+      r->attributeStart = xml->length;
+      r->attributeHasValue = 0;
+      r->attributeSkipped = 0;
+      break;
+    case PLAN_ATTRIBUTE_END:
+      status = finish_attribute(r);
+      break;
+    case PLAN_VALUE:
+      rendered->scratch.length = 0;
+      status = buffer_append(&rendered->scratch, data, op->length);
+      if (status == 0)
+        status = emit_value(r, 0);
+      break;
+    case PLAN_REF:
+      status = buffer_append(xml, data, op->length);
+      r->attributeHasValue = r->inAttribute;
+      break;
+    case PLAN_SUBSTITUTION:
+      if (op->id >= valueCount)
+        return EVTX_ERROR_CORRUPTED;
+      status = render_substitution(r, &rendered->values[valueBase + op->id], op->optional);
+      break;
+    }
+  }
+
+  return status;
+}
+
+void
+winevt_evtx_template_cache_init(struct WinevtEvtxTemplateCache* cache)
+{
+  memset(cache, 0, sizeof(*cache));
+  winevt_mutex_init(&cache->lock);
+}
+
+void
+winevt_evtx_template_cache_destroy(struct WinevtEvtxTemplateCache* cache)
+{
+  for (size_t i = 0; i < cache->capacity; i++) {
+    plan_free(cache->entries[i].plan);
+  }
+  free(cache->entries);
+  winevt_mutex_destroy(&cache->lock);
+  memset(cache, 0, sizeof(*cache));
+}
+
+/* Open addressing by the hash. Call this with the lock. */
+static struct WinevtEvtxTemplateEntry*
+template_cache_find(struct WinevtEvtxTemplateCache* cache, const uint8_t* guid,
+                    uint32_t dataSize, uint64_t hash)
+{
+  if (cache->capacity == 0)
+    return NULL;
+  for (size_t i = (size_t)hash & (cache->capacity - 1);; i = (i + 1) & (cache->capacity - 1)) {
+    struct WinevtEvtxTemplateEntry* entry = &cache->entries[i];
+    if (!entry->plan)
+      return entry;
+    if (entry->hash == hash && entry->dataSize == dataSize &&
+        memcmp(entry->guid, guid, 16) == 0)
+      return entry;
+  }
+}
+
+static int
+template_cache_grow(struct WinevtEvtxTemplateCache* cache)
+{
+  size_t capacity = cache->capacity ? cache->capacity * 2 : 64;
+  struct WinevtEvtxTemplateEntry* old = cache->entries;
+  size_t oldCapacity = cache->capacity;
+
+  cache->entries = calloc(capacity, sizeof(struct WinevtEvtxTemplateEntry));
+  if (!cache->entries) {
+    cache->entries = old;
+    return EVTX_ERROR_NOMEM;
+  }
+  cache->capacity = capacity;
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (old[i].plan) {
+      *template_cache_find(cache, old[i].guid, old[i].dataSize, old[i].hash) = old[i];
+    }
+  }
+  free(old);
+
+  return 0;
+}
+
+/*
+ * Look up the plan of the definition in the cache and compile it when
+ * it is not found. Returns NULL when the template is walked.
+ */
+static const struct WinevtEvtxTemplatePlan*
+lookup_template_plan(struct EvtxRenderer* r, const uint8_t* definition, uint32_t dataSize)
+{
+  struct WinevtEvtxTemplateCache* cache = r->rendered->templateCache;
+  struct WinevtEvtxTemplateEntry* entry;
+  struct WinevtEvtxTemplatePlan* plan = NULL;
+  struct EvtxPlanCompiler c;
+  const uint8_t* guid = definition + 4;
+  const uint8_t* body = definition + 24;
+  uint64_t hash;
+
+  memset(&c, 0, sizeof(c));
+  c.r = r;
+  c.hash = 14695981039346656037ULL;
+  c.capture = CAPTURE_NONE;
+  if (compile_template(&c, body, body + dataSize) != 0)
+    return NULL;
+  hash = c.hash;
+
+  winevt_mutex_lock(&cache->lock);
+  entry = template_cache_find(cache, guid, dataSize, hash);
+  if (entry && entry->plan) {
+    cache->hits++;
+    winevt_mutex_unlock(&cache->lock);
+    return entry->plan;
+  }
+  winevt_mutex_unlock(&cache->lock);
+
+  plan = calloc(1, sizeof(struct WinevtEvtxTemplatePlan));
+  if (!plan)
+    return NULL;
+  memset(&c, 0, sizeof(c));
+  c.r = r;
+  c.plan = plan;
+  c.capture = CAPTURE_NONE;
+  if (compile_template(&c, body, body + dataSize) != 0) {
+    free(c.scratch.data);
+    plan_free(plan);
+    return NULL;
+  }
+  free(c.scratch.data);
+
+  /* The other worker may compile the same template meanwhile. */
+  winevt_mutex_lock(&cache->lock);
+  entry = template_cache_find(cache, guid, dataSize, hash);
+  if (entry && entry->plan) {
+    cache->hits++;
+    plan_free(plan);
+    plan = entry->plan;
+  } else if (cache->size < EVTX_MAX_TEMPLATES &&
+             ((cache->size + 1) * 10 <= cache->capacity * 7 || template_cache_grow(cache) == 0)) {
+    entry = template_cache_find(cache, guid, dataSize, hash);
+    memcpy(entry->guid, guid, 16);
+    entry->dataSize = dataSize;
+    entry->hash = hash;
+    entry->plan = plan;
+    cache->size++;
+    cache->misses++;
+  } else {
+    plan_free(plan);
+    plan = NULL;
+  }
+  winevt_mutex_unlock(&cache->lock);
+
+  return plan;
+}
+
+/* The plans are looked up once for each definition in the chunk. */
+static const struct WinevtEvtxTemplatePlan*
+find_template_plan(struct EvtxRenderer* r, uint32_t definitionOffset, uint32_t dataSize)
+{
+  struct WinevtEvtxRendered* rendered = r->rendered;
+  const struct WinevtEvtxTemplatePlan* plan;
+
+  if (rendered->templateChunk != r->chunk) {
+    rendered->templateChunk = r->chunk;
+    rendered->templateCount = 0;
+  }
+  for (size_t i = 0; i < rendered->templateCount; i++) {
+    if (rendered->templateOffsets[i] == definitionOffset)
+      return rendered->templatePlans[i];
+  }
+
+  plan = lookup_template_plan(r, r->chunk + definitionOffset, dataSize);
+  if (rendered->templateCount < EVTX_CHUNK_TEMPLATES) {
+    rendered->templateOffsets[rendered->templateCount] = definitionOffset;
+    rendered->templatePlans[rendered->templateCount] = plan;
+    rendered->templateCount++;
+  }
+
+  return plan;
+}
+
+/*
+ * Read the template instance at *pos. The definition is in place when
+ * its offset points just after the reference. The substitution values
+ * follow the definition.
+ */
+static int
+render_template_instance(struct EvtxRenderer* r, const uint8_t** pos, const uint8_t* end)
+{
+  struct WinevtEvtxRendered* rendered = r->rendered;
+  const uint8_t* p = *pos;
+  const uint8_t* definition;
+  const uint8_t* body;
+  uint32_t definitionOffset, dataSize, count;
+  size_t valueBase = rendered->valueCount;
+  const struct WinevtEvtxTemplatePlan* plan = NULL;
+  const uint8_t* data;
+  int status;
+
+  if (end - p < 10)
+    return EVTX_ERROR_CORRUPTED;
+  definitionOffset = get_u32(p + 6);
+  p += 10;
+  if (definitionOffset < EVTX_CHUNK_HEADER_SIZE || definitionOffset > EVTX_CHUNK_SIZE - 24)
+    return EVTX_ERROR_CORRUPTED;
+  definition = r->chunk + definitionOffset;
+  dataSize = get_u32(definition + 20);
+  if (dataSize > EVTX_CHUNK_SIZE - definitionOffset - 24)
+    return EVTX_ERROR_CORRUPTED;
+  body = definition + 24;
+  if (definition == p) {
+    if ((size_t)(end - p) < 24 + (size_t)dataSize)
+      return EVTX_ERROR_CORRUPTED;
+    p += 24 + dataSize;
+  }
+
+  if (end - p < 4)
+    return EVTX_ERROR_CORRUPTED;
+  count = get_u32(p);
+  p += 4;
+  if ((size_t)(end - p) / 4 < count)
+    return EVTX_ERROR_CORRUPTED;
+
+  if (rendered->valueCount + count > rendered->valueCapacity) {
+    size_t capacity = rendered->valueCapacity ? rendered->valueCapacity : 32;
+    struct WinevtEvtxValue* values;
+    while (capacity < rendered->valueCount + count) {
+      capacity *= 2;
+    }
+    values = realloc(rendered->values, sizeof(struct WinevtEvtxValue) * capacity);
+    if (!values)
+      return EVTX_ERROR_NOMEM;
+    rendered->values = values;
+    rendered->valueCapacity = capacity;
+  }
+
+  data = p + (size_t)count * 4;
+  for (uint32_t i = 0; i < count; i++) {
+    struct WinevtEvtxValue* value = &rendered->values[valueBase + i];
+    value->size = get_u16(p + i * 4);
+    value->type = p[i * 4 + 2];
+    value->data = data;
+    if ((size_t)(end - data) < value->size)
+      return EVTX_ERROR_CORRUPTED;
+    data += value->size;
+  }
+  rendered->valueCount += count;
+  *pos = data;
+
+  if (r->nesting >= EVTX_MAX_NESTING)
+    return EVTX_ERROR_CORRUPTED;
+  if (rendered->templateCache && r->depth == 0) {
+    plan = find_template_plan(r, definitionOffset, dataSize);
+  }
+  r->nesting++;
+  if (plan) {
+    status = render_plan(r, plan, valueBase, count);
+  } else {
+    status = render_tokens(r, &body, body + dataSize, valueBase, count, 0);
+  }
+  r->nesting--;
+  rendered->valueCount = valueBase;
+
+  return status;
+}
+
+/*
+ * Render the BinXML tokens until EOF. The elements in the embedded
+ * BinXML values do not have the dependency identifier.
+ */
+static int
+render_tokens(struct EvtxRenderer* r, const uint8_t** pos, const uint8_t* end,
+              size_t valueBase, size_t valueCount, int embedded)
+{
+  struct WinevtEvtxRendered* rendered = r->rendered;
+  struct WinevtEvtxBuffer* xml = &rendered->xml;
+  const uint8_t* p = *pos;
+  int status = 0;
+
+  while (status == 0) {
+    uint8_t token;
+    struct EvtxName name;
+
+    if (p >= end)
+      return EVTX_ERROR_CORRUPTED;
+    token = *p;
+
+    switch (token & ~BINXML_TOKEN_MORE_DATA) {
+    case BINXML_TOKEN_EOF:
+      *pos = p + 1;
+      return 0;
+    case BINXML_TOKEN_OPEN_START_ELEMENT:
+      p += embedded ? 5 : 7;
+      if (p > end || (status = read_name(r, &p, end, &name)) < 0)
+        return EVTX_ERROR_CORRUPTED;
+      if (token & BINXML_TOKEN_MORE_DATA)
+        p += 4;
+      if (r->depth >= EVTX_MAX_DEPTH)
+        return EVTX_ERROR_CORRUPTED;
+      r->stack[r->depth++] = name;
+      r->capture = CAPTURE_NONE;
+      status = buffer_append_cstr(xml, "<");
+      if (status == 0)
+        status = write_name(xml, &name);
+      break;
+    case BINXML_TOKEN_CLOSE_START_ELEMENT:
+      p++;
+      status = finish_attribute(r);
+      if (status == 0)
+        status = buffer_append_cstr(xml, ">");
+      if (status == 0)
+        status = start_capture(r, NULL);
+      break;
+    case BINXML_TOKEN_CLOSE_EMPTY_ELEMENT:
+      p++;
+      status = finish_attribute(r);
+      if (status == 0)
+        status = buffer_append_cstr(xml, "/>");
+      if (status == 0)
+        status = start_capture(r, NULL);
+      r->capture = CAPTURE_NONE;
+      if (r->depth > 0)
+        r->depth--;
+      break;
+    case BINXML_TOKEN_END_ELEMENT:
+      p++;
+      if (r->depth == 0)
+        return EVTX_ERROR_CORRUPTED;
+      r->depth--;
+      r->capture = CAPTURE_NONE;
+      status = buffer_append_cstr(xml, "</");
+      if (status == 0)
+        status = write_name(xml, &r->stack[r->depth]);
+      if (status == 0)
+        status = buffer_append_cstr(xml, ">");
+      break;
+    case BINXML_TOKEN_VALUE: {
+      uint16_t length;
+      if (end - p < 4)
+        return EVTX_ERROR_CORRUPTED;
+      length = get_u16(p + 2);
+      if ((size_t)(end - p - 4) < (size_t)length * 2)
+        return EVTX_ERROR_CORRUPTED;
+      rendered->scratch.length = 0;
+      if (p[1] == BINXML_TYPE_STRING) {
+        status = buffer_append_utf16(&rendered->scratch, p + 4, length);
+        p += 4 + (size_t)length * 2;
+      } else {
+        return EVTX_ERROR_CORRUPTED;
+      }
+      if (status == 0)
+        status = emit_value(r, 0);
+      break;
+    }
+    case BINXML_TOKEN_ATTRIBUTE:
+      p++;
+      status = finish_attribute(r);
+      if (status == 0)
+        status = read_name(r, &p, end, &name);
+      if (status < 0)
+        return status;
+      r->inAttribute = 1;
+      r->attributeStart = xml->length;
+      r->attributeHasValue = 0;
+      r->attributeSkipped = 0;
+      status = buffer_append_cstr(xml, " ");
+      if (status == 0)
+        status = write_name(xml, &name);
+      if (status == 0)
+        status = buffer_append_cstr(xml, "='");
+      if (status == 0)
+        status = start_capture(r, &name);
+      break;
+    case BINXML_TOKEN_CDATA_SECTION: {
+      uint16_t length;
+      if (end - p < 3)
+        return EVTX_ERROR_CORRUPTED;
+      length = get_u16(p + 1);
+      if ((size_t)(end - p - 3) < (size_t)length * 2)
+        return EVTX_ERROR_CORRUPTED;
+      status = buffer_append_cstr(xml, "<![CDATA[");
+      if (status == 0)
+        status = buffer_append_utf16(xml, p + 3, length);
+      if (status == 0)
+        status = buffer_append_cstr(xml, "]]>");
+      p += 3 + (size_t)length * 2;
+      break;
+    }
+    case BINXML_TOKEN_CHAR_REF:
+      if (end - p < 3)
+        return EVTX_ERROR_CORRUPTED;
+      status = buffer_printf(xml, "&#%u;", get_u16(p + 1));
+      r->attributeHasValue = r->inAttribute;
+      p += 3;
+      break;
+    case BINXML_TOKEN_ENTITY_REF:
+      p++;
+      status = read_name(r, &p, end, &name);
+      if (status == 0)
+        status = buffer_append_cstr(xml, "&");
+      if (status == 0)
+        status = write_name(xml, &name);
+      if (status == 0)
+        status = buffer_append_cstr(xml, ";");
+      r->attributeHasValue = r->inAttribute;
+      break;
+    case BINXML_TOKEN_PI_TARGET:
+      p++;
+      status = read_name(r, &p, end, &name);
+      if (status == 0)
+        status = buffer_append_cstr(xml, "<?");
+      if (status == 0)
+        status = write_name(xml, &name);
+      break;
+    case BINXML_TOKEN_PI_DATA: {
+      uint16_t length;
+      if (end - p < 3)
+        return EVTX_ERROR_CORRUPTED;
+      length = get_u16(p + 1);
+      if ((size_t)(end - p - 3) < (size_t)length * 2)
+        return EVTX_ERROR_CORRUPTED;
+      status = buffer_append_cstr(xml, " ");
+      if (status == 0)
+        status = buffer_append_utf16(xml, p + 3, length);
+      if (status == 0)
+        status = buffer_append_cstr(xml, "?>");
+      p += 3 + (size_t)length * 2;
+      break;
+    }
+    case BINXML_TOKEN_TEMPLATE_INSTANCE:
+      status = render_template_instance(r, &p, end);
+      break;
+    case BINXML_TOKEN_NORMAL_SUBSTITUTION:
+    case BINXML_TOKEN_OPTIONAL_SUBSTITUTION: {
+      uint16_t id;
+      if (end - p < 4)
+        return EVTX_ERROR_CORRUPTED;
+      id = get_u16(p + 1);
+      if (id >= valueCount)
+        return EVTX_ERROR_CORRUPTED;
+      status = render_substitution(r, &rendered->values[valueBase + id],
+                                   token == BINXML_TOKEN_OPTIONAL_SUBSTITUTION);
+      p += 4;
+      break;
+    }
+    case BINXML_TOKEN_FRAGMENT_HEADER:
+      p += 4;
+      break;
+    default:
+      return EVTX_ERROR_CORRUPTED;
+    }
+  }
+
+  return status;
+}
+
+/*
+ * Render the record into XML and capture its system values and
+ * EventData. The buffers of the rendered are reused.
+ */
+int
+winevt_evtx_render_record(const uint8_t* chunk, const struct WinevtEvtxRecord* record,
+                          struct WinevtEvtxRendered* rendered)
+{
+  struct EvtxRenderer r;
+  const uint8_t* p = record->data;
+
+  rendered->recordId = record->recordId;
+  rendered->xml.length = 0;
+  rendered->text.length = 0;
+  rendered->insertCount = 0;
+  rendered->valueCount = 0;
+  memset(rendered->system, 0, sizeof(rendered->system));
+
+  memset(&r, 0, sizeof(r));
+  r.chunk = chunk;
+  r.rendered = rendered;
+  r.capture = CAPTURE_NONE;
+
+  return render_tokens(&r, &p, record->data + record->size, 0, 0, 0);
+}
+
+void
+winevt_evtx_decoded_chunk_init(struct WinevtEvtxDecodedChunk* decoded)
+{
+  memset(decoded, 0, sizeof(*decoded));
+}
+
+void
+winevt_evtx_decoded_chunk_destroy(struct WinevtEvtxDecodedChunk* decoded)
+{
+  free(decoded->records);
+  free(decoded->xml.data);
+  free(decoded->text.data);
+  free(decoded->inserts);
+  memset(decoded, 0, sizeof(*decoded));
+}
+
+static int
+append_decoded_record(struct WinevtEvtxDecodedChunk* decoded,
+                      const struct WinevtEvtxRendered* rendered)
+{
+  struct WinevtEvtxDecodedRecord* record;
+
+  if (decoded->count == decoded->capacity) {
+    size_t capacity = decoded->capacity ? decoded->capacity * 2 : 64;
+    struct WinevtEvtxDecodedRecord* records =
+      realloc(decoded->records, sizeof(struct WinevtEvtxDecodedRecord) * capacity);
+    if (!records)
+      return EVTX_ERROR_NOMEM;
+    decoded->records = records;
+    decoded->capacity = capacity;
+  }
+  if (decoded->insertCount + rendered->insertCount > decoded->insertCapacity) {
+    size_t capacity = decoded->insertCapacity ? decoded->insertCapacity : 256;
+    struct WinevtEvtxText* inserts;
+    while (capacity < decoded->insertCount + rendered->insertCount) {
+      capacity *= 2;
+    }
+    inserts = realloc(decoded->inserts, sizeof(struct WinevtEvtxText) * capacity);
+    if (!inserts)
+      return EVTX_ERROR_NOMEM;
+    decoded->inserts = inserts;
+    decoded->insertCapacity = capacity;
+  }
+
+  record = &decoded->records[decoded->count];
+  record->recordId = rendered->recordId;
+  record->xmlOffset = decoded->xml.length;
+  record->xmlLength = rendered->xml.length;
+  record->textOffset = decoded->text.length;
+  record->textLength = rendered->text.length;
+  record->insertOffset = decoded->insertCount;
+  record->insertCount = rendered->insertCount;
+  memcpy(record->system, rendered->system, sizeof(record->system));
+  if (buffer_append(&decoded->xml, rendered->xml.data, rendered->xml.length) < 0 ||
+      buffer_append(&decoded->text, rendered->text.data, rendered->text.length) < 0)
+    return EVTX_ERROR_NOMEM;
+  if (rendered->insertCount > 0) {
+    memcpy(decoded->inserts + decoded->insertCount, rendered->inserts,
+           sizeof(struct WinevtEvtxText) * rendered->insertCount);
+  }
+  decoded->insertCount += rendered->insertCount;
+  decoded->count++;
+
+  return 0;
+}
+
+/*
+ * Render the records of the chunk whose EventRecordIDs are in
+ * [firstRecordId, lastRecordId] into decoded. This does not touch
+ * Ruby objects and can be called from the other threads with their
+ * own rendered and decoded. The records before a broken one are
+ * kept and the error is returned and set to decoded->status.
+ */
+int
+winevt_evtx_decode_chunk(const uint8_t* chunk, uint64_t firstRecordId, uint64_t lastRecordId,
+                         struct WinevtEvtxRendered* rendered,
+                         struct WinevtEvtxDecodedChunk* decoded)
+{
+  struct WinevtEvtxChunkHeader header;
+  struct WinevtEvtxRecord record;
+  uint32_t offset = 0;
+  int status;
+
+  /* The chunk may be read again at the same address after it is
+   * overwritten. */
+  rendered->templateChunk = NULL;
+  decoded->count = 0;
+  decoded->xml.length = 0;
+  decoded->text.length = 0;
+  decoded->insertCount = 0;
+
+  status = winevt_evtx_read_chunk_header(chunk, &header);
+  while (status == 0 && (status = winevt_evtx_next_record(chunk, &header, &offset, &record)) > 0) {
+    if (record.recordId < firstRecordId || record.recordId > lastRecordId) {
+      status = 0;
+      continue;
+    }
+    status = winevt_evtx_render_record(chunk, &record, rendered);
+    if (status == 0)
+      status = append_decoded_record(decoded, rendered);
+  }
+  decoded->status = status;
+
+  return status;
+}
+
+/* A view of the decoded record. It is valid until decoded is changed. */
+void
+winevt_evtx_decoded_record(const struct WinevtEvtxDecodedChunk* decoded, size_t index,
+                           struct WinevtEvtxRendered* view)
+{
+  const struct WinevtEvtxDecodedRecord* record = &decoded->records[index];
+
+  memset(view, 0, sizeof(*view));
+  view->recordId = record->recordId;
+  view->xml.data = decoded->xml.data + record->xmlOffset;
+  view->xml.length = record->xmlLength;
+  view->text.data = decoded->text.data + record->textOffset;
+  view->text.length = record->textLength;
+  memcpy(view->system, record->system, sizeof(view->system));
+  view->inserts = decoded->inserts + record->insertOffset;
+  view->insertCount = record->insertCount;
+}
@@ -0,0 +1,1130 @@
+#include <winevt_c.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::EvtxFile
+ *
+ * Read an archived .evtx file without wevtapi. The file is mapped
+ * into memory and its BinXML is rendered natively, so this also works
+ * on the other platforms than Windows.
+ *
+ * This yields the same values as Query with Flag::FilePath except
+ * that the messages are not formatted, because they need the
+ * publisher metadata on the host which wrote the file.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @evtx = Winevt::EventLog::EvtxFile.new("Application.evtx")
+ *
+ *  @evtx.each do |eventlog, message, string_inserts|
+ *    puts ({eventlog: eventlog, data: string_inserts})
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cEvtxFile;
+VALUE rb_eEvtxFileError;
+VALUE rb_cEvtxTemplateCache;
+
+static ID id_template_cache;
+
+struct WinevtEvtxFile
+{
+  struct WinevtMappedFile file;
+  struct WinevtEvtxFileHeader header;
+  size_t chunkCount;
+  unsigned long long corruptedChunks;
+  int renderAsXML;
+  int preserveQualifiers;
+  int preserveSID;
+  size_t workers;
+  uint64_t firstRecordId;
+  uint64_t lastRecordId;
+  struct WinevtEvtxDecoder* decoder;
+};
+
+static void evtx_file_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_evtx_file_type = { "winevt/evtx_file",
+                                                         {
+                                                           0,
+                                                           evtx_file_free,
+                                                           0,
+                                                         },
+                                                         NULL,
+                                                         NULL,
+                                                         RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+evtx_file_free(void* ptr)
+{
+  struct WinevtEvtxFile* winevtEvtxFile = (struct WinevtEvtxFile*)ptr;
+
+  winevt_unmap_file(&winevtEvtxFile->file);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_evtx_file_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtEvtxFile* winevtEvtxFile;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtEvtxFile, &rb_winevt_evtx_file_type, winevtEvtxFile);
+  return obj;
+}
+
+static struct WinevtEvtxFile*
+get_evtx_file(VALUE self)
+{
+  struct WinevtEvtxFile* winevtEvtxFile;
+
+  TypedData_Get_Struct(self, struct WinevtEvtxFile, &rb_winevt_evtx_file_type, winevtEvtxFile);
+
+  return winevtEvtxFile;
+}
+
+static void template_cache_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_template_cache_type = { "winevt/evtx_template_cache",
+                                                              {
+                                                                0,
+                                                                template_cache_free,
+                                                                0,
+                                                              },
+                                                              NULL,
+                                                              NULL,
+                                                              RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+template_cache_free(void* ptr)
+{
+  winevt_evtx_template_cache_destroy((struct WinevtEvtxTemplateCache*)ptr);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_template_cache_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtEvtxTemplateCache* cache;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtEvtxTemplateCache, &rb_winevt_template_cache_type, cache);
+  winevt_evtx_template_cache_init(cache);
+  return obj;
+}
+
+struct WinevtEvtxTemplateCache*
+winevt_evtx_get_template_cache(VALUE self)
+{
+  struct WinevtEvtxTemplateCache* cache;
+
+  TypedData_Get_Struct(
+    self, struct WinevtEvtxTemplateCache, &rb_winevt_template_cache_type, cache);
+
+  return cache;
+}
+
+/*
+ * This method returns the number of the compiled templates.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_template_cache_size(VALUE self)
+{
+  struct WinevtEvtxTemplateCache* cache = winevt_evtx_get_template_cache(self);
+  size_t size;
+
+  winevt_mutex_lock(&cache->lock);
+  size = cache->size;
+  winevt_mutex_unlock(&cache->lock);
+
+  return SIZET2NUM(size);
+}
+
+/*
+ * This method returns how many times the template definitions in the
+ * chunks are found in the cache.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_template_cache_hits(VALUE self)
+{
+  struct WinevtEvtxTemplateCache* cache = winevt_evtx_get_template_cache(self);
+  unsigned long long hits;
+
+  winevt_mutex_lock(&cache->lock);
+  hits = cache->hits;
+  winevt_mutex_unlock(&cache->lock);
+
+  return ULL2NUM(hits);
+}
+
+/*
+ * This method returns how many times the template definitions are
+ * compiled.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_template_cache_misses(VALUE self)
+{
+  struct WinevtEvtxTemplateCache* cache = winevt_evtx_get_template_cache(self);
+  unsigned long long misses;
+
+  winevt_mutex_lock(&cache->lock);
+  misses = cache->misses;
+  winevt_mutex_unlock(&cache->lock);
+
+  return ULL2NUM(misses);
+}
+
+static struct WinevtEvtxFile*
+get_opened_evtx_file(VALUE self)
+{
+  struct WinevtEvtxFile* winevtEvtxFile = get_evtx_file(self);
+
+  if (!winevtEvtxFile->file.data) {
+    rb_raise(rb_eIOError, "closed evtx file");
+  }
+
+  return winevtEvtxFile;
+}
+
+static VALUE
+text_to_rb_str(const struct WinevtEvtxRendered* rendered, const struct WinevtEvtxText* text)
+{
+  return rb_utf8_str_new(rendered->text.data + text->offset, text->length);
+}
+
+static VALUE
+system_to_rb_str(const struct WinevtEvtxRendered* rendered, int index)
+{
+  const struct WinevtEvtxText* text = &rendered->system[index];
+
+  return text->present ? text_to_rb_str(rendered, text) : Qnil;
+}
+
+static unsigned long long
+system_to_ull(const struct WinevtEvtxRendered* rendered, int index)
+{
+  const struct WinevtEvtxText* text = &rendered->system[index];
+  char buffer[32];
+  size_t length = text->length < sizeof(buffer) - 1 ? text->length : sizeof(buffer) - 1;
+
+  if (!text->present)
+    return 0;
+  memcpy(buffer, rendered->text.data + text->offset, length);
+  buffer[length] = '\0';
+
+  return strtoull(buffer, NULL, 0);
+}
+
+/*
+ * TimeCreated is rendered as "2024-01-02T03:04:05.1234567Z" in XML.
+ * The Hash has the same format as render_system_event.
+ */
+static VALUE
+time_created_to_rb_str(const struct WinevtEvtxRendered* rendered)
+{
+  const struct WinevtEvtxText* text = &rendered->system[EVTX_SYSTEM_TIME_CREATED];
+  char buffer[40];
+  unsigned year, month, day, hour, minute, second, fraction;
+  size_t length = text->length < sizeof(buffer) - 1 ? text->length : sizeof(buffer) - 1;
+
+  if (!text->present)
+    return Qnil;
+  memcpy(buffer, rendered->text.data + text->offset, length);
+  buffer[length] = '\0';
+  if (sscanf(buffer, "%4u-%2u-%2uT%2u:%2u:%2u.%7u", &year, &month, &day, &hour, &minute,
+             &second, &fraction) != 7) {
+    return text_to_rb_str(rendered, text);
+  }
+
+  snprintf(buffer, sizeof(buffer), "%02u/%02u/%02u %02u:%02u:%02u.%llu", year, month, day,
+           hour, minute, second, (unsigned long long)fraction * 100);
+
+  return rb_str_new2(buffer);
+}
+
+static VALUE
+system_to_rb_hash(const struct WinevtEvtxRendered* rendered, int preserveQualifiers,
+                  int preserveSID)
+{
+  VALUE hash = rb_hash_new();
+  unsigned long eventId = (unsigned long)system_to_ull(rendered, EVTX_SYSTEM_EVENT_ID);
+  VALUE rbstr;
+
+  rbstr = system_to_rb_str(rendered, EVTX_SYSTEM_PROVIDER_NAME);
+  rb_hash_aset(hash, rb_str_new2("ProviderName"), NIL_P(rbstr) ? rb_utf8_str_new_cstr("") : rbstr);
+  rb_hash_aset(hash, rb_str_new2("ProviderGuid"),
+               system_to_rb_str(rendered, EVTX_SYSTEM_PROVIDER_GUID));
+
+  if (preserveQualifiers) {
+    if (rendered->system[EVTX_SYSTEM_QUALIFIERS].present) {
+      rb_hash_aset(hash, rb_str_new2("Qualifiers"),
+                   INT2NUM((int)system_to_ull(rendered, EVTX_SYSTEM_QUALIFIERS)));
+    } else {
+      rb_hash_aset(hash, rb_str_new2("Qualifiers"), rb_str_new2(""));
+    }
+    rb_hash_aset(hash, rb_str_new2("EventID"), INT2NUM((int)eventId));
+  } else {
+    if (rendered->system[EVTX_SYSTEM_QUALIFIERS].present) {
+      eventId |= (unsigned long)system_to_ull(rendered, EVTX_SYSTEM_QUALIFIERS) << 16;
+    }
+    rb_hash_aset(hash, rb_str_new2("EventID"), ULONG2NUM(eventId));
+  }
+
+  rb_hash_aset(hash, rb_str_new2("Version"),
+               INT2NUM((int)system_to_ull(rendered, EVTX_SYSTEM_VERSION)));
+  rb_hash_aset(hash, rb_str_new2("Level"),
+               INT2NUM((int)system_to_ull(rendered, EVTX_SYSTEM_LEVEL)));
+  rb_hash_aset(hash, rb_str_new2("Task"),
+               INT2NUM((int)system_to_ull(rendered, EVTX_SYSTEM_TASK)));
+  rb_hash_aset(hash, rb_str_new2("Opcode"),
+               INT2NUM((int)system_to_ull(rendered, EVTX_SYSTEM_OPCODE)));
+  rbstr = system_to_rb_str(rendered, EVTX_SYSTEM_KEYWORDS);
+  rb_hash_aset(hash, rb_str_new2("Keywords"),
+               NIL_P(rbstr) ? Qnil : rb_str_new(RSTRING_PTR(rbstr), RSTRING_LEN(rbstr)));
+  rb_hash_aset(hash, rb_str_new2("TimeCreated"), time_created_to_rb_str(rendered));
+  rbstr = system_to_rb_str(rendered, EVTX_SYSTEM_EVENT_RECORD_ID);
+  rb_hash_aset(hash, rb_str_new2("EventRecordID"),
+               NIL_P(rbstr) ? Qnil : rb_str_new(RSTRING_PTR(rbstr), RSTRING_LEN(rbstr)));
+
+  if (rendered->system[EVTX_SYSTEM_ACTIVITY_ID].present) {
+    rb_hash_aset(hash, rb_str_new2("ActivityID"),
+                 system_to_rb_str(rendered, EVTX_SYSTEM_ACTIVITY_ID));
+  }
+  if (rendered->system[EVTX_SYSTEM_RELATED_ACTIVITY_ID].present) {
+    rb_hash_aset(hash, rb_str_new2("RelatedActivityID"),
+                 system_to_rb_str(rendered, EVTX_SYSTEM_RELATED_ACTIVITY_ID));
+  }
+
+  rb_hash_aset(hash, rb_str_new2("ProcessID"),
+               UINT2NUM((unsigned int)system_to_ull(rendered, EVTX_SYSTEM_PROCESS_ID)));
+  rb_hash_aset(hash, rb_str_new2("ThreadID"),
+               UINT2NUM((unsigned int)system_to_ull(rendered, EVTX_SYSTEM_THREAD_ID)));
+  rbstr = system_to_rb_str(rendered, EVTX_SYSTEM_CHANNEL);
+  rb_hash_aset(hash, rb_str_new2("Channel"), NIL_P(rbstr) ? rb_utf8_str_new_cstr("") : rbstr);
+  rbstr = system_to_rb_str(rendered, EVTX_SYSTEM_COMPUTER);
+  rb_hash_aset(hash, rb_str_new2("Computer"), NIL_P(rbstr) ? rb_utf8_str_new_cstr("") : rbstr);
+
+  /* The account name of UserID is not looked up because the SID
+   * belongs to the host which wrote the file. */
+  if (preserveSID && rendered->system[EVTX_SYSTEM_USER_ID].present) {
+    rb_hash_aset(hash, rb_str_new2("UserID"),
+                 system_to_rb_str(rendered, EVTX_SYSTEM_USER_ID));
+  }
+
+  return hash;
+}
+
+/*
+ * Build (Stringified EventLog or Hash of the system values, message,
+ * string inserts) as Query#each yields.
+ */
+VALUE
+winevt_evtx_rendered_to_rb_ary(const struct WinevtEvtxRendered* rendered, int renderAsXML,
+                               int preserveQualifiers, int preserveSID)
+{
+  VALUE eventlog, inserts;
+
+  if (renderAsXML) {
+    eventlog = rb_utf8_str_new(rendered->xml.data, rendered->xml.length);
+  } else {
+    eventlog = system_to_rb_hash(rendered, preserveQualifiers, preserveSID);
+  }
+
+  inserts = rb_ary_new_capa(rendered->insertCount);
+  for (size_t i = 0; i < rendered->insertCount; i++) {
+    const struct WinevtEvtxText* text = &rendered->inserts[i];
+    rb_ary_push(inserts, text->present ? text_to_rb_str(rendered, text) : Qnil);
+  }
+
+  return rb_ary_new_from_args(3, eventlog, rb_utf8_str_new_cstr(""), inserts);
+}
+
+/*
+ * Initalize EvtxFile class.
+ *
+ * @param path [String] Path of .evtx file.
+ * @return [EvtxFile]
+ * @raise [EvtxFile::Error] when the file header is broken.
+ *
+ */
+static VALUE
+rb_winevt_evtx_file_initialize(VALUE self, VALUE rb_path)
+{
+  struct WinevtEvtxFile* winevtEvtxFile = get_evtx_file(self);
+  int error;
+
+  FilePathValue(rb_path);
+  rb_path = rb_str_export_to_enc(rb_path, rb_utf8_encoding());
+  if (winevtEvtxFile->file.data) {
+    rb_raise(rb_eRuntimeError, "already initialized evtx file");
+  }
+
+  error = winevt_map_file(StringValueCStr(rb_path), &winevtEvtxFile->file);
+  if (error == EINVAL) {
+    rb_raise(rb_eEvtxFileError, "Empty evtx file: %" PRIsVALUE, rb_path);
+  } else if (error != 0) {
+    rb_syserr_fail_str(error, rb_path);
+  }
+  if (winevt_evtx_read_file_header(winevtEvtxFile->file.data, winevtEvtxFile->file.size,
+                                   &winevtEvtxFile->header) < 0) {
+    winevt_unmap_file(&winevtEvtxFile->file);
+    rb_raise(rb_eEvtxFileError, "Invalid evtx file header: %" PRIsVALUE, rb_path);
+  }
+
+  winevtEvtxFile->chunkCount = winevt_evtx_chunk_count(winevtEvtxFile->file.size);
+  winevtEvtxFile->corruptedChunks = 0;
+  winevtEvtxFile->renderAsXML = 1;
+  winevtEvtxFile->preserveQualifiers = 0;
+  winevtEvtxFile->preserveSID = 1;
+  winevtEvtxFile->workers = 1;
+  winevtEvtxFile->firstRecordId = 0;
+  winevtEvtxFile->lastRecordId = UINT64_MAX;
+  rb_ivar_set(self, id_template_cache, rb_class_new_instance(0, NULL, rb_cEvtxTemplateCache));
+
+  return Qnil;
+}
+
+struct EvtxChunkOrder
+{
+  size_t index;
+  uint64_t firstRecordId;
+};
+
+static int
+compare_chunk_order(const void* a, const void* b)
+{
+  uint64_t x = ((const struct EvtxChunkOrder*)a)->firstRecordId;
+  uint64_t y = ((const struct EvtxChunkOrder*)b)->firstRecordId;
+
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+ * Decode the chunks on the worker threads. The decoded chunks are put
+ * into a reorder buffer of `window` slots by their sequence, and they
+ * are yielded in the sequence, which is the order of EventRecordID.
+ * The workers do not go ahead more than the window.
+ */
+struct WinevtEvtxDecoder
+{
+  const uint8_t* data;
+  struct EvtxChunkOrder* chunks;
+  size_t chunkCount;
+  uint64_t firstRecordId;
+  uint64_t lastRecordId;
+  struct WinevtEvtxTemplateCache* templateCache;
+  winevt_mutex_t lock;
+  winevt_cond_t ready;
+  winevt_cond_t space;
+  winevt_thread_t* threads;
+  size_t workerCount;
+  size_t startedCount;
+  struct WinevtEvtxDecodedChunk* slots;
+  int* slotReady;
+  size_t window;
+  size_t nextChunk;
+  size_t consumed;
+  int cancelled;
+};
+
+static void*
+decoder_worker(void* ptr)
+{
+  struct WinevtEvtxDecoder* decoder = (struct WinevtEvtxDecoder*)ptr;
+  struct WinevtEvtxRendered rendered;
+
+  winevt_evtx_rendered_init(&rendered);
+  rendered.templateCache = decoder->templateCache;
+  for (;;) {
+    size_t sequence;
+    struct WinevtEvtxDecodedChunk* slot;
+
+    winevt_mutex_lock(&decoder->lock);
+    while (!decoder->cancelled && decoder->nextChunk < decoder->chunkCount &&
+           decoder->nextChunk >= decoder->consumed + decoder->window) {
+      winevt_cond_wait(&decoder->space, &decoder->lock);
+    }
+    if (decoder->cancelled || decoder->nextChunk >= decoder->chunkCount) {
+      winevt_mutex_unlock(&decoder->lock);
+      break;
+    }
+    sequence = decoder->nextChunk++;
+    winevt_mutex_unlock(&decoder->lock);
+
+    slot = &decoder->slots[sequence % decoder->window];
+    winevt_evtx_decode_chunk(decoder->data + EVTX_FILE_HEADER_SIZE +
+                               decoder->chunks[sequence].index * EVTX_CHUNK_SIZE,
+                             decoder->firstRecordId, decoder->lastRecordId, &rendered, slot);
+
+    winevt_mutex_lock(&decoder->lock);
+    decoder->slotReady[sequence % decoder->window] = 1;
+    winevt_cond_broadcast(&decoder->ready);
+    winevt_mutex_unlock(&decoder->lock);
+  }
+  winevt_evtx_rendered_destroy(&rendered);
+
+  return NULL;
+}
+
+/* Cancel the workers and wait for them. */
+static void*
+stop_decoder(void* ptr)
+{
+  struct WinevtEvtxDecoder* decoder = (struct WinevtEvtxDecoder*)ptr;
+
+  winevt_mutex_lock(&decoder->lock);
+  decoder->cancelled = 1;
+  winevt_cond_broadcast(&decoder->space);
+  winevt_mutex_unlock(&decoder->lock);
+
+  for (size_t i = 0; i < decoder->startedCount; i++) {
+    winevt_thread_join(decoder->threads[i]);
+  }
+  decoder->startedCount = 0;
+
+  return NULL;
+}
+
+struct WaitChunkArgs
+{
+  struct WinevtEvtxDecoder* decoder;
+  size_t sequence;
+  int interrupted;
+};
+
+static void*
+wait_chunk_without_gvl(void* ptr)
+{
+  struct WaitChunkArgs* args = (struct WaitChunkArgs*)ptr;
+  struct WinevtEvtxDecoder* decoder = args->decoder;
+
+  winevt_mutex_lock(&decoder->lock);
+  while (!decoder->slotReady[args->sequence % decoder->window] && !args->interrupted) {
+    winevt_cond_wait(&decoder->ready, &decoder->lock);
+  }
+  winevt_mutex_unlock(&decoder->lock);
+
+  return NULL;
+}
+
+static void
+interrupt_wait_chunk(void* ptr)
+{
+  struct WaitChunkArgs* args = (struct WaitChunkArgs*)ptr;
+  struct WinevtEvtxDecoder* decoder = args->decoder;
+
+  winevt_mutex_lock(&decoder->lock);
+  args->interrupted = 1;
+  winevt_cond_broadcast(&decoder->ready);
+  winevt_mutex_unlock(&decoder->lock);
+}
+
+struct EvtxEachArgs
+{
+  VALUE self;
+  VALUE rb_templateCache;
+  struct WinevtEvtxDecoder decoder;
+  int lockInitialized;
+  struct WinevtEvtxRendered rendered;
+  int renderedInitialized;
+};
+
+/* Sort the chunks which have the records in the range. */
+static void
+collect_chunks(struct WinevtEvtxFile* winevtEvtxFile, struct WinevtEvtxDecoder* decoder)
+{
+  /* The chunks are reused as a ring buffer. They are read in the order
+   * of their records. */
+  for (size_t i = 0; i < winevtEvtxFile->chunkCount; i++) {
+    const uint8_t* chunk =
+      winevtEvtxFile->file.data + EVTX_FILE_HEADER_SIZE + i * EVTX_CHUNK_SIZE;
+    struct WinevtEvtxChunkHeader header;
+
+    if (winevt_evtx_read_chunk_header(chunk, &header) < 0) {
+      /* Unused chunks are zero filled. */
+      if (memcmp(chunk, "ElfChnk", 8) == 0) {
+        winevtEvtxFile->corruptedChunks++;
+      }
+      continue;
+    }
+    if (header.lastRecordId < decoder->firstRecordId ||
+        header.firstRecordId > decoder->lastRecordId) {
+      continue;
+    }
+    decoder->chunks[decoder->chunkCount].index = i;
+    decoder->chunks[decoder->chunkCount].firstRecordId = header.firstRecordId;
+    decoder->chunkCount++;
+  }
+  qsort(decoder->chunks, decoder->chunkCount, sizeof(struct EvtxChunkOrder),
+        compare_chunk_order);
+}
+
+static void
+yield_decoded_chunk(VALUE self, const struct WinevtEvtxDecodedChunk* decoded)
+{
+  for (size_t i = 0; i < decoded->count; i++) {
+    struct WinevtEvtxFile* winevtEvtxFile = get_opened_evtx_file(self);
+    struct WinevtEvtxRendered view;
+    VALUE rb_values;
+
+    winevt_evtx_decoded_record(decoded, i, &view);
+    rb_values = winevt_evtx_rendered_to_rb_ary(&view,
+                                               winevtEvtxFile->renderAsXML,
+                                               winevtEvtxFile->preserveQualifiers,
+                                               winevtEvtxFile->preserveSID);
+    rb_yield_values(3,
+                    RARRAY_AREF(rb_values, 0),
+                    RARRAY_AREF(rb_values, 1),
+                    RARRAY_AREF(rb_values, 2));
+  }
+  if (decoded->status == EVTX_ERROR_NOMEM) {
+    rb_memerror();
+  } else if (decoded->status < 0) {
+    get_evtx_file(self)->corruptedChunks++;
+  }
+}
+
+static VALUE
+evtx_file_each_chunk(VALUE ptr)
+{
+  struct EvtxEachArgs* args = (struct EvtxEachArgs*)ptr;
+  struct WinevtEvtxDecoder* decoder = &args->decoder;
+  struct WinevtEvtxFile* winevtEvtxFile = get_opened_evtx_file(args->self);
+
+  collect_chunks(winevtEvtxFile, decoder);
+
+  if (decoder->workerCount <= 1) {
+    winevt_evtx_rendered_init(&args->rendered);
+    args->rendered.templateCache = decoder->templateCache;
+    args->renderedInitialized = 1;
+    for (size_t i = 0; i < decoder->chunkCount; i++) {
+      /* The file may be closed in the block. */
+      winevtEvtxFile = get_opened_evtx_file(args->self);
+      winevt_evtx_decode_chunk(winevtEvtxFile->file.data + EVTX_FILE_HEADER_SIZE +
+                                 decoder->chunks[i].index * EVTX_CHUNK_SIZE,
+                               decoder->firstRecordId, decoder->lastRecordId, &args->rendered,
+                               &decoder->slots[0]);
+      yield_decoded_chunk(args->self, &decoder->slots[0]);
+    }
+    return Qnil;
+  }
+
+  winevt_mutex_init(&decoder->lock);
+  winevt_cond_init(&decoder->ready);
+  winevt_cond_init(&decoder->space);
+  args->lockInitialized = 1;
+  for (size_t i = 0; i < decoder->workerCount && i < decoder->chunkCount; i++) {
+    int error = winevt_thread_create(&decoder->threads[i], decoder_worker, decoder);
+    if (error != 0) {
+      rb_syserr_fail(error, "Cannot create a decoder thread");
+    }
+    decoder->startedCount++;
+  }
+  winevtEvtxFile->decoder = decoder;
+
+  for (size_t sequence = 0; sequence < decoder->chunkCount; sequence++) {
+    struct WaitChunkArgs waitArgs;
+    size_t slot = sequence % decoder->window;
+
+    /* The workers are stopped when the file is closed in the block. */
+    get_opened_evtx_file(args->self);
+    waitArgs.decoder = decoder;
+    waitArgs.sequence = sequence;
+    for (;;) {
+      waitArgs.interrupted = 0;
+      rb_thread_call_without_gvl(wait_chunk_without_gvl, &waitArgs,
+                                 interrupt_wait_chunk, &waitArgs);
+      if (!waitArgs.interrupted) {
+        break;
+      }
+      rb_thread_check_ints();
+    }
+
+    yield_decoded_chunk(args->self, &decoder->slots[slot]);
+
+    winevt_mutex_lock(&decoder->lock);
+    decoder->slotReady[slot] = 0;
+    decoder->consumed++;
+    winevt_cond_broadcast(&decoder->space);
+    winevt_mutex_unlock(&decoder->lock);
+  }
+
+  return Qnil;
+}
+
+static VALUE
+evtx_file_each_ensure(VALUE ptr)
+{
+  struct EvtxEachArgs* args = (struct EvtxEachArgs*)ptr;
+  struct WinevtEvtxDecoder* decoder = &args->decoder;
+  struct WinevtEvtxFile* winevtEvtxFile = get_evtx_file(args->self);
+
+  if (args->lockInitialized) {
+    rb_thread_call_without_gvl(stop_decoder, decoder, NULL, NULL);
+    winevt_cond_destroy(&decoder->space);
+    winevt_cond_destroy(&decoder->ready);
+    winevt_mutex_destroy(&decoder->lock);
+  }
+  if (winevtEvtxFile->decoder == decoder) {
+    winevtEvtxFile->decoder = NULL;
+  }
+  if (args->renderedInitialized) {
+    winevt_evtx_rendered_destroy(&args->rendered);
+  }
+  for (size_t i = 0; i < decoder->window; i++) {
+    winevt_evtx_decoded_chunk_destroy(&decoder->slots[i]);
+  }
+  free(decoder->slots);
+  free(decoder->slotReady);
+  free(decoder->threads);
+  free(decoder->chunks);
+
+  return Qnil;
+}
+
+/*
+ * Enumerate the records in the order of EventRecordID.
+ *
+ * This method yields the following:
+ * (Stringified EventLog or Hash of the system values, empty message,
+ * Stringified insert values)
+ *
+ * When #workers is more than 1, the chunks are decoded on the worker
+ * threads ahead of yielding. Only the records in #record_range are
+ * decoded, and the chunks out of the range are skipped by their
+ * headers. The broken chunks are skipped and counted as
+ * corrupted_chunks.
+ *
+ * @yield (String,String,Array)
+ *
+ */
+static VALUE
+rb_winevt_evtx_file_each(VALUE self)
+{
+  struct WinevtEvtxFile* winevtEvtxFile;
+  struct EvtxEachArgs args;
+  struct WinevtEvtxDecoder* decoder = &args.decoder;
+  VALUE rb_result;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  winevtEvtxFile = get_opened_evtx_file(self);
+  memset(&args, 0, sizeof(args));
+  args.self = self;
+  /* The cache is kept while reading even if it is replaced. */
+  args.rb_templateCache = rb_ivar_get(self, id_template_cache);
+  if (!NIL_P(args.rb_templateCache)) {
+    decoder->templateCache = winevt_evtx_get_template_cache(args.rb_templateCache);
+  }
+  decoder->data = winevtEvtxFile->file.data;
+  decoder->firstRecordId = winevtEvtxFile->firstRecordId;
+  decoder->lastRecordId = winevtEvtxFile->lastRecordId;
+  decoder->workerCount = winevtEvtxFile->workers;
+  decoder->window = decoder->workerCount <= 1 ? 1 : decoder->workerCount * 2;
+  decoder->chunks = malloc(sizeof(struct EvtxChunkOrder) *
+                           (winevtEvtxFile->chunkCount ? winevtEvtxFile->chunkCount : 1));
+  decoder->slots = calloc(decoder->window, sizeof(struct WinevtEvtxDecodedChunk));
+  decoder->slotReady = calloc(decoder->window, sizeof(int));
+  decoder->threads = calloc(decoder->workerCount, sizeof(winevt_thread_t));
+  if (!decoder->chunks || !decoder->slots || !decoder->slotReady || !decoder->threads) {
+    free(decoder->chunks);
+    free(decoder->slots);
+    free(decoder->slotReady);
+    free(decoder->threads);
+    rb_memerror();
+  }
+
+  rb_result =
+    rb_ensure(evtx_file_each_chunk, (VALUE)&args, evtx_file_each_ensure, (VALUE)&args);
+  RB_GC_GUARD(args.rb_templateCache);
+
+  return rb_result;
+}
+
+/*
+ * This method returns the number of the chunks in the file.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_file_chunk_count(VALUE self)
+{
+  return SIZET2NUM(get_opened_evtx_file(self)->chunkCount);
+}
+
+/*
+ * This method returns the EventRecordID which is used for the next
+ * record in the file header.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_file_next_record_id(VALUE self)
+{
+  return ULL2NUM(get_opened_evtx_file(self)->header.nextRecordId);
+}
+
+/*
+ * This method returns the number of the broken chunks which are
+ * skipped by #each.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_file_corrupted_chunks(VALUE self)
+{
+  return ULL2NUM(get_evtx_file(self)->corruptedChunks);
+}
+
+/*
+ * This method returns whether render as xml or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_file_render_as_xml_p(VALUE self)
+{
+  return get_evtx_file(self)->renderAsXML ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether render as xml or not.
+ *
+ * @param rb_render_as_xml [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_file_set_render_as_xml(VALUE self, VALUE rb_render_as_xml)
+{
+  get_evtx_file(self)->renderAsXML = RTEST(rb_render_as_xml);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether preserving qualifiers key or not.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_file_get_preserve_qualifiers_p(VALUE self)
+{
+  return get_evtx_file(self)->preserveQualifiers ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether preserving qualifiers key or not.
+ *
+ * @param rb_preserve_qualifiers [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_file_set_preserve_qualifiers(VALUE self, VALUE rb_preserve_qualifiers)
+{
+  get_evtx_file(self)->preserveQualifiers = RTEST(rb_preserve_qualifiers);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether preserving SID or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_file_preserve_sid_p(VALUE self)
+{
+  return get_evtx_file(self)->preserveSID ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether preserving SID or not.
+ *
+ * @param rb_preserve_sid_p [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_file_set_preserve_sid(VALUE self, VALUE rb_preserve_sid_p)
+{
+  get_evtx_file(self)->preserveSID = RTEST(rb_preserve_sid_p);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the number of the threads which decode the
+ * chunks in #each.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_file_get_workers(VALUE self)
+{
+  return SIZET2NUM(get_evtx_file(self)->workers);
+}
+
+/*
+ * This method specifies the number of the threads which decode the
+ * chunks in #each. 1 decodes them on the calling thread.
+ *
+ * @param rb_workers [Integer]
+ */
+static VALUE
+rb_winevt_evtx_file_set_workers(VALUE self, VALUE rb_workers)
+{
+  long workers = NUM2LONG(rb_workers);
+
+  if (workers < 1 || workers > EVTX_MAX_WORKERS) {
+    rb_raise(rb_eArgError, "workers must be between 1 and %d", EVTX_MAX_WORKERS);
+  }
+  get_evtx_file(self)->workers = (size_t)workers;
+
+  return Qnil;
+}
+
+/*
+ * This method returns the range of EventRecordID which #each reads.
+ *
+ * @return [Range, nil] nil means all of the records.
+ */
+static VALUE
+rb_winevt_evtx_file_get_record_range(VALUE self)
+{
+  struct WinevtEvtxFile* winevtEvtxFile = get_evtx_file(self);
+
+  if (winevtEvtxFile->firstRecordId == 0 && winevtEvtxFile->lastRecordId == UINT64_MAX) {
+    return Qnil;
+  }
+
+  return rb_range_new(ULL2NUM(winevtEvtxFile->firstRecordId),
+                      winevtEvtxFile->lastRecordId == UINT64_MAX
+                        ? Qnil
+                        : ULL2NUM(winevtEvtxFile->lastRecordId),
+                      0);
+}
+
+/*
+ * This method specifies the range of EventRecordID which #each
+ * reads. The chunks out of the range are not decoded.
+ *
+ * @param rb_range [Range, nil] The beginning or the end can be nil.
+ */
+static VALUE
+rb_winevt_evtx_file_set_record_range(VALUE self, VALUE rb_range)
+{
+  struct WinevtEvtxFile* winevtEvtxFile = get_evtx_file(self);
+  VALUE rb_begin, rb_end;
+  int exclusive;
+  uint64_t first = 0, last = UINT64_MAX;
+
+  if (!NIL_P(rb_range)) {
+    if (!rb_range_values(rb_range, &rb_begin, &rb_end, &exclusive)) {
+      rb_raise(rb_eTypeError, "record_range must be a Range or nil");
+    }
+    if (!NIL_P(rb_begin)) {
+      first = NUM2ULL(rb_begin);
+    }
+    if (!NIL_P(rb_end)) {
+      last = NUM2ULL(rb_end);
+      if (exclusive) {
+        if (last == 0) {
+          rb_raise(rb_eArgError, "record_range is empty");
+        }
+        last--;
+      }
+    }
+    if (first > last) {
+      rb_raise(rb_eArgError, "record_range is empty");
+    }
+  }
+  winevtEvtxFile->firstRecordId = first;
+  winevtEvtxFile->lastRecordId = last;
+
+  return Qnil;
+}
+
+/*
+ * This method returns the cache of the compiled templates.
+ *
+ * @return [EvtxFile::TemplateCache, nil]
+ */
+static VALUE
+rb_winevt_evtx_file_get_template_cache(VALUE self)
+{
+  return rb_ivar_get(self, id_template_cache);
+}
+
+/*
+ * This method specifies the cache of the compiled templates. The
+ * files which are written by the same host can share a cache because
+ * they have the same templates. nil disables the cache.
+ *
+ * @param rb_template_cache [EvtxFile::TemplateCache, nil]
+ */
+static VALUE
+rb_winevt_evtx_file_set_template_cache(VALUE self, VALUE rb_template_cache)
+{
+  if (!NIL_P(rb_template_cache)) {
+    winevt_evtx_get_template_cache(rb_template_cache);
+  }
+  rb_ivar_set(self, id_template_cache, rb_template_cache);
+
+  return Qnil;
+}
+
+/*
+ * This method unmaps the file.
+ *
+ */
+static VALUE
+rb_winevt_evtx_file_close(VALUE self)
+{
+  struct WinevtEvtxFile* winevtEvtxFile = get_evtx_file(self);
+
+  /* The workers of #each may still read the mapped chunks. */
+  if (winevtEvtxFile->decoder) {
+    rb_thread_call_without_gvl(stop_decoder, winevtEvtxFile->decoder, NULL, NULL);
+  }
+  winevt_unmap_file(&winevtEvtxFile->file);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether the file is closed or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_file_closed_p(VALUE self)
+{
+  return get_evtx_file(self)->file.data ? Qfalse : Qtrue;
+}
+
+void
+Init_winevt_evtx_file(VALUE rb_cEventLog)
+{
+  rb_cEvtxFile = rb_define_class_under(rb_cEventLog, "EvtxFile", rb_cObject);
+  rb_define_alloc_func(rb_cEvtxFile, rb_winevt_evtx_file_alloc);
+
+  /*
+   * Raised when the file is not an EVTX file.
+   * @since 0.12.0
+   */
+  rb_eEvtxFileError = rb_define_class_under(rb_cEvtxFile, "Error", rb_eStandardError);
+
+  /*
+   * Document-class: Winevt::EventLog::EvtxFile::TemplateCache
+   *
+   * The template definitions which are compiled once and shared by
+   * the chunks and the files.
+   *
+   * @since 0.12.0
+   */
+  rb_cEvtxTemplateCache = rb_define_class_under(rb_cEvtxFile, "TemplateCache", rb_cObject);
+  rb_define_alloc_func(rb_cEvtxTemplateCache, rb_winevt_template_cache_alloc);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTemplateCache, "size", rb_winevt_template_cache_size, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTemplateCache, "hits", rb_winevt_template_cache_hits, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTemplateCache, "misses", rb_winevt_template_cache_misses, 0);
+
+  id_template_cache = rb_intern("@template_cache");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "initialize", rb_winevt_evtx_file_initialize, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "each", rb_winevt_evtx_file_each, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "chunk_count", rb_winevt_evtx_file_chunk_count, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "next_record_id", rb_winevt_evtx_file_next_record_id, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "corrupted_chunks", rb_winevt_evtx_file_corrupted_chunks, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "render_as_xml?", rb_winevt_evtx_file_render_as_xml_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "render_as_xml=", rb_winevt_evtx_file_set_render_as_xml, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cEvtxFile, "preserve_qualifiers?", rb_winevt_evtx_file_get_preserve_qualifiers_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cEvtxFile, "preserve_qualifiers=", rb_winevt_evtx_file_set_preserve_qualifiers, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "preserve_sid?", rb_winevt_evtx_file_preserve_sid_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "preserve_sid=", rb_winevt_evtx_file_set_preserve_sid, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "workers", rb_winevt_evtx_file_get_workers, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "workers=", rb_winevt_evtx_file_set_workers, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "record_range", rb_winevt_evtx_file_get_record_range, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "record_range=", rb_winevt_evtx_file_set_record_range, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "template_cache", rb_winevt_evtx_file_get_template_cache, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "template_cache=", rb_winevt_evtx_file_set_template_cache, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "close", rb_winevt_evtx_file_close, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxFile, "closed?", rb_winevt_evtx_file_closed_p, 0);
+}
@@ -0,0 +1,596 @@
+#include <winevt_c.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::EvtxTail
+ *
+ * Read the new records of an .evtx file which is overwritten with the
+ * newer versions periodically. The checksums of the chunks are kept
+ * between the passes, so only the new or changed chunks are decoded,
+ * and only the records after #last_record_id are yielded.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @tail = Winevt::EventLog::EvtxTail.new("spool/Security.evtx")
+ *
+ *  loop do
+ *    @tail.each do |eventlog, message, string_inserts|
+ *      puts ({eventlog: eventlog, data: string_inserts})
+ *    end
+ *    sleep 60
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cEvtxTail;
+
+static ID id_path;
+static ID id_template_cache;
+
+struct WinevtEvtxTail
+{
+  uint64_t lastRecordId;
+  /* The header and the records checksums of each chunk, or 0 when it
+   * is not read yet. */
+  uint64_t* checksums;
+  size_t chunkCount;
+  unsigned long long changedChunks;
+  unsigned long long corruptedChunks;
+  int renderAsXML;
+  int preserveQualifiers;
+  int preserveSID;
+};
+
+static void evtx_tail_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_evtx_tail_type = { "winevt/evtx_tail",
+                                                         {
+                                                           0,
+                                                           evtx_tail_free,
+                                                           0,
+                                                         },
+                                                         NULL,
+                                                         NULL,
+                                                         RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+evtx_tail_free(void* ptr)
+{
+  struct WinevtEvtxTail* winevtEvtxTail = (struct WinevtEvtxTail*)ptr;
+
+  free(winevtEvtxTail->checksums);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_evtx_tail_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtEvtxTail* winevtEvtxTail;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtEvtxTail, &rb_winevt_evtx_tail_type, winevtEvtxTail);
+  return obj;
+}
+
+static struct WinevtEvtxTail*
+get_evtx_tail(VALUE self)
+{
+  struct WinevtEvtxTail* winevtEvtxTail;
+
+  TypedData_Get_Struct(self, struct WinevtEvtxTail, &rb_winevt_evtx_tail_type, winevtEvtxTail);
+
+  return winevtEvtxTail;
+}
+
+/*
+ * Initalize EvtxTail class. The file is not opened until #each.
+ *
+ * @param path [String] Path of .evtx file.
+ * @return [EvtxTail]
+ *
+ */
+static VALUE
+rb_winevt_evtx_tail_initialize(VALUE self, VALUE rb_path)
+{
+  struct WinevtEvtxTail* winevtEvtxTail = get_evtx_tail(self);
+
+  FilePathValue(rb_path);
+  rb_path = rb_str_export_to_enc(rb_path, rb_utf8_encoding());
+
+  winevtEvtxTail->lastRecordId = 0;
+  winevtEvtxTail->renderAsXML = 1;
+  winevtEvtxTail->preserveQualifiers = 0;
+  winevtEvtxTail->preserveSID = 1;
+  rb_ivar_set(self, id_path, rb_obj_freeze(rb_str_dup(rb_path)));
+  rb_ivar_set(self, id_template_cache, rb_class_new_instance(0, NULL, rb_cEvtxTemplateCache));
+
+  return Qnil;
+}
+
+struct EvtxTailChunk
+{
+  size_t index;
+  uint64_t firstRecordId;
+  uint64_t checksum;
+};
+
+static int
+compare_tail_chunk(const void* a, const void* b)
+{
+  uint64_t x = ((const struct EvtxTailChunk*)a)->firstRecordId;
+  uint64_t y = ((const struct EvtxTailChunk*)b)->firstRecordId;
+
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+struct EvtxTailArgs
+{
+  VALUE self;
+  VALUE rb_path;
+  VALUE rb_templateCache;
+  struct WinevtOpenedFile file;
+  int opened;
+  /* The file header or the chunk which is read last. */
+  uint8_t* chunk;
+  struct EvtxTailChunk* chunks;
+  struct WinevtEvtxRendered rendered;
+  struct WinevtEvtxDecodedChunk decoded;
+};
+
+static uint64_t
+tail_chunk_checksum(const struct WinevtEvtxChunkHeader* header)
+{
+  return ((uint64_t)header->checksum << 32) | header->recordsChecksum;
+}
+
+/*
+ * Read the chunk into args->chunk. The file is not mapped, so it can
+ * be truncated or overwritten while the records are yielded. Returns
+ * 0 when the file is truncated before the end of the chunk.
+ */
+static int
+read_tail_chunk(struct EvtxTailArgs* args, size_t index)
+{
+  size_t read;
+  int error = winevt_read_file_at(&args->file,
+                                  EVTX_FILE_HEADER_SIZE + (uint64_t)index * EVTX_CHUNK_SIZE,
+                                  args->chunk, EVTX_CHUNK_SIZE, &read);
+
+  if (error != 0) {
+    rb_syserr_fail_str(error, args->rb_path);
+  }
+
+  return read == EVTX_CHUNK_SIZE;
+}
+
+/* The chunks which are written after the last pass. */
+static size_t
+collect_changed_chunks(struct WinevtEvtxTail* winevtEvtxTail, struct EvtxTailArgs* args,
+                       size_t chunkCount)
+{
+  size_t count = 0;
+
+  for (size_t i = 0; i < chunkCount && read_tail_chunk(args, i); i++) {
+    struct WinevtEvtxChunkHeader header;
+    uint64_t checksum;
+
+    if (winevt_evtx_read_chunk_header(args->chunk, &header) < 0) {
+      /* The chunk may be in the middle of copying. It is read again
+       * in the next pass. */
+      if (memcmp(args->chunk, "ElfChnk", 8) == 0) {
+        winevtEvtxTail->corruptedChunks++;
+      }
+      continue;
+    }
+    checksum = tail_chunk_checksum(&header);
+    if (i < winevtEvtxTail->chunkCount && winevtEvtxTail->checksums[i] == checksum) {
+      continue;
+    }
+    if (header.lastRecordId <= winevtEvtxTail->lastRecordId) {
+      /* Nothing new, e.g. after last_record_id is restored. */
+      winevtEvtxTail->checksums[i] = checksum;
+      continue;
+    }
+    args->chunks[count].index = i;
+    args->chunks[count].firstRecordId = header.firstRecordId;
+    args->chunks[count].checksum = checksum;
+    count++;
+  }
+  qsort(args->chunks, count, sizeof(struct EvtxTailChunk), compare_tail_chunk);
+
+  return count;
+}
+
+static VALUE
+evtx_tail_each_chunk(VALUE ptr)
+{
+  struct EvtxTailArgs* args = (struct EvtxTailArgs*)ptr;
+  struct WinevtEvtxTail* winevtEvtxTail = get_evtx_tail(args->self);
+  struct WinevtEvtxFileHeader header;
+  size_t chunkCount, count, read;
+  int error;
+
+  error = winevt_open_file(RSTRING_PTR(args->rb_path), &args->file);
+  if (error != 0) {
+    rb_syserr_fail_str(error, args->rb_path);
+  }
+  args->opened = 1;
+  if (args->file.size == 0) {
+    /* The file is truncated to be overwritten. */
+    return Qnil;
+  }
+  args->chunk = malloc(EVTX_CHUNK_SIZE);
+  if (!args->chunk)
+    rb_memerror();
+  error = winevt_read_file_at(&args->file, 0, args->chunk, EVTX_FILE_HEADER_SIZE, &read);
+  if (error != 0) {
+    rb_syserr_fail_str(error, args->rb_path);
+  }
+  if (winevt_evtx_read_file_header(args->chunk, read, &header) < 0) {
+    rb_raise(rb_eEvtxFileError, "Invalid evtx file header: %" PRIsVALUE, args->rb_path);
+  }
+
+  chunkCount = winevt_evtx_chunk_count((size_t)args->file.size);
+  if (chunkCount > winevtEvtxTail->chunkCount) {
+    uint64_t* checksums = realloc(winevtEvtxTail->checksums, sizeof(uint64_t) * chunkCount);
+    if (!checksums)
+      rb_memerror();
+    memset(checksums + winevtEvtxTail->chunkCount, 0,
+           sizeof(uint64_t) * (chunkCount - winevtEvtxTail->chunkCount));
+    winevtEvtxTail->checksums = checksums;
+    winevtEvtxTail->chunkCount = chunkCount;
+  }
+  args->chunks = malloc(sizeof(struct EvtxTailChunk) * (chunkCount ? chunkCount : 1));
+  if (!args->chunks)
+    rb_memerror();
+  count = collect_changed_chunks(winevtEvtxTail, args, chunkCount);
+
+  for (size_t i = 0; i < count; i++) {
+    const struct EvtxTailChunk* tailChunk = &args->chunks[i];
+    struct WinevtEvtxChunkHeader chunkHeader;
+
+    /* The block may have run long enough for the copy job to truncate
+     * or overwrite the file. The chunk and the rest are read again in
+     * the next pass unless it is still the collected one, so no record
+     * is skipped by last_record_id. */
+    if (!read_tail_chunk(args, tailChunk->index) ||
+        winevt_evtx_read_chunk_header(args->chunk, &chunkHeader) < 0 ||
+        tail_chunk_checksum(&chunkHeader) != tailChunk->checksum) {
+      break;
+    }
+    winevtEvtxTail = get_evtx_tail(args->self);
+    winevtEvtxTail->changedChunks++;
+    winevt_evtx_decode_chunk(args->chunk, winevtEvtxTail->lastRecordId + 1, UINT64_MAX,
+                             &args->rendered, &args->decoded);
+    if (args->decoded.status == EVTX_ERROR_NOMEM) {
+      rb_memerror();
+    }
+
+    for (size_t j = 0; j < args->decoded.count; j++) {
+      struct WinevtEvtxRendered view;
+      VALUE rb_values;
+
+      winevt_evtx_decoded_record(&args->decoded, j, &view);
+      rb_values = winevt_evtx_rendered_to_rb_ary(&view,
+                                                 winevtEvtxTail->renderAsXML,
+                                                 winevtEvtxTail->preserveQualifiers,
+                                                 winevtEvtxTail->preserveSID);
+      /* The progress is kept even if the block breaks. */
+      if (view.recordId > winevtEvtxTail->lastRecordId) {
+        winevtEvtxTail->lastRecordId = view.recordId;
+      }
+      rb_yield_values(3,
+                      RARRAY_AREF(rb_values, 0),
+                      RARRAY_AREF(rb_values, 1),
+                      RARRAY_AREF(rb_values, 2));
+      winevtEvtxTail = get_evtx_tail(args->self);
+    }
+    /* The checksums are correct but the records after the broken
+     * one cannot be read in the next pass either. */
+    if (args->decoded.status < 0) {
+      winevtEvtxTail->corruptedChunks++;
+    }
+    winevtEvtxTail->checksums[tailChunk->index] = tailChunk->checksum;
+  }
+
+  return Qnil;
+}
+
+static VALUE
+evtx_tail_each_ensure(VALUE ptr)
+{
+  struct EvtxTailArgs* args = (struct EvtxTailArgs*)ptr;
+
+  winevt_evtx_decoded_chunk_destroy(&args->decoded);
+  winevt_evtx_rendered_destroy(&args->rendered);
+  free(args->chunks);
+  free(args->chunk);
+  if (args->opened) {
+    winevt_close_file(&args->file);
+  }
+
+  return Qnil;
+}
+
+/*
+ * Read the file once and enumerate the records which are written
+ * after the last pass in the order of EventRecordID. The file is
+ * opened for each pass, so it can be replaced between the passes.
+ *
+ * This method yields the same values as EvtxFile#each.
+ *
+ * @yield (String,String,Array)
+ *
+ */
+static VALUE
+rb_winevt_evtx_tail_each(VALUE self)
+{
+  struct EvtxTailArgs args;
+  VALUE rb_result;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  memset(&args, 0, sizeof(args));
+  args.self = self;
+  args.rb_path = rb_ivar_get(self, id_path);
+  if (NIL_P(args.rb_path)) {
+    rb_raise(rb_eRuntimeError, "uninitialized evtx tail");
+  }
+  args.rb_templateCache = rb_ivar_get(self, id_template_cache);
+  winevt_evtx_rendered_init(&args.rendered);
+  winevt_evtx_decoded_chunk_init(&args.decoded);
+  if (!NIL_P(args.rb_templateCache)) {
+    args.rendered.templateCache = winevt_evtx_get_template_cache(args.rb_templateCache);
+  }
+
+  rb_result = rb_ensure(evtx_tail_each_chunk, (VALUE)&args, evtx_tail_each_ensure, (VALUE)&args);
+  RB_GC_GUARD(args.rb_path);
+  RB_GC_GUARD(args.rb_templateCache);
+
+  return rb_result;
+}
+
+/*
+ * This method returns the path of the file.
+ *
+ * @return [String]
+ */
+static VALUE
+rb_winevt_evtx_tail_path(VALUE self)
+{
+  return rb_ivar_get(self, id_path);
+}
+
+/*
+ * This method returns the last EventRecordID which is yielded.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_tail_get_last_record_id(VALUE self)
+{
+  return ULL2NUM(get_evtx_tail(self)->lastRecordId);
+}
+
+/*
+ * This method specifies the last EventRecordID which is already read,
+ * e.g. restored from Checkpoint. The chunks are checked again.
+ *
+ * @param rb_last_record_id [Integer]
+ */
+static VALUE
+rb_winevt_evtx_tail_set_last_record_id(VALUE self, VALUE rb_last_record_id)
+{
+  struct WinevtEvtxTail* winevtEvtxTail = get_evtx_tail(self);
+
+  winevtEvtxTail->lastRecordId = NUM2ULL(rb_last_record_id);
+  if (winevtEvtxTail->checksums) {
+    memset(winevtEvtxTail->checksums, 0, sizeof(uint64_t) * winevtEvtxTail->chunkCount);
+  }
+
+  return Qnil;
+}
+
+/*
+ * This method returns the number of the chunks which are decoded
+ * because they are new or changed.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_tail_changed_chunks(VALUE self)
+{
+  return ULL2NUM(get_evtx_tail(self)->changedChunks);
+}
+
+/*
+ * This method returns the number of the broken chunks which are
+ * skipped. They are read again in the next pass.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_tail_corrupted_chunks(VALUE self)
+{
+  return ULL2NUM(get_evtx_tail(self)->corruptedChunks);
+}
+
+/*
+ * This method returns whether render as xml or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_tail_render_as_xml_p(VALUE self)
+{
+  return get_evtx_tail(self)->renderAsXML ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether render as xml or not.
+ *
+ * @param rb_render_as_xml [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_tail_set_render_as_xml(VALUE self, VALUE rb_render_as_xml)
+{
+  get_evtx_tail(self)->renderAsXML = RTEST(rb_render_as_xml);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether preserving qualifiers key or not.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_evtx_tail_get_preserve_qualifiers_p(VALUE self)
+{
+  return get_evtx_tail(self)->preserveQualifiers ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether preserving qualifiers key or not.
+ *
+ * @param rb_preserve_qualifiers [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_tail_set_preserve_qualifiers(VALUE self, VALUE rb_preserve_qualifiers)
+{
+  get_evtx_tail(self)->preserveQualifiers = RTEST(rb_preserve_qualifiers);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether preserving SID or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_tail_preserve_sid_p(VALUE self)
+{
+  return get_evtx_tail(self)->preserveSID ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether preserving SID or not.
+ *
+ * @param rb_preserve_sid_p [Boolean]
+ */
+static VALUE
+rb_winevt_evtx_tail_set_preserve_sid(VALUE self, VALUE rb_preserve_sid_p)
+{
+  get_evtx_tail(self)->preserveSID = RTEST(rb_preserve_sid_p);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the cache of the compiled templates. It is kept
+ * between the passes.
+ *
+ * @return [EvtxFile::TemplateCache, nil]
+ */
+static VALUE
+rb_winevt_evtx_tail_get_template_cache(VALUE self)
+{
+  return rb_ivar_get(self, id_template_cache);
+}
+
+/*
+ * This method specifies the cache of the compiled templates. nil
+ * disables the cache.
+ *
+ * @param rb_template_cache [EvtxFile::TemplateCache, nil]
+ */
+static VALUE
+rb_winevt_evtx_tail_set_template_cache(VALUE self, VALUE rb_template_cache)
+{
+  if (!NIL_P(rb_template_cache)) {
+    winevt_evtx_get_template_cache(rb_template_cache);
+  }
+  rb_ivar_set(self, id_template_cache, rb_template_cache);
+
+  return Qnil;
+}
+
+void
+Init_winevt_evtx_tail(VALUE rb_cEventLog)
+{
+  rb_cEvtxTail = rb_define_class_under(rb_cEventLog, "EvtxTail", rb_cObject);
+  rb_define_alloc_func(rb_cEvtxTail, rb_winevt_evtx_tail_alloc);
+
+  id_path = rb_intern("@path");
+  id_template_cache = rb_intern("@template_cache");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "initialize", rb_winevt_evtx_tail_initialize, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "each", rb_winevt_evtx_tail_each, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "path", rb_winevt_evtx_tail_path, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "last_record_id", rb_winevt_evtx_tail_get_last_record_id, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "last_record_id=", rb_winevt_evtx_tail_set_last_record_id, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "changed_chunks", rb_winevt_evtx_tail_changed_chunks, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "corrupted_chunks", rb_winevt_evtx_tail_corrupted_chunks, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "render_as_xml?", rb_winevt_evtx_tail_render_as_xml_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "render_as_xml=", rb_winevt_evtx_tail_set_render_as_xml, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cEvtxTail, "preserve_qualifiers?", rb_winevt_evtx_tail_get_preserve_qualifiers_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cEvtxTail, "preserve_qualifiers=", rb_winevt_evtx_tail_set_preserve_qualifiers, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "preserve_sid?", rb_winevt_evtx_tail_preserve_sid_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "preserve_sid=", rb_winevt_evtx_tail_set_preserve_sid, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "template_cache", rb_winevt_evtx_tail_get_template_cache, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cEvtxTail, "template_cache=", rb_winevt_evtx_tail_set_template_cache, 1);
+}
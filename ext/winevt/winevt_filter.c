@@ -0,0 +1,686 @@
+#include <winevt_c.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::Filter
+ *
+ * Predicates which are evaluated on the rendered values of an event
+ * before any Ruby object is created for it. Query and Subscribe drop
+ * the events which do not match all predicates. So, filters which
+ * XPath cannot express, such as regular expressions on EventData, do
+ * not cost converting every event.
+ *
+ * Each predicate is [path, operator, operand]. The path is a value
+ * path of EvtCreateRenderContext, such as "Event/System/EventID" or
+ * "Event/EventData/Data[@Name='IpAddress']". The operators are:
+ *
+ * - :equals: the value is the String, Integer or Time.
+ * - :in: the value is one of the Array of them.
+ * - :range: the value is an Integer or Time in the Range.
+ * - :substring: the string value contains the String.
+ * - :prefix: the string value starts with the String.
+ * - :regex: the string value matches the Regexp.
+ *
+ * Strings are compared as UTF-16 without transcoding the values.
+ * Times are compared as FILETIME. A value of the other type or a
+ * missing value does not match.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @filter = Winevt::EventLog::Filter.new([
+ *    ["Event/System/EventID", :in, [4624, 4625]],
+ *    ["Event/EventData/Data[@Name='IpAddress']", :regex, /\A10\./],
+ *  ])
+ *  @query = Winevt::EventLog::Query.new("Security", "*")
+ *  @query.filter = @filter
+ *  @query.each do |eventlog, message, string_inserts|
+ *    puts ({eventlog: eventlog, data: message})
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cFilter;
+
+static ID id_paths;
+static ID id_equals;
+static ID id_in;
+static ID id_range;
+static ID id_substring;
+static ID id_prefix;
+static ID id_regex;
+
+#define FILTER_EQUALS    1
+#define FILTER_IN        2
+#define FILTER_RANGE     3
+#define FILTER_SUBSTRING 4
+#define FILTER_PREFIX    5
+#define FILTER_REGEX     6
+
+/* FILETIME of 1970-01-01 */
+#define FILTER_UNIX_EPOCH_FILETIME 116444736000000000ULL
+
+struct WinevtFilterPredicate
+{
+  size_t path;
+  int op;
+  /* :equals, :substring and :prefix */
+  struct WinevtFilterValue operand;
+  /* :in */
+  struct WinevtFilterValue* members;
+  size_t memberCount;
+  /* :range */
+  struct WinevtFilterValue min;
+  struct WinevtFilterValue max;
+  int excludeEnd;
+  /* :regex. Compiled for UTF-16LE. */
+  OnigRegex regex;
+};
+
+static void filter_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_filter_type = { "winevt/filter",
+                                                      {
+                                                        0,
+                                                        filter_free,
+                                                        0,
+                                                      },
+                                                      NULL,
+                                                      NULL,
+                                                      RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+free_value(struct WinevtFilterValue* value)
+{
+  free((void*)value->string);
+  value->string = NULL;
+}
+
+static void
+filter_free(void* ptr)
+{
+  struct WinevtFilter* winevtFilter = (struct WinevtFilter*)ptr;
+
+  for (size_t i = 0; i < winevtFilter->count; i++) {
+    struct WinevtFilterPredicate* predicate = &winevtFilter->predicates[i];
+    free_value(&predicate->operand);
+    for (size_t j = 0; j < predicate->memberCount; j++) {
+      free_value(&predicate->members[j]);
+    }
+    free(predicate->members);
+    if (predicate->regex) {
+      onig_free(predicate->regex);
+    }
+  }
+  free(winevtFilter->predicates);
+  for (size_t i = 0; i < winevtFilter->pathCount; i++) {
+    free(winevtFilter->paths[i]);
+  }
+  free(winevtFilter->paths);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_filter_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtFilter* winevtFilter;
+  obj = TypedData_Make_Struct(klass, struct WinevtFilter, &rb_winevt_filter_type, winevtFilter);
+  return obj;
+}
+
+struct WinevtFilter*
+winevt_get_filter(VALUE rb_filter)
+{
+  struct WinevtFilter* winevtFilter;
+
+  TypedData_Get_Struct(rb_filter, struct WinevtFilter, &rb_winevt_filter_type, winevtFilter);
+  if (!winevtFilter->initialized) {
+    rb_raise(rb_eRuntimeError, "uninitialized filter");
+  }
+
+  return winevtFilter;
+}
+
+static rb_encoding*
+utf16le_encoding(void)
+{
+  return rb_enc_find("UTF-16LE");
+}
+
+static VALUE
+to_utf16(VALUE rb_str)
+{
+  return rb_str_encode(rb_str, rb_enc_from_encoding(utf16le_encoding()), 0, Qnil);
+}
+
+static uint16_t*
+copy_wstr(VALUE rb_wide, int terminate)
+{
+  size_t length = (size_t)RSTRING_LEN(rb_wide) / 2;
+  uint16_t* wstr = malloc(sizeof(uint16_t) * (length + (terminate ? 1 : 0)) + 1);
+
+  if (!wstr) {
+    rb_memerror();
+  }
+  memcpy(wstr, RSTRING_PTR(rb_wide), length * 2);
+  if (terminate) {
+    wstr[length] = 0;
+  }
+
+  return wstr;
+}
+
+/*
+ * Convert an operand or a value of #match?. When copy is 0, the
+ * string points into the returned converted String.
+ */
+static VALUE
+to_filter_value(VALUE rb_value, struct WinevtFilterValue* value, int copy)
+{
+  memset(value, 0, sizeof(*value));
+
+  if (NIL_P(rb_value)) {
+    value->type = FILTER_VALUE_NULL;
+  } else if (RB_INTEGER_TYPE_P(rb_value)) {
+    value->type = FILTER_VALUE_INTEGER;
+    if (RTEST(rb_funcall(rb_value, '<', 1, INT2FIX(0)))) {
+      value->negative = 1;
+      value->integer = (uint64_t)NUM2LL(rb_value);
+    } else {
+      value->integer = NUM2ULL(rb_value);
+    }
+  } else if (rb_obj_is_kind_of(rb_value, rb_cTime)) {
+    struct timespec ts = rb_time_timespec(rb_value);
+    int64_t ticks = (int64_t)ts.tv_sec * 10000000 + ts.tv_nsec / 100;
+    value->type = FILTER_VALUE_INTEGER;
+    if (ticks < -(int64_t)FILTER_UNIX_EPOCH_FILETIME) {
+      rb_raise(rb_eRangeError, "too old time: %" PRIsVALUE, rb_value);
+    }
+    value->integer = (uint64_t)ticks + FILTER_UNIX_EPOCH_FILETIME;
+  } else if (RB_TYPE_P(rb_value, T_STRING)) {
+    VALUE rb_wide = to_utf16(rb_value);
+    value->type = FILTER_VALUE_STRING;
+    value->length = (size_t)RSTRING_LEN(rb_wide) / 2;
+    value->string = copy ? copy_wstr(rb_wide, 0) : (const uint16_t*)RSTRING_PTR(rb_wide);
+    return rb_wide;
+  } else {
+    rb_raise(rb_eTypeError,
+             "wrong argument type %" PRIsVALUE " (expected String, Integer or Time)",
+             rb_obj_class(rb_value));
+  }
+
+  return Qnil;
+}
+
+static int
+compare_integers(const struct WinevtFilterValue* a, const struct WinevtFilterValue* b)
+{
+  if (a->negative != b->negative) {
+    return a->negative ? -1 : 1;
+  }
+  if (a->negative) {
+    int64_t x = (int64_t)a->integer, y = (int64_t)b->integer;
+    return x < y ? -1 : x > y ? 1 : 0;
+  }
+
+  return a->integer < b->integer ? -1 : a->integer > b->integer ? 1 : 0;
+}
+
+static int
+values_equal(const struct WinevtFilterValue* a, const struct WinevtFilterValue* b)
+{
+  if (a->type != b->type) {
+    return 0;
+  }
+  switch (a->type) {
+  case FILTER_VALUE_STRING:
+    return a->length == b->length &&
+           memcmp(a->string, b->string, a->length * sizeof(uint16_t)) == 0;
+  case FILTER_VALUE_INTEGER:
+    return compare_integers(a, b) == 0;
+  default:
+    return 0;
+  }
+}
+
+static int
+contains_wstr(const struct WinevtFilterValue* value, const struct WinevtFilterValue* part)
+{
+  if (part->length == 0) {
+    return 1;
+  }
+  for (size_t i = 0; i + part->length <= value->length; i++) {
+    if (value->string[i] == part->string[0] &&
+        memcmp(value->string + i, part->string, part->length * sizeof(uint16_t)) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int
+in_range(const struct WinevtFilterPredicate* predicate, const struct WinevtFilterValue* value)
+{
+  if (predicate->min.type == FILTER_VALUE_INTEGER &&
+      compare_integers(value, &predicate->min) < 0) {
+    return 0;
+  }
+  if (predicate->max.type == FILTER_VALUE_INTEGER) {
+    int c = compare_integers(value, &predicate->max);
+    if (c > 0 || (c == 0 && predicate->excludeEnd)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int
+match_predicate(const struct WinevtFilterPredicate* predicate,
+                const struct WinevtFilterValue* value)
+{
+  switch (predicate->op) {
+  case FILTER_EQUALS:
+    return values_equal(value, &predicate->operand);
+  case FILTER_IN:
+    for (size_t i = 0; i < predicate->memberCount; i++) {
+      if (values_equal(value, &predicate->members[i])) {
+        return 1;
+      }
+    }
+    return 0;
+  case FILTER_RANGE:
+    return value->type == FILTER_VALUE_INTEGER && in_range(predicate, value);
+  case FILTER_SUBSTRING:
+    return value->type == FILTER_VALUE_STRING && contains_wstr(value, &predicate->operand);
+  case FILTER_PREFIX:
+    return value->type == FILTER_VALUE_STRING && value->length >= predicate->operand.length &&
+           memcmp(value->string, predicate->operand.string,
+                  predicate->operand.length * sizeof(uint16_t)) == 0;
+  case FILTER_REGEX: {
+    const OnigUChar* start = (const OnigUChar*)value->string;
+    const OnigUChar* end = start + value->length * sizeof(uint16_t);
+    if (value->type != FILTER_VALUE_STRING) {
+      return 0;
+    }
+    return onig_search(predicate->regex, start, end, start, end, NULL, ONIG_OPTION_NONE) >= 0;
+  }
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Whether values, one for each path of the filter, match all
+ * predicates. This does not touch Ruby objects. So, it can be called
+ * without holding the GVL.
+ */
+int
+winevt_filter_match(const struct WinevtFilter* filter, const struct WinevtFilterValue* values)
+{
+  for (size_t i = 0; i < filter->count; i++) {
+    if (!match_predicate(&filter->predicates[i], &values[filter->predicates[i].path])) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static size_t
+add_path(struct WinevtFilter* winevtFilter, VALUE rb_paths, VALUE rb_path)
+{
+  VALUE rb_wide;
+
+  Check_Type(rb_path, T_STRING);
+  if (RSTRING_LEN(rb_path) == 0) {
+    rb_raise(rb_eArgError, "empty path");
+  }
+  for (long i = 0; i < RARRAY_LEN(rb_paths); i++) {
+    if (rb_str_equal(RARRAY_AREF(rb_paths, i), rb_path) == Qtrue) {
+      return (size_t)i;
+    }
+  }
+
+  rb_wide = to_utf16(rb_path);
+  winevtFilter->paths[winevtFilter->pathCount] = copy_wstr(rb_wide, 1);
+  rb_ary_push(rb_paths, rb_obj_freeze(rb_str_dup(rb_path)));
+
+  return winevtFilter->pathCount++;
+}
+
+static void
+compile_regex(struct WinevtFilterPredicate* predicate, VALUE rb_regexp)
+{
+  OnigErrorInfo einfo;
+  OnigUChar message[ONIG_MAX_ERROR_MESSAGE_LEN];
+  VALUE rb_source = to_utf16(rb_funcall(rb_regexp, rb_intern("source"), 0));
+  int options = rb_reg_options(rb_regexp) &
+                (ONIG_OPTION_IGNORECASE | ONIG_OPTION_EXTEND | ONIG_OPTION_MULTILINE);
+  const OnigUChar* pattern = (const OnigUChar*)RSTRING_PTR(rb_source);
+  int r = onig_new(&predicate->regex, pattern, pattern + RSTRING_LEN(rb_source),
+                   (OnigOptionType)options, utf16le_encoding(), ONIG_SYNTAX_RUBY, &einfo);
+
+  if (r != ONIG_NORMAL) {
+    predicate->regex = NULL;
+    onig_error_code_to_str(message, r, &einfo);
+    rb_raise(rb_eArgError, "unsupported regexp %" PRIsVALUE ": %s", rb_regexp, message);
+  }
+}
+
+static void
+parse_predicate(struct WinevtFilter* winevtFilter, VALUE rb_paths, VALUE rb_predicate)
+{
+  struct WinevtFilterPredicate* predicate = &winevtFilter->predicates[winevtFilter->count];
+  VALUE rb_op, rb_operand;
+  ID op;
+
+  Check_Type(rb_predicate, T_ARRAY);
+  if (RARRAY_LEN(rb_predicate) != 3) {
+    rb_raise(rb_eArgError, "predicate must be [path, operator, operand]");
+  }
+  rb_op = RARRAY_AREF(rb_predicate, 1);
+  rb_operand = RARRAY_AREF(rb_predicate, 2);
+  Check_Type(rb_op, T_SYMBOL);
+  op = SYM2ID(rb_op);
+
+  memset(predicate, 0, sizeof(*predicate));
+  /* Counted first. Then, filter_free releases what is parsed so far
+   * on exceptions. */
+  winevtFilter->count++;
+  predicate->path = add_path(winevtFilter, rb_paths, RARRAY_AREF(rb_predicate, 0));
+
+  if (op == id_equals) {
+    predicate->op = FILTER_EQUALS;
+    to_filter_value(rb_operand, &predicate->operand, 1);
+  } else if (op == id_in) {
+    Check_Type(rb_operand, T_ARRAY);
+    predicate->op = FILTER_IN;
+    predicate->members = calloc(RARRAY_LEN(rb_operand) + 1, sizeof(struct WinevtFilterValue));
+    if (!predicate->members) {
+      rb_memerror();
+    }
+    for (long i = 0; i < RARRAY_LEN(rb_operand); i++) {
+      predicate->memberCount++;
+      to_filter_value(RARRAY_AREF(rb_operand, i), &predicate->members[i], 1);
+    }
+  } else if (op == id_range) {
+    VALUE rb_begin, rb_end;
+    int excludeEnd;
+    if (!rb_range_values(rb_operand, &rb_begin, &rb_end, &excludeEnd)) {
+      rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Range)",
+               rb_obj_class(rb_operand));
+    }
+    predicate->op = FILTER_RANGE;
+    to_filter_value(rb_begin, &predicate->min, 0);
+    to_filter_value(rb_end, &predicate->max, 0);
+    if (predicate->min.type == FILTER_VALUE_STRING || predicate->max.type == FILTER_VALUE_STRING) {
+      predicate->min.string = predicate->max.string = NULL;
+      rb_raise(rb_eTypeError, "range of strings is not supported");
+    }
+    predicate->excludeEnd = excludeEnd;
+  } else if (op == id_substring || op == id_prefix) {
+    Check_Type(rb_operand, T_STRING);
+    predicate->op = op == id_substring ? FILTER_SUBSTRING : FILTER_PREFIX;
+    to_filter_value(rb_operand, &predicate->operand, 1);
+  } else if (op == id_regex) {
+    if (!RB_TYPE_P(rb_operand, T_REGEXP)) {
+      rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Regexp)",
+               rb_obj_class(rb_operand));
+    }
+    predicate->op = FILTER_REGEX;
+    compile_regex(predicate, rb_operand);
+  } else {
+    rb_raise(rb_eArgError, "unknown operator: %" PRIsVALUE, rb_op);
+  }
+}
+
+/*
+ * Initalize Filter class.
+ *
+ * @param predicates [Array<Array>] [path, operator, operand] for each
+ *   predicate. See the class description.
+ * @return [Filter]
+ *
+ */
+static VALUE
+rb_winevt_filter_initialize(VALUE self, VALUE rb_predicates)
+{
+  struct WinevtFilter* winevtFilter;
+  VALUE rb_paths;
+  long count;
+
+  TypedData_Get_Struct(self, struct WinevtFilter, &rb_winevt_filter_type, winevtFilter);
+  Check_Type(rb_predicates, T_ARRAY);
+  if (winevtFilter->predicates) {
+    rb_raise(rb_eRuntimeError, "already initialized filter");
+  }
+
+  count = RARRAY_LEN(rb_predicates);
+  winevtFilter->predicates = calloc(count + 1, sizeof(struct WinevtFilterPredicate));
+  winevtFilter->paths = calloc(count + 1, sizeof(uint16_t*));
+  if (!winevtFilter->predicates || !winevtFilter->paths) {
+    rb_memerror();
+  }
+
+  rb_paths = rb_ary_new();
+  for (long i = 0; i < count; i++) {
+    parse_predicate(winevtFilter, rb_paths, RARRAY_AREF(rb_predicates, i));
+  }
+  rb_ivar_set(self, id_paths, rb_obj_freeze(rb_paths));
+  winevtFilter->initialized = 1;
+
+  return Qnil;
+}
+
+/*
+ * This method returns the value paths which the predicates use.
+ * Values are rendered in this order.
+ *
+ * @return [Array<String>]
+ */
+static VALUE
+rb_winevt_filter_paths(VALUE self)
+{
+  winevt_get_filter(self);
+
+  return rb_ivar_get(self, id_paths);
+}
+
+/*
+ * This method returns the number of the predicates.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_filter_size(VALUE self)
+{
+  return SIZET2NUM(winevt_get_filter(self)->count);
+}
+
+/*
+ * This method evaluates the predicates on the given values in the
+ * same way as Query and Subscribe do.
+ *
+ * @param values [Hash{String=>String,Integer,Time,nil}] Values for
+ *   each path. Missing paths are nil.
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_filter_match_p(VALUE self, VALUE rb_values)
+{
+  struct WinevtFilter* winevtFilter = winevt_get_filter(self);
+  VALUE rb_paths = rb_ivar_get(self, id_paths);
+  VALUE rb_keep = rb_ary_new();
+  VALUE rb_buf;
+  struct WinevtFilterValue* values;
+  int matched;
+
+  Check_Type(rb_values, T_HASH);
+  values = ALLOCV_N(struct WinevtFilterValue, rb_buf, winevtFilter->pathCount + 1);
+  for (size_t i = 0; i < winevtFilter->pathCount; i++) {
+    VALUE rb_value = rb_hash_lookup(rb_values, RARRAY_AREF(rb_paths, i));
+    rb_ary_push(rb_keep, to_filter_value(rb_value, &values[i], 0));
+  }
+  matched = winevt_filter_match(winevtFilter, values);
+  ALLOCV_END(rb_buf);
+  RB_GC_GUARD(rb_keep);
+
+  return matched ? Qtrue : Qfalse;
+}
+
+#ifdef _WIN32
+DWORD
+filter_context_init(struct WinevtFilterContext* filterContext, const struct WinevtFilter* filter)
+{
+  ZeroMemory(filterContext, sizeof(struct WinevtFilterContext));
+  filterContext->values = calloc(filter->pathCount + 1, sizeof(struct WinevtFilterValue));
+  if (!filterContext->values) {
+    return ERROR_OUTOFMEMORY;
+  }
+  filterContext->context = EvtCreateRenderContext(
+    (DWORD)filter->pathCount, (LPCWSTR*)filter->paths, EvtRenderContextValues);
+  if (!filterContext->context) {
+    DWORD status = GetLastError();
+    free(filterContext->values);
+    filterContext->values = NULL;
+    return status;
+  }
+  filterContext->filter = filter;
+
+  return ERROR_SUCCESS;
+}
+
+void
+filter_context_free(struct WinevtFilterContext* filterContext)
+{
+  if (filterContext->context) {
+    EvtClose(filterContext->context);
+  }
+  free(filterContext->buffer);
+  free(filterContext->values);
+  ZeroMemory(filterContext, sizeof(struct WinevtFilterContext));
+}
+
+static void
+variant_to_filter_value(const EVT_VARIANT* variant, struct WinevtFilterValue* value)
+{
+  ZeroMemory(value, sizeof(struct WinevtFilterValue));
+  value->type = FILTER_VALUE_INTEGER;
+
+  switch (variant->Type) {
+  case EvtVarTypeString:
+    value->type = FILTER_VALUE_STRING;
+    value->string = (const uint16_t*)variant->StringVal;
+    value->length = wcslen(variant->StringVal);
+    break;
+  case EvtVarTypeSByte:
+    value->negative = variant->SByteVal < 0;
+    value->integer = (uint64_t)(int64_t)variant->SByteVal;
+    break;
+  case EvtVarTypeInt16:
+    value->negative = variant->Int16Val < 0;
+    value->integer = (uint64_t)(int64_t)variant->Int16Val;
+    break;
+  case EvtVarTypeInt32:
+    value->negative = variant->Int32Val < 0;
+    value->integer = (uint64_t)(int64_t)variant->Int32Val;
+    break;
+  case EvtVarTypeInt64:
+    value->negative = variant->Int64Val < 0;
+    value->integer = (uint64_t)variant->Int64Val;
+    break;
+  case EvtVarTypeByte:
+    value->integer = variant->ByteVal;
+    break;
+  case EvtVarTypeUInt16:
+    value->integer = variant->UInt16Val;
+    break;
+  case EvtVarTypeUInt32:
+  case EvtVarTypeHexInt32:
+    value->integer = variant->UInt32Val;
+    break;
+  case EvtVarTypeUInt64:
+  case EvtVarTypeHexInt64:
+    value->integer = variant->UInt64Val;
+    break;
+  case EvtVarTypeBoolean:
+    value->integer = variant->BooleanVal ? 1 : 0;
+    break;
+  case EvtVarTypeFileTime:
+    value->integer = variant->FileTimeVal;
+    break;
+  default:
+    /* Arrays, GUIDs, SIDs and the others are not supported. */
+    value->type = FILTER_VALUE_NULL;
+    break;
+  }
+}
+
+/*
+ * Render the values of the filter paths and evaluate the predicates
+ * on them. The buffer is reused for the next events. This does not
+ * raise any Ruby exceptions.
+ */
+DWORD
+filter_event(struct WinevtFilterContext* filterContext, EVT_HANDLE hEvent, BOOL* matched)
+{
+  DWORD propCount = 0;
+  DWORD status = render_values_to_buffer(filterContext->context, hEvent, &filterContext->buffer,
+                                         &filterContext->bufferSize, &propCount);
+
+  if (status != ERROR_SUCCESS) {
+    return status;
+  }
+
+  for (DWORD i = 0; i < filterContext->filter->pathCount; i++) {
+    if (i < propCount) {
+      variant_to_filter_value(&filterContext->buffer[i], &filterContext->values[i]);
+    } else {
+      ZeroMemory(&filterContext->values[i], sizeof(struct WinevtFilterValue));
+    }
+  }
+  *matched = winevt_filter_match(filterContext->filter, filterContext->values);
+
+  return ERROR_SUCCESS;
+}
+#endif /* _WIN32 */
+
+void
+Init_winevt_filter(VALUE rb_cEventLog)
+{
+  rb_cFilter = rb_define_class_under(rb_cEventLog, "Filter", rb_cObject);
+  rb_define_alloc_func(rb_cFilter, rb_winevt_filter_alloc);
+
+  id_paths = rb_intern("@paths");
+  id_equals = rb_intern("equals");
+  id_in = rb_intern("in");
+  id_range = rb_intern("range");
+  id_substring = rb_intern("substring");
+  id_prefix = rb_intern("prefix");
+  id_regex = rb_intern("regex");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cFilter, "initialize", rb_winevt_filter_initialize, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cFilter, "paths", rb_winevt_filter_paths, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cFilter, "size", rb_winevt_filter_size, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cFilter, "match?", rb_winevt_filter_match_p, 1);
+}
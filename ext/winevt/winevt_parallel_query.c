@@ -0,0 +1,684 @@
+#include <winevt_c.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::ParallelQuery
+ *
+ * Query a time range of Windows EventLog channel in parallel.
+ *
+ * The range is split into partitions. Each partition is read by its
+ * own thread with its own EvtQuery and rendered there. The partitions
+ * are merged in the order of EventRecordID.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @query = Winevt::EventLog::ParallelQuery.new("Application", "*[System[Level <= 3]]",
+ *                                               Time.now - 86400 * 30, Time.now, 8)
+ *
+ *  @query.each do |eventlog, message, string_inserts|
+ *    puts ({eventlog: eventlog, data: message})
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+static ID id_channel;
+
+static void parallel_query_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_parallel_query_type = { "winevt/parallel_query",
+                                                              {
+                                                                0,
+                                                                parallel_query_free,
+                                                                0,
+                                                              },
+                                                              NULL,
+                                                              NULL,
+                                                              RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+parallel_query_free(void* ptr)
+{
+  struct WinevtParallelQuery* winevtParallelQuery = (struct WinevtParallelQuery*)ptr;
+
+  if (winevtParallelQuery->partitions) {
+    for (DWORD i = 0; i < winevtParallelQuery->partitionCount; i++) {
+      free(winevtParallelQuery->partitions[i].xpath);
+    }
+    xfree(winevtParallelQuery->partitions);
+  }
+  free(winevtParallelQuery->channel);
+  if (winevtParallelQuery->initialized) {
+    winevt_cond_destroy(&winevtParallelQuery->notEmpty);
+    winevt_cond_destroy(&winevtParallelQuery->notFull);
+    winevt_mutex_destroy(&winevtParallelQuery->lock);
+  }
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_parallel_query_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtParallelQuery* winevtParallelQuery;
+  obj = TypedData_Make_Struct(klass,
+                              struct WinevtParallelQuery,
+                              &rb_winevt_parallel_query_type,
+                              winevtParallelQuery);
+  return obj;
+}
+
+static struct WinevtParallelQuery*
+get_parallel_query(VALUE self)
+{
+  struct WinevtParallelQuery* winevtParallelQuery;
+
+  TypedData_Get_Struct(self,
+                       struct WinevtParallelQuery,
+                       &rb_winevt_parallel_query_type,
+                       winevtParallelQuery);
+
+  return winevtParallelQuery;
+}
+
+static WCHAR*
+utf8_to_wstr(const char* str, long length)
+{
+  int len = MultiByteToWideChar(CP_UTF8, 0, str, length, NULL, 0);
+  WCHAR* wstr = malloc(sizeof(WCHAR) * (len + 1));
+
+  if (!wstr) {
+    return NULL;
+  }
+  MultiByteToWideChar(CP_UTF8, 0, str, length, wstr, len);
+  wstr[len] = L'\0';
+
+  return wstr;
+}
+
+/*
+ * Initalize ParallelQuery class.
+ *
+ * @overload initialize(channel, xpath, from, to, partitions=DEFAULT_PARTITIONS)
+ *   @param channel [String] Querying EventLog channel.
+ *   @param xpath [String] Querying XPath. "*" or an XPath with a
+ *     single predicate such as "*[System[Level=2]]".
+ *   @param from [Time] Beginning of the range.
+ *   @param to [Time] End of the range, which is not included.
+ *   @param partitions [Integer] Number of the partitions.
+ * @return [ParallelQuery]
+ *
+ */
+static VALUE
+rb_winevt_parallel_query_initialize(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_channel, rb_xpath, rb_from, rb_to, rb_partitions, rb_buf;
+  struct WinevtParallelQuery* winevtParallelQuery = get_parallel_query(self);
+  struct WinevtTimeRange* ranges;
+  long partitions = PARALLEL_QUERY_DEFAULT_PARTITIONS;
+  size_t count;
+
+  rb_scan_args(argc, argv, "41", &rb_channel, &rb_xpath, &rb_from, &rb_to, &rb_partitions);
+  Check_Type(rb_channel, T_STRING);
+  Check_Type(rb_xpath, T_STRING);
+  if (!NIL_P(rb_partitions)) {
+    partitions = NUM2LONG(rb_partitions);
+  }
+  if (partitions < 1 || partitions > PARALLEL_QUERY_MAX_PARTITIONS) {
+    rb_raise(rb_eArgError, "partitions must be between 1 and %d",
+             PARALLEL_QUERY_MAX_PARTITIONS);
+  }
+  if (winevtParallelQuery->partitions) {
+    rb_raise(rb_eRuntimeError, "already initialized parallel query");
+  }
+
+  ranges = ALLOCV_N(struct WinevtTimeRange, rb_buf, partitions);
+  count = winevt_split_time_range(
+    winevt_time_to_msec(rb_from), winevt_time_to_msec(rb_to), partitions, ranges);
+
+  winevtParallelQuery->partitions = ZALLOC_N(struct WinevtPartition, count > 0 ? count : 1);
+  for (size_t i = 0; i < count; i++) {
+    struct WinevtPartition* partition = &winevtParallelQuery->partitions[i];
+    char* xpath =
+      winevt_time_range_xpath(RSTRING_PTR(rb_xpath), RSTRING_LEN(rb_xpath), &ranges[i]);
+
+    if (!xpath) {
+      ALLOCV_END(rb_buf);
+      rb_raise(rb_eArgError, "Cannot partition the XPath: %" PRIsVALUE, rb_xpath);
+    }
+    partition->parent = winevtParallelQuery;
+    partition->xpath = utf8_to_wstr(xpath, -1);
+    free(xpath);
+    winevtParallelQuery->partitionCount++;
+    if (!partition->xpath) {
+      ALLOCV_END(rb_buf);
+      rb_memerror();
+    }
+  }
+  ALLOCV_END(rb_buf);
+
+  winevtParallelQuery->channel = utf8_to_wstr(RSTRING_PTR(rb_channel), RSTRING_LEN(rb_channel));
+  if (!winevtParallelQuery->channel) {
+    rb_memerror();
+  }
+  winevtParallelQuery->renderAsXML = TRUE;
+  winevtParallelQuery->preserveQualifiers = FALSE;
+  winevtParallelQuery->preserveSID = TRUE;
+  winevtParallelQuery->localeInfo = &default_locale;
+  winevt_mutex_init(&winevtParallelQuery->lock);
+  winevt_cond_init(&winevtParallelQuery->notEmpty);
+  winevt_cond_init(&winevtParallelQuery->notFull);
+  winevtParallelQuery->initialized = TRUE;
+  rb_ivar_set(self, id_channel, rb_obj_freeze(rb_str_dup(rb_channel)));
+
+  return Qnil;
+}
+
+static void
+close_events(EVT_HANDLE* events, DWORD from, DWORD count)
+{
+  for (DWORD i = from; i < count; i++) {
+    EvtClose(events[i]);
+  }
+}
+
+static uint64_t
+render_record_id(EVT_HANDLE hContext, EVT_HANDLE hEvent)
+{
+  DWORD propCount, status;
+  uint64_t recordId = 0;
+  PEVT_VARIANT values = render_to_values(hContext, hEvent, &propCount, &status);
+
+  if (values != NULL && propCount > 0 && values[0].Type == EvtVarTypeUInt64) {
+    recordId = values[0].UInt64Val;
+  }
+  free(values);
+
+  return recordId;
+}
+
+/*
+ * Read a partition and render its events into the queue. This runs on
+ * its own thread. So, this must not touch any Ruby objects.
+ */
+static void*
+partition_thread(void* ptr)
+{
+  static PCWSTR recordIdProperties[] = { L"Event/System/EventRecordID" };
+  struct WinevtPartition* partition = (struct WinevtPartition*)ptr;
+  struct WinevtParallelQuery* parent = partition->parent;
+  struct WinevtRenderOptions options;
+  EVT_HANDLE hEvents[QUERY_ARRAY_SIZE];
+  EVT_HANDLE hQuery = NULL, hRecordIdContext;
+  DWORD count, status = ERROR_SUCCESS;
+
+  options.renderAsXML = parent->renderAsXML;
+  options.langID = parent->localeInfo->langID;
+  options.remoteHandle = NULL;
+  options.systemContext = EvtCreateRenderContext(0, NULL, EvtRenderContextSystem);
+  options.userContext = EvtCreateRenderContext(0, NULL, EvtRenderContextUser);
+  hRecordIdContext =
+    EvtCreateRenderContext(1, recordIdProperties, EvtRenderContextValues);
+  if (!options.systemContext || !options.userContext || !hRecordIdContext) {
+    status = GetLastError();
+    goto done;
+  }
+
+  hQuery = EvtQuery(NULL, parent->channel, partition->xpath,
+                    EvtQueryChannelPath | EvtQueryTolerateQueryErrors);
+  if (!hQuery) {
+    status = GetLastError();
+    goto done;
+  }
+  winevt_mutex_lock(&parent->lock);
+  partition->query = hQuery;
+  if (parent->cancelled) {
+    winevt_mutex_unlock(&parent->lock);
+    goto done;
+  }
+  winevt_mutex_unlock(&parent->lock);
+
+  for (;;) {
+    if (!EvtNext(hQuery, QUERY_ARRAY_SIZE, hEvents, INFINITE, 0, &count)) {
+      status = GetLastError();
+      if (status == ERROR_NO_MORE_ITEMS || status == ERROR_CANCELLED) {
+        status = ERROR_SUCCESS;
+      }
+      break;
+    }
+
+    for (DWORD i = 0; i < count; i++) {
+      struct WinevtPartitionItem item;
+
+      item.recordId = render_record_id(hRecordIdContext, hEvents[i]);
+      status = render_event(hEvents[i], &options, &item.rendered);
+      EvtClose(hEvents[i]);
+      if (status != ERROR_SUCCESS) {
+        close_events(hEvents, i + 1, count);
+        goto done;
+      }
+
+      winevt_mutex_lock(&parent->lock);
+      while (partition->count == PARALLEL_QUERY_QUEUE_SIZE && !parent->cancelled) {
+        winevt_cond_wait(&parent->notFull, &parent->lock);
+      }
+      if (parent->cancelled) {
+        winevt_mutex_unlock(&parent->lock);
+        free_rendered_event(&item.rendered);
+        close_events(hEvents, i + 1, count);
+        goto done;
+      }
+      partition->items[(partition->head + partition->count) % PARALLEL_QUERY_QUEUE_SIZE] =
+        item;
+      partition->count++;
+      winevt_cond_broadcast(&parent->notEmpty);
+      winevt_mutex_unlock(&parent->lock);
+    }
+  }
+
+done:
+  winevt_mutex_lock(&parent->lock);
+  partition->query = NULL;
+  partition->finished = TRUE;
+  partition->error = status;
+  winevt_cond_broadcast(&parent->notEmpty);
+  winevt_mutex_unlock(&parent->lock);
+
+  if (hQuery)
+    EvtClose(hQuery);
+  if (hRecordIdContext)
+    EvtClose(hRecordIdContext);
+  if (options.systemContext)
+    EvtClose(options.systemContext);
+  if (options.userContext)
+    EvtClose(options.userContext);
+
+  return NULL;
+}
+
+/* Cancel the partitions and wait for their threads. */
+static void*
+stop_partitions(void* ptr)
+{
+  struct WinevtParallelQuery* winevtParallelQuery = (struct WinevtParallelQuery*)ptr;
+
+  winevt_mutex_lock(&winevtParallelQuery->lock);
+  winevtParallelQuery->cancelled = TRUE;
+  for (DWORD i = 0; i < winevtParallelQuery->partitionCount; i++) {
+    if (winevtParallelQuery->partitions[i].query) {
+      EvtCancel(winevtParallelQuery->partitions[i].query);
+    }
+  }
+  winevt_cond_broadcast(&winevtParallelQuery->notFull);
+  winevt_mutex_unlock(&winevtParallelQuery->lock);
+
+  for (DWORD i = 0; i < winevtParallelQuery->partitionCount; i++) {
+    struct WinevtPartition* partition = &winevtParallelQuery->partitions[i];
+    if (partition->started) {
+      winevt_thread_join(partition->thread);
+      partition->started = FALSE;
+    }
+  }
+
+  return NULL;
+}
+
+static VALUE
+parallel_query_stop(VALUE self)
+{
+  struct WinevtParallelQuery* winevtParallelQuery = get_parallel_query(self);
+
+  rb_thread_call_without_gvl(stop_partitions, winevtParallelQuery, NULL, NULL);
+
+  for (DWORD i = 0; i < winevtParallelQuery->partitionCount; i++) {
+    struct WinevtPartition* partition = &winevtParallelQuery->partitions[i];
+    for (DWORD j = 0; j < partition->count; j++) {
+      free_rendered_event(
+        &partition->items[(partition->head + j) % PARALLEL_QUERY_QUEUE_SIZE].rendered);
+    }
+    partition->head = 0;
+    partition->count = 0;
+  }
+  winevt_merge_heap_destroy(&winevtParallelQuery->heap);
+  winevtParallelQuery->running = FALSE;
+
+  return Qnil;
+}
+
+struct WaitPartitionArgs
+{
+  struct WinevtPartition* partition;
+  BOOL interrupted;
+};
+
+static void*
+wait_partition_without_gvl(void* ptr)
+{
+  struct WaitPartitionArgs* args = (struct WaitPartitionArgs*)ptr;
+  struct WinevtParallelQuery* parent = args->partition->parent;
+
+  winevt_mutex_lock(&parent->lock);
+  while (args->partition->count == 0 && !args->partition->finished && !args->interrupted) {
+    winevt_cond_wait(&parent->notEmpty, &parent->lock);
+  }
+  winevt_mutex_unlock(&parent->lock);
+
+  return NULL;
+}
+
+static void
+interrupt_wait_partition(void* ptr)
+{
+  struct WaitPartitionArgs* args = (struct WaitPartitionArgs*)ptr;
+  struct WinevtParallelQuery* parent = args->partition->parent;
+
+  winevt_mutex_lock(&parent->lock);
+  args->interrupted = TRUE;
+  winevt_cond_broadcast(&parent->notEmpty);
+  winevt_mutex_unlock(&parent->lock);
+}
+
+/* Wait for the next event of the partition and put it into the heap. */
+static void
+push_partition_head(VALUE self, struct WinevtParallelQuery* winevtParallelQuery,
+                    DWORD index)
+{
+  struct WaitPartitionArgs args;
+  struct WinevtPartition* partition = &winevtParallelQuery->partitions[index];
+  DWORD error;
+
+  args.partition = partition;
+  for (;;) {
+    args.interrupted = FALSE;
+    call_without_gvl(wait_partition_without_gvl, &args, interrupt_wait_partition, &args);
+    if (!args.interrupted) {
+      break;
+    }
+    rb_thread_check_ints();
+  }
+
+  winevt_mutex_lock(&winevtParallelQuery->lock);
+  if (partition->count > 0) {
+    winevt_merge_heap_push(
+      &winevtParallelQuery->heap, partition->items[partition->head].recordId, index);
+    winevt_mutex_unlock(&winevtParallelQuery->lock);
+    return;
+  }
+  error = partition->error;
+  winevt_mutex_unlock(&winevtParallelQuery->lock);
+
+  if (error == ERROR_EVT_CHANNEL_NOT_FOUND) {
+    raise_channel_not_found_error(rb_ivar_get(self, id_channel));
+  } else if (error != ERROR_SUCCESS) {
+    raise_system_error(rb_eWinevtQueryError, error);
+  }
+}
+
+static VALUE
+parallel_query_yield(VALUE self)
+{
+  struct WinevtParallelQuery* winevtParallelQuery = get_parallel_query(self);
+  uint64_t recordId;
+  size_t index;
+
+  for (DWORD i = 0; i < winevtParallelQuery->partitionCount; i++) {
+    push_partition_head(self, winevtParallelQuery, i);
+  }
+
+  while (winevt_merge_heap_pop(&winevtParallelQuery->heap, &recordId, &index)) {
+    struct WinevtPartition* partition = &winevtParallelQuery->partitions[index];
+    struct WinevtPartitionItem* item = &partition->items[partition->head];
+    VALUE rb_event;
+
+    /* The item stays in the queue until it is converted. So, it is
+     * released by parallel_query_stop when this raises. */
+    rb_event = rendered_event_to_rb_ary(&item->rendered,
+                                        winevtParallelQuery->preserveQualifiers,
+                                        winevtParallelQuery->preserveSID);
+
+    winevt_mutex_lock(&winevtParallelQuery->lock);
+    free_rendered_event(&item->rendered);
+    partition->head = (partition->head + 1) % PARALLEL_QUERY_QUEUE_SIZE;
+    partition->count--;
+    winevt_cond_broadcast(&winevtParallelQuery->notFull);
+    winevt_mutex_unlock(&winevtParallelQuery->lock);
+
+    rb_yield_values(3,
+                    RARRAY_AREF(rb_event, 0),
+                    RARRAY_AREF(rb_event, 1),
+                    RARRAY_AREF(rb_event, 2));
+    push_partition_head(self, winevtParallelQuery, (DWORD)index);
+  }
+
+  return Qnil;
+}
+
+/*
+ * Enumerate to obtain Windows EventLog contents of the time range in
+ * the order of EventRecordID.
+ *
+ * This method yields the following:
+ * (Stringified EventLog, Stringified detail message, Stringified
+ * insert values)
+ *
+ * Rendering options are fixed when the enumeration starts.
+ *
+ * @yield (String,String,String)
+ *
+ */
+static VALUE
+rb_winevt_parallel_query_each(VALUE self)
+{
+  struct WinevtParallelQuery* winevtParallelQuery;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  winevtParallelQuery = get_parallel_query(self);
+  if (!winevtParallelQuery->initialized) {
+    rb_raise(rb_eRuntimeError, "uninitialized parallel query");
+  }
+  if (winevtParallelQuery->running) {
+    rb_raise(rb_eRuntimeError, "parallel query is already running");
+  }
+
+  if (winevt_merge_heap_init(&winevtParallelQuery->heap,
+                             winevtParallelQuery->partitionCount) < 0) {
+    rb_memerror();
+  }
+  winevtParallelQuery->running = TRUE;
+  winevtParallelQuery->cancelled = FALSE;
+  for (DWORD i = 0; i < winevtParallelQuery->partitionCount; i++) {
+    struct WinevtPartition* partition = &winevtParallelQuery->partitions[i];
+    int error;
+
+    partition->finished = FALSE;
+    partition->error = ERROR_SUCCESS;
+    partition->query = NULL;
+    error = winevt_thread_create(&partition->thread, partition_thread, partition);
+    if (error != 0) {
+      parallel_query_stop(self);
+      raise_system_error(rb_eWinevtQueryError, error);
+    }
+    partition->started = TRUE;
+  }
+
+  rb_ensure(parallel_query_yield, self, parallel_query_stop, self);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the number of the partitions.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_parallel_query_partitions(VALUE self)
+{
+  return ULONG2NUM(get_parallel_query(self)->partitionCount);
+}
+
+/*
+ * This method returns whether render as xml or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_parallel_query_render_as_xml_p(VALUE self)
+{
+  return get_parallel_query(self)->renderAsXML ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether render as xml or not.
+ *
+ * @param rb_render_as_xml [Boolean]
+ */
+static VALUE
+rb_winevt_parallel_query_set_render_as_xml(VALUE self, VALUE rb_render_as_xml)
+{
+  get_parallel_query(self)->renderAsXML = RTEST(rb_render_as_xml);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether preserving qualifiers or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_parallel_query_get_preserve_qualifiers_p(VALUE self)
+{
+  return get_parallel_query(self)->preserveQualifiers ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether preserving qualifiers key or not.
+ *
+ * @param rb_preserve_qualifiers [Boolean]
+ */
+static VALUE
+rb_winevt_parallel_query_set_preserve_qualifiers(VALUE self, VALUE rb_preserve_qualifiers)
+{
+  get_parallel_query(self)->preserveQualifiers = RTEST(rb_preserve_qualifiers);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether preserving SID or not.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_parallel_query_preserve_sid_p(VALUE self)
+{
+  return get_parallel_query(self)->preserveSID ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies whether preserving SID or not.
+ *
+ * @param rb_preserve_sid_p [Boolean]
+ */
+static VALUE
+rb_winevt_parallel_query_set_preserve_sid(VALUE self, VALUE rb_preserve_sid_p)
+{
+  get_parallel_query(self)->preserveSID = RTEST(rb_preserve_sid_p);
+
+  return Qnil;
+}
+
+/*
+ * This method obtains specified locale with [String].
+ */
+static VALUE
+rb_winevt_parallel_query_get_locale(VALUE self)
+{
+  struct WinevtParallelQuery* winevtParallelQuery = get_parallel_query(self);
+
+  if (winevtParallelQuery->localeInfo && winevtParallelQuery->localeInfo->langCode) {
+    return rb_str_new2(winevtParallelQuery->localeInfo->langCode);
+  } else {
+    return rb_str_new2(default_locale.langCode);
+  }
+}
+
+/*
+ * This method specifies locale with [String].
+ *
+ * @param rb_locale_str [String]
+ */
+static VALUE
+rb_winevt_parallel_query_set_locale(VALUE self, VALUE rb_locale_str)
+{
+  get_parallel_query(self)->localeInfo = get_locale_info_from_rb_str(rb_locale_str);
+
+  return Qnil;
+}
+
+void
+Init_winevt_parallel_query(VALUE rb_cEventLog)
+{
+  rb_define_alloc_func(rb_cParallelQuery, rb_winevt_parallel_query_alloc);
+
+  id_channel = rb_intern("@channel");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cParallelQuery, "initialize", rb_winevt_parallel_query_initialize, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cParallelQuery, "each", rb_winevt_parallel_query_each, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cParallelQuery, "partitions", rb_winevt_parallel_query_partitions, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cParallelQuery, "render_as_xml?", rb_winevt_parallel_query_render_as_xml_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cParallelQuery, "render_as_xml=", rb_winevt_parallel_query_set_render_as_xml, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cParallelQuery,
+                   "preserve_qualifiers?",
+                   rb_winevt_parallel_query_get_preserve_qualifiers_p,
+                   0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cParallelQuery,
+                   "preserve_qualifiers=",
+                   rb_winevt_parallel_query_set_preserve_qualifiers,
+                   1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cParallelQuery, "preserve_sid?", rb_winevt_parallel_query_preserve_sid_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cParallelQuery, "preserve_sid=", rb_winevt_parallel_query_set_preserve_sid, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cParallelQuery, "locale", rb_winevt_parallel_query_get_locale, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cParallelQuery, "locale=", rb_winevt_parallel_query_set_locale, 1);
+}
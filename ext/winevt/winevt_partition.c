@@ -0,0 +1,445 @@
+#include <winevt_c.h>
+
+#include <string.h>
+
+/*
+ * Planning of ParallelQuery: splitting a time range into partitions,
+ * making XPath for each of them and merging the partitions in the
+ * order of EventRecordID. These are portable. Reading partitions is
+ * implemented in winevt_parallel_query.c.
+ */
+
+VALUE rb_cParallelQuery;
+
+/*
+ * Split [from, to) into at most n ranges of the same length. Returns
+ * the number of the ranges.
+ */
+size_t
+winevt_split_time_range(int64_t from, int64_t to, size_t n,
+                        struct WinevtTimeRange* ranges)
+{
+  int64_t span = to - from;
+  size_t count = n;
+
+  if (span <= 0 || n == 0)
+    return 0;
+  if ((uint64_t)span < (uint64_t)n)
+    count = (size_t)span;
+
+  for (size_t i = 0; i < count; i++) {
+    ranges[i].from = from + (int64_t)(span * (double)i / count);
+    ranges[i].to = i + 1 == count ? to : from + (int64_t)(span * (double)(i + 1) / count);
+  }
+
+  return count;
+}
+
+/* Format msec since the epoch as SystemTime, 2020-01-02T03:04:05.678Z. */
+void
+winevt_format_system_time(int64_t msec, char* buffer, size_t size)
+{
+  int64_t days = msec / 86400000;
+  int64_t rest = msec % 86400000;
+  int64_t era, doe, yoe, doy, mp, year, month, day;
+
+  if (rest < 0) {
+    rest += 86400000;
+    days--;
+  }
+
+  /* Civil date from days since 1970-01-01. */
+  days += 719468;
+  era = (days >= 0 ? days : days - 146096) / 146097;
+  doe = days - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = mp < 10 ? mp + 3 : mp - 9;
+  year = yoe + era * 400 + (month <= 2);
+
+  snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+           (int)year, (int)month, (int)day,
+           (int)(rest / 3600000), (int)(rest / 60000 % 60),
+           (int)(rest / 1000 % 60), (int)(rest % 1000));
+}
+
+/*
+ * Return the length of the predicate which starts with '[' at
+ * xpath[0] including its ']', or 0 when it is not closed.
+ */
+static size_t
+predicate_length(const char* xpath, size_t length)
+{
+  int depth = 0;
+  char quote = 0;
+
+  for (size_t i = 0; i < length; i++) {
+    char c = xpath[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+    } else if (c == '[') {
+      depth++;
+    } else if (c == ']' && --depth == 0) {
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Restrict the XPath to the time range. Only "*" and a single
+ * predicate on "*" can be restricted. Returns a string which is
+ * allocated with malloc or NULL when the XPath is not supported.
+ */
+char*
+winevt_time_range_xpath(const char* xpath, size_t length,
+                        const struct WinevtTimeRange* range)
+{
+  char from[32], to[32], clause[128];
+  const char* body = NULL;
+  size_t bodyLength = 0;
+  char* result;
+  size_t resultLength;
+
+  while (length > 0 && (*xpath == ' ' || *xpath == '\t' || *xpath == '\r' || *xpath == '\n')) {
+    xpath++;
+    length--;
+  }
+  while (length > 0 && (xpath[length - 1] == ' ' || xpath[length - 1] == '\t' ||
+                        xpath[length - 1] == '\r' || xpath[length - 1] == '\n')) {
+    length--;
+  }
+
+  if (length > 2 && xpath[0] == '*' && xpath[1] == '[') {
+    if (predicate_length(xpath + 1, length - 1) != length - 1)
+      return NULL;
+    body = xpath + 2;
+    bodyLength = length - 3;
+  } else if (!(length == 0 || (length == 1 && xpath[0] == '*'))) {
+    return NULL;
+  }
+
+  winevt_format_system_time(range->from, from, sizeof(from));
+  winevt_format_system_time(range->to, to, sizeof(to));
+  snprintf(clause, sizeof(clause),
+           "System[TimeCreated[@SystemTime>='%s' and @SystemTime<'%s']]", from, to);
+
+  resultLength = bodyLength + strlen(clause) + 16;
+  result = malloc(resultLength);
+  if (!result)
+    return NULL;
+  if (body) {
+    snprintf(result, resultLength, "*[(%.*s) and %s]", (int)bodyLength, body, clause);
+  } else {
+    snprintf(result, resultLength, "*[%s]", clause);
+  }
+
+  return result;
+}
+
+/* Min heap of the heads of the partitions keyed by EventRecordID. */
+int
+winevt_merge_heap_init(struct WinevtMergeHeap* heap, size_t capacity)
+{
+  heap->keys = malloc(sizeof(uint64_t) * (capacity ? capacity : 1));
+  heap->indexes = malloc(sizeof(size_t) * (capacity ? capacity : 1));
+  heap->count = 0;
+  heap->capacity = capacity;
+  if (!heap->keys || !heap->indexes) {
+    winevt_merge_heap_destroy(heap);
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+winevt_merge_heap_destroy(struct WinevtMergeHeap* heap)
+{
+  free(heap->keys);
+  free(heap->indexes);
+  heap->keys = NULL;
+  heap->indexes = NULL;
+  heap->count = 0;
+  heap->capacity = 0;
+}
+
+/* Ties are broken by the index, that is, the earlier partition. */
+static int
+merge_heap_less(const struct WinevtMergeHeap* heap, size_t a, size_t b)
+{
+  if (heap->keys[a] != heap->keys[b])
+    return heap->keys[a] < heap->keys[b];
+  return heap->indexes[a] < heap->indexes[b];
+}
+
+static void
+merge_heap_swap(struct WinevtMergeHeap* heap, size_t a, size_t b)
+{
+  uint64_t key = heap->keys[a];
+  size_t index = heap->indexes[a];
+
+  heap->keys[a] = heap->keys[b];
+  heap->indexes[a] = heap->indexes[b];
+  heap->keys[b] = key;
+  heap->indexes[b] = index;
+}
+
+/* Each partition has at most one entry. So, it never overflows. */
+void
+winevt_merge_heap_push(struct WinevtMergeHeap* heap, uint64_t key, size_t index)
+{
+  size_t i = heap->count++;
+
+  heap->keys[i] = key;
+  heap->indexes[i] = index;
+  while (i > 0 && merge_heap_less(heap, i, (i - 1) / 2)) {
+    merge_heap_swap(heap, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+/* Returns 0 when the heap is empty. */
+int
+winevt_merge_heap_pop(struct WinevtMergeHeap* heap, uint64_t* key, size_t* index)
+{
+  size_t i = 0;
+
+  if (heap->count == 0)
+    return 0;
+
+  *key = heap->keys[0];
+  *index = heap->indexes[0];
+  heap->count--;
+  heap->keys[0] = heap->keys[heap->count];
+  heap->indexes[0] = heap->indexes[heap->count];
+  for (;;) {
+    size_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+    if (left < heap->count && merge_heap_less(heap, left, smallest))
+      smallest = left;
+    if (right < heap->count && merge_heap_less(heap, right, smallest))
+      smallest = right;
+    if (smallest == i)
+      break;
+    merge_heap_swap(heap, i, smallest);
+    i = smallest;
+  }
+
+  return 1;
+}
+
+/* Convert Time or Numeric of seconds into msec since the epoch. */
+int64_t
+winevt_time_to_msec(VALUE rb_time)
+{
+  struct timespec ts = rb_time_timespec(rb_time);
+
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static VALUE
+msec_to_time(int64_t msec)
+{
+  int64_t sec = msec / 1000, rest = msec % 1000;
+
+  if (rest < 0) {
+    rest += 1000;
+    sec--;
+  }
+
+  return rb_time_nano_new((time_t)sec, (long)rest * 1000000);
+}
+
+/*
+ * This method splits [from, to) into the time ranges of partitions.
+ * The boundaries are rounded to milliseconds.
+ *
+ * @param rb_from [Time]
+ * @param rb_to [Time]
+ * @param rb_partitions [Integer] Number of the partitions.
+ * @return [Array<Array<Time>>] Pairs of the beginning and the end.
+ */
+static VALUE
+rb_winevt_parallel_query_s_split_time_range(VALUE klass, VALUE rb_from, VALUE rb_to,
+                                            VALUE rb_partitions)
+{
+  long partitions = NUM2LONG(rb_partitions);
+  struct WinevtTimeRange* ranges;
+  VALUE rb_ranges, rb_buf;
+  size_t count;
+
+  if (partitions < 1 || partitions > PARALLEL_QUERY_MAX_PARTITIONS) {
+    rb_raise(rb_eArgError, "partitions must be between 1 and %d",
+             PARALLEL_QUERY_MAX_PARTITIONS);
+  }
+
+  ranges = ALLOCV_N(struct WinevtTimeRange, rb_buf, partitions);
+  count = winevt_split_time_range(
+    winevt_time_to_msec(rb_from), winevt_time_to_msec(rb_to), partitions, ranges);
+  rb_ranges = rb_ary_new_capa(count);
+  for (size_t i = 0; i < count; i++) {
+    rb_ary_push(rb_ranges,
+                rb_assoc_new(msec_to_time(ranges[i].from), msec_to_time(ranges[i].to)));
+  }
+  ALLOCV_END(rb_buf);
+
+  return rb_ranges;
+}
+
+/*
+ * This method restricts the XPath to [from, to) with TimeCreated.
+ *
+ * @param rb_xpath [String] "*" or an XPath with a single predicate
+ *   such as "*[System[Level=2]]".
+ * @param rb_from [Time]
+ * @param rb_to [Time]
+ * @return [String]
+ */
+static VALUE
+rb_winevt_parallel_query_s_partition_xpath(VALUE klass, VALUE rb_xpath, VALUE rb_from,
+                                           VALUE rb_to)
+{
+  struct WinevtTimeRange range;
+  char* xpath;
+  VALUE rb_result;
+
+  Check_Type(rb_xpath, T_STRING);
+  range.from = winevt_time_to_msec(rb_from);
+  range.to = winevt_time_to_msec(rb_to);
+
+  xpath = winevt_time_range_xpath(RSTRING_PTR(rb_xpath), RSTRING_LEN(rb_xpath), &range);
+  if (!xpath) {
+    rb_raise(rb_eArgError, "Cannot partition the XPath: %" PRIsVALUE, rb_xpath);
+  }
+  rb_result = rb_utf8_str_new_cstr(xpath);
+  free(xpath);
+
+  return rb_result;
+}
+
+struct MergeArgs
+{
+  struct WinevtMergeHeap heap;
+  VALUE partitions;
+  long* positions;
+};
+
+static uint64_t
+partition_record_id(VALUE rb_pair)
+{
+  Check_Type(rb_pair, T_ARRAY);
+  if (RARRAY_LEN(rb_pair) != 2) {
+    rb_raise(rb_eArgError, "Specify pairs of EventRecordID and a value");
+  }
+
+  return NUM2ULL(RARRAY_AREF(rb_pair, 0));
+}
+
+static void
+push_partition_head(struct MergeArgs* args, long index)
+{
+  VALUE rb_partition = RARRAY_AREF(args->partitions, index);
+
+  if (args->positions[index] < RARRAY_LEN(rb_partition)) {
+    winevt_merge_heap_push(
+      &args->heap,
+      partition_record_id(RARRAY_AREF(rb_partition, args->positions[index])),
+      index);
+  }
+}
+
+static VALUE
+merge_partitions(VALUE ptr)
+{
+  struct MergeArgs* args = (struct MergeArgs*)ptr;
+  uint64_t key;
+  size_t index;
+
+  for (long i = 0; i < RARRAY_LEN(args->partitions); i++) {
+    Check_Type(RARRAY_AREF(args->partitions, i), T_ARRAY);
+    push_partition_head(args, i);
+  }
+  while (winevt_merge_heap_pop(&args->heap, &key, &index)) {
+    VALUE rb_partition = RARRAY_AREF(args->partitions, index);
+    VALUE rb_pair = RARRAY_AREF(rb_partition, args->positions[index]++);
+    rb_yield(RARRAY_AREF(rb_pair, 1));
+    push_partition_head(args, (long)index);
+  }
+
+  return Qnil;
+}
+
+static VALUE
+destroy_merge_heap(VALUE ptr)
+{
+  winevt_merge_heap_destroy(&((struct MergeArgs*)ptr)->heap);
+
+  return Qnil;
+}
+
+/*
+ * This method merges partitions in the order of EventRecordID in the
+ * same way as ParallelQuery#each. Each partition must be sorted.
+ *
+ * @param rb_partitions [Array<Array>] Partitions which consist of
+ *   pairs of EventRecordID and a value.
+ * @yield (Object) The values.
+ */
+static VALUE
+rb_winevt_parallel_query_s_merge(VALUE klass, VALUE rb_partitions)
+{
+  struct MergeArgs args;
+  VALUE rb_buf;
+  long count;
+
+  RETURN_ENUMERATOR(klass, 1, &rb_partitions);
+
+  Check_Type(rb_partitions, T_ARRAY);
+  rb_partitions = rb_ary_dup(rb_partitions);
+  count = RARRAY_LEN(rb_partitions);
+  args.partitions = rb_partitions;
+  args.positions = ALLOCV_N(long, rb_buf, count > 0 ? count : 1);
+  memset(args.positions, 0, sizeof(long) * (count > 0 ? count : 1));
+  if (winevt_merge_heap_init(&args.heap, count) < 0) {
+    ALLOCV_END(rb_buf);
+    rb_memerror();
+  }
+  rb_ensure(merge_partitions, (VALUE)&args, destroy_merge_heap, (VALUE)&args);
+  ALLOCV_END(rb_buf);
+  RB_GC_GUARD(rb_partitions);
+
+  return Qnil;
+}
+
+void
+Init_winevt_partition(VALUE rb_cEventLog)
+{
+  rb_cParallelQuery = rb_define_class_under(rb_cEventLog, "ParallelQuery", rb_cObject);
+
+  /*
+   * Default number of the partitions.
+   * @since 0.12.0
+   */
+  rb_define_const(rb_cParallelQuery, "DEFAULT_PARTITIONS", INT2NUM(PARALLEL_QUERY_DEFAULT_PARTITIONS));
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(
+    rb_cParallelQuery, "split_time_range", rb_winevt_parallel_query_s_split_time_range, 3);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(
+    rb_cParallelQuery, "partition_xpath", rb_winevt_parallel_query_s_partition_xpath, 3);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(rb_cParallelQuery, "merge", rb_winevt_parallel_query_s_merge, 1);
+}
@@ -19,6 +19,9 @@
 
 VALUE rb_cFlag;
 
+static ID id_filter;
+static ID id_sampler;
+
 static void query_free(void* ptr);
 
 static const rb_data_type_t rb_winevt_query_type = { "winevt/query",
@@ -57,6 +60,8 @@ query_free(void* ptr)
 {
   struct WinevtQuery* winevtQuery = (struct WinevtQuery*)ptr;
   close_handles(winevtQuery);
+  filter_context_free(&winevtQuery->filter);
+  sampler_context_free(&winevtQuery->sampler);
 
   xfree(ptr);
 }
@@ -76,7 +81,12 @@ rb_winevt_query_alloc(VALUE klass)
  *
  * @overload initialize(channel, xpath, session=nil)
  *   @param channel [String] Querying EventLog channel.
- *   @param xpath [String] Querying XPath.
+ *   @param xpath [String, CompiledQuery] Querying XPath.
+ *   @param session [Session] Session information for remoting access.
+ * @overload initialize(query_list, session=nil)
+ *   Query the channels of query_list with one handle. #each yields
+ *   the channel of each event as 4th value.
+ *   @param query_list [QueryList] Querying channels and XPaths.
  *   @param session [Session] Session information for remoting access.
  * @return [Query]
  *
@@ -90,12 +100,29 @@ rb_winevt_query_initialize(VALUE argc, VALUE *argv, VALUE self)
   struct WinevtSession* winevtSession;
   EVT_HANDLE hRemoteHandle = NULL;
   DWORD len, flags = 0;
-  VALUE wchannelBuf, wpathBuf;
+  VALUE wchannelBuf = 0, wpathBuf = 0;
+  VALUE queryList = Qnil;
   DWORD err = ERROR_SUCCESS;
 
-  rb_scan_args(argc, argv, "22", &channel, &xpath, &session, &rb_flags);
-  Check_Type(channel, T_STRING);
-  Check_Type(xpath, T_STRING);
+  rb_scan_args(argc, argv, "13", &channel, &xpath, &session, &rb_flags);
+  if (rb_obj_is_kind_of(channel, rb_cQueryList)) {
+    if (argc > 3) {
+      rb_error_arity((int)argc, 1, 3);
+    }
+    queryList = channel;
+    rb_flags = session;
+    session = xpath;
+    xpath = winevt_query_list_to_xml(queryList);
+    channel = Qnil;
+  } else {
+    if (argc < 2) {
+      rb_error_arity((int)argc, 2, 4);
+    }
+    Check_Type(channel, T_STRING);
+    if (!rb_obj_is_kind_of(xpath, rb_cCompiledQuery)) {
+      Check_Type(xpath, T_STRING);
+    }
+  }
 
   if (rb_obj_is_kind_of(session, rb_cSession)) {
     winevtSession = EventSession(session);
@@ -125,19 +152,29 @@ rb_winevt_query_initialize(VALUE argc, VALUE *argv, VALUE self)
     rb_raise(rb_eArgError, "Expected a String, a Symbol, a Fixnum, or a NilClass instance");
   }
 
-  // channel : To wide char
-  len =
-    MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(channel), RSTRING_LEN(channel), NULL, 0);
-  evtChannel = ALLOCV_N(WCHAR, wchannelBuf, len + 1);
-  MultiByteToWideChar(
-    CP_UTF8, 0, RSTRING_PTR(channel), RSTRING_LEN(channel), evtChannel, len);
-  evtChannel[len] = L'\0';
+  if (NIL_P(channel)) {
+    /* The channels are in the structured query. */
+    evtChannel = NULL;
+  } else {
+    // channel : To wide char
+    len =
+      MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(channel), RSTRING_LEN(channel), NULL, 0);
+    evtChannel = ALLOCV_N(WCHAR, wchannelBuf, len + 1);
+    MultiByteToWideChar(
+      CP_UTF8, 0, RSTRING_PTR(channel), RSTRING_LEN(channel), evtChannel, len);
+    evtChannel[len] = L'\0';
+  }
 
-  // xpath : To wide char
-  len = MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(xpath), RSTRING_LEN(xpath), NULL, 0);
-  evtXPath = ALLOCV_N(WCHAR, wpathBuf, len + 1);
-  MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(xpath), RSTRING_LEN(xpath), evtXPath, len);
-  evtXPath[len] = L'\0';
+  if (rb_obj_is_kind_of(xpath, rb_cCompiledQuery)) {
+    /* It is already validated and converted. */
+    evtXPath = (PWSTR)winevt_compiled_query_wstr(xpath);
+  } else {
+    // xpath : To wide char
+    len = MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(xpath), RSTRING_LEN(xpath), NULL, 0);
+    evtXPath = ALLOCV_N(WCHAR, wpathBuf, len + 1);
+    MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(xpath), RSTRING_LEN(xpath), evtXPath, len);
+    evtXPath[len] = L'\0';
+  }
 
   TypedData_Get_Struct(self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
 
@@ -149,7 +186,10 @@ rb_winevt_query_initialize(VALUE argc, VALUE *argv, VALUE self)
       EvtClose(hRemoteHandle);
     }
     if (err == ERROR_EVT_CHANNEL_NOT_FOUND) {
-      raise_channel_not_found_error(channel);
+      raise_channel_not_found_error(
+        NIL_P(queryList)
+          ? channel
+          : rb_ary_join(winevt_query_list_channels(queryList), rb_str_new_cstr(", ")));
     }
     raise_system_error(rb_eRuntimeError, err);
   }
@@ -160,9 +200,12 @@ rb_winevt_query_initialize(VALUE argc, VALUE *argv, VALUE self)
   winevtQuery->localeInfo = &default_locale;
   winevtQuery->remoteHandle = hRemoteHandle;
   winevtQuery->preserveSID = TRUE;
+  winevtQuery->multiChannel = is_structured_query(evtXPath);
+  winevtQuery->yieldPath = !NIL_P(queryList);
 
   ALLOCV_END(wchannelBuf);
   ALLOCV_END(wpathBuf);
+  RB_GC_GUARD(xpath);
 
   return Qnil;
 }
@@ -249,7 +292,7 @@ rb_winevt_query_next(VALUE self)
 
   TypedData_Get_Struct(self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
 
-  if (!EvtNext(winevtQuery->query, QUERY_ARRAY_SIZE, hEvents, INFINITE, 0, &count)) {
+  if (!evt_next(winevtQuery->query, QUERY_ARRAY_SIZE, hEvents, INFINITE, &count)) {
     status = GetLastError();
     if (ERROR_CANCELLED == status) {
       return Qfalse;
@@ -401,14 +444,50 @@ rb_winevt_query_each_yield(VALUE self)
 
   TypedData_Get_Struct(self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
 
+  ULONG yielded = 0;
+
   for (int i = 0; i < winevtQuery->count; i++) {
-    rb_yield_values(3,
-                    rb_winevt_query_render(self, winevtQuery->hEvents[i]),
-                    rb_winevt_query_message(winevtQuery->hEvents[i], winevtQuery->localeInfo,
-                                            winevtQuery->remoteHandle),
-                    rb_winevt_query_string_inserts(winevtQuery->hEvents[i]));
+    if (winevtQuery->filter.filter) {
+      BOOL matched = FALSE;
+      DWORD status = filter_event(&winevtQuery->filter, winevtQuery->hEvents[i], &matched);
+      if (status != ERROR_SUCCESS) {
+        raise_system_error(rb_eWinevtQueryError, status);
+      }
+      if (!matched) {
+        winevtQuery->filteredCount++;
+        continue;
+      }
+    }
+    if (winevtQuery->sampler.sampler) {
+      BOOL kept = TRUE;
+      DWORD status = sample_event(&winevtQuery->sampler, winevtQuery->hEvents[i], &kept);
+      if (status != ERROR_SUCCESS) {
+        raise_system_error(rb_eWinevtQueryError, status);
+      }
+      if (!kept) {
+        winevtQuery->sampledCount++;
+        continue;
+      }
+    }
+    if (winevtQuery->yieldPath) {
+      rb_yield_values(4,
+                      rb_winevt_query_render(self, winevtQuery->hEvents[i]),
+                      rb_winevt_query_message(winevtQuery->hEvents[i],
+                                              winevtQuery->localeInfo,
+                                              winevtQuery->remoteHandle),
+                      rb_winevt_query_string_inserts(winevtQuery->hEvents[i]),
+                      get_event_path(winevtQuery->hEvents[i]));
+    } else {
+      rb_yield_values(3,
+                      rb_winevt_query_render(self, winevtQuery->hEvents[i]),
+                      rb_winevt_query_message(winevtQuery->hEvents[i],
+                                              winevtQuery->localeInfo,
+                                              winevtQuery->remoteHandle),
+                      rb_winevt_query_string_inserts(winevtQuery->hEvents[i]));
+    }
+    yielded++;
   }
-  return Qnil;
+  return ULONG2NUM(yielded);
 }
 
 /*
@@ -418,19 +497,45 @@ rb_winevt_query_each_yield(VALUE self)
  * (Stringified EventLog, Stringified detail message, Stringified
  * insert values)
  *
+ * When the query is opened with a QueryList, the channel of each
+ * event is also yielded as 4th value.
+ *
+ * With max_events: or max_time:, this method stops at the end of the
+ * batch which uses up either of them. Then, the next #each continues
+ * from the next batch.
+ *
+ * @overload each(max_events: nil, max_time: nil)
+ *   @param max_events [Integer, nil] Stop after yielding this number
+ *     of events at least.
+ *   @param max_time [Numeric, nil] Stop after this number of seconds.
  * @yield (String,String,String)
+ * @return [Boolean] Whether more events may be pending. It is true
+ *   when either of the budgets is used up and false when all of the
+ *   events are yielded.
  *
  */
 static VALUE
-rb_winevt_query_each(VALUE self)
+rb_winevt_query_each(int argc, VALUE* argv, VALUE self)
 {
-  RETURN_ENUMERATOR(self, 0, 0);
+  VALUE rb_opts;
+  struct WinevtEachBudget budget;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+
+  rb_scan_args(argc, argv, "0:", &rb_opts);
+  each_budget_init(&budget, rb_opts);
 
   while (rb_winevt_query_next(self)) {
-    rb_ensure(rb_winevt_query_each_yield, self, rb_winevt_query_close_handle, self);
+    budget.yielded += NUM2ULONG(
+      rb_ensure(rb_winevt_query_each_yield, self, rb_winevt_query_close_handle, self));
+    if (each_budget_exhausted(&budget)) {
+      /* The result set does not tell whether it has more events
+       * without reading them. */
+      return Qtrue;
+    }
   }
 
-  return Qnil;
+  return Qfalse;
 }
 
 /*
@@ -577,6 +682,138 @@ rb_winevt_query_preserve_sid_p(VALUE self)
   return winevtQuery->preserveSID ? Qtrue : Qfalse;
 }
 
+/*
+ * This method specifies the filter which is evaluated before
+ * rendering each event in #each. The events which do not match it
+ * are skipped without creating Ruby objects. nil removes the filter.
+ *
+ * @since 0.12.0
+ * @param rb_filter [Filter, nil]
+ */
+static VALUE
+rb_winevt_query_set_filter(VALUE self, VALUE rb_filter)
+{
+  struct WinevtQuery* winevtQuery;
+  struct WinevtFilterContext filterContext;
+
+  TypedData_Get_Struct(
+    self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  ZeroMemory(&filterContext, sizeof(filterContext));
+  if (!NIL_P(rb_filter)) {
+    DWORD status;
+    if (!rb_obj_is_kind_of(rb_filter, rb_cFilter)) {
+      rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Filter)",
+               rb_obj_class(rb_filter));
+    }
+    status = filter_context_init(&filterContext, winevt_get_filter(rb_filter));
+    if (status != ERROR_SUCCESS) {
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
+  }
+  filter_context_free(&winevtQuery->filter);
+  winevtQuery->filter = filterContext;
+  rb_ivar_set(self, id_filter, rb_filter);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the filter.
+ *
+ * @since 0.12.0
+ * @return [Filter, nil]
+ */
+static VALUE
+rb_winevt_query_get_filter(VALUE self)
+{
+  return rb_ivar_get(self, id_filter);
+}
+
+/*
+ * This method returns the number of events which are skipped by the
+ * filter.
+ *
+ * @since 0.12.0
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_query_get_filtered_count(VALUE self)
+{
+  struct WinevtQuery* winevtQuery;
+
+  TypedData_Get_Struct(
+    self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  return ULL2NUM(winevtQuery->filteredCount);
+}
+
+/*
+ * This method specifies the sampler which is applied after the
+ * filter in #each. The events which are sampled out are skipped
+ * without rendering them. nil removes the sampler.
+ *
+ * @since 0.12.0
+ * @param rb_sampler [Sampler, nil]
+ */
+static VALUE
+rb_winevt_query_set_sampler(VALUE self, VALUE rb_sampler)
+{
+  struct WinevtQuery* winevtQuery;
+  struct WinevtSamplerContext samplerContext;
+
+  TypedData_Get_Struct(
+    self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  ZeroMemory(&samplerContext, sizeof(samplerContext));
+  if (!NIL_P(rb_sampler)) {
+    DWORD status;
+    if (!rb_obj_is_kind_of(rb_sampler, rb_cSampler)) {
+      rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Sampler)",
+               rb_obj_class(rb_sampler));
+    }
+    status = sampler_context_init(&samplerContext, winevt_get_sampler(rb_sampler));
+    if (status != ERROR_SUCCESS) {
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
+  }
+  sampler_context_free(&winevtQuery->sampler);
+  winevtQuery->sampler = samplerContext;
+  rb_ivar_set(self, id_sampler, rb_sampler);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the sampler.
+ *
+ * @since 0.12.0
+ * @return [Sampler, nil]
+ */
+static VALUE
+rb_winevt_query_get_sampler(VALUE self)
+{
+  return rb_ivar_get(self, id_sampler);
+}
+
+/*
+ * This method returns the number of events which are sampled out in
+ * this query.
+ *
+ * @since 0.12.0
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_query_get_sampled_count(VALUE self)
+{
+  struct WinevtQuery* winevtQuery;
+
+  TypedData_Get_Struct(
+    self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  return ULL2NUM(winevtQuery->sampledCount);
+}
+
 /*
  * This method cancels channel query.
  *
@@ -621,6 +858,589 @@ rb_winevt_query_close(VALUE self)
   return Qnil;
 }
 
+struct SeekTimeArgs
+{
+  EVT_HANDLE query;
+  EVT_HANDLE context;
+  ULONGLONG target;
+  DWORD status;
+};
+
+/*
+ * Read the TimeCreated of the event at the offset. Returns FALSE when
+ * there is no event at the offset.
+ */
+static BOOL
+time_created_at(struct SeekTimeArgs* args, LONGLONG offset, ULONGLONG* timeCreated)
+{
+  EVT_HANDLE hEvent;
+  DWORD count = 0, propCount, status;
+  PEVT_VARIANT values;
+
+  if (!EvtSeek(args->query, offset, NULL, 0, EvtSeekRelativeToFirst | EvtSeekStrict)) {
+    return FALSE;
+  }
+  if (!evt_next(args->query, 1, &hEvent, INFINITE, &count) || count == 0) {
+    status = GetLastError();
+    if (status != ERROR_NO_MORE_ITEMS && status != ERROR_SUCCESS) {
+      args->status = status;
+    }
+    return FALSE;
+  }
+
+  values = render_to_values(args->context, hEvent, &propCount, &status);
+  EvtClose(hEvent);
+  if (!values || propCount == 0 || values[0].Type != EvtVarTypeFileTime) {
+    free(values);
+    args->status = values ? ERROR_INVALID_DATA : status;
+    return FALSE;
+  }
+  *timeCreated = values[0].FileTimeVal;
+  free(values);
+
+  return TRUE;
+}
+
+/* Whether the event at the offset is earlier than the target. */
+static BOOL
+is_before_target(struct SeekTimeArgs* args, LONGLONG offset)
+{
+  ULONGLONG timeCreated;
+
+  if (!time_created_at(args, offset, &timeCreated)) {
+    return FALSE;
+  }
+
+  return timeCreated < args->target;
+}
+
+static VALUE
+seek_time_search(VALUE ptr)
+{
+  struct SeekTimeArgs* args = (struct SeekTimeArgs*)ptr;
+  LONGLONG lo, hi;
+
+  /* The first event which is not before the target is searched in
+   * (lo, hi]. The range is found by doubling hi. */
+  if (!is_before_target(args, 0)) {
+    hi = 0;
+  } else {
+    lo = 0;
+    hi = 1;
+    while (args->status == ERROR_SUCCESS && is_before_target(args, hi)) {
+      lo = hi;
+      hi *= 2;
+    }
+    while (args->status == ERROR_SUCCESS && hi - lo > 1) {
+      LONGLONG mid = lo + (hi - lo) / 2;
+      if (is_before_target(args, mid)) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+  }
+  if (args->status != ERROR_SUCCESS) {
+    raise_system_error(rb_eWinevtQueryError, args->status);
+  }
+
+  if (EvtSeek(args->query, hi, NULL, 0, EvtSeekRelativeToFirst | EvtSeekStrict)) {
+    return LL2NUM(hi);
+  }
+
+  /* Every event is before the target. Move to the end. */
+  if (EvtSeek(args->query, 0, NULL, 0, EvtSeekRelativeToLast)) {
+    EVT_HANDLE hEvent;
+    DWORD count = 0;
+    if (evt_next(args->query, 1, &hEvent, INFINITE, &count) && count > 0) {
+      EvtClose(hEvent);
+    }
+  }
+
+  return Qnil;
+}
+
+static VALUE
+seek_time_close_context(VALUE ptr)
+{
+  EvtClose(((struct SeekTimeArgs*)ptr)->context);
+
+  return Qnil;
+}
+
+/*
+ * This method moves to the first event which is created at or after
+ * the time. It is found by binary search over the offsets from the
+ * first event, which reads O(log n) events. The events are expected
+ * to be ordered by TimeCreated.
+ *
+ * @since 0.12.0
+ * @param rb_time [Time]
+ * @return [Integer] Offset of the event from the first one. nil when
+ *   every event is created before the time.
+ */
+static VALUE
+rb_winevt_query_seek_time(VALUE self, VALUE rb_time)
+{
+  static PCWSTR timeCreatedProperties[] = { L"Event/System/TimeCreated/@SystemTime" };
+  struct WinevtQuery* winevtQuery;
+  struct SeekTimeArgs args;
+  struct timespec ts = rb_time_timespec(rb_time);
+
+  TypedData_Get_Struct(self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  /* FILETIME counts 100 nanoseconds since 1601-01-01. */
+  args.target =
+    ((ULONGLONG)ts.tv_sec + 11644473600ULL) * 10000000ULL + ts.tv_nsec / 100;
+  args.query = winevtQuery->query;
+  args.status = ERROR_SUCCESS;
+  args.context = EvtCreateRenderContext(1, timeCreatedProperties, EvtRenderContextValues);
+  if (!args.context) {
+    raise_system_error(rb_eWinevtQueryError, GetLastError());
+  }
+
+  return rb_ensure(seek_time_search, (VALUE)&args, seek_time_close_context, (VALUE)&args);
+}
+
+struct CountArgs
+{
+  EVT_HANDLE query;
+  BOOL limited;
+  ULONGLONG limit;
+  ULONGLONG count;
+  DWORD status;
+  /* Set by interrupt_count. Counting stops after the current batch. */
+  volatile BOOL interrupted;
+};
+
+static void*
+count_without_gvl(void* ptr)
+{
+  struct CountArgs* args = (struct CountArgs*)ptr;
+  EVT_HANDLE hEvents[QUERY_COUNT_BATCH_SIZE];
+
+  args->status = ERROR_SUCCESS;
+  while ((!args->limited || args->count < args->limit) && !args->interrupted) {
+    DWORD size = QUERY_COUNT_BATCH_SIZE;
+    DWORD count = 0;
+
+    if (args->limited && args->limit - args->count < size) {
+      size = (DWORD)(args->limit - args->count);
+    }
+    if (!EvtNext(args->query, size, hEvents, INFINITE, 0, &count)) {
+      args->status = GetLastError();
+      break;
+    }
+    for (DWORD i = 0; i < count; i++) {
+      EvtClose(hEvents[i]);
+    }
+    args->count += count;
+  }
+
+  return NULL;
+}
+
+/* EvtCancel is not used here because the query cannot be resumed after
+ * it. EvtNext of a query returns a batch without waiting for events. */
+static void
+interrupt_count(void* ptr)
+{
+  ((struct CountArgs*)ptr)->interrupted = TRUE;
+}
+
+/*
+ * This method counts the rest of the events without rendering them.
+ * The events are consumed as #each does. When #cancel is called from
+ * another thread, the events counted until then are returned.
+ *
+ * @since 0.12.0
+ * @overload count(limit=nil)
+ *   @param limit [Integer] Stop counting at this number.
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_query_count(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_limit;
+  struct WinevtQuery* winevtQuery;
+  struct CountArgs args;
+
+  rb_scan_args(argc, argv, "01", &rb_limit);
+  TypedData_Get_Struct(self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  args.query = winevtQuery->query;
+  args.limited = !NIL_P(rb_limit);
+  args.limit = 0;
+  args.count = 0;
+  if (args.limited) {
+    if (NUM2LL(rb_limit) < 0) {
+      rb_raise(rb_eArgError, "Specify a non-negative integer as limit");
+    }
+    args.limit = NUM2ULL(rb_limit);
+  }
+  if (!args.query) {
+    return INT2FIX(0);
+  }
+
+  for (;;) {
+    args.interrupted = FALSE;
+    call_without_gvl(count_without_gvl, &args, interrupt_count, &args);
+    if (!args.interrupted || args.status != ERROR_SUCCESS) {
+      break;
+    }
+    /* Raise the interrupt if it is an exception, otherwise resume. */
+    rb_thread_check_ints();
+  }
+  if (args.status != ERROR_SUCCESS && args.status != ERROR_NO_MORE_ITEMS &&
+      args.status != ERROR_CANCELLED) {
+    raise_system_error(rb_eWinevtQueryError, args.status);
+  }
+
+  return ULL2NUM(args.count);
+}
+
+/*
+ * This method returns whether an event is left or not. The event is
+ * consumed without rendering.
+ *
+ * @since 0.12.0
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_query_any_p(VALUE self)
+{
+  VALUE rb_limit = INT2FIX(1);
+
+  return NUM2ULL(rb_winevt_query_count(1, &rb_limit, self)) > 0 ? Qtrue : Qfalse;
+}
+
+struct AggregateArgs
+{
+  EVT_HANDLE query;
+  EVT_HANDLE context;
+  struct WinevtAggregate aggregate;
+  /* UTF-8 provider name which grows to the longest one. */
+  char* provider;
+  int providerSize;
+  DWORD status;
+  /* Set by interrupt_aggregate. Counting stops after the current
+   * batch. */
+  volatile BOOL interrupted;
+};
+
+/* Property indexes of aggregateProperties. */
+#define AGGREGATE_PROPERTY_PROVIDER     0
+#define AGGREGATE_PROPERTY_EVENT_ID     1
+#define AGGREGATE_PROPERTY_LEVEL        2
+#define AGGREGATE_PROPERTY_TIME_CREATED 3
+
+static PCWSTR aggregateProperties[] = {
+  L"Event/System/Provider/@Name",
+  L"Event/System/EventID",
+  L"Event/System/Level",
+  L"Event/System/TimeCreated/@SystemTime",
+};
+
+static DWORD
+aggregate_event(struct AggregateArgs* args, EVT_HANDLE event, PEVT_VARIANT* buffer,
+                DWORD* bufferSize)
+{
+  PEVT_VARIANT values;
+  DWORD bufferUsed = 0, propCount = 0;
+  const char* provider = "";
+  int providerLength = 0;
+  uint32_t eventId = 0, level = 0;
+  int64_t time = 0;
+
+  if (!EvtRender(args->context, event, EvtRenderEventValues, *bufferSize, *buffer,
+                 &bufferUsed, &propCount)) {
+    DWORD status = GetLastError();
+    PEVT_VARIANT grown;
+    if (status != ERROR_INSUFFICIENT_BUFFER) {
+      return status;
+    }
+    grown = realloc(*buffer, bufferUsed);
+    if (!grown) {
+      return ERROR_OUTOFMEMORY;
+    }
+    *buffer = grown;
+    *bufferSize = bufferUsed;
+    if (!EvtRender(args->context, event, EvtRenderEventValues, *bufferSize, *buffer,
+                   &bufferUsed, &propCount)) {
+      return GetLastError();
+    }
+  }
+  values = *buffer;
+
+  if (values[AGGREGATE_PROPERTY_PROVIDER].Type == EvtVarTypeString) {
+    PCWSTR name = values[AGGREGATE_PROPERTY_PROVIDER].StringVal;
+    /* The size includes the terminating NUL. */
+    int size = WideCharToMultiByte(CP_UTF8, 0, name, -1, NULL, 0, NULL, NULL);
+    if (size > args->providerSize) {
+      char* grown = realloc(args->provider, size);
+      if (!grown) {
+        return ERROR_OUTOFMEMORY;
+      }
+      args->provider = grown;
+      args->providerSize = size;
+    }
+    if (size > 1 &&
+        WideCharToMultiByte(CP_UTF8, 0, name, -1, args->provider, size, NULL, NULL) == size) {
+      provider = args->provider;
+      providerLength = size - 1;
+    }
+  }
+  if (values[AGGREGATE_PROPERTY_EVENT_ID].Type == EvtVarTypeUInt16) {
+    eventId = values[AGGREGATE_PROPERTY_EVENT_ID].UInt16Val;
+  }
+  if (values[AGGREGATE_PROPERTY_LEVEL].Type == EvtVarTypeByte) {
+    level = values[AGGREGATE_PROPERTY_LEVEL].ByteVal;
+  }
+  if (values[AGGREGATE_PROPERTY_TIME_CREATED].Type == EvtVarTypeFileTime) {
+    /* FILETIME counts 100 nanoseconds since 1601-01-01. */
+    time = (int64_t)(values[AGGREGATE_PROPERTY_TIME_CREATED].FileTimeVal / 10000000ULL) -
+           11644473600LL;
+  }
+
+  if (winevt_aggregate_add(&args->aggregate, time, provider, providerLength,
+                           eventId, level, 1) < 0) {
+    return ERROR_OUTOFMEMORY;
+  }
+
+  return ERROR_SUCCESS;
+}
+
+static void*
+aggregate_without_gvl(void* ptr)
+{
+  struct AggregateArgs* args = (struct AggregateArgs*)ptr;
+  EVT_HANDLE hEvents[QUERY_COUNT_BATCH_SIZE];
+  PEVT_VARIANT buffer = NULL;
+  DWORD bufferSize = 0;
+
+  args->status = ERROR_SUCCESS;
+  while (args->status == ERROR_SUCCESS && !args->interrupted) {
+    DWORD count = 0;
+
+    if (!EvtNext(args->query, QUERY_COUNT_BATCH_SIZE, hEvents, INFINITE, 0, &count)) {
+      args->status = GetLastError();
+      break;
+    }
+    for (DWORD i = 0; i < count; i++) {
+      if (args->status == ERROR_SUCCESS) {
+        args->status = aggregate_event(args, hEvents[i], &buffer, &bufferSize);
+      }
+      EvtClose(hEvents[i]);
+    }
+  }
+  free(buffer);
+  free(args->provider);
+  args->provider = NULL;
+  args->providerSize = 0;
+
+  return NULL;
+}
+
+/* The query is not cancelled so that it can be resumed as #count. */
+static void
+interrupt_aggregate(void* ptr)
+{
+  ((struct AggregateArgs*)ptr)->interrupted = TRUE;
+}
+
+static VALUE
+query_aggregate_run(VALUE ptr)
+{
+  struct AggregateArgs* args = (struct AggregateArgs*)ptr;
+
+  for (;;) {
+    args->interrupted = FALSE;
+    call_without_gvl(aggregate_without_gvl, args, interrupt_aggregate, args);
+    if (!args->interrupted || args->status != ERROR_SUCCESS) {
+      break;
+    }
+    /* Raise the interrupt if it is an exception, otherwise resume. */
+    rb_thread_check_ints();
+  }
+  if (args->status == ERROR_OUTOFMEMORY) {
+    rb_memerror();
+  }
+  if (args->status != ERROR_SUCCESS && args->status != ERROR_NO_MORE_ITEMS &&
+      args->status != ERROR_CANCELLED) {
+    raise_system_error(rb_eWinevtQueryError, args->status);
+  }
+
+  return winevt_aggregate_to_rb_hash(&args->aggregate);
+}
+
+static VALUE
+query_aggregate_close(VALUE ptr)
+{
+  struct AggregateArgs* args = (struct AggregateArgs*)ptr;
+
+  EvtClose(args->context);
+  winevt_aggregate_destroy(&args->aggregate);
+
+  return Qnil;
+}
+
+/*
+ * This method counts the rest of the events per key. Only the system
+ * values of the key are rendered and they are counted natively
+ * without the GVL, so no Ruby object is created per event. The
+ * events are consumed as #each does. When #cancel is called from
+ * another thread, the events counted until then are returned.
+ *
+ * @since 0.12.0
+ * @overload aggregate(by: [:provider, :event_id, :level], bucket: nil)
+ *   @param by [Array<Symbol>] Fields to aggregate by. :provider,
+ *     :event_id and :level are available.
+ *   @param bucket [Integer] Seconds of a time bucket of TimeCreated.
+ *     nil means no time buckets.
+ * @return [Hash] {[bucket, fields...] => count}. See Aggregator#result.
+ */
+static VALUE
+rb_winevt_query_aggregate(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_opts;
+  struct WinevtQuery* winevtQuery;
+  struct AggregateArgs args;
+
+  rb_scan_args(argc, argv, "0:", &rb_opts);
+  TypedData_Get_Struct(self, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  winevt_aggregate_parse_options(&args.aggregate, rb_opts);
+  if (!winevtQuery->query) {
+    return rb_hash_new();
+  }
+
+  args.query = winevtQuery->query;
+  args.provider = NULL;
+  args.providerSize = 0;
+  args.status = ERROR_SUCCESS;
+  args.context = EvtCreateRenderContext(
+    sizeof(aggregateProperties) / sizeof(aggregateProperties[0]), aggregateProperties,
+    EvtRenderContextValues);
+  if (!args.context) {
+    raise_system_error(rb_eWinevtQueryError, GetLastError());
+  }
+  if (winevt_aggregate_init(&args.aggregate) < 0) {
+    EvtClose(args.context);
+    rb_memerror();
+  }
+
+  return rb_ensure(query_aggregate_run, (VALUE)&args, query_aggregate_close, (VALUE)&args);
+}
+
+struct TailArgs
+{
+  VALUE query;
+  EVT_HANDLE* events;
+  DWORD size;
+  DWORD count;
+};
+
+static VALUE
+query_tail_read(VALUE ptr)
+{
+  struct TailArgs* args = (struct TailArgs*)ptr;
+  struct WinevtQuery* winevtQuery;
+  VALUE rb_events;
+
+  TypedData_Get_Struct(args->query, struct WinevtQuery, &rb_winevt_query_type, winevtQuery);
+
+  /* One batch usually returns all of them. */
+  while (args->count < args->size) {
+    DWORD count = 0;
+    if (!evt_next(winevtQuery->query, args->size - args->count,
+                  args->events + args->count, INFINITE, &count)) {
+      DWORD status = GetLastError();
+      if (status == ERROR_NO_MORE_ITEMS || status == ERROR_CANCELLED) {
+        break;
+      }
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
+    args->count += count;
+  }
+
+  /* The events are read from the newest one. */
+  rb_events = rb_ary_new_capa(args->count);
+  for (DWORD i = args->count; i > 0; i--) {
+    EVT_HANDLE event = args->events[i - 1];
+    rb_ary_push(rb_events,
+                rb_ary_new_from_args(3,
+                                     rb_winevt_query_render(args->query, event),
+                                     rb_winevt_query_message(event,
+                                                             winevtQuery->localeInfo,
+                                                             winevtQuery->remoteHandle),
+                                     rb_winevt_query_string_inserts(event)));
+  }
+
+  return rb_events;
+}
+
+static VALUE
+query_tail_close(VALUE ptr)
+{
+  struct TailArgs* args = (struct TailArgs*)ptr;
+
+  for (DWORD i = 0; i < args->count; i++) {
+    EvtClose(args->events[i]);
+  }
+  rb_winevt_query_close(args->query);
+
+  return Qnil;
+}
+
+/*
+ * This method reads the newest events of the channel. They are read
+ * in the reverse direction with a batch of the requested size.
+ *
+ * @since 0.12.0
+ * @overload tail(channel, n, xpath="*", session=nil)
+ *   @param channel [String] Querying EventLog channel.
+ *   @param n [Integer] Number of the events.
+ *   @param xpath [String] Querying XPath.
+ *   @param session [Session] Session information for remoting access.
+ * @return [Array<Array>] Pairs of (Stringified EventLog, Stringified
+ *   detail message, Stringified insert values) in chronological order.
+ */
+static VALUE
+rb_winevt_query_s_tail(int argc, VALUE* argv, VALUE klass)
+{
+  VALUE rb_channel, rb_n, rb_xpath, rb_session, rb_buf, rb_events;
+  VALUE queryArgv[4];
+  struct TailArgs args;
+  long n;
+
+  rb_scan_args(argc, argv, "22", &rb_channel, &rb_n, &rb_xpath, &rb_session);
+  n = NUM2LONG(rb_n);
+  if (n < 0) {
+    rb_raise(rb_eArgError, "Specify a non-negative integer");
+  }
+  if (NIL_P(rb_xpath)) {
+    rb_xpath = rb_str_new_cstr("*");
+  }
+  if (n == 0) {
+    return rb_ary_new();
+  }
+
+  queryArgv[0] = rb_channel;
+  queryArgv[1] = rb_xpath;
+  queryArgv[2] = rb_session;
+  queryArgv[3] = LONG2NUM(EvtQueryChannelPath | EvtQueryReverseDirection |
+                          EvtQueryTolerateQueryErrors);
+  args.query = rb_class_new_instance(4, queryArgv, klass);
+  args.events = ALLOCV_N(EVT_HANDLE, rb_buf, n);
+  args.size = (DWORD)n;
+  args.count = 0;
+
+  rb_events = rb_ensure(query_tail_read, (VALUE)&args, query_tail_close, (VALUE)&args);
+  ALLOCV_END(rb_buf);
+
+  return rb_events;
+}
+
 void
 Init_winevt_query(VALUE rb_cEventLog)
 {
@@ -699,14 +1519,61 @@ Init_winevt_query(VALUE rb_cEventLog)
   rb_define_const(rb_cFlag, "TolerateQueryErrors", LONG2NUM(EvtQueryTolerateQueryErrors));
   /* clang-format on */
 
+  id_filter = rb_intern("@filter");
+  id_sampler = rb_intern("@sampler");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(rb_cQuery, "tail", rb_winevt_query_s_tail, -1);
   rb_define_method(rb_cQuery, "initialize", rb_winevt_query_initialize, -1);
   rb_define_method(rb_cQuery, "next", rb_winevt_query_next, 0);
   rb_define_method(rb_cQuery, "seek", rb_winevt_query_seek, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "seek_time", rb_winevt_query_seek_time, 1);
   rb_define_method(rb_cQuery, "offset", rb_winevt_query_get_offset, 0);
   rb_define_method(rb_cQuery, "offset=", rb_winevt_query_set_offset, 1);
   rb_define_method(rb_cQuery, "timeout", rb_winevt_query_get_timeout, 0);
   rb_define_method(rb_cQuery, "timeout=", rb_winevt_query_set_timeout, 1);
-  rb_define_method(rb_cQuery, "each", rb_winevt_query_each, 0);
+  rb_define_method(rb_cQuery, "each", rb_winevt_query_each, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "count", rb_winevt_query_count, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "any?", rb_winevt_query_any_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "aggregate", rb_winevt_query_aggregate, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "filter", rb_winevt_query_get_filter, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "filter=", rb_winevt_query_set_filter, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "filtered_count", rb_winevt_query_get_filtered_count, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "sampler", rb_winevt_query_get_sampler, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "sampler=", rb_winevt_query_set_sampler, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQuery, "sampled_count", rb_winevt_query_get_sampled_count, 0);
   rb_define_method(rb_cQuery, "render_as_xml?", rb_winevt_query_render_as_xml_p, 0);
   rb_define_method(rb_cQuery, "render_as_xml=", rb_winevt_query_set_render_as_xml, 1);
   /*
@@ -0,0 +1,314 @@
+#include <winevt_c.h>
+
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::QueryList
+ *
+ * Builder of a structured query (QueryList XML) which spans several
+ * channels. Each channel gets one Query element with its Select and
+ * Suppress elements. Query.new and Subscribe#subscribe accept it
+ * instead of a channel and an XPath. Then, one handle reads all of
+ * the channels and the channel of each event is yielded as 4th value.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @query_list = Winevt::EventLog::QueryList.new(
+ *    "Application" => "*[System[Level<=3]]",
+ *    "System" => ["*[System[Level=1]]", "*[System[Provider[@Name='Disk']]]"],
+ *    "Security" => {select: "*", suppress: "*[System[EventID=4624]]"},
+ *  )
+ *  @query = Winevt::EventLog::Query.new(@query_list)
+ *  @query.each do |eventlog, message, string_inserts, channel|
+ *    puts ({channel: channel, eventlog: eventlog})
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cQueryList;
+
+static ID id_queries;
+static ID id_select;
+static ID id_suppress;
+static ID id_structured_p;
+
+static VALUE
+query_list_xpath(VALUE rb_xpath)
+{
+  if (rb_obj_is_kind_of(rb_xpath, rb_cCompiledQuery)) {
+    if (RTEST(rb_funcall(rb_xpath, id_structured_p, 0))) {
+      rb_raise(rb_eArgError, "structured query cannot be nested in QueryList");
+    }
+    return rb_obj_as_string(rb_xpath);
+  }
+  Check_Type(rb_xpath, T_STRING);
+  if (RSTRING_LEN(rb_xpath) == 0) {
+    rb_raise(rb_eArgError, "empty XPath");
+  }
+
+  return rb_str_new_frozen(rb_xpath);
+}
+
+static void
+query_list_add(VALUE self, VALUE rb_channel, ID kind, VALUE rb_xpath)
+{
+  VALUE rb_query;
+
+  Check_Type(rb_channel, T_STRING);
+  if (RSTRING_LEN(rb_channel) == 0) {
+    rb_raise(rb_eArgError, "empty channel");
+  }
+  rb_query = rb_ary_new_from_args(
+    3, rb_str_new_frozen(rb_channel), ID2SYM(kind), query_list_xpath(rb_xpath));
+  rb_ary_push(rb_ivar_get(self, id_queries), rb_obj_freeze(rb_query));
+}
+
+static void
+query_list_add_xpaths(VALUE self, VALUE rb_channel, ID kind, VALUE rb_xpaths)
+{
+  if (RB_TYPE_P(rb_xpaths, T_ARRAY)) {
+    for (long i = 0; i < RARRAY_LEN(rb_xpaths); i++) {
+      query_list_add(self, rb_channel, kind, RARRAY_AREF(rb_xpaths, i));
+    }
+  } else {
+    query_list_add(self, rb_channel, kind, rb_xpaths);
+  }
+}
+
+static int
+query_list_add_i(VALUE rb_channel, VALUE rb_description, VALUE self)
+{
+  if (RB_TYPE_P(rb_description, T_HASH)) {
+    ID keywords[2];
+    VALUE values[2];
+    keywords[0] = id_select;
+    keywords[1] = id_suppress;
+    /* rb_get_kwargs removes the extracted keys. */
+    rb_get_kwargs(rb_hash_dup(rb_description), keywords, 0, 2, values);
+    query_list_add_xpaths(
+      self, rb_channel, id_select, values[0] == Qundef ? rb_str_new_cstr("*") : values[0]);
+    if (values[1] != Qundef) {
+      query_list_add_xpaths(self, rb_channel, id_suppress, values[1]);
+    }
+  } else {
+    query_list_add_xpaths(self, rb_channel, id_select, rb_description);
+  }
+
+  return ST_CONTINUE;
+}
+
+/*
+ * Initalize QueryList class.
+ *
+ * @param description [Hash, nil] Channel name to the XPaths. The
+ *   value is an XPath, an Array of XPaths or a Hash which has
+ *   select: and suppress: XPaths. select: is "*" when it is omitted.
+ *   An XPath is a String or a CompiledQuery.
+ * @return [QueryList]
+ *
+ */
+static VALUE
+rb_winevt_query_list_initialize(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_description;
+
+  rb_scan_args(argc, argv, "01", &rb_description);
+  rb_ivar_set(self, id_queries, rb_ary_new());
+  if (!NIL_P(rb_description)) {
+    Check_Type(rb_description, T_HASH);
+    rb_hash_foreach(rb_description, query_list_add_i, self);
+  }
+
+  return Qnil;
+}
+
+/*
+ * This method adds an XPath which selects events of the channel.
+ *
+ * @param channel [String] Channel name.
+ * @param xpath [String, CompiledQuery] XPath.
+ * @return [QueryList] self
+ */
+static VALUE
+rb_winevt_query_list_select(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_channel, rb_xpath;
+
+  rb_scan_args(argc, argv, "11", &rb_channel, &rb_xpath);
+  rb_check_frozen(self);
+  query_list_add(
+    self, rb_channel, id_select, NIL_P(rb_xpath) ? rb_str_new_cstr("*") : rb_xpath);
+
+  return self;
+}
+
+/*
+ * This method adds an XPath which removes events from the selected
+ * ones of the channel.
+ *
+ * @param channel [String] Channel name.
+ * @param xpath [String, CompiledQuery] XPath.
+ * @return [QueryList] self
+ */
+static VALUE
+rb_winevt_query_list_suppress(VALUE self, VALUE rb_channel, VALUE rb_xpath)
+{
+  rb_check_frozen(self);
+  query_list_add(self, rb_channel, id_suppress, rb_xpath);
+
+  return self;
+}
+
+/*
+ * This method returns the channels in the added order.
+ *
+ * @return [Array<String>]
+ */
+VALUE
+winevt_query_list_channels(VALUE rb_query_list)
+{
+  VALUE rb_queries = rb_ivar_get(rb_query_list, id_queries);
+  VALUE rb_channels = rb_ary_new();
+
+  for (long i = 0; i < RARRAY_LEN(rb_queries); i++) {
+    VALUE rb_channel = RARRAY_AREF(RARRAY_AREF(rb_queries, i), 0);
+    if (!RTEST(rb_ary_includes(rb_channels, rb_channel))) {
+      rb_ary_push(rb_channels, rb_channel);
+    }
+  }
+
+  return rb_channels;
+}
+
+static void
+append_escaped(VALUE rb_xml, VALUE rb_str)
+{
+  const char* p = RSTRING_PTR(rb_str);
+  const char* end = p + RSTRING_LEN(rb_str);
+  const char* start = p;
+
+  for (; p < end; p++) {
+    const char* entity;
+    switch (*p) {
+    case '&':
+      entity = "&amp;";
+      break;
+    case '<':
+      entity = "&lt;";
+      break;
+    case '>':
+      entity = "&gt;";
+      break;
+    case '"':
+      entity = "&quot;";
+      break;
+    case '\'':
+      entity = "&apos;";
+      break;
+    default:
+      continue;
+    }
+    rb_str_cat(rb_xml, start, p - start);
+    rb_str_cat_cstr(rb_xml, entity);
+    start = p + 1;
+  }
+  rb_str_cat(rb_xml, start, p - start);
+}
+
+/*
+ * Build the QueryList XML. Each channel gets a Query element whose
+ * Id is the index of the channel.
+ */
+VALUE
+winevt_query_list_to_xml(VALUE rb_query_list)
+{
+  VALUE rb_queries = rb_ivar_get(rb_query_list, id_queries);
+  VALUE rb_channels = winevt_query_list_channels(rb_query_list);
+  VALUE rb_xml;
+
+  if (RARRAY_LEN(rb_channels) == 0) {
+    rb_raise(rb_eArgError, "empty QueryList");
+  }
+
+  rb_xml = rb_utf8_str_new_cstr("<QueryList>");
+  for (long i = 0; i < RARRAY_LEN(rb_channels); i++) {
+    VALUE rb_channel = RARRAY_AREF(rb_channels, i);
+    int selected = 0;
+
+    rb_str_catf(rb_xml, "<Query Id=\"%ld\" Path=\"", i);
+    append_escaped(rb_xml, rb_channel);
+    rb_str_cat_cstr(rb_xml, "\">");
+    for (long j = 0; j < RARRAY_LEN(rb_queries); j++) {
+      VALUE rb_query = RARRAY_AREF(rb_queries, j);
+      const char* element;
+      if (!RTEST(rb_str_equal(RARRAY_AREF(rb_query, 0), rb_channel))) {
+        continue;
+      }
+      if (SYM2ID(RARRAY_AREF(rb_query, 1)) == id_select) {
+        element = "Select";
+        selected = 1;
+      } else {
+        element = "Suppress";
+      }
+      rb_str_catf(rb_xml, "<%s Path=\"", element);
+      append_escaped(rb_xml, rb_channel);
+      rb_str_cat_cstr(rb_xml, "\">");
+      append_escaped(rb_xml, RARRAY_AREF(rb_query, 2));
+      rb_str_catf(rb_xml, "</%s>", element);
+    }
+    if (!selected) {
+      rb_raise(rb_eArgError, "no XPath selects events of %" PRIsVALUE, rb_channel);
+    }
+    rb_str_cat_cstr(rb_xml, "</Query>");
+  }
+  rb_str_cat_cstr(rb_xml, "</QueryList>");
+
+  return rb_xml;
+}
+
+/*
+ * This method returns the QueryList XML.
+ *
+ * @return [String]
+ */
+static VALUE
+rb_winevt_query_list_to_xml(VALUE self)
+{
+  return winevt_query_list_to_xml(self);
+}
+
+void
+Init_winevt_query_list(VALUE rb_cEventLog)
+{
+  rb_cQueryList = rb_define_class_under(rb_cEventLog, "QueryList", rb_cObject);
+
+  id_queries = rb_intern("@queries");
+  id_select = rb_intern("select");
+  id_suppress = rb_intern("suppress");
+  id_structured_p = rb_intern("structured?");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQueryList, "initialize", rb_winevt_query_list_initialize, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQueryList, "select", rb_winevt_query_list_select, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQueryList, "suppress", rb_winevt_query_list_suppress, 2);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQueryList, "channels", winevt_query_list_channels, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cQueryList, "to_xml", rb_winevt_query_list_to_xml, 0);
+  rb_define_alias(rb_cQueryList, "to_s", "to_xml");
+}
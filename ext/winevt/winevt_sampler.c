@@ -0,0 +1,433 @@
+#include <winevt_c.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::Sampler
+ *
+ * Sampling rules for noisy events. Each rule matches a provider and
+ * an EventID and keeps a sample of them:
+ *
+ * - every: N keeps the first of each N events.
+ * - rate: R keeps events whose EventRecordID hashes below R. The
+ *   decision is deterministic. So, reading the same events again
+ *   keeps the same ones.
+ *
+ * Query and Subscribe read only the provider, EventID and
+ * EventRecordID to decide. The events which are sampled out are not
+ * rendered or formatted. The first matching rule is used. The events
+ * which match no rule are kept.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @sampler = Winevt::EventLog::Sampler.new([
+ *    {provider: "Microsoft-Windows-Security-Auditing", event_id: 5156, every: 10},
+ *    {provider: "Microsoft-Windows-Security-Auditing", event_id: 4663, rate: 0.05},
+ *  ])
+ *  @subscribe = Winevt::EventLog::Subscribe.new
+ *  @subscribe.sampler = @sampler
+ *  @subscribe.subscribe("Security", "*")
+ *  @subscribe.each do |eventlog, message, string_inserts|
+ *    puts ({eventlog: eventlog, data: message})
+ *  end
+ *  @sampler.sampled_count
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cSampler;
+
+static ID id_provider;
+static ID id_event_id;
+static ID id_every;
+static ID id_rate;
+
+struct WinevtSamplerRule
+{
+  uint16_t* provider; /* NULL matches any provider */
+  size_t providerLength;
+  int64_t eventId;    /* -1 matches any EventID */
+  uint64_t every;     /* 0 when rate is used */
+  uint64_t threshold; /* kept when the hash is below it */
+  int keepAll;        /* rate is 1.0 */
+  uint64_t seen;
+  uint64_t sampled;
+};
+
+static void sampler_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_sampler_type = { "winevt/sampler",
+                                                       {
+                                                         0,
+                                                         sampler_free,
+                                                         0,
+                                                       },
+                                                       NULL,
+                                                       NULL,
+                                                       RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+sampler_free(void* ptr)
+{
+  struct WinevtSampler* winevtSampler = (struct WinevtSampler*)ptr;
+
+  for (size_t i = 0; i < winevtSampler->count; i++) {
+    free(winevtSampler->rules[i].provider);
+  }
+  free(winevtSampler->rules);
+  if (winevtSampler->initialized) {
+    winevt_mutex_destroy(&winevtSampler->lock);
+  }
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_sampler_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtSampler* winevtSampler;
+  obj =
+    TypedData_Make_Struct(klass, struct WinevtSampler, &rb_winevt_sampler_type, winevtSampler);
+  return obj;
+}
+
+struct WinevtSampler*
+winevt_get_sampler(VALUE rb_sampler)
+{
+  struct WinevtSampler* winevtSampler;
+
+  TypedData_Get_Struct(rb_sampler, struct WinevtSampler, &rb_winevt_sampler_type, winevtSampler);
+  if (!winevtSampler->initialized) {
+    rb_raise(rb_eRuntimeError, "uninitialized sampler");
+  }
+
+  return winevtSampler;
+}
+
+static int
+rule_matches(const struct WinevtSamplerRule* rule, const uint16_t* provider,
+             size_t providerLength, uint32_t eventId)
+{
+  if (rule->eventId >= 0 && (uint32_t)rule->eventId != eventId) {
+    return 0;
+  }
+  if (rule->provider &&
+      (rule->providerLength != providerLength ||
+       memcmp(rule->provider, provider, providerLength * sizeof(uint16_t)) != 0)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Whether the event is kept. provider is UTF-16 and may be NULL when
+ * the event has no provider name. This does not touch Ruby objects
+ * and can be called from any thread.
+ */
+int
+winevt_sampler_keep(struct WinevtSampler* sampler, const uint16_t* provider,
+                    size_t providerLength, uint32_t eventId, uint64_t recordId)
+{
+  int keep = 1;
+
+  for (size_t i = 0; i < sampler->count; i++) {
+    struct WinevtSamplerRule* rule = &sampler->rules[i];
+
+    if (!rule_matches(rule, provider, providerLength, eventId)) {
+      continue;
+    }
+    if (rule->every == 0) {
+      keep = rule->keepAll ||
+             winevt_xxh64(&recordId, sizeof(recordId), eventId) < rule->threshold;
+    }
+    winevt_mutex_lock(&sampler->lock);
+    if (rule->every > 0) {
+      keep = rule->seen % rule->every == 0;
+    }
+    rule->seen++;
+    if (!keep) {
+      rule->sampled++;
+      sampler->sampled++;
+    }
+    winevt_mutex_unlock(&sampler->lock);
+    break;
+  }
+
+  return keep;
+}
+
+static void
+parse_rule(struct WinevtSampler* winevtSampler, VALUE rb_rule)
+{
+  struct WinevtSamplerRule* rule = &winevtSampler->rules[winevtSampler->count];
+  ID keywords[4];
+  VALUE values[4];
+
+  Check_Type(rb_rule, T_HASH);
+  keywords[0] = id_provider;
+  keywords[1] = id_event_id;
+  keywords[2] = id_every;
+  keywords[3] = id_rate;
+  for (int i = 0; i < 4; i++) {
+    values[i] = Qundef;
+  }
+  /* rb_get_kwargs removes the extracted keys. */
+  rb_get_kwargs(rb_hash_dup(rb_rule), keywords, 0, 4, values);
+
+  memset(rule, 0, sizeof(*rule));
+  rule->eventId = -1;
+  /* Counted first. Then, sampler_free releases it on exceptions. */
+  winevtSampler->count++;
+
+  if (values[0] != Qundef && !NIL_P(values[0])) {
+    VALUE rb_wide;
+    Check_Type(values[0], T_STRING);
+    rb_wide = rb_str_encode(values[0], rb_enc_from_encoding(rb_enc_find("UTF-16LE")), 0, Qnil);
+    rule->providerLength = (size_t)RSTRING_LEN(rb_wide) / 2;
+    rule->provider = malloc(sizeof(uint16_t) * (rule->providerLength + 1));
+    if (!rule->provider) {
+      rb_memerror();
+    }
+    memcpy(rule->provider, RSTRING_PTR(rb_wide), rule->providerLength * sizeof(uint16_t));
+  }
+  if (values[1] != Qundef && !NIL_P(values[1])) {
+    long eventId = NUM2LONG(values[1]);
+    if (eventId < 0 || eventId > 0xFFFF) {
+      rb_raise(rb_eArgError, "event_id must be 0..65535");
+    }
+    rule->eventId = eventId;
+  }
+
+  if ((values[2] == Qundef) == (values[3] == Qundef)) {
+    rb_raise(rb_eArgError, "specify either every or rate");
+  }
+  if (values[2] != Qundef) {
+    long every = NUM2LONG(values[2]);
+    if (every < 1) {
+      rb_raise(rb_eArgError, "every must be positive");
+    }
+    rule->every = (uint64_t)every;
+  } else {
+    double rate = NUM2DBL(values[3]);
+    if (!(rate >= 0 && rate <= 1)) {
+      rb_raise(rb_eArgError, "rate must be 0.0..1.0");
+    }
+    rule->keepAll = rate == 1;
+    /* 2^64 * rate */
+    rule->threshold = rule->keepAll ? UINT64_MAX : (uint64_t)ldexp(rate, 64);
+  }
+}
+
+/*
+ * Initalize Sampler class.
+ *
+ * @param rules [Array<Hash>] Sampling rules. Each rule has
+ *   provider: [String, nil], event_id: [Integer, nil] and either
+ *   every: [Integer] or rate: [Float]. nil or a missing provider or
+ *   event_id matches any.
+ * @return [Sampler]
+ *
+ */
+static VALUE
+rb_winevt_sampler_initialize(VALUE self, VALUE rb_rules)
+{
+  struct WinevtSampler* winevtSampler;
+
+  TypedData_Get_Struct(self, struct WinevtSampler, &rb_winevt_sampler_type, winevtSampler);
+  Check_Type(rb_rules, T_ARRAY);
+  if (winevtSampler->rules) {
+    rb_raise(rb_eRuntimeError, "already initialized sampler");
+  }
+
+  winevtSampler->rules = calloc(RARRAY_LEN(rb_rules) + 1, sizeof(struct WinevtSamplerRule));
+  if (!winevtSampler->rules) {
+    rb_memerror();
+  }
+  for (long i = 0; i < RARRAY_LEN(rb_rules); i++) {
+    parse_rule(winevtSampler, RARRAY_AREF(rb_rules, i));
+  }
+  winevt_mutex_init(&winevtSampler->lock);
+  winevtSampler->initialized = 1;
+
+  return Qnil;
+}
+
+/*
+ * This method decides whether the event is kept in the same way as
+ * Query and Subscribe do. The counters are updated.
+ *
+ * @param provider [String, nil] Provider name.
+ * @param event_id [Integer] EventID.
+ * @param record_id [Integer] EventRecordID.
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_sampler_keep_p(VALUE self, VALUE rb_provider, VALUE rb_event_id, VALUE rb_record_id)
+{
+  struct WinevtSampler* winevtSampler = winevt_get_sampler(self);
+  uint32_t eventId = NUM2UINT(rb_event_id);
+  uint64_t recordId = NUM2ULL(rb_record_id);
+  VALUE rb_wide = Qnil;
+  int keep;
+
+  if (!NIL_P(rb_provider)) {
+    Check_Type(rb_provider, T_STRING);
+    rb_wide = rb_str_encode(rb_provider, rb_enc_from_encoding(rb_enc_find("UTF-16LE")), 0, Qnil);
+  }
+  keep = winevt_sampler_keep(winevtSampler,
+                             NIL_P(rb_wide) ? NULL : (const uint16_t*)RSTRING_PTR(rb_wide),
+                             NIL_P(rb_wide) ? 0 : (size_t)RSTRING_LEN(rb_wide) / 2, eventId,
+                             recordId);
+  RB_GC_GUARD(rb_wide);
+
+  return keep ? Qtrue : Qfalse;
+}
+
+/*
+ * This method returns the number of the events which are sampled
+ * out.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_sampler_sampled_count(VALUE self)
+{
+  struct WinevtSampler* winevtSampler = winevt_get_sampler(self);
+  uint64_t sampled;
+
+  winevt_mutex_lock(&winevtSampler->lock);
+  sampled = winevtSampler->sampled;
+  winevt_mutex_unlock(&winevtSampler->lock);
+
+  return ULL2NUM(sampled);
+}
+
+/*
+ * This method returns the counts of each rule.
+ *
+ * @return [Array<Array(Integer, Integer)>] [matched, sampled out] for
+ *   each rule.
+ */
+static VALUE
+rb_winevt_sampler_counts(VALUE self)
+{
+  struct WinevtSampler* winevtSampler = winevt_get_sampler(self);
+  VALUE rb_counts = rb_ary_new_capa((long)winevtSampler->count);
+
+  for (size_t i = 0; i < winevtSampler->count; i++) {
+    uint64_t seen, sampled;
+    winevt_mutex_lock(&winevtSampler->lock);
+    seen = winevtSampler->rules[i].seen;
+    sampled = winevtSampler->rules[i].sampled;
+    winevt_mutex_unlock(&winevtSampler->lock);
+    rb_ary_push(rb_counts, rb_assoc_new(ULL2NUM(seen), ULL2NUM(sampled)));
+  }
+
+  return rb_counts;
+}
+
+#ifdef _WIN32
+static LPCWSTR samplerProperties[] = {
+  L"Event/System/Provider/@Name",
+  L"Event/System/EventID",
+  L"Event/System/EventRecordID",
+};
+
+DWORD
+sampler_context_init(struct WinevtSamplerContext* samplerContext,
+                     struct WinevtSampler* sampler)
+{
+  ZeroMemory(samplerContext, sizeof(struct WinevtSamplerContext));
+  samplerContext->context = EvtCreateRenderContext(
+    sizeof(samplerProperties) / sizeof(samplerProperties[0]), samplerProperties,
+    EvtRenderContextValues);
+  if (!samplerContext->context) {
+    return GetLastError();
+  }
+  samplerContext->sampler = sampler;
+
+  return ERROR_SUCCESS;
+}
+
+void
+sampler_context_free(struct WinevtSamplerContext* samplerContext)
+{
+  if (samplerContext->context) {
+    EvtClose(samplerContext->context);
+  }
+  free(samplerContext->buffer);
+  ZeroMemory(samplerContext, sizeof(struct WinevtSamplerContext));
+}
+
+/*
+ * Decide whether the event is kept from its provider, EventID and
+ * EventRecordID. This does not raise any Ruby exceptions.
+ */
+DWORD
+sample_event(struct WinevtSamplerContext* samplerContext, EVT_HANDLE hEvent, BOOL* kept)
+{
+  DWORD propCount = 0;
+  DWORD status =
+    render_values_to_buffer(samplerContext->context, hEvent, &samplerContext->buffer,
+                            &samplerContext->bufferSize, &propCount);
+  PEVT_VARIANT values = samplerContext->buffer;
+  const uint16_t* provider = NULL;
+  size_t providerLength = 0;
+  uint32_t eventId = 0;
+  uint64_t recordId = 0;
+
+  if (status != ERROR_SUCCESS) {
+    return status;
+  }
+
+  if (propCount > 0 && values[0].Type == EvtVarTypeString) {
+    provider = (const uint16_t*)values[0].StringVal;
+    providerLength = wcslen(values[0].StringVal);
+  }
+  if (propCount > 1 && values[1].Type == EvtVarTypeUInt16) {
+    eventId = values[1].UInt16Val;
+  }
+  if (propCount > 2 && values[2].Type == EvtVarTypeUInt64) {
+    recordId = values[2].UInt64Val;
+  }
+  *kept = winevt_sampler_keep(samplerContext->sampler, provider, providerLength, eventId,
+                              recordId);
+
+  return ERROR_SUCCESS;
+}
+#endif /* _WIN32 */
+
+void
+Init_winevt_sampler(VALUE rb_cEventLog)
+{
+  rb_cSampler = rb_define_class_under(rb_cEventLog, "Sampler", rb_cObject);
+  rb_define_alloc_func(rb_cSampler, rb_winevt_sampler_alloc);
+
+  id_provider = rb_intern("provider");
+  id_event_id = rb_intern("event_id");
+  id_every = rb_intern("every");
+  id_rate = rb_intern("rate");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSampler, "initialize", rb_winevt_sampler_initialize, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSampler, "keep?", rb_winevt_sampler_keep_p, 3);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSampler, "sampled_count", rb_winevt_sampler_sampled_count, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSampler, "counts", rb_winevt_sampler_counts, 0);
+}
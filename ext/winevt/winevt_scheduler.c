@@ -0,0 +1,389 @@
+#include <winevt_c.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::Scheduler
+ *
+ * Deficit round-robin scheduler which SubscribeGroup uses to share
+ * reading between channels.
+ *
+ * Each round visits the queues in descending order of priority. A
+ * visited queue earns quantum * weight events of allowance and keeps
+ * the unused part for the next round while it is backlogged. So a
+ * quiet channel waits at most one round even when another channel
+ * is flooded.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @queues = [security_events, system_events]
+ *  @scheduler = Winevt::EventLog::Scheduler.new(10)
+ *  @scheduler.add(1)    # security_events
+ *  @scheduler.add(2, 1) # system_events
+ *  @scheduler.start_round
+ *  while (turn = @scheduler.next_turn)
+ *    index, allowance = turn
+ *    events = @queues[index].shift(allowance)
+ *    @scheduler.consume(index, events.size, !@queues[index].empty?)
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cScheduler;
+
+void
+winevt_scheduler_init(struct WinevtScheduler* scheduler, unsigned long quantum)
+{
+  scheduler->entries = NULL;
+  scheduler->order = NULL;
+  scheduler->count = 0;
+  scheduler->capacity = 0;
+  scheduler->position = 0;
+  scheduler->quantum = quantum;
+}
+
+void
+winevt_scheduler_destroy(struct WinevtScheduler* scheduler)
+{
+  free(scheduler->entries);
+  free(scheduler->order);
+  winevt_scheduler_init(scheduler, scheduler->quantum);
+}
+
+/* Keep the visiting order sorted by descending priority. Queues with
+ * the same priority are visited in the order of addition. */
+static void
+scheduler_insert_order(struct WinevtScheduler* scheduler, size_t index)
+{
+  size_t i = index;
+  int priority = scheduler->entries[index].priority;
+
+  while (i > 0 && scheduler->entries[scheduler->order[i - 1]].priority < priority) {
+    scheduler->order[i] = scheduler->order[i - 1];
+    i--;
+  }
+  scheduler->order[i] = index;
+}
+
+/*
+ * Add a queue and return its index, or -1 when memory is exhausted.
+ */
+int
+winevt_scheduler_add(struct WinevtScheduler* scheduler,
+                     unsigned long weight, int priority)
+{
+  if (scheduler->count == scheduler->capacity) {
+    size_t capacity = scheduler->capacity ? scheduler->capacity * 2 : 8;
+    struct WinevtSchedulerEntry* entries;
+    size_t* order;
+
+    entries = realloc(scheduler->entries, capacity * sizeof(*entries));
+    if (!entries)
+      return -1;
+    scheduler->entries = entries;
+
+    order = realloc(scheduler->order, capacity * sizeof(*order));
+    if (!order)
+      return -1;
+    scheduler->order = order;
+
+    scheduler->capacity = capacity;
+  }
+
+  scheduler->entries[scheduler->count].weight = weight;
+  scheduler->entries[scheduler->count].priority = priority;
+  scheduler->entries[scheduler->count].deficit = 0;
+  scheduler_insert_order(scheduler, scheduler->count);
+
+  return (int)scheduler->count++;
+}
+
+void
+winevt_scheduler_start_round(struct WinevtScheduler* scheduler)
+{
+  scheduler->position = 0;
+}
+
+/*
+ * Return the index of the next queue in this round and store how many
+ * events it may deliver, or -1 when the round is finished.
+ */
+long
+winevt_scheduler_next(struct WinevtScheduler* scheduler, unsigned long* allowance)
+{
+  struct WinevtSchedulerEntry* entry;
+  size_t index;
+
+  if (scheduler->position >= scheduler->count)
+    return -1;
+
+  index = scheduler->order[scheduler->position++];
+  entry = &scheduler->entries[index];
+  entry->deficit += scheduler->quantum * entry->weight;
+  *allowance = entry->deficit;
+
+  return (long)index;
+}
+
+/*
+ * Report how many events the queue has delivered in its turn. A queue
+ * which has run out of events loses the rest of its allowance.
+ */
+void
+winevt_scheduler_consumed(struct WinevtScheduler* scheduler, size_t index,
+                          unsigned long consumed, int backlogged)
+{
+  struct WinevtSchedulerEntry* entry = &scheduler->entries[index];
+
+  if (!backlogged || consumed >= entry->deficit) {
+    entry->deficit = 0;
+  } else {
+    entry->deficit -= consumed;
+  }
+}
+
+static void scheduler_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_scheduler_type = { "winevt/scheduler",
+                                                         {
+                                                           0,
+                                                           scheduler_free,
+                                                           0,
+                                                         },
+                                                         NULL,
+                                                         NULL,
+                                                         RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+scheduler_free(void* ptr)
+{
+  winevt_scheduler_destroy((struct WinevtScheduler*)ptr);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_scheduler_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtScheduler* winevtScheduler;
+  obj = TypedData_Make_Struct(
+    klass, struct WinevtScheduler, &rb_winevt_scheduler_type, winevtScheduler);
+  winevt_scheduler_init(winevtScheduler, SCHEDULER_DEFAULT_QUANTUM);
+  return obj;
+}
+
+static struct WinevtScheduler*
+get_scheduler(VALUE self)
+{
+  struct WinevtScheduler* winevtScheduler;
+
+  TypedData_Get_Struct(
+    self, struct WinevtScheduler, &rb_winevt_scheduler_type, winevtScheduler);
+
+  return winevtScheduler;
+}
+
+static size_t
+check_index(struct WinevtScheduler* winevtScheduler, VALUE rb_index)
+{
+  long index = NUM2LONG(rb_index);
+
+  if (index < 0 || (size_t)index >= winevtScheduler->count) {
+    rb_raise(rb_eIndexError, "index %ld is out of range", index);
+  }
+
+  return (size_t)index;
+}
+
+/*
+ * Initalize Scheduler class.
+ *
+ * @overload initialize(quantum=10)
+ *   @param quantum [Integer] Events which weight 1 earns in a round.
+ * @return [Scheduler]
+ *
+ */
+static VALUE
+rb_winevt_scheduler_initialize(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_quantum;
+  long quantum = SCHEDULER_DEFAULT_QUANTUM;
+
+  rb_scan_args(argc, argv, "01", &rb_quantum);
+  if (!NIL_P(rb_quantum)) {
+    quantum = NUM2LONG(rb_quantum);
+    if (quantum < 1) {
+      rb_raise(rb_eArgError, "Specify a positive integer");
+    }
+  }
+
+  get_scheduler(self)->quantum = (unsigned long)quantum;
+
+  return Qnil;
+}
+
+/*
+ * Add a queue.
+ *
+ * @overload add(weight=1, priority=0)
+ *   @param weight [Integer] Multiplier of the quantum.
+ *   @param priority [Integer] Queues with higher priority are visited
+ *     earlier in each round.
+ * @return [Integer] Index of the added queue.
+ */
+static VALUE
+rb_winevt_scheduler_add(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_weight, rb_priority;
+  long weight = 1;
+  int priority = 0;
+  int index;
+
+  rb_scan_args(argc, argv, "02", &rb_weight, &rb_priority);
+  if (!NIL_P(rb_weight)) {
+    weight = NUM2LONG(rb_weight);
+    if (weight < 1) {
+      rb_raise(rb_eArgError, "Specify a positive integer as weight");
+    }
+  }
+  if (!NIL_P(rb_priority)) {
+    priority = NUM2INT(rb_priority);
+  }
+
+  index = winevt_scheduler_add(get_scheduler(self), (unsigned long)weight, priority);
+  if (index < 0) {
+    rb_memerror();
+  }
+
+  return INT2NUM(index);
+}
+
+/*
+ * This method returns the number of queues.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_scheduler_size(VALUE self)
+{
+  return SIZET2NUM(get_scheduler(self)->count);
+}
+
+/*
+ * This method returns the quantum.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_scheduler_quantum(VALUE self)
+{
+  return ULONG2NUM(get_scheduler(self)->quantum);
+}
+
+/*
+ * This method returns the allowance which the queue carries over.
+ *
+ * @param rb_index [Integer] Index of the queue.
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_scheduler_deficit(VALUE self, VALUE rb_index)
+{
+  struct WinevtScheduler* winevtScheduler = get_scheduler(self);
+
+  return ULONG2NUM(winevtScheduler->entries[check_index(winevtScheduler, rb_index)].deficit);
+}
+
+/*
+ * Start a new round.
+ */
+static VALUE
+rb_winevt_scheduler_start_round(VALUE self)
+{
+  winevt_scheduler_start_round(get_scheduler(self));
+
+  return Qnil;
+}
+
+/*
+ * Return the next queue to read in this round.
+ *
+ * @return [Array<Integer>] Index of the queue and how many events it
+ *   may deliver. nil when the round is finished.
+ */
+static VALUE
+rb_winevt_scheduler_next_turn(VALUE self)
+{
+  unsigned long allowance;
+  long index;
+
+  index = winevt_scheduler_next(get_scheduler(self), &allowance);
+  if (index < 0) {
+    return Qnil;
+  }
+
+  return rb_assoc_new(LONG2NUM(index), ULONG2NUM(allowance));
+}
+
+/*
+ * Report how many events the queue has delivered in its turn.
+ *
+ * @param rb_index [Integer] Index of the queue.
+ * @param rb_consumed [Integer] Delivered events.
+ * @param rb_backlogged [Boolean] Whether the queue has more events.
+ */
+static VALUE
+rb_winevt_scheduler_consume(VALUE self, VALUE rb_index, VALUE rb_consumed, VALUE rb_backlogged)
+{
+  struct WinevtScheduler* winevtScheduler = get_scheduler(self);
+
+  winevt_scheduler_consumed(winevtScheduler,
+                            check_index(winevtScheduler, rb_index),
+                            NUM2ULONG(rb_consumed),
+                            RTEST(rb_backlogged));
+
+  return Qnil;
+}
+
+void
+Init_winevt_scheduler(VALUE rb_cEventLog)
+{
+  rb_cScheduler = rb_define_class_under(rb_cEventLog, "Scheduler", rb_cObject);
+
+  rb_define_alloc_func(rb_cScheduler, rb_winevt_scheduler_alloc);
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "initialize", rb_winevt_scheduler_initialize, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "add", rb_winevt_scheduler_add, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "size", rb_winevt_scheduler_size, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "quantum", rb_winevt_scheduler_quantum, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "deficit", rb_winevt_scheduler_deficit, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "start_round", rb_winevt_scheduler_start_round, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "next_turn", rb_winevt_scheduler_next_turn, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cScheduler, "consume", rb_winevt_scheduler_consume, 3);
+}
@@ -16,16 +16,26 @@
  *    "Application", "*[System[(Level <= 4) and TimeCreated[timediff(@SystemTime) <= 86400000]]]"
  *  )
  *  while true do
+ *    @subscribe.wait(1.0)
  *    @subscribe.each do |eventlog, message, string_inserts|
  *      puts ({eventlog: eventlog, data: message})
  *    end
- *    sleep(0.1)
  *  end
  *
  * @see https://docs.microsoft.com/en-us/windows/win32/api/winevt/nf-winevt-evtsubscribe
  */
 /* clang-format on */
 
+static ID id_channel;
+static ID id_start_bookmark;
+static ID id_checkpoint;
+static ID id_filter;
+static ID id_push_filter;
+static ID id_deduplicator;
+static ID id_push_deduplicator;
+static ID id_sampler;
+static ID id_push_sampler;
+
 static void subscribe_free(void* ptr);
 
 static const rb_data_type_t rb_winevt_subscribe_type = { "winevt/subscribe",
@@ -38,12 +48,268 @@ static const rb_data_type_t rb_winevt_subscribe_type = { "winevt/subscribe",
                                                          NULL,
                                                          RUBY_TYPED_FREE_IMMEDIATELY };
 
+static struct WinevtPushQueue*
+push_queue_create(struct WinevtSubscribe* winevtSubscribe,
+                  HANDLE hSignalEvent,
+                  EVT_HANDLE hBookmark,
+                  EVT_HANDLE hRemoteHandle,
+                  DWORD* status)
+{
+  struct WinevtPushQueue* pushQueue;
+
+  pushQueue = ZALLOC(struct WinevtPushQueue);
+  pushQueue->events =
+    ZALLOC_N(struct WinevtRenderedEvent, winevtSubscribe->pushQueueSize);
+  pushQueue->capacity = winevtSubscribe->pushQueueSize;
+  pushQueue->signalEvent = hSignalEvent;
+  pushQueue->bookmark = hBookmark;
+  /* Rendering options are fixed at subscribing time. Because the
+   * callback thread cannot follow changes of them safely. */
+  pushQueue->options.renderAsXML = winevtSubscribe->renderAsXML;
+  pushQueue->options.langID = winevtSubscribe->localeInfo->langID;
+  pushQueue->options.remoteHandle = hRemoteHandle;
+  pushQueue->options.systemContext =
+    EvtCreateRenderContext(0, NULL, EvtRenderContextSystem);
+  pushQueue->options.userContext = EvtCreateRenderContext(0, NULL, EvtRenderContextUser);
+  if (!pushQueue->options.systemContext || !pushQueue->options.userContext) {
+    *status = GetLastError();
+    if (pushQueue->options.systemContext)
+      EvtClose(pushQueue->options.systemContext);
+    if (pushQueue->options.userContext)
+      EvtClose(pushQueue->options.userContext);
+    xfree(pushQueue->events);
+    xfree(pushQueue);
+    return NULL;
+  }
+  if (winevtSubscribe->filter.filter) {
+    *status = filter_context_init(&pushQueue->filter, winevtSubscribe->filter.filter);
+  }
+  if (*status == ERROR_SUCCESS && winevtSubscribe->dedup.dedup) {
+    *status = dedup_context_init(&pushQueue->dedup, winevtSubscribe->dedup.dedup);
+  }
+  if (*status == ERROR_SUCCESS && winevtSubscribe->sampler.sampler) {
+    *status = sampler_context_init(&pushQueue->sampler, winevtSubscribe->sampler.sampler);
+  }
+  if (*status != ERROR_SUCCESS) {
+    filter_context_free(&pushQueue->filter);
+    dedup_context_free(&pushQueue->dedup);
+    EvtClose(pushQueue->options.systemContext);
+    EvtClose(pushQueue->options.userContext);
+    xfree(pushQueue->events);
+    xfree(pushQueue);
+    return NULL;
+  }
+  InitializeCriticalSection(&pushQueue->lock);
+  InitializeConditionVariable(&pushQueue->notFull);
+
+  return pushQueue;
+}
+
+/* Unblock the callback which waits for free space. After this,
+ * the callback drops delivered events. */
+static void
+push_queue_shutdown(struct WinevtPushQueue* pushQueue)
+{
+  EnterCriticalSection(&pushQueue->lock);
+  pushQueue->closing = TRUE;
+  WakeAllConditionVariable(&pushQueue->notFull);
+  LeaveCriticalSection(&pushQueue->lock);
+}
+
+/* This must be called after closing the subscription handle.
+ * EvtClose waits for the running callback. */
+static void
+push_queue_free(struct WinevtPushQueue* pushQueue)
+{
+  for (DWORD i = 0; i < pushQueue->count; i++) {
+    free_rendered_event(
+      &pushQueue->events[(pushQueue->head + i) % pushQueue->capacity]);
+  }
+  EvtClose(pushQueue->options.systemContext);
+  EvtClose(pushQueue->options.userContext);
+  filter_context_free(&pushQueue->filter);
+  dedup_context_free(&pushQueue->dedup);
+  sampler_context_free(&pushQueue->sampler);
+  DeleteCriticalSection(&pushQueue->lock);
+  xfree(pushQueue->events);
+  xfree(pushQueue);
+}
+
+/*
+ * EVT_SUBSCRIBE_CALLBACK for push mode. This is called on a thread
+ * which is owned by the Event Log service client. So, this must not
+ * touch any Ruby objects. The event handle is only valid while this
+ * callback is running. Then, render everything here.
+ */
+static DWORD WINAPI
+subscribe_callback(EVT_SUBSCRIBE_NOTIFY_ACTION action, PVOID context, EVT_HANDLE hEvent)
+{
+  struct WinevtPushQueue* pushQueue = (struct WinevtPushQueue*)context;
+  struct WinevtRenderedEvent rendered;
+  DWORD status = ERROR_SUCCESS;
+  BOOL matched = TRUE;
+  BOOL kept = TRUE;
+  BOOL duplicated = FALSE;
+
+  if (action == EvtSubscribeActionError) {
+    EnterCriticalSection(&pushQueue->lock);
+    pushQueue->error = (DWORD)(ULONG_PTR)hEvent;
+    SetEvent(pushQueue->signalEvent);
+    LeaveCriticalSection(&pushQueue->lock);
+    return ERROR_SUCCESS;
+  }
+
+  if (pushQueue->filter.filter) {
+    status = filter_event(&pushQueue->filter, hEvent, &matched);
+  }
+  if (status == ERROR_SUCCESS && matched && pushQueue->sampler.sampler) {
+    status = sample_event(&pushQueue->sampler, hEvent, &kept);
+  }
+  if (status == ERROR_SUCCESS && matched && kept && pushQueue->dedup.dedup) {
+    status = dedup_event(&pushQueue->dedup, hEvent, &duplicated);
+  }
+  if (status == ERROR_SUCCESS && (!matched || !kept || duplicated)) {
+    /* Dropped events are also covered by the bookmark. */
+    EnterCriticalSection(&pushQueue->lock);
+    if (!matched) {
+      pushQueue->filteredCount++;
+    } else if (!kept) {
+      pushQueue->sampledCount++;
+    }
+    if (!pushQueue->closing) {
+      EvtUpdateBookmark(pushQueue->bookmark, hEvent);
+      pushQueue->bookmarkUpdated = TRUE;
+    }
+    LeaveCriticalSection(&pushQueue->lock);
+    return ERROR_SUCCESS;
+  }
+  if (status == ERROR_SUCCESS) {
+    status = render_event(hEvent, &pushQueue->options, &rendered);
+  } else {
+    ZeroMemory(&rendered, sizeof(rendered));
+  }
+
+  EnterCriticalSection(&pushQueue->lock);
+  while (pushQueue->count == pushQueue->capacity && !pushQueue->closing) {
+    SleepConditionVariableCS(&pushQueue->notFull, &pushQueue->lock, INFINITE);
+  }
+  if (pushQueue->closing) {
+    LeaveCriticalSection(&pushQueue->lock);
+    free_rendered_event(&rendered);
+    return ERROR_SUCCESS;
+  }
+
+  if (status == ERROR_SUCCESS) {
+    pushQueue->events[(pushQueue->head + pushQueue->count) % pushQueue->capacity] =
+      rendered;
+    pushQueue->count++;
+  } else {
+    pushQueue->error = status;
+  }
+  /* In push mode, the bookmark points to the last queued event. */
+  EvtUpdateBookmark(pushQueue->bookmark, hEvent);
+  pushQueue->bookmarkUpdated = TRUE;
+  SetEvent(pushQueue->signalEvent);
+  LeaveCriticalSection(&pushQueue->lock);
+
+  return ERROR_SUCCESS;
+}
+
+static void
+close_pushed_events(struct WinevtSubscribe* winevtSubscribe)
+{
+  for (int i = 0; i < winevtSubscribe->count; i++) {
+    free_rendered_event(&winevtSubscribe->pushedEvents[i]);
+  }
+  winevtSubscribe->count = 0;
+  winevtSubscribe->position = 0;
+}
+
+static void
+close_bookmark_events(struct WinevtSubscribe* winevtSubscribe)
+{
+  for (DWORD i = 0; i < winevtSubscribe->bookmarkEventsCount; i++) {
+    EvtClose(winevtSubscribe->bookmarkEvents[i]);
+    winevtSubscribe->bookmarkEvents[i] = NULL;
+  }
+  winevtSubscribe->bookmarkEventsCount = 0;
+}
+
+/* Update the bookmark with the delivered events kept so far. */
+static void
+apply_bookmark_events(struct WinevtSubscribe* winevtSubscribe)
+{
+  for (DWORD i = 0; i < winevtSubscribe->bookmarkEventsCount; i++) {
+    EvtUpdateBookmark(winevtSubscribe->bookmark, winevtSubscribe->bookmarkEvents[i]);
+    winevtSubscribe->bookmarkUpdated = TRUE;
+  }
+  close_bookmark_events(winevtSubscribe);
+  winevtSubscribe->lastCheckpoint = GetTickCount64();
+  winevtSubscribe->eventsSinceCheckpoint = 0;
+}
+
+static BOOL
+is_checkpoint_due(struct WinevtSubscribe* winevtSubscribe)
+{
+  if (winevtSubscribe->checkpointInterval == 0 && winevtSubscribe->checkpointCount == 0)
+    return TRUE;
+  if (winevtSubscribe->checkpointCount > 0 &&
+      winevtSubscribe->eventsSinceCheckpoint >= winevtSubscribe->checkpointCount)
+    return TRUE;
+  if (winevtSubscribe->checkpointInterval > 0 &&
+      GetTickCount64() - winevtSubscribe->lastCheckpoint >= winevtSubscribe->checkpointInterval)
+    return TRUE;
+
+  return FALSE;
+}
+
+/*
+ * Keep the delivered events which are needed to move the bookmark,
+ * the last one of each channel, and close the others. The bookmark is
+ * updated when the checkpoint is due.
+ */
+static void
+keep_bookmark_events(struct WinevtSubscribe* winevtSubscribe,
+                     EVT_HANDLE* events,
+                     DWORD count)
+{
+  EVT_HANDLE lastEvents[SUBSCRIBE_ARRAY_SIZE];
+  DWORD lastCount;
+
+  lastCount = last_events_per_channel(
+    events, count, winevtSubscribe->multiChannel, lastEvents);
+  if (winevtSubscribe->checkpoint) {
+    update_checkpoint_with_events(winevtSubscribe->checkpoint, lastEvents, lastCount);
+  }
+  for (DWORD i = 0, j = 0; i < count; i++) {
+    if (j < lastCount && events[i] == lastEvents[j]) {
+      j++;
+    } else {
+      EvtClose(events[i]);
+    }
+  }
+
+  if (!winevtSubscribe->multiChannel) {
+    /* The new event supersedes the kept one. */
+    close_bookmark_events(winevtSubscribe);
+  } else if (winevtSubscribe->bookmarkEventsCount + lastCount > SUBSCRIBE_ARRAY_SIZE) {
+    apply_bookmark_events(winevtSubscribe);
+  }
+  for (DWORD i = 0; i < lastCount; i++) {
+    winevtSubscribe->bookmarkEvents[winevtSubscribe->bookmarkEventsCount++] = lastEvents[i];
+  }
+  winevtSubscribe->eventsSinceCheckpoint += count;
+
+  if (is_checkpoint_due(winevtSubscribe)) {
+    apply_bookmark_events(winevtSubscribe);
+  }
+}
+
 static void
 close_handles(struct WinevtSubscribe* winevtSubscribe)
 {
-  if (winevtSubscribe->signalEvent) {
-    CloseHandle(winevtSubscribe->signalEvent);
-    winevtSubscribe->signalEvent = NULL;
+  if (winevtSubscribe->pushQueue) {
+    push_queue_shutdown(winevtSubscribe->pushQueue);
   }
 
   if (winevtSubscribe->subscription) {
@@ -51,6 +317,20 @@ close_handles(struct WinevtSubscribe* winevtSubscribe)
     winevtSubscribe->subscription = NULL;
   }
 
+  if (winevtSubscribe->pushQueue) {
+    close_pushed_events(winevtSubscribe);
+    winevtSubscribe->filteredCount += winevtSubscribe->pushQueue->filteredCount;
+    winevtSubscribe->sampledCount += winevtSubscribe->pushQueue->sampledCount;
+    push_queue_free(winevtSubscribe->pushQueue);
+    winevtSubscribe->pushQueue = NULL;
+  }
+
+  if (winevtSubscribe->signalEvent) {
+    CloseHandle(winevtSubscribe->signalEvent);
+    winevtSubscribe->signalEvent = NULL;
+  }
+
+  close_bookmark_events(winevtSubscribe);
   if (winevtSubscribe->bookmark) {
     EvtClose(winevtSubscribe->bookmark);
     winevtSubscribe->bookmark = NULL;
@@ -63,6 +343,7 @@ close_handles(struct WinevtSubscribe* winevtSubscribe)
     }
   }
   winevtSubscribe->count = 0;
+  winevtSubscribe->position = 0;
 
   if (winevtSubscribe->remoteHandle) {
     EvtClose(winevtSubscribe->remoteHandle);
@@ -75,10 +356,154 @@ subscribe_free(void* ptr)
 {
   struct WinevtSubscribe* winevtSubscribe = (struct WinevtSubscribe*)ptr;
   close_handles(winevtSubscribe);
+  filter_context_free(&winevtSubscribe->filter);
+  dedup_context_free(&winevtSubscribe->dedup);
+  sampler_context_free(&winevtSubscribe->sampler);
 
   xfree(ptr);
 }
 
+static LONGLONG
+monotonic_ticks(void)
+{
+  LARGE_INTEGER counter;
+
+  QueryPerformanceCounter(&counter);
+
+  return counter.QuadPart;
+}
+
+static LONGLONG
+monotonic_ticks_per_second(void)
+{
+  static LONGLONG frequency = 0;
+
+  if (frequency == 0) {
+    LARGE_INTEGER value;
+
+    QueryPerformanceFrequency(&value);
+    frequency = value.QuadPart;
+  }
+
+  return frequency;
+}
+
+static void
+token_bucket_init(struct WinevtTokenBucket* bucket, LONG rate, LONG burst)
+{
+  bucket->rate = rate;
+  bucket->burst = burst;
+  bucket->tokens = burst > 0 ? burst : rate;
+  bucket->lastTick = monotonic_ticks();
+}
+
+static void
+token_bucket_refill(struct WinevtTokenBucket* bucket, LONGLONG now)
+{
+  double capacity;
+
+  if (bucket->rate == SUBSCRIBE_RATE_INFINITE)
+    return;
+
+  capacity = bucket->burst > 0 ? bucket->burst : bucket->rate;
+  bucket->tokens += (double)(now - bucket->lastTick) * bucket->rate /
+                    monotonic_ticks_per_second();
+  if (bucket->tokens > capacity)
+    bucket->tokens = capacity;
+  bucket->lastTick = now;
+}
+
+/* Milliseconds until the bucket has the required tokens. */
+static DWORD
+token_bucket_wait_msec(struct WinevtTokenBucket* bucket, double required)
+{
+  double msec;
+
+  if (bucket->rate == SUBSCRIBE_RATE_INFINITE || bucket->tokens >= required)
+    return 0;
+
+  msec = (required - bucket->tokens) * 1000 / bucket->rate;
+
+  return msec < 1 ? 1 : (DWORD)msec + 1;
+}
+
+static void
+token_bucket_consume(struct WinevtTokenBucket* bucket, double tokens)
+{
+  if (bucket->rate == SUBSCRIBE_RATE_INFINITE)
+    return;
+
+  /* The byte bucket can be in debt because the size of an event is
+   * known only after rendering it. */
+  bucket->tokens -= tokens;
+}
+
+/* Milliseconds until the next event can be delivered. 0 means that
+ * delivering is allowed now. */
+static DWORD
+rate_limit_wait_msec(struct WinevtSubscribe* winevtSubscribe)
+{
+  LONGLONG now = monotonic_ticks();
+  DWORD eventWait, byteWait;
+
+  token_bucket_refill(&winevtSubscribe->eventBucket, now);
+  token_bucket_refill(&winevtSubscribe->byteBucket, now);
+  eventWait = token_bucket_wait_msec(&winevtSubscribe->eventBucket, 1);
+  byteWait = token_bucket_wait_msec(&winevtSubscribe->byteBucket, 1);
+
+  if (eventWait == 0 && byteWait == 0) {
+    if (winevtSubscribe->throttleStart != 0) {
+      winevtSubscribe->throttledTicks += now - winevtSubscribe->throttleStart;
+      winevtSubscribe->throttleStart = 0;
+    }
+    return 0;
+  }
+
+  if (winevtSubscribe->throttleStart == 0) {
+    winevtSubscribe->throttleStart = now;
+    winevtSubscribe->throttledCount++;
+  }
+
+  return eventWait > byteWait ? eventWait : byteWait;
+}
+
+static BOOL
+is_rate_limit_exceeded(struct WinevtSubscribe* winevtSubscribe)
+{
+  return rate_limit_wait_msec(winevtSubscribe) > 0;
+}
+
+static BOOL
+has_pending_events(struct WinevtSubscribe* winevtSubscribe)
+{
+  return winevtSubscribe->position < winevtSubscribe->count;
+}
+
+/*
+ * Whether the next #each has events to yield. The events which are
+ * not read yet are known by the signal event or the push queue.
+ */
+static BOOL
+subscribe_has_more_events(struct WinevtSubscribe* winevtSubscribe)
+{
+  BOOL queued;
+
+  if (has_pending_events(winevtSubscribe)) {
+    return TRUE;
+  }
+  if (!winevtSubscribe->subscription) {
+    return FALSE;
+  }
+  if (winevtSubscribe->pushQueue) {
+    EnterCriticalSection(&winevtSubscribe->pushQueue->lock);
+    queued = winevtSubscribe->pushQueue->count > 0;
+    LeaveCriticalSection(&winevtSubscribe->pushQueue->lock);
+    return queued;
+  }
+
+  return WaitForSingleObject(winevtSubscribe->signalEvent, 0) == WAIT_OBJECT_0;
+}
+
 static VALUE
 rb_winevt_subscribe_alloc(VALUE klass)
 {
@@ -103,14 +528,24 @@ rb_winevt_subscribe_initialize(VALUE self)
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  winevtSubscribe->rateLimit = SUBSCRIBE_RATE_INFINITE;
-  winevtSubscribe->lastTime = 0;
-  winevtSubscribe->currentRate = 0;
+  token_bucket_init(&winevtSubscribe->eventBucket, SUBSCRIBE_RATE_INFINITE, 0);
+  token_bucket_init(&winevtSubscribe->byteBucket, SUBSCRIBE_RATE_INFINITE, 0);
+  winevtSubscribe->throttleStart = 0;
+  winevtSubscribe->throttledTicks = 0;
+  winevtSubscribe->throttledCount = 0;
   winevtSubscribe->renderAsXML = TRUE;
   winevtSubscribe->readExistingEvents = TRUE;
   winevtSubscribe->preserveQualifiers = FALSE;
   winevtSubscribe->localeInfo = &default_locale;
   winevtSubscribe->preserveSID = TRUE;
+  winevtSubscribe->pushMode = FALSE;
+  winevtSubscribe->pushQueueSize = SUBSCRIBE_PUSH_QUEUE_SIZE;
+  winevtSubscribe->bookmarkEventsCount = 0;
+  winevtSubscribe->checkpointInterval = 0;
+  winevtSubscribe->checkpointCount = 0;
+  winevtSubscribe->lastCheckpoint = GetTickCount64();
+  winevtSubscribe->eventsSinceCheckpoint = 0;
+  winevtSubscribe->checkpoint = NULL;
 
   return Qnil;
 }
@@ -149,13 +584,46 @@ rb_winevt_subscribe_read_existing_events_p(VALUE self)
   return winevtSubscribe->readExistingEvents ? Qtrue : Qfalse;
 }
 
+static EVT_HANDLE
+copy_bookmark(EVT_HANDLE hBookmark, DWORD* status)
+{
+  WCHAR* bookmarkXml;
+  EVT_HANDLE hCopy;
+
+  bookmarkXml = render_to_wstr(hBookmark, EvtRenderBookmark, status);
+  if (!bookmarkXml) {
+    return NULL;
+  }
+  hCopy = EvtCreateBookmark(bookmarkXml);
+  if (hCopy == NULL) {
+    *status = GetLastError();
+  }
+  free(bookmarkXml);
+
+  return hCopy;
+}
+
 /*
  * Subscribe into a Windows EventLog channel.
  *
  * @overload subscribe(path, query, bookmark=nil, session=nil)
  *   @param path [String] Subscribe Channel
- *   @param query [String] Query string for channel
- *   @param bookmark [Bookmark] bookmark Bookmark class instance.
+ *   @param query [String, CompiledQuery] Query string for channel
+ *   @param bookmark [Bookmark, String] bookmark Bookmark class instance
+ *     or rendered Bookmark XML. A Bookmark instance is used as is
+ *     without rendering it, unless query is a structured query (see
+ *     below).
+ *   @param session [Session] Session information for remoting access.
+ * @overload subscribe(query_list, bookmark=nil, session=nil)
+ *   Subscribe the channels of query_list with one handle. #each
+ *   yields the channel of each event as 4th value.
+ *   @param query_list [QueryList] Subscribe channels and XPaths.
+ *   @param bookmark [Bookmark, String] bookmark Bookmark class instance
+ *     or rendered Bookmark XML. With a structured query, i.e. a
+ *     QueryList or a QueryList XML as query, a Bookmark instance is
+ *     rendered to XML and parsed again once here. The subscription
+ *     moves its own copy per channel, and the copy must start with the
+ *     positions of all channels. The Bookmark instance is not changed.
  *   @param session [Session] Session information for remoting access.
  * @return [Boolean]
  *
@@ -164,12 +632,15 @@ static VALUE
 rb_winevt_subscribe_subscribe(int argc, VALUE* argv, VALUE self)
 {
   VALUE rb_path, rb_query, rb_bookmark, rb_session;
-  EVT_HANDLE hSubscription = NULL, hBookmark = NULL;
+  EVT_HANDLE hSubscription = NULL, hBookmark = NULL, hStartBookmark = NULL;
+  VALUE rb_start_bookmark = Qnil;
   HANDLE hSignalEvent;
   EVT_HANDLE hRemoteHandle = NULL;
+  struct WinevtPushQueue* pushQueue = NULL;
   DWORD len, flags = 0L;
   DWORD err = ERROR_SUCCESS;
-  VALUE wpathBuf, wqueryBuf, wBookmarkBuf;
+  VALUE wpathBuf = 0, wqueryBuf = 0, wBookmarkBuf;
+  VALUE rb_query_list = Qnil;
   PWSTR path, query, bookmarkXml;
   DWORD status = ERROR_SUCCESS;
   struct WinevtSession* winevtSession;
@@ -178,9 +649,25 @@ rb_winevt_subscribe_subscribe(int argc, VALUE* argv, VALUE self)
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  rb_scan_args(argc, argv, "22", &rb_path, &rb_query, &rb_bookmark, &rb_session);
-  Check_Type(rb_path, T_STRING);
-  Check_Type(rb_query, T_STRING);
+  rb_scan_args(argc, argv, "13", &rb_path, &rb_query, &rb_bookmark, &rb_session);
+  if (rb_obj_is_kind_of(rb_path, rb_cQueryList)) {
+    if (argc > 3) {
+      rb_error_arity(argc, 1, 3);
+    }
+    rb_query_list = rb_path;
+    rb_session = rb_bookmark;
+    rb_bookmark = rb_query;
+    rb_query = winevt_query_list_to_xml(rb_query_list);
+    rb_path = Qnil;
+  } else {
+    if (argc < 2) {
+      rb_error_arity(argc, 2, 4);
+    }
+    Check_Type(rb_path, T_STRING);
+    if (!rb_obj_is_kind_of(rb_query, rb_cCompiledQuery)) {
+      Check_Type(rb_query, T_STRING);
+    }
+  }
 
   if (rb_obj_is_kind_of(rb_bookmark, rb_cString)) {
     // bookmarkXml : To wide char
@@ -214,22 +701,52 @@ rb_winevt_subscribe_subscribe(int argc, VALUE* argv, VALUE self)
     }
   }
 
-  // path : To wide char
-  len =
-    MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(rb_path), RSTRING_LEN(rb_path), NULL, 0);
-  path = ALLOCV_N(WCHAR, wpathBuf, len + 1);
-  MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(rb_path), RSTRING_LEN(rb_path), path, len);
-  path[len] = L'\0';
+  if (NIL_P(rb_path)) {
+    /* The channels are in the structured query. */
+    path = NULL;
+  } else {
+    // path : To wide char
+    len =
+      MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(rb_path), RSTRING_LEN(rb_path), NULL, 0);
+    path = ALLOCV_N(WCHAR, wpathBuf, len + 1);
+    MultiByteToWideChar(CP_UTF8, 0, RSTRING_PTR(rb_path), RSTRING_LEN(rb_path), path, len);
+    path[len] = L'\0';
+  }
+
+  if (rb_obj_is_kind_of(rb_query, rb_cCompiledQuery)) {
+    /* It is already validated and converted. */
+    query = (PWSTR)winevt_compiled_query_wstr(rb_query);
+  } else {
+    // query : To wide char
+    len = MultiByteToWideChar(
+      CP_UTF8, 0, RSTRING_PTR(rb_query), RSTRING_LEN(rb_query), NULL, 0);
+    query = ALLOCV_N(WCHAR, wqueryBuf, len + 1);
+    MultiByteToWideChar(
+      CP_UTF8, 0, RSTRING_PTR(rb_query), RSTRING_LEN(rb_query), query, len);
+    query[len] = L'\0';
+  }
 
-  // query : To wide char
-  len = MultiByteToWideChar(
-    CP_UTF8, 0, RSTRING_PTR(rb_query), RSTRING_LEN(rb_query), NULL, 0);
-  query = ALLOCV_N(WCHAR, wqueryBuf, len + 1);
-  MultiByteToWideChar(
-    CP_UTF8, 0, RSTRING_PTR(rb_query), RSTRING_LEN(rb_query), query, len);
-  query[len] = L'\0';
+  if (rb_obj_is_kind_of(rb_bookmark, rb_cBookmark)) {
+    hStartBookmark = EventBookMark(rb_bookmark)->bookmark;
+    if (is_structured_query(query)) {
+      /* The positions of all channels are needed from the start, and
+       * EvtUpdateBookmark must not move the caller's Bookmark, so it
+       * is copied. wevtapi has no API to duplicate a bookmark without
+       * rendering it. */
+      hBookmark = copy_bookmark(hStartBookmark, &status);
+      if (hBookmark == NULL) {
+        raise_system_error(rb_eWinevtQueryError, status);
+      }
+    } else {
+      /* The own bookmark gets the position with the first event.
+       * Until then, the given one is rendered instead. */
+      rb_start_bookmark = rb_bookmark;
+    }
+  } else {
+    hStartBookmark = hBookmark;
+  }
 
-  if (hBookmark) {
+  if (hStartBookmark) {
     flags |= EvtSubscribeStartAfterBookmark;
   } else if (winevtSubscribe->readExistingEvents) {
     flags |= EvtSubscribeStartAtOldestRecord;
@@ -237,11 +754,42 @@ rb_winevt_subscribe_subscribe(int argc, VALUE* argv, VALUE self)
     flags |= EvtSubscribeToFutureEvents;
   }
 
-  hSignalEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
-  hSubscription =
-    EvtSubscribe(hRemoteHandle, hSignalEvent, path, query, hBookmark, NULL, NULL, flags);
+  if (!hBookmark) {
+    hBookmark = EvtCreateBookmark(NULL);
+    if (hBookmark == NULL) {
+      status = GetLastError();
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
+  }
+
+  /* In push mode, the signal event is set while the queue has events. */
+  hSignalEvent = CreateEvent(NULL, TRUE, !winevtSubscribe->pushMode, NULL);
+  if (winevtSubscribe->pushMode) {
+    pushQueue = push_queue_create(
+      winevtSubscribe, hSignalEvent, hBookmark, hRemoteHandle, &status);
+    if (!pushQueue) {
+      EvtClose(hBookmark);
+      CloseHandle(hSignalEvent);
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
+    pushQueue->options.renderPath = !NIL_P(rb_query_list);
+    hSubscription = EvtSubscribe(hRemoteHandle,
+                                 NULL,
+                                 path,
+                                 query,
+                                 hStartBookmark,
+                                 pushQueue,
+                                 subscribe_callback,
+                                 flags);
+  } else {
+    hSubscription = EvtSubscribe(
+      hRemoteHandle, hSignalEvent, path, query, hStartBookmark, NULL, NULL, flags);
+  }
   if (!hSubscription) {
     status = GetLastError();
+    if (pushQueue != NULL) {
+      push_queue_free(pushQueue);
+    }
     if (hBookmark != NULL) {
       EvtClose(hBookmark);
     }
@@ -255,7 +803,10 @@ rb_winevt_subscribe_subscribe(int argc, VALUE* argv, VALUE self)
 
     switch (status) {
     case ERROR_EVT_CHANNEL_NOT_FOUND:
-      raise_channel_not_found_error(rb_path);
+      raise_channel_not_found_error(
+        NIL_P(rb_query_list)
+          ? rb_path
+          : rb_ary_join(winevt_query_list_channels(rb_query_list), rb_str_new_cstr(", ")));
     default:
       raise_system_error(rb_eWinevtQueryError, status);
       break;
@@ -266,26 +817,23 @@ rb_winevt_subscribe_subscribe(int argc, VALUE* argv, VALUE self)
   ALLOCV_END(wpathBuf);
   ALLOCV_END(wqueryBuf);
 
-  if (!hBookmark) {
-    hBookmark = EvtCreateBookmark(NULL);
-    if (hBookmark == NULL) {
-      status = GetLastError();
-      if (hSubscription != NULL) {
-        EvtClose(hSubscription);
-      }
-      if (hSignalEvent != NULL) {
-        CloseHandle(hSignalEvent);
-      }
-      raise_system_error(rb_eWinevtQueryError, status);
-    }
+  if (winevtSubscribe->pushQueue) {
+      push_queue_shutdown(winevtSubscribe->pushQueue);
   }
-
   if (winevtSubscribe->subscription) {
       EvtClose(winevtSubscribe->subscription);
   }
+  if (winevtSubscribe->pushQueue) {
+      close_pushed_events(winevtSubscribe);
+      winevtSubscribe->filteredCount += winevtSubscribe->pushQueue->filteredCount;
+      winevtSubscribe->sampledCount += winevtSubscribe->pushQueue->sampledCount;
+      push_queue_free(winevtSubscribe->pushQueue);
+  }
   if (winevtSubscribe->signalEvent) {
       CloseHandle(winevtSubscribe->signalEvent);
   }
+  /* The kept events belong to the previous bookmark. */
+  close_bookmark_events(winevtSubscribe);
   if (winevtSubscribe->bookmark) {
       EvtClose(winevtSubscribe->bookmark);
   }
@@ -293,85 +841,298 @@ rb_winevt_subscribe_subscribe(int argc, VALUE* argv, VALUE self)
   winevtSubscribe->subscription = hSubscription;
   winevtSubscribe->remoteHandle = hRemoteHandle;
   winevtSubscribe->bookmark = hBookmark;
+  winevtSubscribe->pushQueue = pushQueue;
+  winevtSubscribe->multiChannel = is_structured_query(query);
+  winevtSubscribe->yieldPath = !NIL_P(rb_query_list);
+  winevtSubscribe->bookmarkUpdated = FALSE;
+  winevtSubscribe->checkpoint = NULL;
+  rb_ivar_set(self, id_checkpoint, Qnil);
+  rb_ivar_set(self, id_start_bookmark, rb_start_bookmark);
+  rb_ivar_set(self, id_channel, NIL_P(rb_path) ? Qnil : rb_obj_freeze(rb_str_dup(rb_path)));
+  /* The callback thread uses the filter until the next subscribe. */
+  rb_ivar_set(self, id_push_filter, pushQueue ? rb_ivar_get(self, id_filter) : Qnil);
+  rb_ivar_set(
+    self, id_push_deduplicator, pushQueue ? rb_ivar_get(self, id_deduplicator) : Qnil);
+  rb_ivar_set(self, id_push_sampler, pushQueue ? rb_ivar_get(self, id_sampler) : Qnil);
 
   return Qtrue;
 }
 
-BOOL
-is_rate_limit_exceeded(struct WinevtSubscribe* winevtSubscribe)
+/*
+ * Inspect what a subscription is waiting for. Returns FALSE when the
+ * subscription is closed. Otherwise, *delay is the time until the rate
+ * limit allows delivering and *signalEvent is the handle to wait for,
+ * or NULL when events can be delivered right now.
+ */
+static BOOL
+subscribe_wait_state(VALUE self, HANDLE* signalEvent, DWORD* delay)
 {
-  time_t now;
-
-  if (winevtSubscribe->rateLimit == SUBSCRIBE_RATE_INFINITE)
-    return FALSE;
+  struct WinevtSubscribe* winevtSubscribe;
 
-  time(&now);
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  if (now <= winevtSubscribe->lastTime) {
-    if (winevtSubscribe->currentRate >= winevtSubscribe->rateLimit) {
-      return TRUE;
-    }
-  } else {
-    winevtSubscribe->currentRate = 0;
+  *signalEvent = NULL;
+  *delay = 0;
+  if (!winevtSubscribe->subscription) {
+    return FALSE;
   }
 
-  return FALSE;
-}
-
-void
-update_to_reflect_rate_limit_state(struct WinevtSubscribe* winevtSubscribe, ULONG count)
-{
-  time_t lastTime = 0;
-
-  if (winevtSubscribe->rateLimit == SUBSCRIBE_RATE_INFINITE)
-    return;
+  *delay = rate_limit_wait_msec(winevtSubscribe);
+  if (*delay == 0 && !has_pending_events(winevtSubscribe)) {
+    *signalEvent = winevtSubscribe->signalEvent;
+  }
 
-  time(&lastTime);
-  winevtSubscribe->lastTime = lastTime;
-  winevtSubscribe->currentRate += count;
+  return TRUE;
 }
 
 /*
- * Handle the next values. Since v0.6.0, this method is used for
- * testing only. Please use #each instead.
- *
- * @return [Boolean]
+ * Wait until subscribed events are available. The GVL is released
+ * while waiting, so this can be used instead of sleep polling between
+ * #each calls.
  *
- * @see each
+ * @since 0.12.0
+ * @overload wait(timeout=nil)
+ *   @param timeout [Numeric] Seconds to wait. nil means waiting forever.
+ * @return [Boolean] true if events are available, false on timeout.
  */
-
 static VALUE
-rb_winevt_subscribe_next(VALUE self)
+rb_winevt_subscribe_wait(int argc, VALUE* argv, VALUE self)
 {
-  EVT_HANDLE hEvents[SUBSCRIBE_ARRAY_SIZE];
-  ULONG count = 0;
-  DWORD status = ERROR_SUCCESS;
-  DWORD dwWait = 0;
-
+  VALUE rb_timeout;
+  DWORD timeout, remaining, delay;
+  ULONGLONG deadline;
   struct WinevtSubscribe* winevtSubscribe;
 
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  if (is_rate_limit_exceeded(winevtSubscribe)) {
-    return Qfalse;
+  rb_scan_args(argc, argv, "01", &rb_timeout);
+  timeout = timeout_to_msec(rb_timeout);
+  deadline = GetTickCount64() + timeout;
+
+  for (;;) {
+    if (!winevtSubscribe->subscription) {
+      return Qfalse;
+    }
+
+    remaining = remaining_msec(timeout, deadline);
+    delay = rate_limit_wait_msec(winevtSubscribe);
+    if (delay == 0 && has_pending_events(winevtSubscribe)) {
+      return Qtrue;
+    }
+    if (delay == 0) {
+      break;
+    }
+    if (delay >= remaining) {
+      wait_for_signal_events(NULL, 0, remaining);
+      return Qfalse;
+    }
+    wait_for_signal_events(NULL, 0, delay);
   }
 
-  /* If subscription handle is NULL, it should return false. */
-  if (!winevtSubscribe->subscription) {
-    return Qfalse;
+  if (wait_for_signal_events(&winevtSubscribe->signalEvent, 1, remaining) ==
+      WAIT_OBJECT_0) {
+    return Qtrue;
   }
 
-  /* If a signalEvent notifies whether a state of processed event(s)
-   * is existing or not.
-   * For checking for a result of WaitForSingleObject,
-   * we need to raise SubscribeHandlerError exception when
-   * WAIT_FAILED is detected for further investigations.
-   * Note that we don't need to wait explicitly here.
-   * Because this function is inside of each enumerator.
-   * So, WaitForSingleObject should return immediately and should be
+  return Qfalse;
+}
+
+/*
+ * Wait until one or more of the subscriptions have available events
+ * and return them. The signal events are waited for together, in
+ * chunks of MAXIMUM_WAIT_OBJECTS handles, and the rate limited ones
+ * are waited for until the earliest delay ends. Shared by
+ * Subscribe.wait_any and SubscribeGroup#wait.
+ */
+VALUE
+subscribe_wait_ready(VALUE rb_subscriptions, VALUE rb_timeout)
+{
+  VALUE rb_ready, vhandles, vindices;
+  HANDLE* handles;
+  long* indices;
+  HANDLE signalEvent;
+  DWORD count, timeout, remaining, delay, minDelay, result;
+  ULONGLONG deadline;
+  long size;
+
+  timeout = timeout_to_msec(rb_timeout);
+  deadline = GetTickCount64() + timeout;
+  rb_subscriptions = rb_ary_dup(rb_subscriptions);
+  size = RARRAY_LEN(rb_subscriptions);
+  handles = ALLOCV_N(HANDLE, vhandles, size + 1);
+  indices = ALLOCV_N(long, vindices, size + 1);
+  rb_ready = rb_ary_new();
+
+  for (;;) {
+    count = 0;
+    minDelay = INFINITE;
+    for (long i = 0; i < size; i++) {
+      if (!subscribe_wait_state(RARRAY_AREF(rb_subscriptions, i), &signalEvent, &delay)) {
+        continue;
+      }
+      if (delay > 0) {
+        if (delay < minDelay) {
+          minDelay = delay;
+        }
+        continue;
+      }
+      if (!signalEvent) {
+        /* Events which are already read are always ready. */
+        rb_ary_push(rb_ready, RARRAY_AREF(rb_subscriptions, i));
+        continue;
+      }
+      handles[count] = signalEvent;
+      indices[count] = i;
+      count++;
+    }
+
+    if (RARRAY_LEN(rb_ready) > 0 || (count == 0 && minDelay == INFINITE)) {
+      break;
+    }
+
+    remaining = remaining_msec(timeout, deadline);
+    result = wait_for_signal_events(
+      handles, count, minDelay < remaining ? minDelay : remaining);
+    if (result != WAIT_TIMEOUT) {
+      for (DWORD i = 0; i < count; i++) {
+        if (WaitForSingleObject(handles[i], 0) == WAIT_OBJECT_0) {
+          rb_ary_push(rb_ready, RARRAY_AREF(rb_subscriptions, indices[i]));
+        }
+      }
+      break;
+    }
+    if (minDelay >= remaining) {
+      break;
+    }
+  }
+
+  ALLOCV_END(vhandles);
+  ALLOCV_END(vindices);
+  RB_GC_GUARD(rb_subscriptions);
+
+  return rb_ready;
+}
+
+/*
+ * Wait until one or more subscriptions have available events.
+ * The GVL is released while waiting.
+ *
+ * @since 0.12.0
+ * @overload wait_any(subscriptions, timeout=nil)
+ *   @param subscriptions [Array<Subscribe>] Up to 63 subscriptions.
+ *   @param timeout [Numeric] Seconds to wait. nil means waiting forever.
+ * @return [Array<Subscribe>] Ready subscriptions. Empty on timeout.
+ */
+static VALUE
+rb_winevt_subscribe_s_wait_any(int argc, VALUE* argv, VALUE klass)
+{
+  VALUE rb_subscriptions, rb_timeout;
+
+  rb_scan_args(argc, argv, "11", &rb_subscriptions, &rb_timeout);
+  Check_Type(rb_subscriptions, T_ARRAY);
+  if (RARRAY_LEN(rb_subscriptions) > MAXIMUM_WAIT_OBJECTS - 1) {
+    rb_raise(rb_eArgError,
+             "Cannot wait for more than %d subscriptions at once",
+             MAXIMUM_WAIT_OBJECTS - 1);
+  }
+
+  return subscribe_wait_ready(rb_subscriptions, rb_timeout);
+}
+
+/*
+ * Handle the next values. Since v0.6.0, this method is used for
+ * testing only. Please use #each instead.
+ *
+ * @return [Boolean]
+ *
+ * @see each
+ */
+
+static VALUE
+rb_winevt_subscribe_next_pushed(struct WinevtSubscribe* winevtSubscribe)
+{
+  struct WinevtPushQueue* pushQueue = winevtSubscribe->pushQueue;
+  DWORD count = 0;
+  DWORD error;
+
+  if (has_pending_events(winevtSubscribe)) {
+    return Qtrue;
+  }
+  close_pushed_events(winevtSubscribe);
+
+  EnterCriticalSection(&pushQueue->lock);
+  error = pushQueue->error;
+  pushQueue->error = ERROR_SUCCESS;
+  if (error != ERROR_SUCCESS) {
+    LeaveCriticalSection(&pushQueue->lock);
+    raise_system_error(rb_eSubscribeHandlerError, error);
+  }
+
+  while (count < SUBSCRIBE_ARRAY_SIZE && pushQueue->count > 0) {
+    winevtSubscribe->pushedEvents[count++] = pushQueue->events[pushQueue->head];
+    pushQueue->head = (pushQueue->head + 1) % pushQueue->capacity;
+    pushQueue->count--;
+  }
+  if (pushQueue->count == 0) {
+    ResetEvent(pushQueue->signalEvent);
+  }
+  if (count > 0) {
+    WakeAllConditionVariable(&pushQueue->notFull);
+  }
+  LeaveCriticalSection(&pushQueue->lock);
+
+  if (count == 0) {
+    return Qfalse;
+  }
+
+  winevtSubscribe->count = count;
+
+  return Qtrue;
+}
+
+static VALUE
+rb_winevt_subscribe_next(VALUE self)
+{
+  EVT_HANDLE hEvents[SUBSCRIBE_ARRAY_SIZE];
+  ULONG count = 0;
+  DWORD status = ERROR_SUCCESS;
+  DWORD dwWait = 0;
+
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (is_rate_limit_exceeded(winevtSubscribe)) {
+    return Qfalse;
+  }
+
+  /* If subscription handle is NULL, it should return false. */
+  if (!winevtSubscribe->subscription) {
+    return Qfalse;
+  }
+
+  if (winevtSubscribe->pushQueue) {
+    return rb_winevt_subscribe_next_pushed(winevtSubscribe);
+  }
+
+  /* If a signalEvent notifies whether a state of processed event(s)
+   * is existing or not.
+   * For checking for a result of WaitForSingleObject,
+   * we need to raise SubscribeHandlerError exception when
+   * WAIT_FAILED is detected for further investigations.
+   * Note that we don't need to wait explicitly here.
+   * Because this function is inside of each enumerator.
+   * So, WaitForSingleObject should return immediately and should be
    * processed with the latter each loops if there is no more items.
    * Just intended to check that there is no errors here. */
+  /* Events which were held back by the rate limit are delivered first. */
+  if (has_pending_events(winevtSubscribe)) {
+    return Qtrue;
+  }
+
   dwWait = WaitForSingleObject(winevtSubscribe->signalEvent, 0);
   if (dwWait == WAIT_FAILED) {
     raise_system_error(rb_eSubscribeHandlerError, GetLastError());
@@ -379,12 +1140,11 @@ rb_winevt_subscribe_next(VALUE self)
     return Qfalse;
   }
 
-  if (!EvtNext(winevtSubscribe->subscription,
-               SUBSCRIBE_ARRAY_SIZE,
-               hEvents,
-               INFINITE,
-               0,
-               &count)) {
+  if (!evt_next(winevtSubscribe->subscription,
+                SUBSCRIBE_ARRAY_SIZE,
+                hEvents,
+                INFINITE,
+                &count)) {
     status = GetLastError();
     if (ERROR_CANCELLED == status) {
       return Qfalse;
@@ -400,170 +1160,859 @@ rb_winevt_subscribe_next(VALUE self)
     winevtSubscribe->count = count;
     for (int i = 0; i < count; i++) {
       winevtSubscribe->hEvents[i] = hEvents[i];
-      EvtUpdateBookmark(winevtSubscribe->bookmark, winevtSubscribe->hEvents[i]);
     }
 
-    update_to_reflect_rate_limit_state(winevtSubscribe, count);
+    return Qtrue;
+  }
+
+  return Qfalse;
+}
+
+static VALUE
+rb_winevt_subscribe_render(VALUE self, EVT_HANDLE event)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (winevtSubscribe->renderAsXML) {
+    return render_to_rb_str(event, EvtRenderEventXml);
+  } else {
+    return render_system_event(event, winevtSubscribe->preserveQualifiers,
+                               winevtSubscribe->preserveSID);
+  }
+}
+
+static VALUE
+rb_winevt_subscribe_message(EVT_HANDLE event, LocaleInfo* localeInfo, EVT_HANDLE hRemote)
+{
+  WCHAR* wResult;
+  VALUE utf8str;
+
+  wResult = get_description(event, localeInfo->langID, hRemote);
+  utf8str = wstr_to_rb_str(CP_UTF8, wResult, -1);
+  free(wResult);
+
+  return utf8str;
+}
+
+static VALUE
+rb_winevt_subscribe_string_inserts(EVT_HANDLE event)
+{
+  return get_values(event);
+}
+
+static VALUE
+rb_winevt_subscribe_close_handle(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+  EVT_HANDLE delivered[SUBSCRIBE_ARRAY_SIZE];
+  DWORD deliveredCount = 0;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  /* Only the delivered events are released. The rest of the batch is
+   * kept for the next each call when the rate limit is exceeded. */
+  for (DWORD i = 0; i < winevtSubscribe->position; i++) {
+    if (winevtSubscribe->pushQueue) {
+      free_rendered_event(&winevtSubscribe->pushedEvents[i]);
+    } else if (winevtSubscribe->hEvents[i] != NULL) {
+      delivered[deliveredCount++] = winevtSubscribe->hEvents[i];
+      winevtSubscribe->hEvents[i] = NULL;
+    }
+  }
+  if (deliveredCount > 0) {
+    keep_bookmark_events(winevtSubscribe, delivered, deliveredCount);
+  }
+  if (!has_pending_events(winevtSubscribe)) {
+    winevtSubscribe->count = 0;
+    winevtSubscribe->position = 0;
+  }
+
+  return Qnil;
+}
+
+static int
+sum_string_bytesize_i(VALUE key, VALUE value, VALUE arg)
+{
+  LONG* size = (LONG*)arg;
+
+  if (RB_TYPE_P(value, T_STRING)) {
+    *size += RSTRING_LEN(value);
+  }
+
+  return ST_CONTINUE;
+}
+
+/* Approximate size of the delivered event for the byte rate limit. */
+static LONG
+event_bytesize(VALUE eventlog, VALUE message, VALUE stringInserts)
+{
+  LONG size = 0;
+
+  if (RB_TYPE_P(eventlog, T_STRING)) {
+    size += RSTRING_LEN(eventlog);
+  } else if (RB_TYPE_P(eventlog, T_HASH)) {
+    rb_hash_foreach(eventlog, sum_string_bytesize_i, (VALUE)&size);
+  }
+  size += RSTRING_LEN(message);
+  for (long i = 0; i < RARRAY_LEN(stringInserts); i++) {
+    VALUE insert = RARRAY_AREF(stringInserts, i);
+    if (RB_TYPE_P(insert, T_STRING)) {
+      size += RSTRING_LEN(insert);
+    }
+  }
+
+  return size;
+}
+
+struct SubscribeYieldArgs
+{
+  VALUE self;
+  VALUE channel;
+  DWORD maxEvents;
+  DWORD yielded;
+};
+
+static VALUE
+subscribe_yield_events(VALUE ptr)
+{
+  struct SubscribeYieldArgs* args = (struct SubscribeYieldArgs*)ptr;
+  VALUE self = args->self;
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  /* The rate limit is checked for each event. The events which are
+   * not delivered remain in the batch. */
+  while (args->yielded < args->maxEvents &&
+         has_pending_events(winevtSubscribe) &&
+         !is_rate_limit_exceeded(winevtSubscribe)) {
+    DWORD i = winevtSubscribe->position;
+    VALUE eventlog, message, stringInserts, channel = args->channel;
+
+    if (!winevtSubscribe->pushQueue) {
+      DWORD status = ERROR_SUCCESS;
+      BOOL matched = TRUE;
+      BOOL kept = TRUE;
+      BOOL duplicated = FALSE;
+      if (winevtSubscribe->filter.filter) {
+        status =
+          filter_event(&winevtSubscribe->filter, winevtSubscribe->hEvents[i], &matched);
+      }
+      if (status == ERROR_SUCCESS && matched && winevtSubscribe->sampler.sampler) {
+        status =
+          sample_event(&winevtSubscribe->sampler, winevtSubscribe->hEvents[i], &kept);
+      }
+      if (status == ERROR_SUCCESS && matched && kept && winevtSubscribe->dedup.dedup) {
+        status =
+          dedup_event(&winevtSubscribe->dedup, winevtSubscribe->hEvents[i], &duplicated);
+      }
+      if (status != ERROR_SUCCESS) {
+        raise_system_error(rb_eSubscribeHandlerError, status);
+      }
+      if (!matched || !kept || duplicated) {
+        /* It is released and bookmarked with the delivered events. */
+        winevtSubscribe->position++;
+        if (!matched) {
+          winevtSubscribe->filteredCount++;
+        } else if (!kept) {
+          winevtSubscribe->sampledCount++;
+        }
+        continue;
+      }
+    }
+
+    if (winevtSubscribe->pushQueue) {
+      VALUE values = rendered_event_to_rb_ary(&winevtSubscribe->pushedEvents[i],
+                                              winevtSubscribe->preserveQualifiers,
+                                              winevtSubscribe->preserveSID);
+      eventlog = RARRAY_AREF(values, 0);
+      message = RARRAY_AREF(values, 1);
+      stringInserts = RARRAY_AREF(values, 2);
+      if (winevtSubscribe->yieldPath) {
+        channel = wstr_to_rb_str(CP_UTF8, winevtSubscribe->pushedEvents[i].path, -1);
+      }
+    } else {
+      eventlog = rb_winevt_subscribe_render(self, winevtSubscribe->hEvents[i]);
+      message = rb_winevt_subscribe_message(winevtSubscribe->hEvents[i],
+                                            winevtSubscribe->localeInfo,
+                                            winevtSubscribe->remoteHandle);
+      stringInserts = rb_winevt_subscribe_string_inserts(winevtSubscribe->hEvents[i]);
+      if (winevtSubscribe->yieldPath) {
+        channel = get_event_path(winevtSubscribe->hEvents[i]);
+      }
+    }
+
+    token_bucket_consume(&winevtSubscribe->eventBucket, 1);
+    token_bucket_consume(&winevtSubscribe->byteBucket,
+                         event_bytesize(eventlog, message, stringInserts));
+    winevtSubscribe->position++;
+    args->yielded++;
+
+    if (channel == Qundef) {
+      rb_yield_values(3, eventlog, message, stringInserts);
+    } else {
+      rb_yield_values(4, eventlog, message, stringInserts, channel);
+    }
+  }
+
+  return Qnil;
+}
+
+/*
+ * Read the next batch when the current one is consumed. Returns
+ * Qtrue when there are events to yield.
+ */
+VALUE
+subscribe_next(VALUE self)
+{
+  return rb_winevt_subscribe_next(self);
+}
+
+/*
+ * Yield up to maxEvents events of the current batch and release the
+ * delivered ones. When channel is not Qundef, it is yielded as 4th
+ * value. When it is subscribed with a QueryList, the channel of each
+ * event is yielded instead. Returns the number of yielded events.
+ */
+DWORD
+subscribe_yield_batch(VALUE self, VALUE channel, DWORD maxEvents)
+{
+  struct SubscribeYieldArgs args;
+
+  args.self = self;
+  args.channel = channel;
+  args.maxEvents = maxEvents;
+  args.yielded = 0;
+
+  rb_ensure(
+    subscribe_yield_events, (VALUE)&args, rb_winevt_subscribe_close_handle, self);
+
+  return args.yielded;
+}
+
+/*
+ * Enumerate to obtain Windows EventLog contents.
+ *
+ * This method yields the following:
+ * (Stringified EventLog, Stringified detail message, Stringified
+ * insert values)
+ *
+ * When it is subscribed with a QueryList, the channel of each event
+ * is also yielded as 4th value.
+ *
+ * With max_events: or max_time:, this method stops when either of
+ * them is used up. max_events: is checked for each event and
+ * max_time: is checked at the end of each batch. The events which
+ * are not yielded yet are kept for the next #each.
+ *
+ * @overload each(max_events: nil, max_time: nil)
+ *   @param max_events [Integer, nil] Stop after yielding this number
+ *     of events.
+ *   @param max_time [Numeric, nil] Stop after this number of seconds.
+ * @yield (String,String,String)
+ * @return [Boolean] Whether more events are pending. It is also true
+ *   when the rate limit holds back events.
+ *
+ */
+static VALUE
+rb_winevt_subscribe_each(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_opts;
+  struct WinevtEachBudget budget;
+  struct WinevtSubscribe* winevtSubscribe;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+
+  rb_scan_args(argc, argv, "0:", &rb_opts);
+  each_budget_init(&budget, rb_opts);
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  while (rb_winevt_subscribe_next(self)) {
+    budget.yielded += subscribe_yield_batch(
+      self, Qundef, each_budget_allowance(&budget, SUBSCRIBE_ARRAY_SIZE));
+    if (each_budget_exhausted(&budget)) {
+      break;
+    }
+  }
+
+  return subscribe_has_more_events(winevtSubscribe) ? Qtrue : Qfalse;
+}
+
+/*
+ * This method renders bookmark content which is related to Subscribe class instance.
+ *
+ * @return [String]
+ */
+static VALUE
+rb_winevt_subscribe_get_bookmark(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (winevtSubscribe->pushQueue) {
+    WCHAR* bookmarkXml;
+    DWORD status;
+    VALUE rb_bookmark;
+    EVT_HANDLE hBookmark = winevtSubscribe->bookmark;
+    VALUE rb_start_bookmark = rb_ivar_get(self, id_start_bookmark);
+
+    /* The callback thread also updates the bookmark. */
+    EnterCriticalSection(&winevtSubscribe->pushQueue->lock);
+    if (!winevtSubscribe->pushQueue->bookmarkUpdated && !NIL_P(rb_start_bookmark)) {
+      hBookmark = EventBookMark(rb_start_bookmark)->bookmark;
+    }
+    bookmarkXml = render_to_wstr(hBookmark, EvtRenderBookmark, &status);
+    LeaveCriticalSection(&winevtSubscribe->pushQueue->lock);
+    if (!bookmarkXml) {
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
+    rb_bookmark = wstr_to_rb_str(CP_UTF8, bookmarkXml, -1);
+    free(bookmarkXml);
+
+    return rb_bookmark;
+  }
+
+  /* Delivered events which wait for the checkpoint are reflected. */
+  apply_bookmark_events(winevtSubscribe);
+  if (!winevtSubscribe->bookmarkUpdated &&
+      !NIL_P(rb_ivar_get(self, id_start_bookmark))) {
+    return render_to_rb_str(EventBookMark(rb_ivar_get(self, id_start_bookmark))->bookmark,
+                            EvtRenderBookmark);
+  }
+
+  return render_to_rb_str(winevtSubscribe->bookmark, EvtRenderBookmark);
+}
+
+/*
+ * This method specifies whether using push mode or not.
+ * In push mode, events are rendered on the callback thread of
+ * EvtSubscribe into a bounded queue and #each drains the queue.
+ * This takes effect at the next #subscribe. Rendering options such as
+ * render_as_xml and locale are also fixed at that time.
+ * The bookmark covers the queued events in push mode.
+ *
+ * @since 0.12.0
+ * @param rb_push_mode_p [Boolean]
+ */
+static VALUE
+rb_winevt_subscribe_set_push_mode(VALUE self, VALUE rb_push_mode_p)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  winevtSubscribe->pushMode = RTEST(rb_push_mode_p);
+
+  return Qnil;
+}
+
+/*
+ * This method returns whether using push mode or not.
+ *
+ * @since 0.12.0
+ * @return [Boolean]
+ */
+static VALUE
+rb_winevt_subscribe_push_mode_p(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  return winevtSubscribe->pushMode ? Qtrue : Qfalse;
+}
+
+/*
+ * This method specifies the maximum number of queued events in push
+ * mode. The callback thread waits while the queue is full.
+ *
+ * @since 0.12.0
+ * @param rb_push_queue_size [Integer]
+ */
+static VALUE
+rb_winevt_subscribe_set_push_queue_size(VALUE self, VALUE rb_push_queue_size)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+  long pushQueueSize;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  pushQueueSize = NUM2LONG(rb_push_queue_size);
+  if (pushQueueSize < SUBSCRIBE_ARRAY_SIZE) {
+    rb_raise(rb_eArgError, "Specify %d or more", SUBSCRIBE_ARRAY_SIZE);
+  }
+  winevtSubscribe->pushQueueSize = pushQueueSize;
+
+  return Qnil;
+}
+
+/*
+ * This method returns the maximum number of queued events in push mode.
+ *
+ * @since 0.12.0
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_subscribe_get_push_queue_size(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  return ULONG2NUM(winevtSubscribe->pushQueueSize);
+}
+
+/*
+ * This method returns rate limit value.
+ *
+ * @since 0.6.0
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_subscribe_get_rate_limit(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  return LONG2NUM(winevtSubscribe->eventBucket.rate);
+}
+
+static LONG
+rate_limit_value(VALUE rb_rate)
+{
+  LONG rate = NUM2LONG(rb_rate);
+
+  if (rate != SUBSCRIBE_RATE_INFINITE && rate < 1) {
+    rb_raise(rb_eArgError, "Specify a positive integer or RATE_INFINITE constant");
+  }
+
+  return rate;
+}
+
+static LONG
+rate_limit_burst_value(VALUE rb_burst)
+{
+  LONG burst;
+
+  if (NIL_P(rb_burst)) {
+    return 0;
+  }
+
+  burst = NUM2LONG(rb_burst);
+  if (burst < 1) {
+    rb_raise(rb_eArgError, "Specify a positive integer or nil");
+  }
+
+  return burst;
+}
+
+/*
+ * This method specifies rate limit value. It is the number of events
+ * per second delivered by each. The events which exceed the rate
+ * limit are held back until tokens are refilled.
+ *
+ * @since 0.6.0
+ * @param rb_rate_limit [Integer] rate_limit value
+ */
+static VALUE
+rb_winevt_subscribe_set_rate_limit(VALUE self, VALUE rb_rate_limit)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+  LONG rateLimit;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  rateLimit = rate_limit_value(rb_rate_limit);
+  token_bucket_init(&winevtSubscribe->eventBucket,
+                    rateLimit, winevtSubscribe->eventBucket.burst);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the burst size of the rate limit.
+ *
+ * @since 0.12.0
+ * @return [Integer] nil means the same as rate_limit.
+ */
+static VALUE
+rb_winevt_subscribe_get_rate_limit_burst(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (winevtSubscribe->eventBucket.burst == 0) {
+    return Qnil;
+  }
+
+  return LONG2NUM(winevtSubscribe->eventBucket.burst);
+}
+
+/*
+ * This method specifies the number of events which can be delivered
+ * at once after being idle.
+ *
+ * @since 0.12.0
+ * @param rb_burst [Integer] nil means the same as rate_limit.
+ */
+static VALUE
+rb_winevt_subscribe_set_rate_limit_burst(VALUE self, VALUE rb_burst)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  token_bucket_init(&winevtSubscribe->eventBucket,
+                    winevtSubscribe->eventBucket.rate,
+                    rate_limit_burst_value(rb_burst));
+
+  return Qnil;
+}
+
+/*
+ * This method returns byte rate limit value.
+ *
+ * @since 0.12.0
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_subscribe_get_byte_rate_limit(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  return LONG2NUM(winevtSubscribe->byteBucket.rate);
+}
+
+/*
+ * This method specifies byte rate limit value. It is the number of
+ * bytes of the yielded strings per second.
+ *
+ * @since 0.12.0
+ * @param rb_rate_limit [Integer] byte_rate_limit value
+ */
+static VALUE
+rb_winevt_subscribe_set_byte_rate_limit(VALUE self, VALUE rb_rate_limit)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+  LONG rateLimit;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  rateLimit = rate_limit_value(rb_rate_limit);
+  token_bucket_init(&winevtSubscribe->byteBucket,
+                    rateLimit, winevtSubscribe->byteBucket.burst);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the burst size of the byte rate limit.
+ *
+ * @since 0.12.0
+ * @return [Integer] nil means the same as byte_rate_limit.
+ */
+static VALUE
+rb_winevt_subscribe_get_byte_rate_limit_burst(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-    return Qtrue;
+  if (winevtSubscribe->byteBucket.burst == 0) {
+    return Qnil;
   }
 
-  return Qfalse;
+  return LONG2NUM(winevtSubscribe->byteBucket.burst);
 }
 
+/*
+ * This method specifies the number of bytes which can be delivered
+ * at once after being idle.
+ *
+ * @since 0.12.0
+ * @param rb_burst [Integer] nil means the same as byte_rate_limit.
+ */
 static VALUE
-rb_winevt_subscribe_render(VALUE self, EVT_HANDLE event)
+rb_winevt_subscribe_set_byte_rate_limit_burst(VALUE self, VALUE rb_burst)
 {
   struct WinevtSubscribe* winevtSubscribe;
 
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  if (winevtSubscribe->renderAsXML) {
-    return render_to_rb_str(event, EvtRenderEventXml);
-  } else {
-    return render_system_event(event, winevtSubscribe->preserveQualifiers,
-                               winevtSubscribe->preserveSID);
-  }
+  token_bucket_init(&winevtSubscribe->byteBucket,
+                    winevtSubscribe->byteBucket.rate,
+                    rate_limit_burst_value(rb_burst));
+
+  return Qnil;
 }
 
+/*
+ * This method returns the total time in seconds which has been
+ * throttled by the rate limits.
+ *
+ * @since 0.12.0
+ * @return [Float]
+ */
 static VALUE
-rb_winevt_subscribe_message(EVT_HANDLE event, LocaleInfo* localeInfo, EVT_HANDLE hRemote)
+rb_winevt_subscribe_get_throttled_time(VALUE self)
 {
-  WCHAR* wResult;
-  VALUE utf8str;
+  struct WinevtSubscribe* winevtSubscribe;
+  LONGLONG ticks;
 
-  wResult = get_description(event, localeInfo->langID, hRemote);
-  utf8str = wstr_to_rb_str(CP_UTF8, wResult, -1);
-  free(wResult);
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  return utf8str;
+  ticks = winevtSubscribe->throttledTicks;
+  if (winevtSubscribe->throttleStart != 0) {
+    ticks += monotonic_ticks() - winevtSubscribe->throttleStart;
+  }
+
+  return DBL2NUM((double)ticks / monotonic_ticks_per_second());
 }
 
+/*
+ * This method returns how many times the rate limits have started
+ * throttling.
+ *
+ * @since 0.12.0
+ * @return [Integer]
+ */
 static VALUE
-rb_winevt_subscribe_string_inserts(EVT_HANDLE event)
+rb_winevt_subscribe_get_throttled_count(VALUE self)
 {
-  return get_values(event);
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  return ULL2NUM(winevtSubscribe->throttledCount);
 }
 
+/*
+ * This method specifies the filter which is evaluated before
+ * rendering each event. The events which do not match it are skipped
+ * without creating Ruby objects, and the bookmark still covers them.
+ * nil removes the filter. In push mode, this takes effect at the next
+ * #subscribe and the filter is evaluated on the callback thread.
+ *
+ * @since 0.12.0
+ * @param rb_filter [Filter, nil]
+ */
 static VALUE
-rb_winevt_subscribe_close_handle(VALUE self)
+rb_winevt_subscribe_set_filter(VALUE self, VALUE rb_filter)
 {
   struct WinevtSubscribe* winevtSubscribe;
+  struct WinevtFilterContext filterContext;
 
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  for (int i = 0; i < winevtSubscribe->count; i++) {
-    if (winevtSubscribe->hEvents[i] != NULL) {
-      EvtClose(winevtSubscribe->hEvents[i]);
-      winevtSubscribe->hEvents[i] = NULL;
+  ZeroMemory(&filterContext, sizeof(filterContext));
+  if (!NIL_P(rb_filter)) {
+    DWORD status;
+    if (!rb_obj_is_kind_of(rb_filter, rb_cFilter)) {
+      rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Filter)",
+               rb_obj_class(rb_filter));
+    }
+    status = filter_context_init(&filterContext, winevt_get_filter(rb_filter));
+    if (status != ERROR_SUCCESS) {
+      raise_system_error(rb_eWinevtQueryError, status);
     }
   }
+  filter_context_free(&winevtSubscribe->filter);
+  winevtSubscribe->filter = filterContext;
+  rb_ivar_set(self, id_filter, rb_filter);
 
   return Qnil;
 }
 
+/*
+ * This method returns the filter.
+ *
+ * @since 0.12.0
+ * @return [Filter, nil]
+ */
+static VALUE
+rb_winevt_subscribe_get_filter(VALUE self)
+{
+  return rb_ivar_get(self, id_filter);
+}
+
+/*
+ * This method returns the number of events which are skipped by the
+ * filter.
+ *
+ * @since 0.12.0
+ * @return [Integer]
+ */
 static VALUE
-rb_winevt_subscribe_each_yield(VALUE self)
+rb_winevt_subscribe_get_filtered_count(VALUE self)
 {
-  RETURN_ENUMERATOR(self, 0, 0);
   struct WinevtSubscribe* winevtSubscribe;
+  ULONGLONG count;
 
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  for (int i = 0; i < winevtSubscribe->count; i++) {
-    rb_yield_values(3,
-                    rb_winevt_subscribe_render(self, winevtSubscribe->hEvents[i]),
-                    rb_winevt_subscribe_message(winevtSubscribe->hEvents[i], winevtSubscribe->localeInfo,
-                                                winevtSubscribe->remoteHandle),
-                    rb_winevt_subscribe_string_inserts(winevtSubscribe->hEvents[i]));
+  count = winevtSubscribe->filteredCount;
+  if (winevtSubscribe->pushQueue) {
+    EnterCriticalSection(&winevtSubscribe->pushQueue->lock);
+    count += winevtSubscribe->pushQueue->filteredCount;
+    LeaveCriticalSection(&winevtSubscribe->pushQueue->lock);
   }
 
-  return Qnil;
+  return ULL2NUM(count);
 }
 
 /*
- * Enumerate to obtain Windows EventLog contents.
- *
- * This method yields the following:
- * (Stringified EventLog, Stringified detail message, Stringified
- * insert values)
- *
- * @yield (String,String,String)
+ * This method specifies the deduplicator which drops the events
+ * delivered already before rendering them. The bookmark still covers
+ * the dropped events. The same deduplicator can be shared by
+ * subscriptions and kept across resubscribing. nil removes it. In
+ * push mode, this takes effect at the next #subscribe.
  *
+ * @since 0.12.0
+ * @param rb_deduplicator [Deduplicator, nil]
+ * @see Deduplicator#duplicates
  */
 static VALUE
-rb_winevt_subscribe_each(VALUE self)
+rb_winevt_subscribe_set_deduplicator(VALUE self, VALUE rb_deduplicator)
 {
-  RETURN_ENUMERATOR(self, 0, 0);
+  struct WinevtSubscribe* winevtSubscribe;
+  struct WinevtDedupContext dedupContext;
 
-  while (rb_winevt_subscribe_next(self)) {
-    rb_ensure(
-      rb_winevt_subscribe_each_yield, self, rb_winevt_subscribe_close_handle, self);
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  ZeroMemory(&dedupContext, sizeof(dedupContext));
+  if (!NIL_P(rb_deduplicator)) {
+    DWORD status;
+    if (!rb_obj_is_kind_of(rb_deduplicator, rb_cDeduplicator)) {
+      rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Deduplicator)",
+               rb_obj_class(rb_deduplicator));
+    }
+    status = dedup_context_init(&dedupContext, winevt_get_dedup(rb_deduplicator));
+    if (status != ERROR_SUCCESS) {
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
   }
+  dedup_context_free(&winevtSubscribe->dedup);
+  winevtSubscribe->dedup = dedupContext;
+  rb_ivar_set(self, id_deduplicator, rb_deduplicator);
 
   return Qnil;
 }
 
 /*
- * This method renders bookmark content which is related to Subscribe class instance.
+ * This method returns the deduplicator.
  *
- * @return [String]
+ * @since 0.12.0
+ * @return [Deduplicator, nil]
  */
 static VALUE
-rb_winevt_subscribe_get_bookmark(VALUE self)
+rb_winevt_subscribe_get_deduplicator(VALUE self)
 {
-  struct WinevtSubscribe* winevtSubscribe;
-
-  TypedData_Get_Struct(
-    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
-
-  return render_to_rb_str(winevtSubscribe->bookmark, EvtRenderBookmark);
+  return rb_ivar_get(self, id_deduplicator);
 }
 
 /*
- * This method returns rate limit value.
+ * This method specifies the sampler which is applied after the
+ * filter. The events which are sampled out are not rendered but the
+ * bookmark still covers them. nil removes the sampler. In push mode,
+ * this takes effect at the next #subscribe.
  *
- * @since 0.6.0
- * @return [Integer]
+ * @since 0.12.0
+ * @param rb_sampler [Sampler, nil]
+ * @see Sampler#sampled_count
  */
 static VALUE
-rb_winevt_subscribe_get_rate_limit(VALUE self)
+rb_winevt_subscribe_set_sampler(VALUE self, VALUE rb_sampler)
 {
   struct WinevtSubscribe* winevtSubscribe;
+  struct WinevtSamplerContext samplerContext;
 
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  return INT2NUM(winevtSubscribe->rateLimit);
+  ZeroMemory(&samplerContext, sizeof(samplerContext));
+  if (!NIL_P(rb_sampler)) {
+    DWORD status;
+    if (!rb_obj_is_kind_of(rb_sampler, rb_cSampler)) {
+      rb_raise(rb_eTypeError, "wrong argument type %" PRIsVALUE " (expected Sampler)",
+               rb_obj_class(rb_sampler));
+    }
+    status = sampler_context_init(&samplerContext, winevt_get_sampler(rb_sampler));
+    if (status != ERROR_SUCCESS) {
+      raise_system_error(rb_eWinevtQueryError, status);
+    }
+  }
+  sampler_context_free(&winevtSubscribe->sampler);
+  winevtSubscribe->sampler = samplerContext;
+  rb_ivar_set(self, id_sampler, rb_sampler);
+
+  return Qnil;
 }
 
 /*
- * This method specifies rate limit value.
+ * This method returns the sampler.
  *
- * @since 0.6.0
- * @param rb_rate_limit [Integer] rate_limit value
+ * @since 0.12.0
+ * @return [Sampler, nil]
  */
 static VALUE
-rb_winevt_subscribe_set_rate_limit(VALUE self, VALUE rb_rate_limit)
+rb_winevt_subscribe_get_sampler(VALUE self)
+{
+  return rb_ivar_get(self, id_sampler);
+}
+
+/*
+ * This method returns the number of events which are sampled out in
+ * this subscription.
+ *
+ * @since 0.12.0
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_subscribe_get_sampled_count(VALUE self)
 {
   struct WinevtSubscribe* winevtSubscribe;
-  DWORD rateLimit;
+  ULONGLONG count;
 
   TypedData_Get_Struct(
     self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
 
-  rateLimit = NUM2LONG(rb_rate_limit);
-
-  if ((rateLimit != SUBSCRIBE_RATE_INFINITE) && (rateLimit < 10 || rateLimit % 10)) {
-    rb_raise(rb_eArgError, "Specify a multiples of 10 or RATE_INFINITE constant");
-  } else {
-    winevtSubscribe->rateLimit = rateLimit;
+  count = winevtSubscribe->sampledCount;
+  if (winevtSubscribe->pushQueue) {
+    EnterCriticalSection(&winevtSubscribe->pushQueue->lock);
+    count += winevtSubscribe->pushQueue->sampledCount;
+    LeaveCriticalSection(&winevtSubscribe->pushQueue->lock);
   }
 
-  return Qnil;
+  return ULL2NUM(count);
 }
 
 /*
@@ -759,6 +2208,139 @@ rb_winevt_subscribe_close(VALUE self)
 }
 
 
+/*
+ * This method returns the checkpoint interval in seconds.
+ *
+ * @since 0.12.0
+ * @return [Float] nil means no time based checkpoint.
+ */
+static VALUE
+rb_winevt_subscribe_get_checkpoint_interval(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (winevtSubscribe->checkpointInterval == 0) {
+    return Qnil;
+  }
+
+  return DBL2NUM(winevtSubscribe->checkpointInterval / 1000.0);
+}
+
+/*
+ * This method specifies how often the bookmark is updated with the
+ * delivered events. By default, it is updated once per batch.
+ * #bookmark always reflects all delivered events.
+ *
+ * @since 0.12.0
+ * @param rb_interval [Numeric] Seconds. nil means no time based checkpoint.
+ */
+static VALUE
+rb_winevt_subscribe_set_checkpoint_interval(VALUE self, VALUE rb_interval)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+  double interval = 0;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (!NIL_P(rb_interval)) {
+    interval = NUM2DBL(rb_interval);
+    if (interval * 1000 < 1) {
+      rb_raise(rb_eArgError, "checkpoint interval must be positive or nil");
+    }
+  }
+  winevtSubscribe->checkpointInterval = (DWORD)(interval * 1000);
+
+  return Qnil;
+}
+
+/*
+ * This method returns the number of events between checkpoints.
+ *
+ * @since 0.12.0
+ * @return [Integer] nil means no count based checkpoint.
+ */
+static VALUE
+rb_winevt_subscribe_get_checkpoint_count(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (winevtSubscribe->checkpointCount == 0) {
+    return Qnil;
+  }
+
+  return ULONG2NUM(winevtSubscribe->checkpointCount);
+}
+
+/*
+ * This method specifies the number of delivered events after which
+ * the bookmark is updated.
+ *
+ * @since 0.12.0
+ * @param rb_count [Integer] nil means no count based checkpoint.
+ */
+static VALUE
+rb_winevt_subscribe_set_checkpoint_count(VALUE self, VALUE rb_count)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+  long count = 0;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  if (!NIL_P(rb_count)) {
+    count = NUM2LONG(rb_count);
+    if (count < 1) {
+      rb_raise(rb_eArgError, "checkpoint count must be positive or nil");
+    }
+  }
+  winevtSubscribe->checkpointCount = (DWORD)count;
+
+  return Qnil;
+}
+
+/*
+ * This method returns the last EventRecordID of each channel which is
+ * delivered so far. It starts from the bookmark at the first call and
+ * is kept up to date with every delivered batch without waiting for
+ * the checkpoint of the bookmark. In push mode, it is built from the
+ * bookmark at every call.
+ *
+ * @since 0.12.0
+ * @return [Checkpoint]
+ */
+static VALUE
+rb_winevt_subscribe_get_checkpoint(VALUE self)
+{
+  struct WinevtSubscribe* winevtSubscribe;
+  VALUE rb_checkpoint;
+
+  TypedData_Get_Struct(
+    self, struct WinevtSubscribe, &rb_winevt_subscribe_type, winevtSubscribe);
+
+  rb_checkpoint = rb_ivar_get(self, id_checkpoint);
+  if (!NIL_P(rb_checkpoint)) {
+    return rb_checkpoint;
+  }
+
+  rb_checkpoint = rb_funcall(rb_cCheckpoint,
+                             rb_intern("from_bookmark_xml"),
+                             1,
+                             rb_winevt_subscribe_get_bookmark(self));
+  if (winevtSubscribe->subscription && !winevtSubscribe->pushQueue) {
+    winevtSubscribe->checkpoint = winevt_checkpoint_of(rb_checkpoint);
+    rb_ivar_set(self, id_checkpoint, rb_checkpoint);
+  }
+
+  return rb_checkpoint;
+}
+
 void
 Init_winevt_subscribe(VALUE rb_cEventLog)
 {
@@ -766,6 +2348,16 @@ Init_winevt_subscribe(VALUE rb_cEventLog)
 
   rb_define_alloc_func(rb_cSubscribe, rb_winevt_subscribe_alloc);
 
+  id_channel = rb_intern("@channel");
+  id_start_bookmark = rb_intern("@start_bookmark");
+  id_checkpoint = rb_intern("@checkpoint");
+  id_filter = rb_intern("@filter");
+  id_push_filter = rb_intern("@push_filter");
+  id_deduplicator = rb_intern("@deduplicator");
+  id_push_deduplicator = rb_intern("@push_deduplicator");
+  id_sampler = rb_intern("@sampler");
+  id_push_sampler = rb_intern("@push_sampler");
+
   /*
    * For Subscribe#rate_limit=. It represents unspecified rate limit.
    * @since 0.6.0
@@ -775,8 +2367,22 @@ Init_winevt_subscribe(VALUE rb_cEventLog)
   rb_define_method(rb_cSubscribe, "initialize", rb_winevt_subscribe_initialize, 0);
   rb_define_method(rb_cSubscribe, "subscribe", rb_winevt_subscribe_subscribe, -1);
   rb_define_method(rb_cSubscribe, "next", rb_winevt_subscribe_next, 0);
-  rb_define_method(rb_cSubscribe, "each", rb_winevt_subscribe_each, 0);
+  rb_define_method(rb_cSubscribe, "each", rb_winevt_subscribe_each, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "wait", rb_winevt_subscribe_wait, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_singleton_method(rb_cSubscribe, "wait_any", rb_winevt_subscribe_s_wait_any, -1);
   rb_define_method(rb_cSubscribe, "bookmark", rb_winevt_subscribe_get_bookmark, 0);
+  /*
+   * The channel path which is passed to #subscribe. It is nil when
+   * a QueryList is passed.
+   * @since 0.12.0
+   */
+  rb_define_attr(rb_cSubscribe, "channel", 1, 0);
   /*
    * @since 0.7.0
    */
@@ -787,6 +2393,70 @@ Init_winevt_subscribe(VALUE rb_cEventLog)
   rb_define_method(rb_cSubscribe, "read_existing_events=", rb_winevt_subscribe_set_read_existing_events, 1);
   rb_define_method(rb_cSubscribe, "rate_limit", rb_winevt_subscribe_get_rate_limit, 0);
   rb_define_method(rb_cSubscribe, "rate_limit=", rb_winevt_subscribe_set_rate_limit, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "rate_limit_burst", rb_winevt_subscribe_get_rate_limit_burst, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "rate_limit_burst=", rb_winevt_subscribe_set_rate_limit_burst, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "byte_rate_limit", rb_winevt_subscribe_get_byte_rate_limit, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "byte_rate_limit=", rb_winevt_subscribe_set_byte_rate_limit, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "byte_rate_limit_burst", rb_winevt_subscribe_get_byte_rate_limit_burst, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "byte_rate_limit_burst=", rb_winevt_subscribe_set_byte_rate_limit_burst, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "throttled_time", rb_winevt_subscribe_get_throttled_time, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "throttled_count", rb_winevt_subscribe_get_throttled_count, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "filter", rb_winevt_subscribe_get_filter, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "filter=", rb_winevt_subscribe_set_filter, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "filtered_count", rb_winevt_subscribe_get_filtered_count, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "deduplicator", rb_winevt_subscribe_get_deduplicator, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "deduplicator=", rb_winevt_subscribe_set_deduplicator, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "sampler", rb_winevt_subscribe_get_sampler, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "sampler=", rb_winevt_subscribe_set_sampler, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "sampled_count", rb_winevt_subscribe_get_sampled_count, 0);
   rb_define_method(
     rb_cSubscribe, "render_as_xml?", rb_winevt_subscribe_render_as_xml_p, 0);
   rb_define_method(
@@ -819,6 +2489,48 @@ Init_winevt_subscribe(VALUE rb_cEventLog)
    * @since 0.11.0
    */
   rb_define_method(rb_cSubscribe, "preserve_sid=", rb_winevt_subscribe_set_preserve_sid, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "push_mode?", rb_winevt_subscribe_push_mode_p, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "push_mode=", rb_winevt_subscribe_set_push_mode, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cSubscribe, "push_queue_size", rb_winevt_subscribe_get_push_queue_size, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cSubscribe, "push_queue_size=", rb_winevt_subscribe_set_push_queue_size, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cSubscribe, "checkpoint_interval", rb_winevt_subscribe_get_checkpoint_interval, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cSubscribe, "checkpoint_interval=", rb_winevt_subscribe_set_checkpoint_interval, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cSubscribe, "checkpoint_count", rb_winevt_subscribe_get_checkpoint_count, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(
+    rb_cSubscribe, "checkpoint_count=", rb_winevt_subscribe_set_checkpoint_count, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribe, "checkpoint", rb_winevt_subscribe_get_checkpoint, 0);
   /*
    * @since 0.9.1
    */
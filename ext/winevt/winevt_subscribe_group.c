@@ -0,0 +1,298 @@
+#include <winevt_c.h>
+
+/* clang-format off */
+/*
+ * Document-class: Winevt::EventLog::SubscribeGroup
+ *
+ * Read many subscriptions with one wait loop.
+ *
+ * @example
+ *  require 'winevt'
+ *
+ *  @group = Winevt::EventLog::SubscribeGroup.new
+ *  # Read System first and twice as much as the others in each round.
+ *  [["Application", 1, 0], ["Security", 1, 0], ["System", 2, 1]].each do |channel, weight, priority|
+ *    subscribe = Winevt::EventLog::Subscribe.new
+ *    subscribe.subscribe(channel, "*")
+ *    @group.add(subscribe, weight, priority)
+ *  end
+ *  while true do
+ *    @group.wait(1.0)
+ *    # Each call reads one round of the subscriptions.
+ *    @group.each do |eventlog, message, string_inserts, channel|
+ *      puts ({channel: channel, eventlog: eventlog, data: message})
+ *    end
+ *  end
+ * @since 0.12.0
+ */
+/* clang-format on */
+
+VALUE rb_cSubscribeGroup;
+
+static ID id_subscriptions;
+static ID id_channel;
+
+static void subscribe_group_free(void* ptr);
+
+static const rb_data_type_t rb_winevt_subscribe_group_type = { "winevt/subscribe_group",
+                                                               {
+                                                                 0,
+                                                                 subscribe_group_free,
+                                                                 0,
+                                                               },
+                                                               NULL,
+                                                               NULL,
+                                                               RUBY_TYPED_FREE_IMMEDIATELY };
+
+static void
+subscribe_group_free(void* ptr)
+{
+  struct WinevtSubscribeGroup* winevtSubscribeGroup = (struct WinevtSubscribeGroup*)ptr;
+
+  winevt_scheduler_destroy(&winevtSubscribeGroup->scheduler);
+
+  xfree(ptr);
+}
+
+static VALUE
+rb_winevt_subscribe_group_alloc(VALUE klass)
+{
+  VALUE obj;
+  struct WinevtSubscribeGroup* winevtSubscribeGroup;
+  obj = TypedData_Make_Struct(klass,
+                              struct WinevtSubscribeGroup,
+                              &rb_winevt_subscribe_group_type,
+                              winevtSubscribeGroup);
+  winevt_scheduler_init(&winevtSubscribeGroup->scheduler, SCHEDULER_DEFAULT_QUANTUM);
+  return obj;
+}
+
+static VALUE
+subscriptions_of(VALUE self)
+{
+  return rb_ivar_get(self, id_subscriptions);
+}
+
+static struct WinevtSubscribeGroup*
+get_subscribe_group(VALUE self)
+{
+  struct WinevtSubscribeGroup* winevtSubscribeGroup;
+
+  TypedData_Get_Struct(self,
+                       struct WinevtSubscribeGroup,
+                       &rb_winevt_subscribe_group_type,
+                       winevtSubscribeGroup);
+
+  return winevtSubscribeGroup;
+}
+
+/*
+ * Initalize SubscribeGroup class.
+ *
+ * @overload initialize(quantum=10)
+ *   @param quantum [Integer] Events which weight 1 earns in a round.
+ * @return [SubscribeGroup]
+ *
+ */
+static VALUE
+rb_winevt_subscribe_group_initialize(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_quantum;
+  long quantum = SCHEDULER_DEFAULT_QUANTUM;
+
+  rb_scan_args(argc, argv, "01", &rb_quantum);
+  if (!NIL_P(rb_quantum)) {
+    quantum = NUM2LONG(rb_quantum);
+    if (quantum < 1) {
+      rb_raise(rb_eArgError, "Specify a positive integer");
+    }
+  }
+
+  get_subscribe_group(self)->scheduler.quantum = (unsigned long)quantum;
+  rb_ivar_set(self, id_subscriptions, rb_ary_new());
+
+  return Qnil;
+}
+
+/*
+ * Add a subscription to this group.
+ *
+ * @overload add(subscribe, weight=1, priority=0)
+ *   @param subscribe [Subscribe]
+ *   @param weight [Integer] Multiplier of the events read in a round.
+ *   @param priority [Integer] Subscriptions with higher priority are
+ *     read earlier in each round.
+ * @return [SubscribeGroup] self
+ */
+static VALUE
+rb_winevt_subscribe_group_add(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_subscribe, rb_weight, rb_priority;
+  long weight = 1;
+  int priority = 0;
+
+  rb_scan_args(argc, argv, "12", &rb_subscribe, &rb_weight, &rb_priority);
+  if (!rb_obj_is_kind_of(rb_subscribe, rb_cSubscribe)) {
+    rb_raise(rb_eArgError, "Expected a Subscribe instance");
+  }
+  if (!NIL_P(rb_weight)) {
+    weight = NUM2LONG(rb_weight);
+    if (weight < 1) {
+      rb_raise(rb_eArgError, "Specify a positive integer as weight");
+    }
+  }
+  if (!NIL_P(rb_priority)) {
+    priority = NUM2INT(rb_priority);
+  }
+
+  if (winevt_scheduler_add(&get_subscribe_group(self)->scheduler,
+                           (unsigned long)weight, priority) < 0) {
+    rb_memerror();
+  }
+  rb_ary_push(subscriptions_of(self), rb_subscribe);
+
+  return self;
+}
+
+static VALUE
+rb_winevt_subscribe_group_push(VALUE self, VALUE rb_subscribe)
+{
+  return rb_winevt_subscribe_group_add(1, &rb_subscribe, self);
+}
+
+/*
+ * This method returns the subscriptions in this group.
+ *
+ * @return [Array<Subscribe>]
+ */
+static VALUE
+rb_winevt_subscribe_group_subscriptions(VALUE self)
+{
+  return rb_ary_dup(subscriptions_of(self));
+}
+
+/*
+ * This method returns the number of subscriptions in this group.
+ *
+ * @return [Integer]
+ */
+static VALUE
+rb_winevt_subscribe_group_size(VALUE self)
+{
+  return LONG2NUM(RARRAY_LEN(subscriptions_of(self)));
+}
+
+/*
+ * Wait until one or more subscriptions have available events. All
+ * signal events are waited for together, in chunks of
+ * MAXIMUM_WAIT_OBJECTS handles. The GVL is released while waiting.
+ *
+ * @overload wait(timeout=nil)
+ *   @param timeout [Numeric] Seconds to wait. nil means waiting forever.
+ * @return [Array<Subscribe>] Ready subscriptions. Empty on timeout.
+ */
+static VALUE
+rb_winevt_subscribe_group_wait(int argc, VALUE* argv, VALUE self)
+{
+  VALUE rb_timeout;
+
+  rb_scan_args(argc, argv, "01", &rb_timeout);
+
+  return subscribe_wait_ready(subscriptions_of(self), rb_timeout);
+}
+
+/*
+ * Enumerate events of the subscriptions for one round.
+ *
+ * Subscriptions are read by deficit round-robin over their batches.
+ * In each round, a subscription may deliver quantum * weight events
+ * plus what it has not used in the previous rounds, so a busy channel
+ * cannot starve the others. One call reads one round, so it returns
+ * even while the channels are flooded. The deficits are kept between
+ * the calls.
+ *
+ * This method yields the following:
+ * (Stringified EventLog, Stringified detail message, Stringified
+ * insert values, Channel path)
+ *
+ * @yield (String,String,String,String)
+ * @return [Boolean] true when a subscription used up its share and
+ *   may have more events. Call #each again, #wait also returns at once.
+ */
+static VALUE
+rb_winevt_subscribe_group_each(VALUE self)
+{
+  VALUE rb_subscriptions, rb_subscribe;
+  struct WinevtScheduler* scheduler;
+  unsigned long allowance, consumed;
+  BOOL backlogged, pending = FALSE;
+  long index;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  scheduler = &get_subscribe_group(self)->scheduler;
+  rb_subscriptions = rb_ary_dup(subscriptions_of(self));
+
+  winevt_scheduler_start_round(scheduler);
+  while ((index = winevt_scheduler_next(scheduler, &allowance)) >= 0) {
+    rb_subscribe = RARRAY_AREF(rb_subscriptions, index);
+    consumed = 0;
+    backlogged = TRUE;
+    while (consumed < allowance) {
+      if (!subscribe_next(rb_subscribe)) {
+        backlogged = FALSE;
+        break;
+      }
+      consumed += subscribe_yield_batch(
+        rb_subscribe, rb_ivar_get(rb_subscribe, id_channel), allowance - consumed);
+    }
+    winevt_scheduler_consumed(scheduler, index, consumed, backlogged);
+    if (backlogged) {
+      pending = TRUE;
+    }
+  }
+
+  RB_GC_GUARD(rb_subscriptions);
+
+  return pending ? Qtrue : Qfalse;
+}
+
+void
+Init_winevt_subscribe_group(VALUE rb_cEventLog)
+{
+  rb_cSubscribeGroup = rb_define_class_under(rb_cEventLog, "SubscribeGroup", rb_cObject);
+
+  rb_define_alloc_func(rb_cSubscribeGroup, rb_winevt_subscribe_group_alloc);
+
+  id_subscriptions = rb_intern("@subscriptions");
+  id_channel = rb_intern("@channel");
+
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribeGroup, "initialize", rb_winevt_subscribe_group_initialize, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribeGroup, "add", rb_winevt_subscribe_group_add, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribeGroup, "<<", rb_winevt_subscribe_group_push, 1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribeGroup, "subscriptions", rb_winevt_subscribe_group_subscriptions, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribeGroup, "size", rb_winevt_subscribe_group_size, 0);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribeGroup, "wait", rb_winevt_subscribe_group_wait, -1);
+  /*
+   * @since 0.12.0
+   */
+  rb_define_method(rb_cSubscribeGroup, "each", rb_winevt_subscribe_group_each, 0);
+}
@@ -0,0 +1,198 @@
+#include <winevt_c.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <time.h>
+#endif
+
+#ifdef _WIN32
+struct ThreadStart
+{
+  void* (*func)(void*);
+  void* arg;
+};
+
+static DWORD WINAPI
+thread_start(LPVOID ptr)
+{
+  struct ThreadStart start = *(struct ThreadStart*)ptr;
+
+  free(ptr);
+  start.func(start.arg);
+
+  return 0;
+}
+
+/* Returns 0 or the error code. */
+int
+winevt_thread_create(winevt_thread_t* thread, void* (*func)(void*), void* arg)
+{
+  struct ThreadStart* start = malloc(sizeof(struct ThreadStart));
+
+  if (!start) {
+    return ERROR_NOT_ENOUGH_MEMORY;
+  }
+  start->func = func;
+  start->arg = arg;
+  *thread = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+  if (!*thread) {
+    free(start);
+    return GetLastError();
+  }
+
+  return 0;
+}
+
+void
+winevt_thread_join(winevt_thread_t thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+void
+winevt_mutex_init(winevt_mutex_t* mutex)
+{
+  InitializeCriticalSection(mutex);
+}
+
+void
+winevt_mutex_destroy(winevt_mutex_t* mutex)
+{
+  DeleteCriticalSection(mutex);
+}
+
+void
+winevt_mutex_lock(winevt_mutex_t* mutex)
+{
+  EnterCriticalSection(mutex);
+}
+
+void
+winevt_mutex_unlock(winevt_mutex_t* mutex)
+{
+  LeaveCriticalSection(mutex);
+}
+
+void
+winevt_cond_init(winevt_cond_t* cond)
+{
+  InitializeConditionVariable(cond);
+}
+
+void
+winevt_cond_destroy(winevt_cond_t* cond)
+{
+  /* Condition variables do not need to be deleted on Windows. */
+}
+
+void
+winevt_cond_wait(winevt_cond_t* cond, winevt_mutex_t* mutex)
+{
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void
+winevt_cond_timedwait(winevt_cond_t* cond, winevt_mutex_t* mutex, unsigned long msec)
+{
+  SleepConditionVariableCS(cond, mutex, msec);
+}
+
+void
+winevt_cond_broadcast(winevt_cond_t* cond)
+{
+  WakeAllConditionVariable(cond);
+}
+
+uint64_t
+winevt_monotonic_msec(void)
+{
+  return GetTickCount64();
+}
+#else
+/* Returns 0 or errno. */
+int
+winevt_thread_create(winevt_thread_t* thread, void* (*func)(void*), void* arg)
+{
+  return pthread_create(thread, NULL, func, arg);
+}
+
+void
+winevt_thread_join(winevt_thread_t thread)
+{
+  pthread_join(thread, NULL);
+}
+
+void
+winevt_mutex_init(winevt_mutex_t* mutex)
+{
+  pthread_mutex_init(mutex, NULL);
+}
+
+void
+winevt_mutex_destroy(winevt_mutex_t* mutex)
+{
+  pthread_mutex_destroy(mutex);
+}
+
+void
+winevt_mutex_lock(winevt_mutex_t* mutex)
+{
+  pthread_mutex_lock(mutex);
+}
+
+void
+winevt_mutex_unlock(winevt_mutex_t* mutex)
+{
+  pthread_mutex_unlock(mutex);
+}
+
+void
+winevt_cond_init(winevt_cond_t* cond)
+{
+  pthread_cond_init(cond, NULL);
+}
+
+void
+winevt_cond_destroy(winevt_cond_t* cond)
+{
+  pthread_cond_destroy(cond);
+}
+
+void
+winevt_cond_wait(winevt_cond_t* cond, winevt_mutex_t* mutex)
+{
+  pthread_cond_wait(cond, mutex);
+}
+
+void
+winevt_cond_timedwait(winevt_cond_t* cond, winevt_mutex_t* mutex, unsigned long msec)
+{
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += msec / 1000;
+  deadline.tv_nsec += (long)(msec % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+void
+winevt_cond_broadcast(winevt_cond_t* cond)
+{
+  pthread_cond_broadcast(cond);
+}
+
+uint64_t
+winevt_monotonic_msec(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+#endif /* _WIN32 */
@@ -1,8 +1,12 @@
 #include <winevt_c.h>
 
 #include <sddl.h>
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#include <ruby/fiber/scheduler.h>
+#endif /* HAVE_RUBY_FIBER_SCHEDULER_H */
 #include <stdlib.h>
 #include <string>
+#include <algorithm>
 #include <vector>
 
 VALUE
@@ -101,6 +105,376 @@ render_to_rb_str(EVT_HANDLE handle, DWORD flags)
   return result;
 }
 
+/*
+ * Render the event or the bookmark into a malloc'ed string.
+ * This does not raise any Ruby exceptions and returns NULL with
+ * setting the error code on failure.
+ */
+WCHAR*
+render_to_wstr(EVT_HANDLE handle, DWORD flags, DWORD* status)
+{
+  WCHAR* buffer;
+  ULONG bufferSize = 0;
+  ULONG bufferSizeUsed = 0;
+  ULONG count;
+
+  *status = ERROR_SUCCESS;
+
+  if (EvtRender(nullptr, handle, flags, 0, NULL, &bufferSize, &count)) {
+    bufferSize = sizeof(WCHAR);
+  } else if ((*status = GetLastError()) != ERROR_INSUFFICIENT_BUFFER) {
+    return nullptr;
+  }
+
+  buffer = (WCHAR*)malloc(bufferSize);
+  if (buffer == nullptr) {
+    *status = ERROR_NOT_ENOUGH_MEMORY;
+    return nullptr;
+  }
+
+  if (!EvtRender(nullptr, handle, flags, bufferSize, buffer, &bufferSizeUsed, &count)) {
+    *status = GetLastError();
+    free(buffer);
+    return nullptr;
+  }
+  *status = ERROR_SUCCESS;
+
+  return buffer;
+}
+
+/*
+ * Get the path of the channel or the log file which has the event
+ * into a malloc'ed string. This does not raise any Ruby exceptions
+ * and returns NULL with setting the error code on failure.
+ */
+WCHAR*
+event_path_to_wstr(EVT_HANDLE hEvent, DWORD* status)
+{
+  PEVT_VARIANT value;
+  DWORD bufferSize = 0;
+  DWORD bufferSizeUsed = 0;
+  WCHAR* path;
+
+  *status = ERROR_SUCCESS;
+  if (!EvtGetEventInfo(hEvent, EvtEventPath, 0, NULL, &bufferSize) &&
+      (*status = GetLastError()) != ERROR_INSUFFICIENT_BUFFER) {
+    return nullptr;
+  }
+
+  value = (PEVT_VARIANT)malloc(bufferSize);
+  if (value == nullptr) {
+    *status = ERROR_NOT_ENOUGH_MEMORY;
+    return nullptr;
+  }
+  if (!EvtGetEventInfo(hEvent, EvtEventPath, bufferSize, value, &bufferSizeUsed)) {
+    *status = GetLastError();
+    free(value);
+    return nullptr;
+  }
+  *status = ERROR_SUCCESS;
+
+  if (value->Type != EvtVarTypeString || value->StringVal == nullptr) {
+    free(value);
+    return _wcsdup(L"");
+  }
+  path = _wcsdup(value->StringVal);
+  free(value);
+  if (path == nullptr) {
+    *status = ERROR_NOT_ENOUGH_MEMORY;
+  }
+
+  return path;
+}
+
+/*
+ * Get the path of the channel or the log file which has the event.
+ */
+VALUE
+get_event_path(EVT_HANDLE hEvent)
+{
+  DWORD status;
+  WCHAR* path = event_path_to_wstr(hEvent, &status);
+  VALUE rb_path;
+
+  if (path == nullptr) {
+    raise_system_error(rb_eWinevtQueryError, status);
+  }
+  rb_path = wstr_to_rb_str(CP_UTF8, path, -1);
+  free(path);
+
+  return rb_path;
+}
+
+/*
+ * Render the event values with the specified render context into a
+ * malloc'ed EVT_VARIANT array. This does not raise any Ruby exceptions.
+ */
+PEVT_VARIANT
+render_to_values(EVT_HANDLE hContext, EVT_HANDLE handle, DWORD* propCount,
+                 DWORD* status)
+{
+  PEVT_VARIANT values;
+  ULONG bufferSize = 0;
+  ULONG bufferSizeUsed = 0;
+
+  *status = ERROR_SUCCESS;
+  *propCount = 0;
+
+  if (!EvtRender(
+        hContext, handle, EvtRenderEventValues, 0, NULL, &bufferSize, propCount)) {
+    *status = GetLastError();
+    if (*status != ERROR_INSUFFICIENT_BUFFER) {
+      return nullptr;
+    }
+  }
+
+  // Keep the same buffer. EVT_VARIANTs points into it.
+  values = (PEVT_VARIANT)malloc(bufferSize > 0 ? bufferSize : sizeof(EVT_VARIANT));
+  if (values == nullptr) {
+    *status = ERROR_NOT_ENOUGH_MEMORY;
+    return nullptr;
+  }
+
+  if (!EvtRender(hContext,
+                 handle,
+                 EvtRenderEventValues,
+                 bufferSize,
+                 values,
+                 &bufferSizeUsed,
+                 propCount)) {
+    *status = GetLastError();
+    free(values);
+    return nullptr;
+  }
+  *status = ERROR_SUCCESS;
+
+  return values;
+}
+
+/*
+ * Render values into the buffer which is grown as needed and reused
+ * for the next events. This does not raise any Ruby exceptions.
+ */
+DWORD
+render_values_to_buffer(EVT_HANDLE hContext, EVT_HANDLE handle, PEVT_VARIANT* buffer,
+                        DWORD* bufferSize, DWORD* propCount)
+{
+  DWORD bufferUsed = 0;
+  PEVT_VARIANT grown;
+
+  *propCount = 0;
+  if (EvtRender(hContext, handle, EvtRenderEventValues, *bufferSize, *buffer,
+                &bufferUsed, propCount)) {
+    return ERROR_SUCCESS;
+  }
+  if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+    return GetLastError();
+  }
+  grown = (PEVT_VARIANT)realloc(*buffer, bufferUsed);
+  if (grown == nullptr) {
+    return ERROR_OUTOFMEMORY;
+  }
+  *buffer = grown;
+  *bufferSize = bufferUsed;
+  if (!EvtRender(hContext, handle, EvtRenderEventValues, *bufferSize, *buffer,
+                 &bufferUsed, propCount)) {
+    return GetLastError();
+  }
+
+  return ERROR_SUCCESS;
+}
+
+/*
+ * Whether the query is a structured XML query (QueryList), which can
+ * select events from more than one channel.
+ */
+BOOL
+is_structured_query(const WCHAR* query)
+{
+  while (*query == L' ' || *query == L'\t' || *query == L'\r' || *query == L'\n') {
+    query++;
+  }
+
+  return *query == L'<';
+}
+
+/*
+ * Pick the events which are needed to move a bookmark over the
+ * batch: the last event of each channel. Only one event is needed
+ * unless the events can come from more than one channel. The picked
+ * events keep the order in the batch. Returns the number of them.
+ */
+DWORD
+last_events_per_channel(EVT_HANDLE* events, DWORD count, BOOL multiChannel,
+                        EVT_HANDLE* lastEvents)
+{
+  static PCWSTR channelProperties[] = { L"Event/System/Channel" };
+  std::vector<std::wstring> channels;
+  std::vector<EVT_HANDLE> picked;
+  EVT_HANDLE hContext;
+
+  if (count == 0) {
+    return 0;
+  }
+  if (!multiChannel) {
+    lastEvents[0] = events[count - 1];
+    return 1;
+  }
+
+  hContext = EvtCreateRenderContext(1, channelProperties, EvtRenderContextValues);
+  if (hContext == nullptr) {
+    // Every event moves the bookmark. It is slower but still correct.
+    for (DWORD i = 0; i < count; i++) {
+      lastEvents[i] = events[i];
+    }
+    return count;
+  }
+
+  for (DWORD i = count; i > 0; i--) {
+    DWORD propCount, status;
+    PEVT_VARIANT values = render_to_values(hContext, events[i - 1], &propCount, &status);
+    std::wstring channel;
+
+    if (values != nullptr && propCount > 0 && values[0].Type == EvtVarTypeString) {
+      channel = values[0].StringVal;
+    }
+    free(values);
+
+    if (std::find(channels.begin(), channels.end(), channel) == channels.end()) {
+      channels.push_back(channel);
+      picked.push_back(events[i - 1]);
+    }
+  }
+  EvtClose(hContext);
+
+  std::reverse_copy(picked.begin(), picked.end(), lastEvents);
+
+  return picked.size();
+}
+
+/*
+ * Record the channel and the EventRecordID of the events into the
+ * checkpoint. Events which cannot be rendered are skipped.
+ */
+void
+update_checkpoint_with_events(struct WinevtCheckpoint* checkpoint,
+                              EVT_HANDLE* events, DWORD count)
+{
+  static PCWSTR properties[] = { L"Event/System/Channel",
+                                 L"Event/System/EventRecordID" };
+  EVT_HANDLE hContext;
+
+  hContext = EvtCreateRenderContext(2, properties, EvtRenderContextValues);
+  if (hContext == nullptr) {
+    return;
+  }
+
+  for (DWORD i = 0; i < count; i++) {
+    DWORD propCount, status;
+    PEVT_VARIANT values = render_to_values(hContext, events[i], &propCount, &status);
+
+    if (values != nullptr && propCount == 2 && values[0].Type == EvtVarTypeString &&
+        values[1].Type == EvtVarTypeUInt64) {
+      int len = WideCharToMultiByte(CP_UTF8, 0, values[0].StringVal, -1,
+                                    nullptr, 0, nullptr, nullptr);
+      if (len > 0) {
+        std::vector<char> channel(len);
+        WideCharToMultiByte(CP_UTF8, 0, values[0].StringVal, -1,
+                            channel.data(), len, nullptr, nullptr);
+        winevt_checkpoint_update(checkpoint, channel.data(), len - 1,
+                                 values[1].UInt64Val);
+      }
+    }
+    free(values);
+  }
+  EvtClose(hContext);
+}
+
+/*
+ * Render everything which is needed for yielding an event into
+ * rendered. This does not raise any Ruby exceptions. So, it can be
+ * called without holding the GVL.
+ */
+DWORD
+render_event(EVT_HANDLE hEvent, const struct WinevtRenderOptions* options,
+             struct WinevtRenderedEvent* rendered)
+{
+  DWORD status = ERROR_SUCCESS;
+
+  ZeroMemory(rendered, sizeof(struct WinevtRenderedEvent));
+
+  if (options->renderAsXML) {
+    rendered->xml = render_to_wstr(hEvent, EvtRenderEventXml, &status);
+  } else {
+    rendered->systemValues = render_to_values(
+      options->systemContext, hEvent, &rendered->systemValuesCount, &status);
+  }
+  if (status != ERROR_SUCCESS) {
+    goto error;
+  }
+
+  status = format_description(
+    hEvent, options->langID, options->remoteHandle, &rendered->message);
+  if (status != ERROR_SUCCESS) {
+    goto error;
+  }
+
+  rendered->userValues = render_to_values(
+    options->userContext, hEvent, &rendered->userValuesCount, &status);
+  if (status != ERROR_SUCCESS) {
+    goto error;
+  }
+
+  if (options->renderPath) {
+    rendered->path = event_path_to_wstr(hEvent, &status);
+    if (status != ERROR_SUCCESS) {
+      goto error;
+    }
+  }
+
+  return ERROR_SUCCESS;
+
+error:
+  free_rendered_event(rendered);
+
+  return status;
+}
+
+void
+free_rendered_event(struct WinevtRenderedEvent* rendered)
+{
+  free(rendered->xml);
+  free(rendered->systemValues);
+  free(rendered->message);
+  free(rendered->userValues);
+  free(rendered->path);
+  ZeroMemory(rendered, sizeof(struct WinevtRenderedEvent));
+}
+
+/*
+ * Build the yielded values, (eventlog, message, string_inserts), from
+ * the rendered event.
+ */
+VALUE
+rendered_event_to_rb_ary(const struct WinevtRenderedEvent* rendered,
+                         BOOL preserveQualifiers, BOOL preserveSID)
+{
+  VALUE eventlog;
+
+  if (rendered->xml) {
+    eventlog = wstr_to_rb_str(CP_UTF8, rendered->xml, -1);
+  } else {
+    eventlog =
+      system_values_to_rb_hash(rendered->systemValues, preserveQualifiers, preserveSID);
+  }
+
+  return rb_ary_new_from_args(3,
+                              eventlog,
+                              wstr_to_rb_str(CP_UTF8, rendered->message, -1),
+                              extract_user_evt_variants(rendered->userValues,
+                                                        rendered->userValuesCount));
+}
+
 EVT_HANDLE
 connect_to_remote(LPWSTR computerName, LPWSTR domain, LPWSTR username, LPWSTR password,
                   EVT_RPC_LOGIN_FLAGS flags, DWORD *error_code)
@@ -127,6 +501,513 @@ connect_to_remote(LPWSTR computerName, LPWSTR domain, LPWSTR username, LPWSTR pa
   return hRemote;
 }
 
+DWORD
+timeout_to_msec(VALUE rb_timeout)
+{
+  double timeout;
+
+  if (NIL_P(rb_timeout)) {
+    return INFINITE;
+  }
+
+  timeout = NUM2DBL(rb_timeout);
+  if (timeout < 0) {
+    rb_raise(rb_eArgError, "timeout must be positive or nil");
+  }
+  // INFINITE itself is reserved for nil.
+  if (timeout * 1000 >= (double)(INFINITE - 1)) {
+    return INFINITE - 1;
+  }
+
+  return (DWORD)(timeout * 1000);
+}
+
+/*
+ * Parse max_events: and max_time: of #each. Both of them are
+ * unlimited when they are nil or omitted.
+ */
+void
+each_budget_init(struct WinevtEachBudget* budget, VALUE rb_opts)
+{
+  static ID keywords[2];
+  VALUE values[2] = { Qundef, Qundef };
+
+  if (!keywords[0]) {
+    keywords[0] = rb_intern("max_events");
+    keywords[1] = rb_intern("max_time");
+  }
+  if (!NIL_P(rb_opts)) {
+    rb_get_kwargs(rb_opts, keywords, 0, 2, values);
+  }
+
+  budget->maxEvents = 0;
+  if (values[0] != Qundef && !NIL_P(values[0])) {
+    budget->maxEvents = NUM2ULL(values[0]);
+    if (budget->maxEvents == 0) {
+      rb_raise(rb_eArgError, "max_events must be positive or nil");
+    }
+  }
+  budget->timeout = timeout_to_msec(values[1] == Qundef ? Qnil : values[1]);
+  budget->deadline = GetTickCount64() + budget->timeout;
+  budget->yielded = 0;
+}
+
+/* The number of events which can be yielded from a batch of size. */
+DWORD
+each_budget_allowance(const struct WinevtEachBudget* budget, DWORD size)
+{
+  if (budget->maxEvents == 0 || budget->maxEvents - budget->yielded >= size) {
+    return size;
+  }
+
+  return (DWORD)(budget->maxEvents - budget->yielded);
+}
+
+BOOL
+each_budget_exhausted(const struct WinevtEachBudget* budget)
+{
+  if (budget->maxEvents > 0 && budget->yielded >= budget->maxEvents) {
+    return TRUE;
+  }
+
+  return remaining_msec(budget->timeout, budget->deadline) == 0;
+}
+
+struct BlockingCallArgs
+{
+  void* (*func)(void*);
+  void* data1;
+  rb_unblock_function_t* ubf;
+  void* data2;
+  void* result;
+  VALUE done;
+  BOOL finished;
+};
+
+/* The jobs for the worker threads. The workers are kept and reused, so
+ * a blocking call does not create a thread. */
+static VALUE blockingCallQueue = Qnil;
+static long blockingCallIdleWorkers = 0;
+
+static VALUE
+blocking_call_worker(void*)
+{
+  for (;;) {
+    VALUE job = rb_funcall(blockingCallQueue, rb_intern("pop"), 0);
+    struct BlockingCallArgs* args = (struct BlockingCallArgs*)NUM2SIZET(job);
+    VALUE done = args->done;
+
+    args->result =
+      rb_thread_call_without_gvl(args->func, args->data1, args->ubf, args->data2);
+    args->finished = TRUE;
+    blockingCallIdleWorkers++;
+    // args may be released by the waiting fiber after this.
+    rb_funcall(done, rb_intern("push"), 1, Qtrue);
+  }
+
+  return Qnil;
+}
+
+static VALUE
+wait_blocking_call(VALUE ptr)
+{
+  struct BlockingCallArgs* args = (struct BlockingCallArgs*)ptr;
+
+  // Thread::Queue#pop blocks the fiber through the scheduler.
+  return rb_funcall(args->done, rb_intern("pop"), 0);
+}
+
+static VALUE
+ensure_blocking_call(VALUE ptr)
+{
+  struct BlockingCallArgs* args = (struct BlockingCallArgs*)ptr;
+
+  // When the waiting fiber is interrupted, the job must finish before
+  // args goes out of scope.
+  if (!args->finished) {
+    if (args->ubf) {
+      args->ubf(args->data2);
+    }
+    rb_funcall(args->done, rb_intern("pop"), 0);
+  }
+
+  return Qnil;
+}
+
+static void*
+call_on_worker(void* (*func)(void*), void* data1, rb_unblock_function_t* ubf, void* data2)
+{
+  struct BlockingCallArgs args;
+
+  if (NIL_P(blockingCallQueue)) {
+    rb_gc_register_address(&blockingCallQueue);
+    blockingCallQueue = rb_class_new_instance(0, nullptr, rb_path2class("Thread::Queue"));
+  }
+  args.func = func;
+  args.data1 = data1;
+  args.ubf = ubf;
+  args.data2 = data2;
+  args.result = nullptr;
+  args.done = rb_class_new_instance(0, nullptr, rb_path2class("Thread::Queue"));
+  args.finished = FALSE;
+  // A worker is added only when all of them are busy, so the workers
+  // are as many as the concurrent blocking calls.
+  if (blockingCallIdleWorkers > 0) {
+    blockingCallIdleWorkers--;
+  } else {
+    rb_thread_create(blocking_call_worker, nullptr);
+  }
+  rb_funcall(blockingCallQueue, rb_intern("push"), 1, SIZET2NUM((size_t)&args));
+  rb_ensure(wait_blocking_call, (VALUE)&args, ensure_blocking_call, (VALUE)&args);
+  RB_GC_GUARD(args.done);
+
+  return args.result;
+}
+
+/*
+ * Call a blocking function without holding the GVL.
+ *
+ * When a Fiber scheduler is set on the current thread, the function is
+ * offloaded so that the other fibers keep running: by the scheduler's
+ * blocking_operation_wait hook if it is supported, otherwise by a
+ * worker thread which the fiber waits for through the scheduler.
+ */
+void*
+call_without_gvl(void* (*func)(void*), void* data1, rb_unblock_function_t* ubf, void* data2)
+{
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+  VALUE scheduler = rb_fiber_scheduler_current();
+
+  if (!NIL_P(scheduler)) {
+#ifdef RB_NOGVL_OFFLOAD_SAFE
+    if (rb_respond_to(scheduler, rb_intern("blocking_operation_wait"))) {
+      return rb_nogvl(func, data1, ubf, data2, RB_NOGVL_OFFLOAD_SAFE);
+    }
+#endif /* RB_NOGVL_OFFLOAD_SAFE */
+
+    return call_on_worker(func, data1, ubf, data2);
+  }
+#endif /* HAVE_RUBY_FIBER_SCHEDULER_H */
+
+  return rb_thread_call_without_gvl(func, data1, ubf, data2);
+}
+
+struct EvtNextArgs
+{
+  EVT_HANDLE resultSet;
+  DWORD eventsSize;
+  EVT_HANDLE* events;
+  DWORD timeout;
+  DWORD count;
+  BOOL succeeded;
+  DWORD status;
+  /* Set when evt_next_cancel cancels EvtNext for an interrupt. */
+  volatile BOOL interrupted;
+};
+
+static void*
+evt_next_without_gvl(void* ptr)
+{
+  struct EvtNextArgs* args = (struct EvtNextArgs*)ptr;
+
+  args->succeeded = EvtNext(
+    args->resultSet, args->eventsSize, args->events, args->timeout, 0, &args->count);
+  args->status = args->succeeded ? ERROR_SUCCESS : GetLastError();
+
+  return nullptr;
+}
+
+static void
+evt_next_cancel(void* ptr)
+{
+  struct EvtNextArgs* args = (struct EvtNextArgs*)ptr;
+
+  args->interrupted = TRUE;
+  EvtCancel(args->resultSet);
+}
+
+/*
+ * EvtNext which does not block other Ruby threads and fibers.
+ * The error code is available via GetLastError() as EvtNext.
+ */
+BOOL
+evt_next(EVT_HANDLE resultSet, DWORD eventsSize, EVT_HANDLE* events, DWORD timeout,
+         DWORD* count)
+{
+  struct EvtNextArgs args;
+  ULONGLONG deadline = GetTickCount64() + timeout;
+
+  args.resultSet = resultSet;
+  args.eventsSize = eventsSize;
+  args.events = events;
+  args.timeout = timeout;
+
+  for (;;) {
+    args.count = 0;
+    args.succeeded = FALSE;
+    args.status = ERROR_SUCCESS;
+    args.interrupted = FALSE;
+    call_without_gvl(evt_next_without_gvl, &args, evt_next_cancel, &args);
+    // ERROR_CANCELLED by #cancel is returned to the caller.
+    if (args.status != ERROR_CANCELLED || !args.interrupted) {
+      break;
+    }
+    // Canceled by an interrupt. Raise it if it is an exception,
+    // otherwise wait for the rest of the timeout.
+    rb_thread_check_ints();
+    args.timeout = remaining_msec(timeout, deadline);
+  }
+
+  *count = args.count;
+  SetLastError(args.status);
+
+  return args.succeeded;
+}
+
+/*
+ * Milliseconds left until the deadline which is computed from the
+ * timeout by GetTickCount64.
+ */
+DWORD
+remaining_msec(DWORD timeout, ULONGLONG deadline)
+{
+  ULONGLONG now;
+
+  if (timeout == INFINITE)
+    return INFINITE;
+
+  now = GetTickCount64();
+  if (now >= deadline)
+    return 0;
+
+  return (DWORD)(deadline - now);
+}
+
+/* Handles which one WaitForMultipleObjects call watches besides the
+ * interrupt and the cancel events. */
+#define WAIT_CHUNK_SIZE (MAXIMUM_WAIT_OBJECTS - 2)
+
+struct WaitSignalEventsArgs
+{
+  HANDLE* handles;
+  DWORD count;
+  HANDLE hInterrupt;
+  DWORD timeout;
+  DWORD result;
+  DWORD error;
+};
+
+struct WaitChunkArgs
+{
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+  DWORD count;
+  DWORD timeout;
+  volatile LONG* signaled;
+  HANDLE hCancel;
+};
+
+static DWORD WINAPI
+wait_chunk_thread(LPVOID ptr)
+{
+  struct WaitChunkArgs* args = (struct WaitChunkArgs*)ptr;
+  DWORD result;
+
+  // The last handle is the cancel event shared by all chunks.
+  result = WaitForMultipleObjects(args->count, args->handles, FALSE, args->timeout);
+  if (result < WAIT_OBJECT_0 + args->count - 1) {
+    InterlockedExchange(args->signaled, 1);
+    SetEvent(args->hCancel);
+  }
+
+  return 0;
+}
+
+/*
+ * WaitForMultipleObjects can watch only MAXIMUM_WAIT_OBJECTS handles.
+ * The first chunk is watched by the calling thread and each remaining
+ * chunk by a helper thread, which sets the cancel event when one of
+ * its handles is signaled.
+ */
+static void
+wait_for_chunked_signal_events(struct WaitSignalEventsArgs* args)
+{
+  std::vector<WaitChunkArgs> chunks;
+  std::vector<HANDLE> threads;
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+  volatile LONG signaled = 0;
+  DWORD firstCount = args->count < WAIT_CHUNK_SIZE ? args->count : WAIT_CHUNK_SIZE;
+  HANDLE hCancel;
+
+  hCancel = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (hCancel == nullptr) {
+    args->result = WAIT_FAILED;
+    args->error = GetLastError();
+    return;
+  }
+
+  for (DWORD offset = firstCount; offset < args->count; offset += WAIT_CHUNK_SIZE) {
+    WaitChunkArgs chunk;
+    chunk.count = 0;
+    for (DWORD i = offset; i < args->count && chunk.count < WAIT_CHUNK_SIZE; i++) {
+      chunk.handles[chunk.count++] = args->handles[i];
+    }
+    chunk.handles[chunk.count++] = hCancel;
+    chunk.timeout = args->timeout;
+    chunk.signaled = &signaled;
+    chunk.hCancel = hCancel;
+    chunks.push_back(chunk);
+  }
+  for (auto& chunk : chunks) {
+    HANDLE hThread = CreateThread(nullptr, 0, wait_chunk_thread, &chunk, 0, nullptr);
+    if (hThread == nullptr) {
+      args->result = WAIT_FAILED;
+      args->error = GetLastError();
+      break;
+    }
+    threads.push_back(hThread);
+  }
+
+  if (threads.size() == chunks.size()) {
+    for (DWORD i = 0; i < firstCount; i++) {
+      handles[i] = args->handles[i];
+    }
+    handles[firstCount] = args->hInterrupt;
+    handles[firstCount + 1] = hCancel;
+    args->result =
+      WaitForMultipleObjects(firstCount + 2, handles, FALSE, args->timeout);
+    if (args->result == WAIT_FAILED) {
+      args->error = GetLastError();
+    } else if (args->result == WAIT_OBJECT_0 + firstCount) {
+      args->result = WAIT_OBJECT_0 + args->count;
+    } else if (args->result < WAIT_OBJECT_0 + firstCount ||
+               signaled) {
+      // The index is not reported for chunked waits.
+      args->result = WAIT_OBJECT_0;
+    } else {
+      args->result = WAIT_TIMEOUT;
+    }
+  }
+
+  SetEvent(hCancel);
+  for (auto hThread : threads) {
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+  }
+  CloseHandle(hCancel);
+}
+
+static void*
+wait_for_signal_events_without_gvl(void* ptr)
+{
+  struct WaitSignalEventsArgs* args = (struct WaitSignalEventsArgs*)ptr;
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+
+  if (args->count > MAXIMUM_WAIT_OBJECTS - 1) {
+    wait_for_chunked_signal_events(args);
+    return nullptr;
+  }
+
+  for (DWORD i = 0; i < args->count; i++) {
+    handles[i] = args->handles[i];
+  }
+  handles[args->count] = args->hInterrupt;
+  args->result =
+    WaitForMultipleObjects(args->count + 1, handles, FALSE, args->timeout);
+  if (args->result == WAIT_FAILED) {
+    args->error = GetLastError();
+  }
+
+  return nullptr;
+}
+
+static void
+interrupt_wait_for_signal_events(void* ptr)
+{
+  SetEvent((HANDLE)ptr);
+}
+
+static VALUE
+wait_for_signal_events_loop(VALUE ptr)
+{
+  struct WaitSignalEventsArgs* args = (struct WaitSignalEventsArgs*)ptr;
+  ULONGLONG deadline = GetTickCount64() + args->timeout;
+  DWORD timeout = args->timeout;
+
+  for (;;) {
+    call_without_gvl(wait_for_signal_events_without_gvl,
+                     args,
+                     interrupt_wait_for_signal_events,
+                     args->hInterrupt);
+    if (args->result == WAIT_FAILED) {
+      raise_system_error(rb_eSubscribeHandlerError, args->error);
+    }
+    if (args->result != WAIT_OBJECT_0 + args->count) {
+      break;
+    }
+
+    // Woken up by the unblocking function. Process pending interrupts
+    // (signal traps, Thread#raise and so on) and wait again for the
+    // remaining time.
+    ResetEvent(args->hInterrupt);
+    rb_thread_check_ints();
+
+    if (timeout != INFINITE) {
+      ULONGLONG now = GetTickCount64();
+      if (now >= deadline) {
+        args->result = WAIT_TIMEOUT;
+        break;
+      }
+      args->timeout = (DWORD)(deadline - now);
+    }
+  }
+
+  return Qnil;
+}
+
+static VALUE
+close_interrupt_event(VALUE ptr)
+{
+  struct WaitSignalEventsArgs* args = (struct WaitSignalEventsArgs*)ptr;
+
+  CloseHandle(args->hInterrupt);
+
+  return Qnil;
+}
+
+/*
+ * Wait for one of signal event handles without holding the GVL.
+ * Returns WAIT_OBJECT_0 + index of the signaled handle or
+ * WAIT_TIMEOUT. When count is 0, this just sleeps interruptibly.
+ * More than MAXIMUM_WAIT_OBJECTS - 1 handles are waited for in chunks
+ * and then WAIT_OBJECT_0 is returned for any signaled handle.
+ */
+DWORD
+wait_for_signal_events(HANDLE* handles, DWORD count, DWORD timeout)
+{
+  struct WaitSignalEventsArgs args;
+
+  if (count > WAIT_CHUNK_SIZE * MAXIMUM_WAIT_OBJECTS) {
+    rb_raise(rb_eArgError,
+             "Cannot wait for more than %d handles at once",
+             WAIT_CHUNK_SIZE * MAXIMUM_WAIT_OBJECTS);
+  }
+
+  args.hInterrupt = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (args.hInterrupt == nullptr) {
+    raise_system_error(rb_eSubscribeHandlerError, GetLastError());
+  }
+
+  args.handles = handles;
+  args.count = count;
+  args.timeout = timeout;
+  args.result = WAIT_FAILED;
+  args.error = ERROR_SUCCESS;
+
+  rb_ensure(wait_for_signal_events_loop, (VALUE)&args, close_interrupt_event, (VALUE)&args);
+
+  return args.result;
+}
+
 static std::wstring
 guid_to_wstr(const GUID& guid)
 {
@@ -169,7 +1050,7 @@ make_displayable_binary_string(PBYTE bin, size_t length)
   return str;
 }
 
-static VALUE
+VALUE
 extract_user_evt_variants(PEVT_VARIANT pRenderedValues, DWORD propCount)
 {
   VALUE userValues = rb_ary_new();
@@ -408,14 +1289,65 @@ get_values(EVT_HANDLE handle)
   return userValues;
 }
 
-static std::vector<WCHAR>
-get_message(EVT_HANDLE hMetadata, EVT_HANDLE handle)
+static BOOL
+is_message_unavailable_status(DWORD status)
+{
+  switch (status) {
+    case ERROR_EVT_MESSAGE_NOT_FOUND:
+    case ERROR_EVT_MESSAGE_ID_NOT_FOUND:
+    case ERROR_EVT_MESSAGE_LOCALE_NOT_FOUND:
+    case ERROR_RESOURCE_DATA_NOT_FOUND:
+    case ERROR_RESOURCE_TYPE_NOT_FOUND:
+    case ERROR_RESOURCE_NAME_NOT_FOUND:
+    case ERROR_RESOURCE_LANG_NOT_FOUND:
+    case ERROR_MUI_FILE_NOT_FOUND:
+    case ERROR_EVT_UNRESOLVED_PARAMETER_INSERT:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static void
+get_system_message(DWORD status, std::vector<WCHAR>& result)
+{
+  LPVOID lpMsgBuf = nullptr;
+
+  if (FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM |
+                       FORMAT_MESSAGE_IGNORE_INSERTS,
+                     nullptr,
+                     status,
+                     MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                     reinterpret_cast<WCHAR*>(&lpMsgBuf),
+                     0,
+                     nullptr) == 0)
+    FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM |
+                     FORMAT_MESSAGE_IGNORE_INSERTS,
+                   nullptr,
+                   status,
+                   MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US),
+                   reinterpret_cast<WCHAR*>(&lpMsgBuf),
+                   0,
+                   nullptr);
+
+  if (lpMsgBuf == nullptr) {
+    return;
+  }
+
+  std::wstring ret(reinterpret_cast<WCHAR*>(lpMsgBuf));
+  std::copy(ret.begin(), ret.end(), std::back_inserter(result));
+  result.push_back(L'\0');
+  LocalFree(lpMsgBuf);
+}
+
+// This does not raise any Ruby exceptions. So, it can be used
+// outside of the GVL such as in EvtSubscribe callbacks.
+static DWORD
+get_message(EVT_HANDLE hMetadata, EVT_HANDLE handle, std::vector<WCHAR>& result)
 {
 #define BUFSIZE 4096
-  std::vector<WCHAR> result;
-  ULONG status;
+  ULONG status = ERROR_SUCCESS;
   ULONG bufferSizeNeeded = 0;
-  LPVOID lpMsgBuf;
   std::vector<WCHAR> message(BUFSIZE);
 
   if (!EvtFormatMessage(hMetadata,
@@ -429,117 +1361,49 @@ get_message(EVT_HANDLE hMetadata, EVT_HANDLE handle)
                         &bufferSizeNeeded)) {
     status = GetLastError();
 
-    if (status != ERROR_EVT_UNRESOLVED_VALUE_INSERT) {
-      switch (status) {
-        case ERROR_EVT_MESSAGE_NOT_FOUND:
-        case ERROR_EVT_MESSAGE_ID_NOT_FOUND:
-        case ERROR_EVT_MESSAGE_LOCALE_NOT_FOUND:
-        case ERROR_RESOURCE_DATA_NOT_FOUND:
-        case ERROR_RESOURCE_TYPE_NOT_FOUND:
-        case ERROR_RESOURCE_NAME_NOT_FOUND:
-        case ERROR_RESOURCE_LANG_NOT_FOUND:
-        case ERROR_MUI_FILE_NOT_FOUND:
-        case ERROR_EVT_UNRESOLVED_PARAMETER_INSERT: {
-          if (FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM |
-                               FORMAT_MESSAGE_IGNORE_INSERTS,
-                             nullptr,
-                             status,
-                             MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-                             reinterpret_cast<WCHAR*>(&lpMsgBuf),
-                             0,
-                             nullptr) == 0)
-            FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM |
-                             FORMAT_MESSAGE_IGNORE_INSERTS,
-                           nullptr,
-                           status,
-                           MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US),
-                           reinterpret_cast<WCHAR*>(&lpMsgBuf),
-                           0,
-                           nullptr);
-
-          std::wstring ret(reinterpret_cast<WCHAR*>(lpMsgBuf));
-          std::copy(ret.begin(), ret.end(), std::back_inserter(result));
-          result.push_back(L'\0');
-          LocalFree(lpMsgBuf);
-
-          goto cleanup;
-        }
-      }
-
-      if (status != ERROR_INSUFFICIENT_BUFFER)
-        rb_raise(rb_eWinevtQueryError, "ErrorCode: %lu", status);
-    }
-
     if (status == ERROR_INSUFFICIENT_BUFFER) {
       message.resize(bufferSizeNeeded);
       message.shrink_to_fit();
 
-      if (!EvtFormatMessage(hMetadata,
-                            handle,
-                            0xffffffff,
-                            0,
-                            nullptr,
-                            EvtFormatMessageEvent,
-                            message.size(),
-                            &message.front(),
-                            &bufferSizeNeeded)) {
+      if (EvtFormatMessage(hMetadata,
+                           handle,
+                           0xffffffff,
+                           0,
+                           nullptr,
+                           EvtFormatMessageEvent,
+                           message.size(),
+                           &message.front(),
+                           &bufferSizeNeeded)) {
+        status = ERROR_SUCCESS;
+      } else {
         status = GetLastError();
-
-        if (status != ERROR_EVT_UNRESOLVED_VALUE_INSERT) {
-          switch (status) {
-            case ERROR_EVT_MESSAGE_NOT_FOUND:
-            case ERROR_EVT_MESSAGE_ID_NOT_FOUND:
-            case ERROR_EVT_MESSAGE_LOCALE_NOT_FOUND:
-            case ERROR_RESOURCE_DATA_NOT_FOUND:
-            case ERROR_RESOURCE_TYPE_NOT_FOUND:
-            case ERROR_RESOURCE_NAME_NOT_FOUND:
-            case ERROR_RESOURCE_LANG_NOT_FOUND:
-            case ERROR_MUI_FILE_NOT_FOUND:
-            case ERROR_EVT_UNRESOLVED_PARAMETER_INSERT:
-              if (FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER |
-                                   FORMAT_MESSAGE_FROM_SYSTEM |
-                                   FORMAT_MESSAGE_IGNORE_INSERTS,
-                                 nullptr,
-                                 status,
-                                 MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-                                 reinterpret_cast<WCHAR*>(&lpMsgBuf),
-                                 0,
-                                 nullptr) == 0)
-                FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER |
-                                 FORMAT_MESSAGE_FROM_SYSTEM |
-                                 FORMAT_MESSAGE_IGNORE_INSERTS,
-                               nullptr,
-                               status,
-                               MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US),
-                               reinterpret_cast<WCHAR*>(&lpMsgBuf),
-                               0,
-                               nullptr);
-
-              std::wstring ret(reinterpret_cast<WCHAR*>(lpMsgBuf));
-              std::copy(ret.begin(), ret.end(), std::back_inserter(result));
-              result.push_back(L'\0');
-              LocalFree(lpMsgBuf);
-
-              goto cleanup;
-          }
-
-          rb_raise(rb_eWinevtQueryError, "ErrorCode: %lu", status);
-        }
       }
     }
   }
 
-  result = message;
+  if (status == ERROR_SUCCESS || status == ERROR_EVT_UNRESOLVED_VALUE_INSERT) {
+    result = message;
+    return ERROR_SUCCESS;
+  }
 
-cleanup:
+  if (is_message_unavailable_status(status)) {
+    get_system_message(status, result);
+    return ERROR_SUCCESS;
+  }
 
-  return result;
+  return status;
 
 #undef BUFSIZE
 }
 
-WCHAR*
-get_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote)
+/*
+ * Obtain the formatted description of the event as a malloc'ed string.
+ * This does not raise any Ruby exceptions and returns the error code
+ * on failure.
+ */
+DWORD
+format_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote,
+                   WCHAR** description)
 {
 #define BUFSIZE 4096
   std::vector<WCHAR> buffer(BUFSIZE);
@@ -548,11 +1412,13 @@ get_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote)
   std::vector<WCHAR> result;
   EVT_HANDLE hMetadata = nullptr;
 
+  *description = nullptr;
+
   static PCWSTR eventProperties[] = { L"Event/System/Provider/@Name" };
   EVT_HANDLE renderContext =
     EvtCreateRenderContext(1, eventProperties, EvtRenderContextValues);
   if (renderContext == nullptr) {
-    rb_raise(rb_eWinevtQueryError, "Failed to create renderContext");
+    return GetLastError();
   }
 
   if (EvtRender(renderContext,
@@ -569,7 +1435,7 @@ get_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote)
 
   if (status != ERROR_SUCCESS) {
     EvtClose(renderContext);
-    raise_system_error(rb_eWinevtQueryError, status);
+    return status;
   }
 
   // Obtain buffer as EVT_VARIANT pointer. To avoid ErrorCide 87 in EvtRender.
@@ -588,7 +1454,7 @@ get_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote)
     goto cleanup;
   }
 
-  result = get_message(hMetadata, handle);
+  status = get_message(hMetadata, handle, result);
 
 #undef BUFSIZE
 
@@ -600,11 +1466,34 @@ cleanup:
   if (hMetadata)
     EvtClose(hMetadata);
 
+  if (status != ERROR_SUCCESS) {
+    return status;
+  }
+
   if (result.empty()) {
-    return _wcsdup(L"");
+    *description = _wcsdup(L"");
+  } else {
+    *description = _wcsdup(result.data());
+  }
+
+  if (*description == nullptr) {
+    return ERROR_NOT_ENOUGH_MEMORY;
+  }
+
+  return ERROR_SUCCESS;
+}
+
+WCHAR*
+get_description(EVT_HANDLE handle, LANGID langID, EVT_HANDLE hRemote)
+{
+  WCHAR* description = nullptr;
+  DWORD status = format_description(handle, langID, hRemote, &description);
+
+  if (status != ERROR_SUCCESS) {
+    raise_system_error(rb_eWinevtQueryError, status);
   }
 
-  return _wcsdup(result.data());
+  return description;
 }
 
 static char* convert_wstr(wchar_t *wstr)
@@ -715,16 +1604,7 @@ render_system_event(EVT_HANDLE hEvent, BOOL preserve_qualifiers, BOOL preserveSI
   DWORD dwPropertyCount = 0;
   VALUE vRenderedValues;
   PEVT_VARIANT pRenderedValues = NULL;
-  WCHAR wsGuid[50];
-  LPSTR pwsSid = NULL;
-  ULONGLONG ullTimeStamp = 0;
-  ULONGLONG ullNanoseconds = 0;
-  SYSTEMTIME st;
-  FILETIME ft;
-  CHAR buffer[32];
-  VALUE rbstr;
-  DWORD EventID;
-  VALUE hash = rb_hash_new();
+  VALUE hash;
 
   hContext = EvtCreateRenderContext(0, NULL, EvtRenderContextSystem);
   if (NULL == hContext) {
@@ -766,6 +1646,29 @@ render_system_event(EVT_HANDLE hEvent, BOOL preserve_qualifiers, BOOL preserveSI
     }
   }
 
+  hash = system_values_to_rb_hash(pRenderedValues, preserve_qualifiers, preserveSID_p);
+
+  EvtClose(hContext);
+  RB_ALLOCV_END(vRenderedValues);
+
+  return hash;
+}
+
+VALUE
+system_values_to_rb_hash(PEVT_VARIANT pRenderedValues, BOOL preserve_qualifiers,
+                         BOOL preserveSID_p)
+{
+  WCHAR wsGuid[50];
+  LPSTR pwsSid = NULL;
+  ULONGLONG ullTimeStamp = 0;
+  ULONGLONG ullNanoseconds = 0;
+  SYSTEMTIME st;
+  FILETIME ft;
+  CHAR buffer[32];
+  VALUE rbstr;
+  DWORD EventID;
+  VALUE hash = rb_hash_new();
+
   // EVT_VARIANT value with EvtRenderContextSystem will be decomposed
   // as the following enum definition:
   // https://docs.microsoft.com/en-us/windows/win32/api/winevt/ne-winevt-evt_system_property_id
@@ -918,8 +1821,5 @@ render_system_event(EVT_HANDLE hEvent, BOOL preserve_qualifiers, BOOL preserveSI
     }
   }
 
-  EvtClose(hContext);
-  RB_ALLOCV_END(vRenderedValues);
-
   return hash;
 }
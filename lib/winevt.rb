@@ -3,11 +3,16 @@ begin
 rescue LoadError
   require "winevt/winevt"
 end
-require "winevt/bookmark"
-require "winevt/query"
-require "winevt/subscribe"
 require "winevt/version"
-require "winevt/session"
+require "winevt/checkpoint"
+require "winevt/compiled_query"
+# Only the portable parts are available on the other platforms.
+if Gem.win_platform?
+  require "winevt/bookmark"
+  require "winevt/query"
+  require "winevt/subscribe"
+  require "winevt/session"
+end
 
 module Winevt
   # Your code goes here...
@@ -0,0 +1,17 @@
+module Winevt
+  class EventLog
+    class Checkpoint
+      def self.read(path)
+        load(File.binread(path))
+      end
+
+      def self.from_bookmark(bookmark)
+        from_bookmark_xml(bookmark.render)
+      end
+
+      def to_bookmark
+        Winevt::EventLog::Bookmark.new(to_bookmark_xml)
+      end
+    end
+  end
+end
@@ -0,0 +1,29 @@
+module Winevt
+  class EventLog
+    class CompiledQuery
+      CACHE_SIZE = 256
+
+      @cache = {}
+      @cache_lock = Mutex.new
+
+      # Returns the compiled query of xpath. The compiled queries are
+      # shared by the same XPath so reopening Query or Subscribe with it
+      # does not validate and convert it again.
+      def self.compile(xpath)
+        key = xpath.to_s
+        @cache_lock.synchronize do
+          compiled = @cache.delete(key)
+          unless compiled
+            compiled = new(key)
+            @cache.shift if @cache.size >= CACHE_SIZE
+          end
+          @cache[key] = compiled
+        end
+      end
+
+      def self.clear_cache
+        @cache_lock.synchronize { @cache.clear }
+      end
+    end
+  end
+end
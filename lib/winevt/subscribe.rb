@@ -6,9 +6,9 @@ module Winevt
       def subscribe(path, query, bookmark = nil, session = nil)
         if bookmark.is_a?(Winevt::EventLog::Bookmark) &&
            session.is_a?(Winevt::EventLog::Session)
-          subscribe_raw(path, query, bookmark.render, session)
+          subscribe_raw(path, query, bookmark, session)
         elsif bookmark.is_a?(Winevt::EventLog::Bookmark)
-          subscribe_raw(path, query, bookmark.render)
+          subscribe_raw(path, query, bookmark)
         else
           subscribe_raw(path, query)
         end
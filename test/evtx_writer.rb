@@ -0,0 +1,240 @@
+require "zlib"
+
+# Build .evtx files for testing the native parser. The records are
+# written with a template as Windows does: the template definition is
+# placed in the first record which uses it in each chunk, and the
+# other records refer it by the offset.
+class EvtxWriter
+  FILE_HEADER_SIZE = 4096
+  CHUNK_SIZE = 65536
+  CHUNK_HEADER_SIZE = 512
+
+  module Type
+    NULL = 0x00
+    STRING = 0x01
+    UINT8 = 0x04
+    UINT16 = 0x06
+    UINT32 = 0x08
+    UINT64 = 0x0a
+    GUID = 0x0f
+    FILE_TIME = 0x11
+    SID = 0x13
+    HEX_INT64 = 0x15
+  end
+
+  EVENT_NAMESPACE = "http://schemas.microsoft.com/win/2004/08/events/event"
+
+  # [:element, name, {attribute => value}, children]. A value is a
+  # String or [:sub, index, type] or [:opt, index, type].
+  SYSTEM_TEMPLATE =
+    [:element, "Event", {"xmlns" => EVENT_NAMESPACE}, [
+       [:element, "System", {}, [
+          [:element, "Provider", {"Name" => [:sub, 0, Type::STRING],
+                                  "Guid" => [:opt, 1, Type::GUID]}, []],
+          [:element, "EventID", {"Qualifiers" => [:opt, 2, Type::UINT16]},
+           [[:sub, 3, Type::UINT16]]],
+          [:element, "Version", {}, [[:sub, 4, Type::UINT8]]],
+          [:element, "Level", {}, [[:sub, 5, Type::UINT8]]],
+          [:element, "Task", {}, [[:sub, 6, Type::UINT16]]],
+          [:element, "Opcode", {}, [[:sub, 7, Type::UINT8]]],
+          [:element, "Keywords", {}, [[:sub, 8, Type::HEX_INT64]]],
+          [:element, "TimeCreated", {"SystemTime" => [:sub, 9, Type::FILE_TIME]}, []],
+          [:element, "EventRecordID", {}, [[:sub, 10, Type::UINT64]]],
+          [:element, "Correlation", {"ActivityID" => [:opt, 11, Type::GUID]}, []],
+          [:element, "Execution", {"ProcessID" => [:sub, 12, Type::UINT32],
+                                   "ThreadID" => [:sub, 13, Type::UINT32]}, []],
+          [:element, "Channel", {}, [[:sub, 14, Type::STRING]]],
+          [:element, "Computer", {}, [[:sub, 15, Type::STRING]]],
+          [:element, "Security", {"UserID" => [:opt, 16, Type::SID]}, []],
+        ]],
+       [:element, "EventData", {}, [
+          [:element, "Data", {"Name" => "param1"}, [[:sub, 17, Type::STRING]]],
+          [:element, "Data", {"Name" => "param2"}, [[:opt, 18, Type::STRING]]],
+        ]],
+     ]]
+  SYSTEM_TEMPLATE_GUID = "{6B4A2A36-4D4E-4C50-9D1B-2F1E6C6A0001}"
+
+  Event = Struct.new(:provider, :provider_guid, :qualifiers, :event_id, :level,
+                     :keywords, :time, :process_id, :thread_id, :channel,
+                     :computer, :user_id, :data, keyword_init: true)
+
+  def initialize
+    @chunks = []
+  end
+
+  attr_reader :chunks
+
+  # Add a chunk with the events. Their EventRecordIDs start from
+  # first_record_id.
+  def add_chunk(first_record_id, events)
+    @chunks << build_chunk(first_record_id, events)
+    self
+  end
+
+  def add_empty_chunk
+    @chunks << ("\0" * CHUNK_SIZE).b
+    self
+  end
+
+  def to_s
+    header = ["ElfFile\0", 0, [@chunks.size - 1, 0].max, next_record_id,
+              128, 1, 3, FILE_HEADER_SIZE, @chunks.size].pack("a8Q<Q<Q<VvvvV")
+    header = header.ljust(120, "\0") + [0].pack("V")
+    header += [Zlib.crc32(header[0, 120])].pack("V")
+    header.ljust(FILE_HEADER_SIZE, "\0") + @chunks.join
+  end
+
+  def write(path)
+    File.binwrite(path, to_s)
+  end
+
+  def self.encode_guid(guid)
+    hex = guid.delete("{}-")
+    [hex[0, 8].to_i(16), hex[8, 4].to_i(16), hex[12, 4].to_i(16)].pack("Vvv") +
+      [hex[16, 16]].pack("H*")
+  end
+
+  def self.encode_sid(sid)
+    _, revision, authority, *sub_authorities = sid.split("-")
+    [revision.to_i, sub_authorities.size].pack("CC") +
+      [authority.to_i].pack("Q>")[2, 6] + sub_authorities.map(&:to_i).pack("V*")
+  end
+
+  def self.file_time(time)
+    (time.to_r * 10_000_000).to_i + 116_444_736_000_000_000
+  end
+
+  private
+
+  def next_record_id
+    @next_record_id ||= 1
+  end
+
+  def build_chunk(first_record_id, events)
+    data = "".b
+    template_offset = nil
+    offset = CHUNK_HEADER_SIZE
+    events.each_with_index do |event, i|
+      record_id = first_record_id + i
+      offset = CHUNK_HEADER_SIZE + data.bytesize
+      binxml, template_offset = record_binxml(offset + 24, event, record_id, template_offset)
+      size = 24 + binxml.bytesize + 4
+      data << ["**\0\0", size, record_id, EvtxWriter.file_time(event.time)].pack("a4VQ<Q<")
+      data << binxml << [size].pack("V")
+    end
+    last_record_id = first_record_id + events.size - 1
+    @next_record_id = [next_record_id, last_record_id + 1].max
+
+    free_space_offset = CHUNK_HEADER_SIZE + data.bytesize
+    header = ["ElfChnk\0", first_record_id, last_record_id, first_record_id, last_record_id,
+              128, offset, free_space_offset, Zlib.crc32(data)].pack("a8Q<Q<Q<Q<VVVV")
+    header = header.ljust(120, "\0") + [0].pack("V")
+    tables = "\0" * (CHUNK_HEADER_SIZE - 128)
+    header += [Zlib.crc32(tables, Zlib.crc32(header[0, 120]))].pack("V") + tables
+    (header + data).ljust(CHUNK_SIZE, "\0")
+  end
+
+  def record_binxml(offset, event, record_id, template_offset)
+    out = [0x0f, 1, 1, 0].pack("C*")
+    guid = EvtxWriter.encode_guid(SYSTEM_TEMPLATE_GUID)
+    out << [0x0c, 1, guid.unpack1("V")].pack("CCV")
+    if template_offset
+      out << [template_offset].pack("V")
+    else
+      template_offset = offset + out.bytesize + 4
+      out << [template_offset].pack("V")
+      body = [0x0f, 1, 1, 0].pack("C*")
+      body << element(template_offset + 24 + body.bytesize, SYSTEM_TEMPLATE)
+      body << "\0"
+      out << [0].pack("V") << guid << [body.bytesize].pack("V") << body
+    end
+    values = substitution_values(event, record_id)
+    out << [values.size].pack("V")
+    values.each do |type, value|
+      out << [value.bytesize, type, 0].pack("vCC")
+    end
+    values.each do |_, value|
+      out << value
+    end
+    out << "\0"
+    [out, template_offset]
+  end
+
+  def substitution_values(event, record_id)
+    optional = lambda do |type, value, &encode|
+      value.nil? ? [Type::NULL, "".b] : [type, encode.call(value)]
+    end
+    [
+      [Type::STRING, utf16(event.provider)],
+      optional.call(Type::GUID, event.provider_guid) { |v| EvtxWriter.encode_guid(v) },
+      optional.call(Type::UINT16, event.qualifiers) { |v| [v].pack("v") },
+      [Type::UINT16, [event.event_id].pack("v")],
+      [Type::UINT8, [0].pack("C")],
+      [Type::UINT8, [event.level].pack("C")],
+      [Type::UINT16, [0].pack("v")],
+      [Type::UINT8, [0].pack("C")],
+      [Type::HEX_INT64, [event.keywords].pack("Q<")],
+      [Type::FILE_TIME, [EvtxWriter.file_time(event.time)].pack("Q<")],
+      [Type::UINT64, [record_id].pack("Q<")],
+      [Type::NULL, "".b],
+      [Type::UINT32, [event.process_id].pack("V")],
+      [Type::UINT32, [event.thread_id].pack("V")],
+      [Type::STRING, utf16(event.channel)],
+      [Type::STRING, utf16(event.computer)],
+      optional.call(Type::SID, event.user_id) { |v| EvtxWriter.encode_sid(v) },
+      [Type::STRING, utf16(event.data[0])],
+      optional.call(Type::STRING, event.data[1]) { |v| utf16(v) },
+    ]
+  end
+
+  def utf16(string)
+    string.encode("UTF-16LE").b
+  end
+
+  # The names are placed in the template definition.
+  def name(offset, string)
+    chars = utf16(string)
+    [offset + 4, 0, 0, string.size].pack("VVvv") + chars + "\0\0"
+  end
+
+  def element(offset, node)
+    _, element_name, attributes, children = node
+    out = [attributes.empty? ? 0x01 : 0x41, 0xffff, 0].pack("CvV")
+    out << name(offset + out.bytesize, element_name)
+    unless attributes.empty?
+      attribute_list_offset = out.bytesize
+      out << [0].pack("V")
+      attributes.each_with_index do |(attribute, value), i|
+        out << [i == attributes.size - 1 ? 0x06 : 0x46].pack("C")
+        out << name(offset + out.bytesize, attribute)
+        out << value_tokens(value)
+      end
+      out[attribute_list_offset, 4] = [out.bytesize - attribute_list_offset - 4].pack("V")
+    end
+    if children.empty?
+      out << [0x03].pack("C")
+    else
+      out << [0x02].pack("C")
+      children.each do |child|
+        if child.is_a?(Array) && child.first == :element
+          out << element(offset + out.bytesize, child)
+        else
+          out << value_tokens(child)
+        end
+      end
+      out << [0x04].pack("C")
+    end
+    out[3, 4] = [out.bytesize - 7].pack("V")
+    out
+  end
+
+  def value_tokens(value)
+    case value
+    when String
+      [0x05, Type::STRING, value.size].pack("CCv") + utf16(value)
+    else
+      kind, index, type = value
+      [kind == :opt ? 0x0e : 0x0d, index, type].pack("CvC")
+    end
+  end
+end
@@ -0,0 +1,66 @@
+require_relative 'helper'
+
+class AggregatorTest < Test::Unit::TestCase
+  Aggregator = Winevt::EventLog::Aggregator
+
+  def test_default_fields
+    aggregator = Aggregator.new
+    aggregator.add(Time.utc(2024, 1, 1), "Application Error", 1000, 2)
+    aggregator.add(Time.utc(2024, 1, 2), "Application Error", 1000, 2)
+    aggregator.add(Time.utc(2024, 1, 2), "Application Error", 1001, 4, 3)
+    assert_equal({["Application Error", 1000, 2] => 2,
+                  ["Application Error", 1001, 4] => 3},
+                 aggregator.result)
+    assert_equal(2, aggregator.size)
+  end
+
+  def test_zero_count
+    aggregator = Aggregator.new
+    aggregator.add(Time.utc(2024, 1, 1), "A", 1, 2, 0)
+    aggregator.add(Time.utc(2024, 1, 1), "B", 1, 2, 0)
+    aggregator.add(Time.utc(2024, 1, 1), "A", 1, 2)
+    assert_equal({["A", 1, 2] => 1}, aggregator.result)
+    assert_equal(1, aggregator.size)
+  end
+
+  def test_bucket
+    aggregator = Aggregator.new(by: [:level], bucket: 60)
+    from = Time.utc(2024, 1, 1)
+    [0, 30, 59, 60, 61, 3600].each do |offset|
+      aggregator.add(from + offset, "Provider", 1, 4)
+    end
+    assert_equal({[from, 4] => 3, [from + 60, 4] => 2, [from + 3600, 4] => 1},
+                 aggregator.result)
+  end
+
+  def test_fields_order
+    aggregator = Aggregator.new(by: [:level, :provider])
+    aggregator.add(Time.now, "A", 1, 4)
+    aggregator.add(Time.now, "A", 2, 4)
+    assert_equal({[4, "A"] => 2}, aggregator.result)
+  end
+
+  def test_many_keys
+    aggregator = Aggregator.new(by: [:provider, :event_id])
+    1000.times do |i|
+      aggregator.add(Time.now, "Provider#{i % 10}", i, 0)
+      aggregator.add(Time.now, "Provider#{i % 10}", i, 0)
+    end
+    result = aggregator.result
+    assert_equal(1000, result.size)
+    assert_equal([2], result.values.uniq)
+    assert_equal(2, result[["Provider7", 997]])
+  end
+
+  def test_invalid_options
+    assert_raise(ArgumentError) do
+      Aggregator.new(by: [:channel])
+    end
+    assert_raise(ArgumentError) do
+      Aggregator.new(by: [:level, :level])
+    end
+    assert_raise(ArgumentError) do
+      Aggregator.new(bucket: 0)
+    end
+  end
+end
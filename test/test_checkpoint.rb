@@ -0,0 +1,94 @@
+require_relative 'helper'
+require 'tmpdir'
+
+class CheckpointTest < Test::Unit::TestCase
+  BOOKMARK_XML = <<~XML.chomp
+    <BookmarkList>
+      <Bookmark Channel='Application' RecordId='1234'/>
+      <Bookmark Channel='Security' RecordId='98765' IsCurrent='true'/>
+    </BookmarkList>
+  XML
+
+  def setup
+    @checkpoint = Winevt::EventLog::Checkpoint.new
+  end
+
+  def test_update
+    assert_nil(@checkpoint["Application"])
+    assert_nil(@checkpoint.current)
+    @checkpoint.update("Application", 10)
+    @checkpoint.update("System", 20)
+    @checkpoint.update("Application", 11)
+    assert_equal(11, @checkpoint["Application"])
+    assert_equal(["Application", "System"], @checkpoint.channels)
+    assert_equal("Application", @checkpoint.current)
+    assert_equal(2, @checkpoint.size)
+    assert_equal({"Application" => 11, "System" => 20}, @checkpoint.to_h)
+  end
+
+  def test_dump_and_load
+    @checkpoint.update("Application", 2**63 + 1)
+    @checkpoint.update("Microsoft-Windows-Sysmon/Operational", 42)
+    data = @checkpoint.dump
+    assert_equal(Encoding::ASCII_8BIT, data.encoding)
+    loaded = Winevt::EventLog::Checkpoint.load(data)
+    assert_equal(@checkpoint.to_h, loaded.to_h)
+    assert_equal("Microsoft-Windows-Sysmon/Operational", loaded.current)
+  end
+
+  def test_load_broken_data
+    @checkpoint.update("Application", 1)
+    data = @checkpoint.dump
+    assert_raise(ArgumentError) do
+      Winevt::EventLog::Checkpoint.load(data[0, data.size - 1])
+    end
+    data.setbyte(14, data.getbyte(14) ^ 1)
+    assert_raise(ArgumentError) do
+      Winevt::EventLog::Checkpoint.load(data)
+    end
+    assert_raise(ArgumentError) do
+      Winevt::EventLog::Checkpoint.load("")
+    end
+  end
+
+  def test_from_bookmark_xml
+    checkpoint = Winevt::EventLog::Checkpoint.from_bookmark_xml(BOOKMARK_XML)
+    assert_equal({"Application" => 1234, "Security" => 98765}, checkpoint.to_h)
+    assert_equal("Security", checkpoint.current)
+
+    empty = Winevt::EventLog::Checkpoint.from_bookmark_xml("<BookmarkList>\r\n</BookmarkList>")
+    assert_equal(0, empty.size)
+  end
+
+  def test_to_bookmark_xml
+    @checkpoint.update("A&B's", 7)
+    @checkpoint.update("Security", 8)
+    @checkpoint.update("A&B's", 9)
+    xml = @checkpoint.to_bookmark_xml
+    assert_equal("<BookmarkList>\r\n" \
+                 "  <Bookmark Channel='A&amp;B&apos;s' RecordId='9' IsCurrent='true'/>\r\n" \
+                 "  <Bookmark Channel='Security' RecordId='8'/>\r\n" \
+                 "</BookmarkList>", xml)
+    roundtrip = Winevt::EventLog::Checkpoint.from_bookmark_xml(xml)
+    assert_equal(@checkpoint.to_h, roundtrip.to_h)
+    assert_equal("A&B's", roundtrip.current)
+  end
+
+  def test_write_and_read
+    @checkpoint.update("Application", 100)
+    Dir.mktmpdir do |dir|
+      path = File.join(dir, "application.checkpoint")
+      @checkpoint.write(path)
+      @checkpoint.update("Application", 101)
+      @checkpoint.write(path)
+      assert_equal([File.basename(path)], Dir.children(dir))
+      assert_equal(101, Winevt::EventLog::Checkpoint.read(path)["Application"])
+    end
+  end
+
+  def test_write_error
+    assert_raise(Errno::ENOENT) do
+      @checkpoint.write(File.join(Dir.tmpdir, "missing-#{$$}", "checkpoint"))
+    end
+  end
+end
@@ -0,0 +1,129 @@
+require_relative 'helper'
+require 'fileutils'
+require 'timeout'
+require 'tmpdir'
+
+class CheckpointWriterTest < Test::Unit::TestCase
+  # Stands in for Subscribe, which provides its checkpoint.
+  FakeSubscribe = Struct.new(:checkpoint)
+  # Stands in for SubscribeGroup, which provides its subscriptions.
+  FakeGroup = Struct.new(:subscriptions)
+
+  def setup
+    @dir = Dir.mktmpdir
+    @path = File.join(@dir, "checkpoint")
+    @checkpoint = Winevt::EventLog::Checkpoint.new
+  end
+
+  def teardown
+    @writer.close if @writer && !@writer.closed?
+    FileUtils.remove_entry(@dir)
+  end
+
+  def read_checkpoint
+    Winevt::EventLog::Checkpoint.read(@path)
+  end
+
+  def test_flush
+    @writer = Winevt::EventLog::CheckpointWriter.new(@path, nil)
+    assert_equal(@path, @writer.path)
+    assert_nil(@writer.interval)
+    @checkpoint.update("Application", 1)
+    @writer.update(@checkpoint)
+    assert_false(File.exist?(@path))
+    @writer.flush
+    assert_equal(1, read_checkpoint["Application"])
+    assert_equal(1, @writer.written_count)
+  end
+
+  def test_coalesce_updates
+    @writer = Winevt::EventLog::CheckpointWriter.new(@path, nil)
+    10.times do |i|
+      @checkpoint.update("Application", i)
+      @writer.update(@checkpoint)
+    end
+    @writer.flush
+    assert_equal(9, read_checkpoint["Application"])
+    assert_equal(1, @writer.written_count)
+  end
+
+  def test_interval
+    @writer = Winevt::EventLog::CheckpointWriter.new(@path, 0.05)
+    assert_equal(0.05, @writer.interval)
+    @checkpoint.update("Application", 5)
+    @writer.update(@checkpoint)
+    Timeout.timeout(5) do
+      sleep 0.01 until File.exist?(@path)
+    end
+    assert_equal(5, read_checkpoint["Application"])
+  end
+
+  def test_persist
+    @writer = Winevt::EventLog::CheckpointWriter.new(@path, nil)
+    @checkpoint.update("Application", 3)
+    @writer.update(@checkpoint).persist
+    Timeout.timeout(5) do
+      sleep 0.01 until File.exist?(@path)
+    end
+    assert_equal(3, read_checkpoint["Application"])
+  end
+
+  def test_flush_while_writing
+    @writer = Winevt::EventLog::CheckpointWriter.new(@path, nil)
+    # persist starts a write and flush is requested while it runs.
+    Timeout.timeout(30) do
+      500.times do |i|
+        @checkpoint.update("Application", i * 2)
+        @writer.update(@checkpoint).persist
+        @checkpoint.update("Application", i * 2 + 1)
+        @writer.update(@checkpoint).flush
+        assert_equal(i * 2 + 1, read_checkpoint["Application"])
+      end
+    end
+  end
+
+  def test_update_from_sources
+    @writer = Winevt::EventLog::CheckpointWriter.new(@path, nil)
+    security = Winevt::EventLog::Checkpoint.new.update("Security", 20)
+    @checkpoint.update("Application", 10)
+    @writer.update(FakeSubscribe.new(@checkpoint)).flush
+    assert_equal({"Application" => 10}, read_checkpoint.to_h)
+    @writer.update(FakeGroup.new([FakeSubscribe.new(@checkpoint),
+                                  FakeSubscribe.new(security)])).flush
+    assert_equal({"Application" => 10, "Security" => 20}, read_checkpoint.to_h)
+    assert_raise(TypeError) do
+      @writer.update(Object.new)
+    end
+  end
+
+  def test_close_writes_pending_snapshot
+    @writer = Winevt::EventLog::CheckpointWriter.new(@path, 60)
+    @checkpoint.update("Application", 7)
+    @writer.update(@checkpoint)
+    @writer.close
+    assert_true(@writer.closed?)
+    assert_equal(7, read_checkpoint["Application"])
+    assert_raise(IOError) do
+      @writer.update(@checkpoint)
+    end
+    assert_nil(@writer.close)
+  end
+
+  def test_write_error
+    @writer = Winevt::EventLog::CheckpointWriter.new(File.join(@dir, "missing", "checkpoint"), nil)
+    @writer.update(@checkpoint)
+    assert_raise(Errno::ENOENT) do
+      @writer.flush
+    end
+    # The snapshot is kept and retried until the writer is closed.
+    assert_raise(Errno::ENOENT) do
+      @writer.close
+    end
+  end
+
+  def test_invalid_interval
+    assert_raise(ArgumentError) do
+      Winevt::EventLog::CheckpointWriter.new(@path, 0)
+    end
+  end
+end
@@ -0,0 +1,67 @@
+require_relative 'helper'
+
+class CompiledQueryTest < Test::Unit::TestCase
+  CompiledQuery = Winevt::EventLog::CompiledQuery
+
+  def test_valid_xpath
+    ["*",
+     "Event/System[EventID=4624]",
+     "*[System[(Level=1 or Level=2) and (EventID != 7036)]]",
+     "*[System[Provider[@Name='Service Control Manager'] and band(Keywords, 0x8000000000000000)]]",
+     "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]",
+     "*[EventData[Data[@Name=\"param1\"]=\"running\"]]",
+    ].each do |xpath|
+      query = CompiledQuery.new(xpath)
+      assert_equal(xpath, query.to_s)
+      assert_true(query.to_s.frozen?)
+      assert_false(query.structured?)
+      assert_equal(xpath.encode("UTF-16LE").bytesize / 2, query.wide_length)
+    end
+  end
+
+  def test_invalid_xpath
+    ["",
+     "*[System[EventID=1",
+     "*[System[Level=]]",
+     "*[System[EventID=1]] and",
+     "*[System[unknown(Level)]]",
+     "*[System[Provider[@Name='SCM]]]",
+    ].each do |xpath|
+      assert_raise(CompiledQuery::Error, xpath) do
+        CompiledQuery.new(xpath)
+      end
+    end
+    assert_kind_of(ArgumentError, CompiledQuery::Error.new)
+    assert_raise(TypeError) do
+      CompiledQuery.new(nil)
+    end
+  end
+
+  def test_structured_query
+    xml = <<~XML
+      <QueryList>
+        <Query Id="0" Path="Application">
+          <Select Path="Application">*[System[Level&lt;=3]]</Select>
+          <Suppress Path="Application">*[System[EventID=1]]</Suppress>
+        </Query>
+      </QueryList>
+    XML
+    query = CompiledQuery.new(xml)
+    assert_true(query.structured?)
+    assert_raise(CompiledQuery::Error) do
+      CompiledQuery.new(xml.sub("EventID=1", "EventID="))
+    end
+    assert_raise(CompiledQuery::Error) do
+      CompiledQuery.new("<QueryList><Query Id=\"0\"></Query></QueryList>")
+    end
+  end
+
+  def test_compile_cache
+    CompiledQuery.clear_cache
+    query = CompiledQuery.compile("*[System[EventID=1]]")
+    assert_same(query, CompiledQuery.compile("*[System[EventID=1]]"))
+    assert_not_same(query, CompiledQuery.compile("*[System[EventID=2]]"))
+    CompiledQuery.clear_cache
+    assert_not_same(query, CompiledQuery.compile("*[System[EventID=1]]"))
+  end
+end
@@ -0,0 +1,79 @@
+require_relative 'helper'
+
+class DeduplicatorTest < Test::Unit::TestCase
+  Deduplicator = Winevt::EventLog::Deduplicator
+
+  def test_xxh64
+    assert_equal(0xef46db3751d8e999, Deduplicator.xxh64(""))
+    assert_equal(0xfbcea83c8a378bf1, Deduplicator.xxh64("Nobody inspects the spammish repetition"))
+  end
+
+  def test_add
+    deduplicator = Deduplicator.new
+    assert_equal(65536, deduplicator.capacity)
+    assert_nil(deduplicator.window)
+    assert_true(deduplicator.add?("Application", 1))
+    assert_true(deduplicator.add?("System", 1))
+    assert_true(deduplicator.add?("Application", 2))
+    assert_false(deduplicator.add?("Application", 1))
+    assert_equal([3, 1], [deduplicator.size, deduplicator.duplicates])
+
+    xml = "<Event><System><Provider Name='Application Error'/></System></Event>"
+    assert_true(deduplicator.add_xml?(xml))
+    assert_false(deduplicator.add_xml?(xml.dup))
+    assert_true(deduplicator.add_xml?(xml.sub("Error", "Hang")))
+
+    deduplicator.clear
+    assert_equal(0, deduplicator.size)
+    assert_true(deduplicator.add?("Application", 1))
+  end
+
+  def test_capacity
+    deduplicator = Deduplicator.new(capacity: 3)
+    (1..3).each { |i| assert_true(deduplicator.add?("System", i)) }
+    assert_false(deduplicator.add?("System", 1))
+    # The oldest one is forgotten.
+    assert_true(deduplicator.add?("System", 4))
+    assert_true(deduplicator.add?("System", 1))
+    assert_false(deduplicator.add?("System", 3))
+    assert_equal(3, deduplicator.size)
+
+    random = Random.new(42)
+    deduplicator = Deduplicator.new(capacity: 16)
+    remembered = []
+    expected = []
+    actual = []
+    5000.times do
+      id = random.rand(48)
+      expected << !remembered.include?(id)
+      if expected.last
+        remembered.shift if remembered.size == 16
+        remembered << id
+      end
+      actual << deduplicator.add?("System", id)
+    end
+    assert_equal(expected, actual)
+  end
+
+  def test_window
+    deduplicator = Deduplicator.new(window: 0.2)
+    assert_equal(0.2, deduplicator.window)
+    assert_true(deduplicator.add?("System", 1))
+    assert_false(deduplicator.add?("System", 1))
+    sleep(0.3)
+    assert_true(deduplicator.add?("System", 1))
+    assert_equal(1, deduplicator.size)
+  end
+
+  def test_invalid_options
+    assert_raise(ArgumentError) do
+      Deduplicator.new(capacity: 0)
+    end
+    assert_raise(ArgumentError) do
+      Deduplicator.new(window: 0)
+    end
+    assert_raise(ArgumentError) do
+      Deduplicator.new(size: 1)
+    end
+  end
+end
@@ -0,0 +1,217 @@
+require_relative 'helper'
+require_relative 'evtx_writer'
+require 'fileutils'
+require 'tmpdir'
+
+class EvtxFileTest < Test::Unit::TestCase
+  EvtxFile = Winevt::EventLog::EvtxFile
+
+  def setup
+    @dir = Dir.mktmpdir
+    @path = File.join(@dir, "System.evtx")
+  end
+
+  def teardown
+    FileUtils.remove_entry(@dir)
+  end
+
+  def event(i, **options)
+    EvtxWriter::Event.new(provider: "Service Control Manager",
+                          provider_guid: "{555908D1-A6D7-4695-8E1E-26931D2012F4}",
+                          qualifiers: 16384, event_id: 7036, level: 4,
+                          keywords: 0x8080000000000000,
+                          time: Time.utc(2024, 1, 2, 3, 4, 5) + i + 0.1234567r,
+                          process_id: 720, thread_id: 1604, channel: "System",
+                          computer: "host.example", user_id: "S-1-5-18",
+                          data: ["Service #{i}", "running"], **options)
+  end
+
+  def write_evtx
+    writer = EvtxWriter.new
+    yield writer
+    writer.write(@path)
+  end
+
+  def test_each_renders_xml
+    write_evtx do |writer|
+      writer.add_chunk(1, [event(0, qualifiers: nil, data: ["Tom & Jerry's <1>", nil])])
+    end
+    evtx = EvtxFile.new(@path)
+    eventlogs = evtx.each.to_a
+    assert_equal(1, eventlogs.size)
+    xml, message, string_inserts = eventlogs.first
+    assert_equal("<Event xmlns='http://schemas.microsoft.com/win/2004/08/events/event'>" +
+                 "<System><Provider Name='Service Control Manager' Guid='{555908D1-A6D7-4695-8E1E-26931D2012F4}'/>" +
+                 "<EventID>7036</EventID><Version>0</Version><Level>4</Level><Task>0</Task><Opcode>0</Opcode>" +
+                 "<Keywords>0x8080000000000000</Keywords><TimeCreated SystemTime='2024-01-02T03:04:05.1234567Z'/>" +
+                 "<EventRecordID>1</EventRecordID><Correlation/><Execution ProcessID='720' ThreadID='1604'/>" +
+                 "<Channel>System</Channel><Computer>host.example</Computer><Security UserID='S-1-5-18'/></System>" +
+                 "<EventData><Data Name='param1'>Tom &amp; Jerry&apos;s &lt;1&gt;</Data><Data Name='param2'></Data></EventData>" +
+                 "</Event>",
+                 xml)
+    assert_equal(Encoding::UTF_8, xml.encoding)
+    assert_equal("", message)
+    assert_equal(["Tom & Jerry's <1>", nil], string_inserts)
+  end
+
+  def test_system_values
+    write_evtx do |writer|
+      writer.add_chunk(1, [event(0), event(1, provider_guid: nil, user_id: nil)])
+    end
+    evtx = EvtxFile.new(@path)
+    evtx.render_as_xml = false
+    first, second = evtx.each.map { |eventlog, _, _| eventlog }
+    assert_equal({"ProviderName" => "Service Control Manager",
+                  "ProviderGuid" => "{555908D1-A6D7-4695-8E1E-26931D2012F4}",
+                  "EventID" => (16384 << 16) | 7036,
+                  "Version" => 0,
+                  "Level" => 4,
+                  "Task" => 0,
+                  "Opcode" => 0,
+                  "Keywords" => "0x8080000000000000",
+                  "TimeCreated" => "2024/01/02 03:04:05.123456700",
+                  "EventRecordID" => "1",
+                  "ProcessID" => 720,
+                  "ThreadID" => 1604,
+                  "Channel" => "System",
+                  "Computer" => "host.example",
+                  "UserID" => "S-1-5-18"},
+                 first)
+    assert_nil(second["ProviderGuid"])
+    assert_false(second.key?("UserID"))
+
+    evtx.preserve_qualifiers = true
+    evtx.preserve_sid = false
+    first = evtx.each.first.first
+    assert_equal([16384, 7036], first.values_at("Qualifiers", "EventID"))
+    assert_false(first.key?("UserID"))
+  end
+
+  def test_records_are_ordered_by_record_id
+    write_evtx do |writer|
+      writer.add_chunk(4, (3..5).map { |i| event(i) })
+      writer.add_chunk(1, (0..2).map { |i| event(i) })
+      writer.add_empty_chunk
+    end
+    evtx = EvtxFile.new(@path)
+    evtx.render_as_xml = false
+    assert_equal(3, evtx.chunk_count)
+    assert_equal(7, evtx.next_record_id)
+    assert_equal(%w[1 2 3 4 5 6], evtx.each.map { |eventlog, _, _| eventlog["EventRecordID"] })
+    assert_equal(0, evtx.corrupted_chunks)
+  end
+
+  def test_corrupted_chunk_is_skipped
+    write_evtx do |writer|
+      writer.add_chunk(1, [event(0)])
+      writer.add_chunk(2, [event(1)])
+    end
+    data = File.binread(@path)
+    data.setbyte(EvtxWriter::FILE_HEADER_SIZE + 600, data.getbyte(EvtxWriter::FILE_HEADER_SIZE + 600) ^ 0xff)
+    File.binwrite(@path, data)
+
+    evtx = EvtxFile.new(@path)
+    evtx.render_as_xml = false
+    assert_equal(["2"], evtx.each.map { |eventlog, _, _| eventlog["EventRecordID"] })
+    assert_equal(1, evtx.corrupted_chunks)
+  end
+
+  def test_workers
+    write_evtx do |writer|
+      (0...12).to_a.shuffle(random: Random.new(42)).each do |i|
+        writer.add_chunk(i * 10 + 1, (0...10).map { |j| event(i * 10 + j) })
+      end
+    end
+    evtx = EvtxFile.new(@path)
+    expected = evtx.each.to_a
+    assert_equal((1..120).map(&:to_s), expected.map { |xml, _, _| xml[/<EventRecordID>(\d+)</, 1] })
+
+    evtx.workers = 4
+    assert_equal(4, evtx.workers)
+    assert_equal(expected, evtx.each.to_a)
+    assert_equal(expected.first(15), evtx.each.first(15))
+
+    assert_raise(IOError) do
+      evtx.each do
+        evtx.close
+      end
+    end
+  end
+
+  def test_record_range
+    write_evtx do |writer|
+      writer.add_chunk(1, (0..4).map { |i| event(i) })
+      writer.add_chunk(6, (5..9).map { |i| event(i) })
+      writer.add_chunk(11, (10..14).map { |i| event(i) })
+    end
+    evtx = EvtxFile.new(@path)
+    evtx.render_as_xml = false
+    assert_nil(evtx.record_range)
+
+    [1, 3].each do |workers|
+      evtx.workers = workers
+      evtx.record_range = 4...12
+      assert_equal(4..11, evtx.record_range)
+      assert_equal((4..11).map(&:to_s), evtx.each.map { |eventlog, _, _| eventlog["EventRecordID"] })
+      evtx.record_range = (13..)
+      assert_equal(%w[13 14 15], evtx.each.map { |eventlog, _, _| eventlog["EventRecordID"] })
+    end
+    evtx.record_range = nil
+    assert_equal(15, evtx.each.count)
+
+    assert_raise(ArgumentError) do
+      evtx.record_range = 5..4
+    end
+    assert_raise(ArgumentError) do
+      evtx.workers = 0
+    end
+  end
+
+  def test_template_cache
+    write_evtx do |writer|
+      writer.add_chunk(1, (0..2).map { |i| event(i, user_id: nil) })
+      writer.add_chunk(4, (3..5).map { |i| event(i, qualifiers: nil, data: ["Service #{i}", nil]) })
+    end
+    evtx = EvtxFile.new(@path)
+    cache = evtx.template_cache
+    assert_kind_of(EvtxFile::TemplateCache, cache)
+    eventlogs = evtx.each.to_a
+    assert_equal([1, 1, 1], [cache.size, cache.misses, cache.hits])
+
+    evtx.template_cache = nil
+    assert_equal(eventlogs, evtx.each.to_a)
+
+    other = EvtxFile.new(@path)
+    other.template_cache = cache
+    other.workers = 2
+    assert_equal(eventlogs, other.each.to_a)
+    assert_equal([1, 1, 3], [cache.size, cache.misses, cache.hits])
+
+    assert_raise(TypeError) do
+      evtx.template_cache = Object.new
+    end
+  end
+
+  def test_invalid_file
+    File.binwrite(@path, "ElfFile\0".ljust(4096, "\0"))
+    assert_raise(EvtxFile::Error) do
+      EvtxFile.new(@path)
+    end
+    assert_raise(Errno::ENOENT) do
+      EvtxFile.new(File.join(@dir, "missing.evtx"))
+    end
+  end
+
+  def test_close
+    write_evtx do |writer|
+      writer.add_chunk(1, [event(0)])
+    end
+    evtx = EvtxFile.new(@path)
+    assert_false(evtx.closed?)
+    evtx.close
+    assert_true(evtx.closed?)
+    assert_raise(IOError) do
+      evtx.each.to_a
+    end
+  end
+end
@@ -0,0 +1,128 @@
+require_relative 'helper'
+require_relative 'evtx_writer'
+require 'fileutils'
+require 'tmpdir'
+
+class EvtxTailTest < Test::Unit::TestCase
+  EvtxTail = Winevt::EventLog::EvtxTail
+
+  def setup
+    @dir = Dir.mktmpdir
+    @path = File.join(@dir, "Security.evtx")
+  end
+
+  def teardown
+    FileUtils.remove_entry(@dir)
+  end
+
+  def events(record_ids)
+    record_ids.map do |i|
+      EvtxWriter::Event.new(provider: "Microsoft-Windows-Security-Auditing",
+                            provider_guid: "{54849625-5478-4994-A5BA-3E3B0328C30D}",
+                            event_id: 4624, level: 0, keywords: 0x8020000000000000,
+                            time: Time.utc(2024, 1, 2) + i, process_id: 4, thread_id: 8,
+                            channel: "Security", computer: "host.example",
+                            data: ["S-1-5-18", "user#{i}"])
+    end
+  end
+
+  def write_evtx(chunks)
+    writer = EvtxWriter.new
+    chunks.each do |record_ids|
+      writer.add_chunk(record_ids.first, events(record_ids))
+    end
+    writer.write(@path)
+  end
+
+  def record_ids(tail)
+    tail.each.map { |eventlog, _, _| eventlog["EventRecordID"].to_i }
+  end
+
+  def test_each_reads_changed_chunks
+    write_evtx([1..5, 6..8])
+    tail = EvtxTail.new(@path)
+    tail.render_as_xml = false
+    assert_equal((1..8).to_a, record_ids(tail))
+    assert_equal([8, 2], [tail.last_record_id, tail.changed_chunks])
+
+    assert_equal([], record_ids(tail))
+    assert_equal(2, tail.changed_chunks)
+
+    # The last chunk is appended and a new chunk is added.
+    write_evtx([1..5, 6..10, 11..12])
+    assert_equal((9..12).to_a, record_ids(tail))
+    assert_equal([12, 4], [tail.last_record_id, tail.changed_chunks])
+
+    # The oldest chunk is reused.
+    write_evtx([13..14, 6..10, 11..12])
+    assert_equal([13, 14], record_ids(tail))
+    assert_equal(5, tail.changed_chunks)
+    assert_equal(0, tail.corrupted_chunks)
+  end
+
+  def test_last_record_id
+    write_evtx([1..5, 6..8])
+    tail = EvtxTail.new(@path)
+    tail.render_as_xml = false
+    tail.last_record_id = 6
+    assert_equal([7, 8], record_ids(tail))
+    assert_equal(1, tail.changed_chunks)
+
+    records = []
+    tail.last_record_id = 0
+    tail.each do |eventlog, _, _|
+      records << eventlog
+      break if records.size == 3
+    end
+    assert_equal(3, tail.last_record_id)
+    assert_equal((4..8).to_a, record_ids(tail))
+  end
+
+  def test_file_rewritten_while_yielding
+    write_evtx([1..5, 6..8, 9..10])
+    tail = EvtxTail.new(@path)
+    tail.render_as_xml = false
+
+    # The copy job truncates and rewrites the file in the block.
+    yielded = tail.each.map do |eventlog, _, _|
+      write_evtx([11..12]) if eventlog["EventRecordID"] == "1"
+      eventlog["EventRecordID"].to_i
+    end
+    assert_equal((1..5).to_a, yielded)
+    assert_equal(5, tail.last_record_id)
+    assert_equal((11..12).to_a, record_ids(tail))
+
+    write_evtx([11..15, 16..18])
+    yielded = tail.each.map do |eventlog, _, _|
+      File.binwrite(@path, "") if eventlog["EventRecordID"] == "13"
+      eventlog["EventRecordID"].to_i
+    end
+    assert_equal((13..15).to_a, yielded)
+    write_evtx([11..15, 16..18])
+    assert_equal((16..18).to_a, record_ids(tail))
+  end
+
+  def test_partially_copied_file
+    write_evtx([1..5, 6..8])
+    data = File.binread(@path)
+    tail = EvtxTail.new(@path)
+    tail.render_as_xml = false
+
+    # The second chunk is in the middle of copying.
+    File.binwrite(@path, data[0, EvtxWriter::FILE_HEADER_SIZE + EvtxWriter::CHUNK_SIZE] +
+                         data[EvtxWriter::FILE_HEADER_SIZE + EvtxWriter::CHUNK_SIZE, 1024].ljust(EvtxWriter::CHUNK_SIZE, "\0"))
+    assert_equal((1..5).to_a, record_ids(tail))
+    assert_equal(1, tail.corrupted_chunks)
+
+    File.binwrite(@path, "")
+    assert_equal([], record_ids(tail))
+
+    File.binwrite(@path, data)
+    assert_equal((6..8).to_a, record_ids(tail))
+
+    FileUtils.rm(@path)
+    assert_raise(Errno::ENOENT) do
+      tail.each.to_a
+    end
+  end
+end
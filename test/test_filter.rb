@@ -0,0 +1,98 @@
+require_relative 'helper'
+
+class FilterTest < Test::Unit::TestCase
+  Filter = Winevt::EventLog::Filter
+
+  EVENT_ID = "Event/System/EventID"
+  IP_ADDRESS = "Event/EventData/Data[@Name='IpAddress']"
+  TIME_CREATED = "Event/System/TimeCreated/@SystemTime"
+
+  def test_paths
+    filter = Filter.new([[EVENT_ID, :in, [4624, 4625]],
+                         [IP_ADDRESS, :prefix, "10."],
+                         [EVENT_ID, :range, 4000..4999]])
+    assert_equal([EVENT_ID, IP_ADDRESS], filter.paths)
+    assert_true(filter.paths.frozen?)
+    assert_equal(3, filter.size)
+    assert_true(filter.match?(EVENT_ID => 4624, IP_ADDRESS => "10.0.0.1"))
+    assert_false(filter.match?(EVENT_ID => 4634, IP_ADDRESS => "10.0.0.1"))
+    assert_false(filter.match?(EVENT_ID => 4624, IP_ADDRESS => "192.168.0.1"))
+    assert_false(filter.match?(EVENT_ID => 4624))
+    assert_true(Filter.new([]).match?({}))
+  end
+
+  def test_equals
+    filter = Filter.new([["a", :equals, "Service Control Manager"], ["b", :equals, -1]])
+    assert_true(filter.match?("a" => "Service Control Manager", "b" => -1))
+    assert_false(filter.match?("a" => "service control manager", "b" => -1))
+    assert_false(filter.match?("a" => "Service Control Manager", "b" => 2**64 - 1))
+    assert_false(Filter.new([["a", :equals, "1"]]).match?("a" => 1))
+    assert_true(Filter.new([["a", :equals, 2**64 - 1]]).match?("a" => 2**64 - 1))
+  end
+
+  def test_in
+    filter = Filter.new([["a", :in, [1, "2", nil]]])
+    assert_true(filter.match?("a" => 1))
+    assert_true(filter.match?("a" => "2"))
+    assert_false(filter.match?("a" => 2))
+    assert_false(filter.match?("a" => nil))
+  end
+
+  def test_range
+    filter = Filter.new([["a", :range, -10...10]])
+    assert_true(filter.match?("a" => -10))
+    assert_true(filter.match?("a" => 9))
+    assert_false(filter.match?("a" => 10))
+    assert_false(filter.match?("a" => "5"))
+    assert_true(Filter.new([["a", :range, (5..)]]).match?("a" => 2**64 - 1))
+    assert_true(Filter.new([["a", :range, ..-5]]).match?("a" => -2**63))
+
+    time = Time.utc(2024, 1, 2, 3, 4, 5)
+    filter = Filter.new([[TIME_CREATED, :range, time...(time + 60)]])
+    assert_true(filter.match?(TIME_CREATED => time + 0.5))
+    assert_false(filter.match?(TIME_CREATED => time + 60))
+    # FILETIME of the time
+    assert_true(filter.match?(TIME_CREATED => 133486382450000000))
+  end
+
+  def test_strings
+    filter = Filter.new([["a", :substring, "日本"], ["b", :prefix, "ab"]])
+    assert_true(filter.match?("a" => "xx日本yy", "b" => "abc"))
+    assert_true(filter.match?("a" => "日本".encode("UTF-16LE"), "b" => "ab"))
+    assert_false(filter.match?("a" => "日", "b" => "abc"))
+    assert_false(filter.match?("a" => "xx日本yy", "b" => "a"))
+    assert_false(filter.match?("a" => 1, "b" => "abc"))
+  end
+
+  def test_regex
+    filter = Filter.new([[IP_ADDRESS, :regex, /\A10\.\d+\.\d+\.\d+\z/]])
+    assert_true(filter.match?(IP_ADDRESS => "10.1.2.3"))
+    assert_false(filter.match?(IP_ADDRESS => "110.1.2.3"))
+    assert_false(filter.match?(IP_ADDRESS => 10))
+    assert_true(Filter.new([["a", :regex, /ü+x/i]]).match?("a" => "-ÜüX-"))
+  end
+
+  def test_invalid_predicates
+    assert_raise(ArgumentError) do
+      Filter.new([["a", :unknown, 1]])
+    end
+    assert_raise(ArgumentError) do
+      Filter.new([["a", :equals]])
+    end
+    assert_raise(ArgumentError) do
+      Filter.new([["", :equals, 1]])
+    end
+    assert_raise(TypeError) do
+      Filter.new([["a", :equals, 1.5]])
+    end
+    assert_raise(TypeError) do
+      Filter.new([["a", :range, "a".."z"]])
+    end
+    assert_raise(TypeError) do
+      Filter.new([["a", :regex, "a"]])
+    end
+    assert_raise(RegexpError) do
+      Filter.new([["a", :regex, Regexp.new("(?<=a+)b")]])
+    end
+  end
+end
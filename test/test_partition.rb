@@ -0,0 +1,80 @@
+require_relative 'helper'
+
+class PartitionTest < Test::Unit::TestCase
+  ParallelQuery = Winevt::EventLog::ParallelQuery
+
+  def test_split_time_range
+    from = Time.utc(2024, 1, 1)
+    ranges = ParallelQuery.split_time_range(from, from + 10, 4)
+    assert_equal([[0, 2.5], [2.5, 5], [5, 7.5], [7.5, 10]],
+                 ranges.map { |range| range.map { |time| time - from } })
+  end
+
+  def test_split_time_range_is_contiguous
+    from = Time.utc(2024, 1, 1)
+    to = from + 86400 * 7 + 0.123r
+    ranges = ParallelQuery.split_time_range(from, to, 7)
+    assert_equal(7, ranges.size)
+    assert_equal(from, ranges.first.first)
+    assert_equal(to, ranges.last.last)
+    ranges.each_cons(2) do |left, right|
+      assert_equal(left.last, right.first)
+    end
+  end
+
+  def test_split_short_or_empty_time_range
+    from = Time.utc(2024, 1, 1)
+    assert_equal(2, ParallelQuery.split_time_range(from, from + 0.002, 8).size)
+    assert_equal([], ParallelQuery.split_time_range(from, from, 8))
+    assert_equal([], ParallelQuery.split_time_range(from + 1, from, 8))
+    assert_raise(ArgumentError) do
+      ParallelQuery.split_time_range(from, from + 1, 0)
+    end
+  end
+
+  def test_partition_xpath
+    from = Time.utc(2024, 2, 29, 23, 59, 59.5r)
+    to = Time.utc(2024, 3, 1)
+    clause = "System[TimeCreated[@SystemTime>='2024-02-29T23:59:59.500Z' " \
+             "and @SystemTime<'2024-03-01T00:00:00.000Z']]"
+    assert_equal("*[#{clause}]", ParallelQuery.partition_xpath("*", from, to))
+    assert_equal("*[#{clause}]", ParallelQuery.partition_xpath(" ", from, to))
+    assert_equal("*[(System[(Level=1 or Level=2)]) and #{clause}]",
+                 ParallelQuery.partition_xpath("*[System[(Level=1 or Level=2)]]", from, to))
+    assert_equal("*[(EventData[Data='a]b']) and #{clause}]",
+                 ParallelQuery.partition_xpath("*[EventData[Data='a]b']]", from, to))
+  end
+
+  def test_partition_unsupported_xpath
+    from = Time.utc(2024, 1, 1)
+    ["*[System[Level=1]] or *[System[Level=2]]",
+     "Event/System[Level=2]",
+     "<QueryList></QueryList>"].each do |xpath|
+      assert_raise(ArgumentError) do
+        ParallelQuery.partition_xpath(xpath, from, from + 1)
+      end
+    end
+  end
+
+  def test_merge_fake_partitions
+    partitions = [
+      [[1, "a"], [4, "d"], [9, "i"]],
+      [],
+      [[2, "b"], [3, "c"]],
+      [[5, "e"], [6, "f"], [7, "g"], [8, "h"]],
+    ]
+    assert_equal(%w[a b c d e f g h i], ParallelQuery.merge(partitions).to_a)
+  end
+
+  def test_merge_prefers_earlier_partition_on_ties
+    partitions = [[[3, "first"]], [[3, "second"]], [[1, "zero"]]]
+    assert_equal(%w[zero first second], ParallelQuery.merge(partitions).to_a)
+  end
+
+  def test_merge_many_partitions
+    random = Random.new(42)
+    ids = (1..1000).to_a.shuffle(random: random)
+    partitions = ids.each_slice(37).map { |slice| slice.sort.map { |id| [id, id] } }
+    assert_equal((1..1000).to_a, ParallelQuery.merge(partitions).to_a)
+  end
+end
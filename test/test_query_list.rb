@@ -0,0 +1,53 @@
+require_relative 'helper'
+
+class QueryListTest < Test::Unit::TestCase
+  QueryList = Winevt::EventLog::QueryList
+
+  def test_to_xml
+    query_list = QueryList.new
+    query_list.select("Application", "*[System[Level<=3]]")
+              .select("System")
+              .suppress("Application", "*[System[Provider[@Name='Disk']]]")
+    assert_equal(["Application", "System"], query_list.channels)
+    assert_equal('<QueryList>' \
+                 '<Query Id="0" Path="Application">' \
+                 '<Select Path="Application">*[System[Level&lt;=3]]</Select>' \
+                 '<Suppress Path="Application">*[System[Provider[@Name=&apos;Disk&apos;]]]</Suppress>' \
+                 '</Query>' \
+                 '<Query Id="1" Path="System"><Select Path="System">*</Select></Query>' \
+                 '</QueryList>',
+                 query_list.to_xml)
+    assert_equal(query_list.to_xml, query_list.to_s)
+  end
+
+  def test_description
+    query_list = QueryList.new(
+      "Application" => "*[System[Level=1]]",
+      "System" => ["*[System[Level=1]]", "*[System[Level=2]]"],
+      "Security" => {suppress: "*[System[EventID=4624]]"},
+    )
+    assert_equal(["Application", "System", "Security"], query_list.channels)
+    xml = query_list.to_xml
+    assert_equal(2, xml.scan('<Select Path="System">').size)
+    assert_match(%r{<Select Path="Security">\*</Select><Suppress Path="Security">}, xml)
+    assert_true(Winevt::EventLog::CompiledQuery.new(xml).structured?)
+  end
+
+  def test_compiled_query
+    xpath = Winevt::EventLog::CompiledQuery.new("*[System[EventID=1000]]")
+    query_list = QueryList.new("Application" => xpath)
+    assert_match(%r{<Select Path="Application">\*\[System\[EventID=1000\]\]</Select>}, query_list.to_xml)
+    assert_raise(ArgumentError) do
+      QueryList.new("Application" => Winevt::EventLog::CompiledQuery.new(query_list.to_xml))
+    end
+  end
+
+  def test_invalid
+    assert_raise(ArgumentError) { QueryList.new.to_xml }
+    assert_raise(ArgumentError) { QueryList.new.suppress("Security", "*").to_xml }
+    assert_raise(ArgumentError) { QueryList.new.select("", "*") }
+    assert_raise(ArgumentError) { QueryList.new.select("Application", "") }
+    assert_raise(TypeError) { QueryList.new.select(:Application) }
+    assert_raise(TypeError) { QueryList.new("Application" => 1) }
+  end
+end
@@ -0,0 +1,64 @@
+require_relative 'helper'
+
+class SamplerTest < Test::Unit::TestCase
+  Sampler = Winevt::EventLog::Sampler
+  SECURITY = "Microsoft-Windows-Security-Auditing"
+
+  def test_every
+    sampler = Sampler.new([{provider: SECURITY, event_id: 5156, every: 3}])
+    kept = (1..9).map { |record_id| sampler.keep?(SECURITY, 5156, record_id) }
+    assert_equal([true, false, false] * 3, kept)
+    assert_equal(6, sampler.sampled_count)
+    assert_equal([[9, 6]], sampler.counts)
+  end
+
+  def test_unmatched_events_are_kept
+    sampler = Sampler.new([{provider: SECURITY, event_id: 5156, every: 100}])
+    assert_true(sampler.keep?(SECURITY, 5156, 1))
+    assert_true(sampler.keep?(SECURITY, 4624, 2))
+    assert_true(sampler.keep?("Application Error", 5156, 3))
+    assert_true(sampler.keep?(nil, 5156, 4))
+    assert_equal(0, sampler.sampled_count)
+    assert_equal([[1, 0]], sampler.counts)
+  end
+
+  def test_first_matching_rule
+    sampler = Sampler.new([
+      {provider: SECURITY, event_id: 4663, every: 1},
+      {provider: SECURITY, rate: 0.0},
+      {event_id: 1000, every: 2},
+    ])
+    assert_true(sampler.keep?(SECURITY, 4663, 1))
+    assert_false(sampler.keep?(SECURITY, 4624, 2))
+    assert_true(sampler.keep?("Application Error", 1000, 3))
+    assert_false(sampler.keep?("Application Hang", 1000, 4))
+    assert_equal([[1, 0], [1, 1], [2, 1]], sampler.counts)
+  end
+
+  def test_rate
+    sampler = Sampler.new([{provider: SECURITY, event_id: 4663, rate: 0.1}])
+    kept = (1..10000).select { |record_id| sampler.keep?(SECURITY, 4663, record_id) }
+    assert_in_delta(1000, kept.size, 150)
+    assert_equal(10000 - kept.size, sampler.sampled_count)
+
+    # The decision depends on only the event.
+    other = Sampler.new([{provider: SECURITY, event_id: 4663, rate: 0.1}])
+    assert_equal(kept, (1..10000).select { |record_id| other.keep?(SECURITY, 4663, record_id) })
+
+    all = Sampler.new([{rate: 1.0}])
+    assert_true((1..1000).all? { |record_id| all.keep?(SECURITY, 4663, record_id) })
+  end
+
+  def test_invalid_rules
+    assert_raise(ArgumentError) { Sampler.new([{provider: SECURITY}]) }
+    assert_raise(ArgumentError) { Sampler.new([{every: 2, rate: 0.5}]) }
+    assert_raise(ArgumentError) { Sampler.new([{every: 0}]) }
+    assert_raise(ArgumentError) { Sampler.new([{rate: 1.5}]) }
+    assert_raise(ArgumentError) { Sampler.new([{event_id: 65536, every: 2}]) }
+    assert_raise(ArgumentError) { Sampler.new([{level: 2, every: 2}]) }
+    assert_raise(TypeError) { Sampler.new([[SECURITY, 4663, 2]]) }
+    rule = {provider: SECURITY, every: 2}.freeze
+    Sampler.new([rule])
+    assert_equal({provider: SECURITY, every: 2}, rule)
+  end
+end
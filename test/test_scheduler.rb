@@ -0,0 +1,80 @@
+require_relative 'helper'
+
+class SchedulerTest < Test::Unit::TestCase
+  def setup
+    @scheduler = Winevt::EventLog::Scheduler.new(10)
+  end
+
+  # Drain the queues by rounds and return [index, count] of each turn.
+  def run_rounds(queues, rounds)
+    turns = []
+    rounds.times do
+      @scheduler.start_round
+      while (turn = @scheduler.next_turn)
+        index, allowance = turn
+        count = [queues[index], allowance].min
+        queues[index] -= count
+        @scheduler.consume(index, count, queues[index] > 0)
+        turns << [index, count] if count > 0
+      end
+    end
+    turns
+  end
+
+  def test_add
+    assert_equal(0, @scheduler.add)
+    assert_equal(1, @scheduler.add(2, 1))
+    assert_equal(2, @scheduler.size)
+    assert_equal(10, @scheduler.quantum)
+    assert_raise(ArgumentError) do
+      @scheduler.add(0)
+    end
+    assert_raise(ArgumentError) do
+      Winevt::EventLog::Scheduler.new(0)
+    end
+  end
+
+  def test_round_robin
+    3.times { @scheduler.add }
+    assert_equal([[0, 10], [1, 10], [2, 5], [0, 10], [1, 10], [0, 5]],
+                 run_rounds([25, 20, 5], 3))
+  end
+
+  def test_weight
+    @scheduler.add(1)
+    @scheduler.add(3)
+    assert_equal([[0, 10], [1, 30], [0, 10], [1, 30]],
+                 run_rounds([100, 100], 2))
+  end
+
+  def test_priority
+    @scheduler.add(1, 0)
+    @scheduler.add(1, 5)
+    @scheduler.add(1, 5)
+    assert_equal([[1, 10], [2, 10], [0, 10]],
+                 run_rounds([100, 100, 100], 1))
+  end
+
+  def test_quiet_queue_waits_at_most_one_round
+    @scheduler.add
+    @scheduler.add
+    turns = run_rounds([1000, 1], 1)
+    assert_equal([[0, 10], [1, 1]], turns)
+  end
+
+  def test_deficit_is_carried_over
+    @scheduler.add
+    @scheduler.start_round
+    index, allowance = @scheduler.next_turn
+    assert_equal([0, 10], [index, allowance])
+    @scheduler.consume(index, 4, true)
+    assert_equal(6, @scheduler.deficit(index))
+    @scheduler.start_round
+    assert_equal([0, 16], @scheduler.next_turn)
+    @scheduler.consume(index, 1, false)
+    assert_equal(0, @scheduler.deficit(index))
+    assert_raise(IndexError) do
+      @scheduler.deficit(1)
+    end
+  end
+end
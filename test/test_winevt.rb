@@ -1,5 +1,6 @@
 # coding: utf-8
 require "helper"
+require "time"
 
 class WinevtTest < Test::Unit::TestCase
   class QueryTest < self
@@ -27,6 +28,128 @@ class WinevtTest < Test::Unit::TestCase
       assert_true(@query.next)
     end
 
+    def test_seek_time
+      xml, = Winevt::EventLog::Query.tail("Application", 100).first
+      time = Time.parse(xml[/SystemTime='([^']+)'/, 1])
+      offset = @query.seek_time(time)
+      assert_kind_of(Integer, offset)
+      @query.each do |eventlog, _message, _string_inserts|
+        assert_operator(Time.parse(eventlog[/SystemTime='([^']+)'/, 1]), :>=, time)
+        break
+      end
+      assert_nil(@query.seek_time(Time.now + 86400))
+      assert_false(@query.any?)
+    end
+
+    def test_count
+      query = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      expected = Winevt::EventLog::Query.new("Application", query).each.count
+      assert_equal(expected, Winevt::EventLog::Query.new("Application", query).count)
+      assert_equal([expected, 3].min,
+                   Winevt::EventLog::Query.new("Application", query).count(3))
+      assert_equal(0, @query.count(0))
+      assert_raise(ArgumentError) do
+        @query.count(-1)
+      end
+    end
+
+    def test_compiled_query
+      query = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      compiled = Winevt::EventLog::CompiledQuery.compile(query)
+      expected = Winevt::EventLog::Query.new("Application", query).count
+      assert_equal(expected, Winevt::EventLog::Query.new("Application", compiled).count)
+    end
+
+    def test_filter
+      query = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      all = Winevt::EventLog::Query.new("Application", query).each.map { |xml, _, _| xml[/<Level>(\d+)</, 1].to_i }
+      filter = Winevt::EventLog::Filter.new([["Event/System/Level", :range, 0..3]])
+      filtered = Winevt::EventLog::Query.new("Application", query)
+      filtered.filter = filter
+      assert_same(filter, filtered.filter)
+      assert_equal(all.select { |level| level <= 3 }.size, filtered.each.count)
+      assert_equal(all.count { |level| level > 3 }, filtered.filtered_count)
+      assert_raise(TypeError) do
+        filtered.filter = "Level=1"
+      end
+    end
+
+    def test_each_with_budget
+      query = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      expected = Winevt::EventLog::Query.new("Application", query).count
+      omit("Not enough events") if expected < 25
+      budgeted = Winevt::EventLog::Query.new("Application", query)
+      count = 0
+      assert_true(budgeted.each(max_events: 15) { count += 1 })
+      # It stops at the end of the batch.
+      assert_equal(20, count)
+      assert_false(budgeted.each(max_time: 60) { count += 1 })
+      assert_equal(expected, count)
+      assert_raise(ArgumentError) do
+        budgeted.each(max_events: 0) {}
+      end
+    end
+
+    def test_query_list
+      xpath = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      query_list = Winevt::EventLog::QueryList.new("Application" => xpath, "System" => xpath)
+      expected = ["Application", "System"].sum do |channel|
+        Winevt::EventLog::Query.new(channel, xpath).count
+      end
+      channels = Winevt::EventLog::Query.new(query_list).each.map do |_, _, _, channel|
+        channel
+      end
+      assert_equal(expected, channels.size)
+      assert_equal([], channels.uniq - ["Application", "System"])
+    end
+
+    def test_sampler
+      query = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      expected = Winevt::EventLog::Query.new("Application", query).count
+      sampler = Winevt::EventLog::Sampler.new([{every: 2}])
+      sampled = Winevt::EventLog::Query.new("Application", query)
+      sampled.sampler = sampler
+      assert_same(sampler, sampled.sampler)
+      assert_equal((expected + 1) / 2, sampled.each.count)
+      assert_equal(expected / 2, sampled.sampled_count)
+      assert_equal(expected / 2, sampler.sampled_count)
+      assert_raise(TypeError) do
+        sampled.sampler = {every: 2}
+      end
+    end
+
+    def test_aggregate
+      query = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      expected = Winevt::EventLog::Query.new("Application", query).count
+      result = Winevt::EventLog::Query.new("Application", query).aggregate(by: [:level], bucket: 60)
+      assert_equal(expected, result.values.sum)
+      result.each_key do |bucket, level|
+        assert_equal(0, bucket.to_i % 60)
+        assert_kind_of(Integer, level)
+      end
+      assert_raise(ArgumentError) do
+        @query.aggregate(by: [:unknown])
+      end
+    end
+
+    def test_any_p
+      assert_true(@query.any?)
+      @query.count
+      assert_false(@query.any?)
+    end
+
+    def test_tail
+      record_id = ->(xml) { Integer(xml[/<EventRecordID>(\d+)<\/EventRecordID>/, 1]) }
+      ids = Winevt::EventLog::Query.tail("Application", 5).map do |xml, _message, _string_inserts|
+        record_id.call(xml)
+      end
+      assert_equal(5, ids.size)
+      assert_equal(ids.sort, ids)
+      newest, = Winevt::EventLog::Query.tail("Application", 1, "*").first
+      assert_operator(record_id.call(newest), :>=, ids.last)
+      assert_equal([], Winevt::EventLog::Query.tail("Application", 0))
+    end
+
     def test_cancel
       assert_true(@query.cancel)
       assert_false(@query.next)
@@ -187,6 +310,73 @@ class WinevtTest < Test::Unit::TestCase
       end
     end
 
+    def test_compiled_query
+      query = Winevt::EventLog::CompiledQuery.compile("*[System[Level <= 3]]")
+      assert do
+        @subscribe.subscribe("Application", query)
+      end
+    end
+
+    def test_filter
+      @subscribe.filter = Winevt::EventLog::Filter.new([["Event/System/Level", :in, [1, 2, 3]]])
+      @subscribe.each do |eventlog, _, _|
+        assert_match(/<Level>[123]</, eventlog)
+      end
+      assert_kind_of(Integer, @subscribe.filtered_count)
+    end
+
+    def test_deduplicator
+      deduplicator = Winevt::EventLog::Deduplicator.new
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.read_existing_events = true
+      subscribe.deduplicator = deduplicator
+      query = "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]"
+      subscribe.subscribe("Application", query)
+      count = subscribe.each.count
+      assert_equal(count, deduplicator.size)
+
+      # Reading the same events again delivers nothing.
+      subscribe.subscribe("Application", query)
+      assert_equal(0, subscribe.each.count)
+      assert_equal(count, deduplicator.duplicates)
+    end
+
+    def test_each_with_budget
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.read_existing_events = true
+      subscribe.subscribe("Application", "*")
+      yielded = []
+      assert_true(subscribe.each(max_events: 3) { |eventlog, _, _| yielded << eventlog })
+      assert_equal(3, yielded.size)
+      subscribe.each(max_events: 3) { |eventlog, _, _| yielded << eventlog }
+      assert_equal(yielded.uniq, yielded)
+      subscribe.each(max_time: 0) { |eventlog, _, _| yielded << eventlog }
+      assert_operator(yielded.size, :<=, 6 + 10)
+    end
+
+    def test_query_list
+      query_list = Winevt::EventLog::QueryList.new("Application" => "*", "System" => "*")
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.read_existing_events = true
+      subscribe.subscribe(query_list)
+      assert_nil(subscribe.channel)
+      subscribe.each do |eventlog, _, _, channel|
+        assert_include(["Application", "System"], channel)
+        assert_include(eventlog, "<Channel>#{channel}</Channel>")
+        break
+      end
+    end
+
+    def test_sampler
+      sampler = Winevt::EventLog::Sampler.new([{rate: 0.0}])
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.read_existing_events = true
+      subscribe.sampler = sampler
+      subscribe.subscribe("Application", "*[System[TimeCreated[timediff(@SystemTime) <= 86400000]]]")
+      assert_equal(0, subscribe.each.count)
+      assert_equal(sampler.sampled_count, subscribe.sampled_count)
+    end
+
     def test_subscribe_twice
       subscribe = Winevt::EventLog::Subscribe.new
       subscribe.subscribe("Application", "*")
@@ -205,6 +395,15 @@ class WinevtTest < Test::Unit::TestCase
       assert_true(subscribe.next)
     end
 
+    def test_subscribe_with_bookmark_keeps_position
+      query = Winevt::EventLog::Query.new("Application", "*")
+      assert_true(query.next)
+      @bookmark.update(query)
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.subscribe("Application", "*", @bookmark)
+      assert_equal(@bookmark.render, subscribe.bookmark)
+    end
+
     def test_subscribe_with_bookmark_and_session
       subscribe = Winevt::EventLog::Subscribe.new
       session = Winevt::EventLog::Session.new("127.0.0.1")
@@ -260,6 +459,72 @@ class WinevtTest < Test::Unit::TestCase
       end
     end
 
+    def test_wait
+      assert_true(@subscribe.wait(1))
+    end
+
+    def test_wait_after_close
+      @subscribe.close
+      assert_false(@subscribe.wait(0))
+    end
+
+    def test_wait_with_invalid_timeout
+      assert_raise(ArgumentError) do
+        @subscribe.wait(-1)
+      end
+    end
+
+    def test_wait_any
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.subscribe("Application", "*")
+      assert_equal([@subscribe, subscribe],
+                   Winevt::EventLog::Subscribe.wait_any([@subscribe, subscribe], 1))
+    end
+
+    def test_push_mode
+      subscribe = Winevt::EventLog::Subscribe.new
+      assert_false(subscribe.push_mode?)
+      subscribe.push_mode = true
+      assert_true(subscribe.push_mode?)
+      subscribe.subscribe("Application", "*")
+      assert_true(subscribe.wait(5))
+      assert_true(subscribe.next)
+      assert(subscribe.bookmark)
+      assert_nothing_raised do
+        subscribe.close
+      end
+    end
+
+    def test_push_mode_each
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.push_mode = true
+      subscribe.push_queue_size = 10
+      subscribe.subscribe("Application", "*")
+      assert_true(subscribe.wait(5))
+      events = []
+      subscribe.each do |xml, message, string_inserts|
+        events << [xml, message, string_inserts]
+        break if events.size >= 20
+      end
+      assert_false(events.empty?)
+      subscribe.close
+    end
+
+    def test_push_queue_size
+      assert_equal(1024, @subscribe.push_queue_size)
+      @subscribe.push_queue_size = 16
+      assert_equal(16, @subscribe.push_queue_size)
+      assert_raise(ArgumentError) do
+        @subscribe.push_queue_size = 1
+      end
+    end
+
+    def test_wait_any_with_too_many_subscriptions
+      assert_raise(ArgumentError) do
+        Winevt::EventLog::Subscribe.wait_any([@subscribe] * 64)
+      end
+    end
+
     def test_rate_limit
       assert_equal(Winevt::EventLog::Subscribe::RATE_INFINITE,
                    @subscribe.rate_limit)
@@ -269,14 +534,100 @@ class WinevtTest < Test::Unit::TestCase
       @subscribe.rate_limit = Winevt::EventLog::Subscribe::RATE_INFINITE
       assert_equal(Winevt::EventLog::Subscribe::RATE_INFINITE,
                    @subscribe.rate_limit)
+      @subscribe.rate_limit = 3
+      assert_equal(3, @subscribe.rate_limit)
+      @subscribe.rate_limit = 33
+      assert_equal(33, @subscribe.rate_limit)
       assert_raise(ArgumentError) do
-        @subscribe.rate_limit = 3
+        @subscribe.rate_limit = 0
       end
       assert_raise(ArgumentError) do
-        @subscribe.rate_limit = 33
+        @subscribe.rate_limit = -2
       end
     end
 
+    def test_checkpoint
+      assert_nil(@subscribe.checkpoint_interval)
+      assert_nil(@subscribe.checkpoint_count)
+      @subscribe.checkpoint_interval = 2.5
+      assert_equal(2.5, @subscribe.checkpoint_interval)
+      @subscribe.checkpoint_count = 100
+      assert_equal(100, @subscribe.checkpoint_count)
+      @subscribe.checkpoint_interval = nil
+      assert_nil(@subscribe.checkpoint_interval)
+      assert_raise(ArgumentError) do
+        @subscribe.checkpoint_interval = 0
+      end
+      assert_raise(ArgumentError) do
+        @subscribe.checkpoint_count = 0
+      end
+    end
+
+    def test_bookmark_reflects_events_before_checkpoint
+      @subscribe.read_existing_events = true
+      @subscribe.checkpoint_count = 1_000_000
+      @subscribe.subscribe("Application", "*")
+      @subscribe.wait(1.0)
+      record_ids = []
+      @subscribe.each do |xml, _message, _string_inserts|
+        record_ids << xml[/<EventRecordID>(\d+)<\/EventRecordID>/, 1]
+      end
+      assert_match(/RecordId='#{record_ids.last}'/, @subscribe.bookmark)
+    end
+
+    def test_checkpoint_follows_delivered_events
+      @subscribe.read_existing_events = true
+      @subscribe.checkpoint_count = 1_000_000
+      @subscribe.subscribe("Application", "*")
+      checkpoint = @subscribe.checkpoint
+      @subscribe.wait(1.0)
+      record_ids = []
+      @subscribe.each do |xml, _message, _string_inserts|
+        record_ids << xml[/<EventRecordID>(\d+)<\/EventRecordID>/, 1]
+      end
+      assert_equal(Integer(record_ids.last), checkpoint["Application"])
+      assert_equal("Application", checkpoint.current)
+      assert_equal(checkpoint.to_h,
+                   Winevt::EventLog::Checkpoint.from_bookmark(checkpoint.to_bookmark).to_h)
+    end
+
+    def test_rate_limit_burst
+      assert_nil(@subscribe.rate_limit_burst)
+      @subscribe.rate_limit_burst = 200
+      assert_equal(200, @subscribe.rate_limit_burst)
+      @subscribe.rate_limit_burst = nil
+      assert_nil(@subscribe.rate_limit_burst)
+      assert_raise(ArgumentError) do
+        @subscribe.rate_limit_burst = 0
+      end
+    end
+
+    def test_byte_rate_limit
+      assert_equal(Winevt::EventLog::Subscribe::RATE_INFINITE,
+                   @subscribe.byte_rate_limit)
+      @subscribe.byte_rate_limit = 1024 * 1024
+      assert_equal(1024 * 1024, @subscribe.byte_rate_limit)
+      @subscribe.byte_rate_limit_burst = 4096
+      assert_equal(4096, @subscribe.byte_rate_limit_burst)
+      assert_raise(ArgumentError) do
+        @subscribe.byte_rate_limit = 0
+      end
+    end
+
+    def test_rate_limit_holds_back_events
+      @subscribe.read_existing_events = true
+      @subscribe.rate_limit = 1
+      @subscribe.subscribe("Application", "*")
+      @subscribe.wait(1.0)
+      count = 0
+      @subscribe.each { count += 1 }
+      assert_equal(1, count)
+      @subscribe.each { count += 1 }
+      assert_equal(1, count)
+      assert_true(@subscribe.throttled_count >= 1)
+      assert_true(@subscribe.throttled_time > 0)
+    end
+
     def test_render_as_xml
       assert_true(@subscribe.render_as_xml?)
       @subscribe.render_as_xml = false
@@ -326,6 +677,108 @@ class WinevtTest < Test::Unit::TestCase
     end
   end
 
+  class SubscribeGroupTest < self
+    def setup
+      @group = Winevt::EventLog::SubscribeGroup.new
+    end
+
+    def subscribe(channel)
+      subscribe = Winevt::EventLog::Subscribe.new
+      subscribe.read_existing_events = true
+      subscribe.subscribe(channel, "*")
+      subscribe
+    end
+
+    def test_add
+      assert_equal(0, @group.size)
+      application = subscribe("Application")
+      @group << application
+      @group.add(subscribe("System"))
+      assert_equal(2, @group.size)
+      assert_equal(application, @group.subscriptions.first)
+      assert_equal("Application", application.channel)
+      assert_raise(ArgumentError) do
+        @group << "Application"
+      end
+    end
+
+    def test_add_with_weight_and_priority
+      @group.add(subscribe("Application"), 2, 1)
+      assert_equal(1, @group.size)
+      assert_raise(ArgumentError) do
+        @group.add(subscribe("System"), 0)
+      end
+    end
+
+    def test_wait
+      @group << subscribe("Application")
+      @group << subscribe("System")
+      ready = @group.wait(1.0)
+      assert_false(ready.empty?)
+    end
+
+    def test_each
+      @group << subscribe("Application")
+      @group << subscribe("System")
+      @group.wait(1.0)
+      channels = []
+      pending = @group.each do |eventlog, message, string_inserts, channel|
+        assert_true(eventlog.is_a?(String))
+        channels << channel
+      end
+      assert_include([true, false], pending)
+      assert_equal(["Application", "System"], channels.uniq.sort)
+
+      # Each call reads one round, so the backlog is drained by calls.
+      rounds = 0
+      rounds += 1 while @group.each { } && rounds < 10000
+      assert_operator(rounds, :<, 10000)
+    end
+
+    def test_wait_many_subscriptions
+      100.times do
+        @group << subscribe("Application")
+      end
+      assert_equal(100, @group.wait(1.0).size)
+    end
+  end
+
+  class ParallelQueryTest < self
+    def record_ids(events)
+      events.map { |xml, _message, _string_inserts|
+        Integer(xml[/<EventRecordID>(\d+)<\/EventRecordID>/, 1])
+      }
+    end
+
+    def test_each
+      to = Time.now
+      from = to - 86400 * 7
+      query = Winevt::EventLog::ParallelQuery.new("Application", "*", from, to, 4)
+      assert_equal(4, query.partitions)
+      ids = record_ids(query.each.to_a)
+      assert_equal(ids.sort, ids)
+
+      xpath = Winevt::EventLog::ParallelQuery.partition_xpath("*", from, to)
+      expected = record_ids(Winevt::EventLog::Query.new("Application", xpath).each.to_a)
+      assert_equal(expected, ids)
+    end
+
+    def test_render_as_hash
+      query = Winevt::EventLog::ParallelQuery.new("Application", "*", Time.now - 86400, Time.now)
+      query.render_as_xml = false
+      query.each do |eventlog, _message, _string_inserts|
+        assert_true(eventlog.is_a?(Hash))
+        break
+      end
+    end
+
+    def test_unsupported_xpath
+      assert_raise(ArgumentError) do
+        Winevt::EventLog::ParallelQuery.new("Application", "Event/System", Time.now - 1, Time.now)
+      end
+    end
+  end
+
   class ChannelTest < self
     def setup
       @channel = Winevt::EventLog::Channel.new